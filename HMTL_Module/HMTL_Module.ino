@@ -37,6 +37,7 @@
 #include "HMTLProtocol.h"
 #include "ProgramManager.h"
 #include "MessageHandler.h"
+#include "LoopStats.h"
 
 #include "PixelUtil.h"
 
@@ -118,6 +119,7 @@ byte wifi_data_buffer[TCP_BUFFER_TOTAL(WIFI_SEND_BUFFER_SIZE)];
 Socket *sockets[MAX_SOCKETS] = { NULL, NULL };
 
 config_hdr_t config;
+config_groups_t groups;
 output_hdr_t *outputs[HMTL_MAX_OUTPUTS];
 config_max_t readoutputs[HMTL_MAX_OUTPUTS];
 void *objects[HMTL_MAX_OUTPUTS];
@@ -168,6 +170,9 @@ program_tracker_t *active_programs[HMTL_MAX_OUTPUTS];
 ProgramManager manager;
 MessageHandler handler;
 
+/* Timing of each phase of the main loop, reported via MSG_TYPE_STATS */
+LoopStats loop_stats;
+
 #ifdef ENABLE_PUSH_BUTTON
   #define PUSH_BUTTON_PIN 8
 #endif
@@ -196,7 +201,8 @@ void setup() {
                                      NULL, // MPR121
                                      NULL, // RGB
                                      NULL, // Value
-                                     NULL);
+                                     NULL,
+                                     &groups);
 
   byte num_sockets = 0;
 
@@ -251,7 +257,9 @@ void setup() {
   manager = ProgramManager(outputs, active_programs, objects, HMTL_MAX_OUTPUTS,
                            program_functions, NUM_PROGRAMS);
 
-  handler = MessageHandler(config.address, &manager, sockets, num_sockets);
+  handler.init(config.address, &manager, sockets, num_sockets);
+  handler.set_loop_stats(&loop_stats);
+  handler.set_groups(&groups);
 
   /* Perform any additional setup that's required */
   additional_setup();
@@ -316,40 +324,48 @@ void startup_commands() {
   while ((output = manager.lookup_output_by_type(HMTL_OUTPUT_VALUE, num)) != HMTL_NO_OUTPUT) {
     DEBUG3_VALUELN("Init: blink ", output);
     num++;
-    hmtl_program_blink_fmt(sockets[0]->send_buffer, sockets[0]->send_data_size,
-                           config.address, output,
-                           250*num, pixel_color(128,0,0),
-                           250, 0);
-    msg = (msg_hdr_t *)sockets[0]->send_buffer;
+    if (hmtl_program_blink_fmt(sockets[0]->send_buffer,
+                               sockets[0]->send_data_size,
+                               config.address, output,
+                               250*num, pixel_color(128,0,0),
+                               250, 0) > 0) {
+      msg = (msg_hdr_t *)sockets[0]->send_buffer;
+    }
 #endif // STARTUP_BLINK
 
 #ifdef STARTUP_SPARKLE
   byte output = manager.lookup_output_by_type(HMTL_OUTPUT_PIXELS);
   if (output != HMTL_NO_OUTPUT) {
     DEBUG4_VALUELN("Init: sparkle ", output);
-    program_sparkle_fmt(sockets[0]->send_buffer, sockets[0]->send_data_size,
-                        config.address, output,
+    uint16_t len =
+      program_sparkle_fmt(sockets[0]->send_buffer, sockets[0]->send_data_size,
+                          config.address, output,
 #ifdef STARTUP_ARGS
-                        STARTUP_ARGS);
+                          STARTUP_ARGS);
 #else
-                        0,0,0,0,0,0,0,0,0,0);
+                          0,0,0,0,0,0,0,0,0,0);
 #endif
-    msg = (msg_hdr_t *)sockets[0]->send_buffer;
+    if (len > 0) {
+      msg = (msg_hdr_t *)sockets[0]->send_buffer;
+    }
 #endif // STARTUP_SPARKLE
 
 #ifdef STARTUP_CIRCULAR
   byte output = manager.lookup_output_by_type(HMTL_OUTPUT_PIXELS);
   if (output != HMTL_NO_OUTPUT) {
     DEBUG4_VALUELN("Init: circular ", output);
-    program_circular_fmt(sockets[0]->send_buffer, sockets[0]->send_data_size,
-                         config.address, output,
+    uint16_t len =
+      program_circular_fmt(sockets[0]->send_buffer, sockets[0]->send_data_size,
+                           config.address, output,
 #ifdef STARTUP_ARGS
-                         STARTUP_ARGS);
+                           STARTUP_ARGS);
 #else
-                         100, pixels.numPixels() / 3, CRGB::Black,
-                         1, 0);
+                           100, pixels.numPixels() / 3, CRGB::Black,
+                           1, 0);
 #endif
-    msg = (msg_hdr_t *)sockets[0]->send_buffer;
+    if (len > 0) {
+      msg = (msg_hdr_t *)sockets[0]->send_buffer;
+    }
 #endif // STARTUP_CIRCULAR
 
     if (msg) {
@@ -378,6 +394,7 @@ boolean first_run = true;
  * - Updates any outputs
  */
 void loop() {
+  loop_stats.begin();
 
   // Check and send a serial-ready message if needed
   handler.serial_ready();
@@ -387,13 +404,16 @@ void loop() {
    * processing them if they are for this module.
    */
   boolean update = handler.check(&config);
+  loop_stats.mark(LOOP_PHASE_CHECK);
 
   additional_loop();
+  loop_stats.mark(LOOP_PHASE_ADDITIONAL);
 
   /* Execute any active programs */
   if (manager.run()) {
     update = true;
   }
+  loop_stats.mark(LOOP_PHASE_PROGRAMS);
 
   /* If this is the first execution then update to set initial values */
   if (first_run) {
@@ -401,12 +421,18 @@ void loop() {
     first_run = false;
   }
 
+  /* Hold off updates while a pixel frame is partially received */
+  update = handler.check_update(update);
+
   if (update) {
     /* Update the outputs */
     for (byte i = 0; i < config.num_outputs; i++) {
       hmtl_update_output(outputs[i], objects[i]);
     }
+    loop_stats.mark(LOOP_PHASE_OUTPUTS);
   }
+
+  loop_stats.end();
 }
 
 void additional_loop() {
@@ -418,12 +444,14 @@ void additional_loop() {
     DEBUG1_VALUELN("Push button to ", prev_value);
     if (prev_value == LOW) {
       uint32_t value = (prev_value == LOW ? pixel_color(255,255,255) : 0);
-      hmtl_program_timed_change_fmt(sockets[0]->send_buffer,
-                             sockets[0]->send_data_size,
-                             config.address, (byte)3,
-                             500, value,
-                             0);
-      handler.process_msg((msg_hdr_t *)sockets[0]->send_buffer, sockets[0], NULL, &config);
+      if (hmtl_program_timed_change_fmt(sockets[0]->send_buffer,
+                                        sockets[0]->send_data_size,
+                                        config.address, (byte)3,
+                                        500, value,
+                                        0) > 0) {
+        handler.process_msg((msg_hdr_t *)sockets[0]->send_buffer, sockets[0],
+                            NULL, &config);
+      }
 
     }
   }
@@ -23,6 +23,81 @@
 #include "PixelUtil.h"
 #include "RS485Utils.h"
 
+/*
+ * Table for the CRC-8 with reflected polynomial 0x8C, the same CRC as is used
+ * for EEPROM objects, processing a byte at a time.
+ */
+static const byte hmtl_crc_table[256] PROGMEM = {
+  0x00, 0x5e, 0xbc, 0xe2, 0x61, 0x3f, 0xdd, 0x83, 0xc2, 0x9c, 0x7e, 0x20,
+  0xa3, 0xfd, 0x1f, 0x41, 0x9d, 0xc3, 0x21, 0x7f, 0xfc, 0xa2, 0x40, 0x1e,
+  0x5f, 0x01, 0xe3, 0xbd, 0x3e, 0x60, 0x82, 0xdc, 0x23, 0x7d, 0x9f, 0xc1,
+  0x42, 0x1c, 0xfe, 0xa0, 0xe1, 0xbf, 0x5d, 0x03, 0x80, 0xde, 0x3c, 0x62,
+  0xbe, 0xe0, 0x02, 0x5c, 0xdf, 0x81, 0x63, 0x3d, 0x7c, 0x22, 0xc0, 0x9e,
+  0x1d, 0x43, 0xa1, 0xff, 0x46, 0x18, 0xfa, 0xa4, 0x27, 0x79, 0x9b, 0xc5,
+  0x84, 0xda, 0x38, 0x66, 0xe5, 0xbb, 0x59, 0x07, 0xdb, 0x85, 0x67, 0x39,
+  0xba, 0xe4, 0x06, 0x58, 0x19, 0x47, 0xa5, 0xfb, 0x78, 0x26, 0xc4, 0x9a,
+  0x65, 0x3b, 0xd9, 0x87, 0x04, 0x5a, 0xb8, 0xe6, 0xa7, 0xf9, 0x1b, 0x45,
+  0xc6, 0x98, 0x7a, 0x24, 0xf8, 0xa6, 0x44, 0x1a, 0x99, 0xc7, 0x25, 0x7b,
+  0x3a, 0x64, 0x86, 0xd8, 0x5b, 0x05, 0xe7, 0xb9, 0x8c, 0xd2, 0x30, 0x6e,
+  0xed, 0xb3, 0x51, 0x0f, 0x4e, 0x10, 0xf2, 0xac, 0x2f, 0x71, 0x93, 0xcd,
+  0x11, 0x4f, 0xad, 0xf3, 0x70, 0x2e, 0xcc, 0x92, 0xd3, 0x8d, 0x6f, 0x31,
+  0xb2, 0xec, 0x0e, 0x50, 0xaf, 0xf1, 0x13, 0x4d, 0xce, 0x90, 0x72, 0x2c,
+  0x6d, 0x33, 0xd1, 0x8f, 0x0c, 0x52, 0xb0, 0xee, 0x32, 0x6c, 0x8e, 0xd0,
+  0x53, 0x0d, 0xef, 0xb1, 0xf0, 0xae, 0x4c, 0x12, 0x91, 0xcf, 0x2d, 0x73,
+  0xca, 0x94, 0x76, 0x28, 0xab, 0xf5, 0x17, 0x49, 0x08, 0x56, 0xb4, 0xea,
+  0x69, 0x37, 0xd5, 0x8b, 0x57, 0x09, 0xeb, 0xb5, 0x36, 0x68, 0x8a, 0xd4,
+  0x95, 0xcb, 0x29, 0x77, 0xf4, 0xaa, 0x48, 0x16, 0xe9, 0xb7, 0x55, 0x0b,
+  0x88, 0xd6, 0x34, 0x6a, 0x2b, 0x75, 0x97, 0xc9, 0x4a, 0x14, 0xf6, 0xa8,
+  0x74, 0x2a, 0xc8, 0x96, 0x15, 0x4b, 0xa9, 0xf7, 0xb6, 0xe8, 0x0a, 0x54,
+  0xd7, 0x89, 0x6b, 0x35
+};
+
+byte hmtl_msg_crc(const msg_hdr_t *msg_hdr) {
+  const byte *data = (const byte *)msg_hdr;
+  byte crc = 0;
+
+  /* The startcode, then the CRC field as zero */
+  crc = pgm_read_byte(&hmtl_crc_table[data[0]]);
+  crc = pgm_read_byte(&hmtl_crc_table[crc]);
+  uint16_t length = hmtl_msg_length(msg_hdr);
+  for (uint16_t i = 2; i < length; i++) {
+    crc = pgm_read_byte(&hmtl_crc_table[crc ^ data[i]]);
+  }
+
+  return crc;
+}
+
+void hmtl_msg_set_crc(msg_hdr_t *msg_hdr) {
+#ifdef HMTL_USE_CRC
+  msg_hdr->crc = hmtl_msg_crc(msg_hdr);
+#endif
+}
+
+boolean hmtl_msg_valid(const msg_hdr_t *msg_hdr, msg_drop_counts_t *drops) {
+#ifdef HMTL_USE_V2_COMPAT
+  if (msg_hdr->version == HMTL_MSG_VERSION_2) {
+    /* Version 2 messages have no CRC */
+    return true;
+  }
+#endif
+
+  if (msg_hdr->version != HMTL_MSG_VERSION) {
+    DEBUG1_VALUELN("hmtl_msg_valid: bad version ", msg_hdr->version);
+    if (drops) drops->bad_version++;
+    return false;
+  }
+
+#ifdef HMTL_USE_CRC
+  if (msg_hdr->crc != hmtl_msg_crc(msg_hdr)) {
+    DEBUG1_HEXVALLN("hmtl_msg_valid: bad crc ", msg_hdr->crc);
+    if (drops) drops->bad_crc++;
+    return false;
+  }
+#endif
+
+  return true;
+}
+
 uint16_t hmtl_msg_size(output_hdr_t *output) 
 {
   switch (output->type) {
@@ -57,7 +132,19 @@ hmtl_handle_output_msg(msg_hdr_t *msg_hdr,
     return -1;
   }
 
-  output_hdr_t *msg = (output_hdr_t *)(msg_hdr + 1);
+  return hmtl_handle_output((output_hdr_t *)(msg_hdr + 1),
+                            num_outputs, outputs, objects);
+}
+
+/*
+ * Apply an output message, which may be from a MSG_TYPE_OUTPUT message or
+ * a record within a batch.
+ */
+int
+hmtl_handle_output(output_hdr_t *msg,
+                   byte num_outputs, output_hdr_t *outputs[],
+                   void *objects[])
+{
   DEBUG4_VALUE("hmtl_handle_msg: type=", msg->type);
   DEBUG4_VALUELN(" out=", msg->output);
 
@@ -123,19 +210,29 @@ hmtl_handle_output_msg(msg_hdr_t *msg_hdr,
 
 /* Check for HMTL formatted msg over a socket interface */
 msg_hdr_t *
-hmtl_socket_getmsg(Socket *socket, unsigned int *msglen, uint16_t address) {
+hmtl_socket_getmsg(Socket *socket, unsigned int *msglen, uint16_t address,
+                   msg_drop_counts_t *drops, byte *upgrade,
+                   uint16_t upgrade_size) {
   const byte *data;
   if (address == SOCKET_ADDR_INVALID) data = socket->getMsg(msglen);
   else data = socket->getMsg(address, msglen);
   if (data != NULL) {
     msg_hdr_t *msg_hdr = (msg_hdr_t *)data;
-      
-    if (*msglen < sizeof (msg_hdr_t)) {
+    byte hdr_len = sizeof (msg_hdr_t);
+
+#ifdef HMTL_USE_V2_COMPAT
+    if ((*msglen >= HMTL_MSG_V2_HDR_LEN) &&
+        (msg_hdr->version == HMTL_MSG_VERSION_2)) {
+      hdr_len = HMTL_MSG_V2_HDR_LEN;
+    }
+#endif
+
+    if (*msglen < hdr_len) {
       DEBUG1_VALUE("hmtl_socket_getmsg: msg length ", *msglen);
-      DEBUG1_VALUELN(" short for header ", sizeof (msg_hdr_t));
+      DEBUG1_VALUELN(" short for header ", hdr_len);
       goto ERROR_OUT;
     }
-    if (msg_hdr->length < sizeof (msg_hdr_t)) {
+    if (msg_hdr->length < hdr_len) {
       DEBUG_ERR("hmtl_socket_getmsg: msg length is too short");
       goto ERROR_OUT;
     }
@@ -149,69 +246,168 @@ hmtl_socket_getmsg(Socket *socket, unsigned int *msglen, uint16_t address) {
       goto ERROR_OUT;
     }
 
-    // TODO: Check the CRC!  Check the version!
+    if (!hmtl_msg_valid(msg_hdr, drops)) {
+      goto ERROR_OUT;
+    }
+
+#ifdef HMTL_USE_V2_COMPAT
+    if (msg_hdr->version == HMTL_MSG_VERSION_2) {
+      if (upgrade == NULL) {
+        DEBUG1_PRINTLN("hmtl_socket_getmsg: no buffer to upgrade version 2");
+        if (drops) drops->bad_version++;
+        goto ERROR_OUT;
+      }
+
+      /* The socket's data can't grow, so the message is copied */
+      socket_addr_t sender = socket->sourceFromData((void *)data);
+      uint16_t upgraded_len = hmtl_msg_upgrade(msg_hdr, upgrade, upgrade_size,
+                                               sender);
+      if (upgraded_len == 0) {
+        goto ERROR_OUT;
+      }
+      *msglen = upgraded_len;
+      return (msg_hdr_t *)upgrade;
+    }
+#endif
 
     return msg_hdr;
   }
 
- ERROR_OUT:
   *msglen = 0;
   return NULL;
+
+ ERROR_OUT:
+  // The frame's length is left so that a drop can be told from no message
+  return NULL;
+}
+
+/*
+ * Read a block of bytes already known to be available from the serial device.
+ * This avoids the per-byte timeout handling of Serial.readBytes().
+ */
+static inline void serial_read_block(byte *data, byte length) {
+  for (byte i = 0; i < length; i++) {
+    data[i] = Serial.read();
+  }
+}
+
+/*
+ * Discard the start of a buffered message that was found to be invalid,
+ * moving the next start code in the buffer, if any, to the beginning.
+ * Returns the number of bytes that remain buffered.
+ */
+static byte serial_resync(byte *msg, byte offset) {
+  byte *start = (byte *)memchr(msg + 1, HMTL_MSG_START, offset - 1);
+  if (start == NULL) {
+    return 0;
+  }
+
+  byte remaining = offset - (start - msg);
+  memmove(msg, start, remaining);
+  return remaining;
+}
+
+/*
+ * Return the length of the header of a partially received message, which is
+ * only known once enough has been read to tell a version 2 header apart.
+ */
+static inline byte serial_hdr_len(const msg_hdr_t *msg_hdr, byte offset) {
+#ifdef HMTL_USE_V2_COMPAT
+  if ((offset < HMTL_MSG_V2_HDR_LEN) ||
+      (msg_hdr->version == HMTL_MSG_VERSION_2)) {
+    return HMTL_MSG_V2_HDR_LEN;
+  }
+#endif
+  return sizeof (msg_hdr_t);
 }
 
 /*
- * Read in a message structure from the serial interface
+ * Read in a message structure from the serial interface.
+ *
+ * Available bytes are read in blocks directly into the message buffer, first
+ * the header and then the remainder of the message, so that the following
+ * message is left in the Serial device's buffer.  Until a start code is found
+ * each block is scanned for one, and if a message turns out to be invalid
+ * the buffered bytes are rescanned for the next start code.
  */
 boolean
-hmtl_serial_getmsg(byte *msg, byte msg_len, byte *offset_ptr) 
+hmtl_serial_getmsg(byte *msg, byte msg_len, byte *offset_ptr,
+                   msg_drop_counts_t *drops)
 {
   msg_hdr_t *msg_hdr = (msg_hdr_t *)&msg[0];
   byte offset = *offset_ptr;
   boolean complete = false;
 
-  while (Serial.available()) {
-    if (offset > msg_len) {
-      /* Offset has exceed the buffer size, start fresh */
-      offset = 0;
-      DEBUG_ERR("hmtl_serial_update: exceed max msg len");
-    }
-
-    byte val = Serial.read();
-    //    DEBUG4_VALUE(" ", offset);
-    //    DEBUG4_HEXVAL("-", val);
+  while (true) {
+    byte hdr_len = serial_hdr_len(msg_hdr, offset);
+    if (offset >= hdr_len) {
+      /* We have the entire message header */
+      if ((msg_hdr->length < hdr_len) ||
+          (msg_hdr->length + (sizeof (msg_hdr_t) - hdr_len) > msg_len)) {
+        DEBUG1_VALUELN("hmtl_serial_getmsg: bad msg length ", msg_hdr->length);
+        offset = serial_resync(msg, offset);
+        continue;
+      }
 
-    if (offset == 0) {
-      /* Wait for the start code at the beginning of the message */
-      if (val != HMTL_MSG_START) {
-        DEBUG1_HEXVALLN("hmtl_serial_getmsg: not start code: ",
-                        val);
+      if ((msg_hdr->version != HMTL_MSG_VERSION) &&
+          (hdr_len == sizeof (msg_hdr_t))) {
+        /* Check early so that a false start code is skipped quickly */
+        DEBUG1_VALUELN("hmtl_serial_getmsg: bad version ", msg_hdr->version);
+        if (drops) drops->bad_version++;
+        offset = serial_resync(msg, offset);
         continue;
       }
 
-      /* This is probably the beginning of the message */ 
+      if (offset >= msg_hdr->length) {
+        /* This is a complete message */
+        if (!hmtl_msg_valid(msg_hdr, drops)) {
+          offset = serial_resync(msg, offset);
+          continue;
+        }
+
+#ifdef HMTL_USE_V2_COMPAT
+        if (msg_hdr->version == HMTL_MSG_VERSION_2) {
+          /* Upgrade in place, leaving the origin for the receiver to assign */
+          offset = hmtl_msg_upgrade(msg_hdr, msg, msg_len);
+        }
+#endif
+
+        DEBUG4_PRINTLN("hmtl_serial_getmsg: Received complete command");
+        complete = true;
+        break;
+      }
+    }
+
+    int available = Serial.available();
+    if (available <= 0) {
+      break;
     }
 
-    msg[offset] = val;
-    offset++;
+    /* Read up to the end of the header, or the end of the message */
+    byte want = (offset < hdr_len ? hdr_len : msg_hdr->length) - offset;
+    if (want > available) {
+      want = available;
+    }
 
-    if (offset >= sizeof (msg_hdr_t)) {
-      /* We have the entire message header */
+    byte *block = &msg[offset];
+    serial_read_block(block, want);
 
-      if (msg_hdr->length < sizeof (msg_hdr_t)) {
-        DEBUG_ERR("hmtl_serial_getmsg: msg length is too short");
-        offset = 0;
+    if (offset == 0) {
+      /* Wait for the start code at the beginning of the message */
+      byte *start = (byte *)memchr(block, HMTL_MSG_START, want);
+      if (start == NULL) {
+        DEBUG1_VALUELN("hmtl_serial_getmsg: no start code in ", want);
         continue;
       }
 
-      if (offset == msg_hdr->length) {
-        /* This is a complete message */
-        DEBUG4_PRINTLN("hmtl_serial_getmsg: Received complete command");
-        complete = true;
-
-        // XXX: Check the CRC and the version
-        break;
+      /* This is probably the beginning of the message */
+      if (start != block) {
+        want -= start - block;
+        memmove(msg, start, want);
       }
     }
+
+    offset += want;
   }
 
   DEBUG5_COMMAND(
@@ -230,113 +426,325 @@ hmtl_serial_getmsg(byte *msg, byte msg_len, byte *offset_ptr)
  * Individual message formatting
  */
 
+static uint8_t msg_sequence = 0;
+
+uint8_t hmtl_next_sequence() {
+  return msg_sequence++;
+}
+
 /* Initialize the message header */
-void hmtl_msg_fmt(msg_hdr_t *msg_hdr, uint16_t address, uint8_t length, 
+void hmtl_msg_fmt(msg_hdr_t *msg_hdr, uint16_t address, uint16_t length,
                   uint8_t type, uint8_t flags) {
   msg_hdr->startcode = HMTL_MSG_START;
   msg_hdr->crc = 0;
-  msg_hdr->version = HMTL_MSG_VERSION;
-  msg_hdr->length = length;
   msg_hdr->type = type;
   msg_hdr->flags = flags;
   msg_hdr->address = address;
+  msg_hdr->origin = SOCKET_ADDR_INVALID;
+  msg_hdr->sequence = hmtl_next_sequence();
+
+  if (length > 0xFF) {
+    /* Only sent in fragments, so the ttl holds the high byte of the length */
+    msg_hdr->version = HMTL_MSG_VERSION_LONG;
+    msg_hdr->length = length & 0xFF;
+    msg_hdr->ttl = length >> 8;
+  } else {
+    msg_hdr->version = HMTL_MSG_VERSION;
+    msg_hdr->length = length;
+    msg_hdr->ttl = HMTL_MSG_DEFAULT_TTL;
+  }
 
-#ifdef HMTL_USE_CRC
-  /* Compute the CRC with the crc value with the crc value == 0 */
-  msg_hdr->crc = EEPROM_crc(msg_hdr, length);
-#endif
+  hmtl_msg_set_crc(msg_hdr);
+}
+
+uint16_t hmtl_msg_upgrade(const msg_hdr_t *msg_hdr, byte *buffer,
+                          uint16_t buffsize, socket_addr_t origin) {
+  byte grow = sizeof (msg_hdr_t) - HMTL_MSG_V2_HDR_LEN;
+  uint16_t length = msg_hdr->length + grow;
+  if ((msg_hdr->length < HMTL_MSG_V2_HDR_LEN) || (length > buffsize) ||
+      (length > 0xFF)) {
+    DEBUG1_VALUELN("hmtl_msg_upgrade: can't upgrade length ", msg_hdr->length);
+    return 0;
+  }
+
+  /* Move the payload first in case the message is upgraded in place */
+  memmove(buffer + sizeof (msg_hdr_t),
+          (const byte *)msg_hdr + HMTL_MSG_V2_HDR_LEN,
+          msg_hdr->length - HMTL_MSG_V2_HDR_LEN);
+  if ((const byte *)msg_hdr != buffer) {
+    memcpy(buffer, msg_hdr, HMTL_MSG_V2_HDR_LEN);
+  }
+
+  msg_hdr_t *upgraded = (msg_hdr_t *)buffer;
+  upgraded->version = HMTL_MSG_VERSION;
+  upgraded->length = length;
+  upgraded->origin = origin;
+  upgraded->sequence = (origin == SOCKET_ADDR_INVALID ?
+                        0 : hmtl_next_sequence());
+  upgraded->ttl = HMTL_MSG_DEFAULT_TTL;
+  hmtl_msg_set_crc(upgraded);
+
+  return length;
+}
+
+uint16_t hmtl_msg_downgrade(msg_hdr_t *msg_hdr) {
+  if ((msg_hdr->version != HMTL_MSG_VERSION) ||
+      (msg_hdr->length < sizeof (msg_hdr_t))) {
+    DEBUG1_VALUELN("hmtl_msg_downgrade: can't downgrade ", msg_hdr->version);
+    return 0;
+  }
+
+  byte shrink = sizeof (msg_hdr_t) - HMTL_MSG_V2_HDR_LEN;
+  memmove((byte *)msg_hdr + HMTL_MSG_V2_HDR_LEN, msg_hdr + 1,
+          msg_hdr->length - sizeof (msg_hdr_t));
+  msg_hdr->version = HMTL_MSG_VERSION_2;
+  msg_hdr->length -= shrink;
+  msg_hdr->crc = 0;
+
+  return msg_hdr->length;
+}
+
+void hmtl_msg_build_error(uint16_t buffsize, uint16_t length) {
+  DEBUG1_VALUE("hmtl_msg_build: buff too small:", buffsize);
+  DEBUG1_VALUELN(" needed:", length);
 }
 
 /* Format a value message */
 uint16_t hmtl_value_fmt(byte *buffer, uint16_t buffsize,
                         uint16_t address, uint8_t output, int value) {
-  msg_hdr_t *msg_hdr = (msg_hdr_t *)buffer;
-  msg_value_t *msg_value = (msg_value_t *)(msg_hdr + 1);
-
-  if (buffsize < HMTL_MSG_VALUE_LEN) {
-    DEBUG_ERR("hmtl_value_fmt: too small size");
-    DEBUG_ERR_STATE(1);
+  msg_value_t *msg_value = hmtl_output_build<msg_value_t>(buffer, buffsize,
+                                                          output);
+  if (msg_value == NULL) {
+    return 0;
   }
-
-  msg_value->hdr.type = HMTL_OUTPUT_VALUE;
-  msg_value->hdr.output = output;
   msg_value->value = value;
 
-  hmtl_msg_fmt(msg_hdr, address, HMTL_MSG_VALUE_LEN, MSG_TYPE_OUTPUT);
-  return HMTL_MSG_VALUE_LEN;
+  return hmtl_msg_finish<msg_value_t>(buffer, address);
 }
 
 /* Format an RGB message */
 uint16_t hmtl_rgb_fmt(byte *buffer, uint16_t buffsize,
                       uint16_t address, uint8_t output, 
                       uint8_t r, uint8_t g, uint8_t b) {
-  msg_hdr_t *msg_hdr = (msg_hdr_t *)buffer;
-  msg_rgb_t *msg_rgb = (msg_rgb_t *)(msg_hdr + 1);
-
-  if (buffsize < HMTL_MSG_RGB_LEN) {
-    DEBUG_ERR("hmtl_rgb_fmt: too small size");
-    DEBUG_ERR_STATE(1);
+  msg_rgb_t *msg_rgb = hmtl_output_build<msg_rgb_t>(buffer, buffsize, output);
+  if (msg_rgb == NULL) {
+    return 0;
   }
-
-  msg_rgb->hdr.type = HMTL_OUTPUT_RGB;
-  msg_rgb->hdr.output = output;
   msg_rgb->values[0] = r;
   msg_rgb->values[1] = g;
   msg_rgb->values[2] = b;
 
-  hmtl_msg_fmt(msg_hdr, address, HMTL_MSG_RGB_LEN, MSG_TYPE_OUTPUT);
-  return HMTL_MSG_VALUE_LEN;
+  return hmtl_msg_finish<msg_rgb_t>(buffer, address);
+}
+
+/*
+ * Start an empty batch message.  Records are added with hmtl_batch_add() and
+ * the header is formatted by hmtl_batch_finish() once all have been added.
+ */
+uint16_t hmtl_batch_fmt(byte *buffer, uint16_t buffsize,
+                        uint16_t address) {
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)buffer;
+
+  if (hmtl_msg_build<msg_batch_t>(buffer, buffsize, 0) == NULL) {
+    return 0;
+  }
+
+  msg_hdr->address = address;
+  msg_hdr->length = HMTL_MSG_BATCH_MIN_LEN;
+  return HMTL_MSG_BATCH_MIN_LEN;
+}
+
+/*
+ * Append an output message of the indicated length to a batch.  Returns the
+ * new length of the batch, or 0 if the record does not fit.
+ */
+uint16_t hmtl_batch_add(byte *buffer, uint16_t buffsize,
+                        output_hdr_t *output, uint8_t length) {
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)buffer;
+  uint16_t len = msg_hdr->length + sizeof (uint8_t) + length;
+
+  if ((len > buffsize) || (len > HMTL_MSG_BATCH_MAX_LEN) ||
+      (length < sizeof (output_hdr_t))) {
+    DEBUG1_VALUELN("hmtl_batch_add: no room for ", length);
+    return 0;
+  }
+
+  msg_batch_record_t *record =
+          (msg_batch_record_t *)(buffer + msg_hdr->length);
+  record->length = length;
+  memcpy(&record->hdr, output, length);
+
+  msg_hdr->length = len;
+  return len;
+}
+
+/* Format the header of a batch once its records are added */
+uint16_t hmtl_batch_finish(byte *buffer, uint8_t flags) {
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)buffer;
+
+  return hmtl_msg_finish<msg_batch_t>(buffer, msg_hdr->address, flags,
+                                      msg_hdr->length -
+                                      HMTL_MSG_BATCH_MIN_LEN);
 }
 
 /* Format a poll response message */
 uint16_t hmtl_poll_fmt(byte *buffer, uint16_t buffsize, uint16_t address,
                        byte flags, uint16_t object_type,
                        config_hdr_t *config, output_hdr_t *outputs[],
-                       uint16_t recv_buffer_size) {
-  msg_hdr_t *msg_hdr = (msg_hdr_t *)buffer;
-  msg_poll_response_t *msg_poll = (msg_poll_response_t *)(msg_hdr + 1);
-
-  if (buffsize < HMTL_MSG_POLL_MIN_LEN) {
-    DEBUG_ERR("hmtl_poll_fmt: buff too small");
-    DEBUG_ERR_STATE(1);
+                       uint8_t num_outputs, uint8_t first_output,
+                       uint16_t recv_buffer_size, uint8_t msg_version) {
+  msg_poll_response_t *msg_poll =
+          hmtl_msg_build<msg_poll_response_t>(buffer, buffsize,
+                                              sizeof (msg_poll_outputs_t));
+  if (msg_poll == NULL) {
+    return 0;
   }
+  msg_poll_outputs_t *msg_outputs = (msg_poll_outputs_t *)(msg_poll->data);
 
   // Construct the primary data
-  uint16_t len = HMTL_MSG_POLL_MIN_LEN;
   memcpy(&msg_poll->config, config, sizeof (config_hdr_t));
   msg_poll->object_type = object_type;
   msg_poll->recv_buffer_size = recv_buffer_size;
-  msg_poll->msg_version = HMTL_MSG_VERSION;
-  
-  // TODO: Add outputs XXX
+  msg_poll->msg_version = msg_version;
 
-  hmtl_msg_fmt(msg_hdr, address, len, MSG_TYPE_POLL);
-  msg_hdr->flags |= flags | MSG_FLAG_ACK;
-  return len;
+  // Describe as many of the outputs as fit
+  if (buffsize > HMTL_MAX_MSG_LEN) {
+    buffsize = HMTL_MAX_MSG_LEN;
+  }
+  uint8_t count = 0;
+  if (first_output < num_outputs) {
+    count = num_outputs - first_output;
+    if (count > HMTL_POLL_OUTPUTS(buffsize)) {
+      count = HMTL_POLL_OUTPUTS(buffsize);
+    }
+  }
+
+  msg_outputs->first = first_output;
+  msg_outputs->count = count;
+  for (uint8_t i = 0; i < count; i++) {
+    output_hdr_t *output = outputs[first_output + i];
+    msg_poll_output_t *desc = &msg_outputs->outputs[i];
+
+    desc->output = first_output + i;
+    desc->pixels = 0;
+    if (output == NULL) {
+      desc->type = HMTL_OUTPUT_NONE;
+    } else {
+      desc->type = output->type;
+      if (output->type == HMTL_OUTPUT_PIXELS) {
+        desc->pixels = ((config_pixels_t *)output)->numPixels;
+      }
+    }
+  }
+
+  flags &= ~MSG_FLAG_MORE_DATA;
+  if ((count > 0) && (first_output + count < num_outputs)) {
+    flags |= MSG_FLAG_MORE_DATA;
+  }
+
+  return hmtl_msg_finish<msg_poll_response_t>(buffer, address,
+                                              flags | MSG_FLAG_ACK,
+                                              sizeof (msg_poll_outputs_t) +
+                                              count *
+                                              sizeof (msg_poll_output_t));
+}
+
+/* Format a broadcast poll requesting discovery mode responses */
+uint16_t hmtl_poll_discover_fmt(byte *buffer, uint16_t buffsize,
+                                uint8_t nonce, uint8_t slots, uint8_t slot_ms,
+                                socket_addr_t known_base,
+                                const byte *known, uint8_t known_len,
+                                uint8_t flags) {
+  if (buffsize > HMTL_MAX_MSG_LEN) {
+    buffsize = HMTL_MAX_MSG_LEN;
+  }
+  msg_poll_discover_t *discover =
+          hmtl_msg_build<msg_poll_discover_t>(buffer, buffsize, known_len);
+  if (discover == NULL) {
+    return 0;
+  }
+
+  discover->nonce = nonce;
+  discover->slots = slots;
+  discover->slot_ms = slot_ms;
+  discover->flags = flags;
+  discover->known_base = known_base;
+  memcpy(discover->known, known, known_len);
+
+  return hmtl_msg_finish<msg_poll_discover_t>(buffer, SOCKET_ADDR_ANY,
+                                              MSG_FLAG_RESPONSE, known_len);
+}
+
+/* Format a request for pages of a module's configuration */
+uint16_t hmtl_dumpconfig_request_fmt(byte *buffer, uint16_t buffsize,
+                                     socket_addr_t address,
+                                     uint16_t offset, uint8_t pages) {
+  msg_dumpconfig_request_t *request =
+          hmtl_msg_build<msg_dumpconfig_request_t>(buffer, buffsize);
+  if (request == NULL) {
+    return 0;
+  }
+  request->offset = offset;
+  request->pages = pages;
+  request->reserved = 0;
+
+  return hmtl_msg_finish<msg_dumpconfig_request_t>(buffer, address,
+                                                   MSG_FLAG_RESPONSE);
 }
 
 /* Perform the basic formatting for a configuration dump response */
 uint16_t hmtl_dumpconfig_fmt(byte *buffer, uint16_t buffsize, uint16_t address,
-                             byte flags,
+                             byte flags, uint16_t offset, uint16_t next,
                              byte datalen) {
-  msg_hdr_t *msg_hdr = (msg_hdr_t *)buffer;
+  msg_dumpconfig_response_t *resp =
+          hmtl_msg_build<msg_dumpconfig_response_t>(buffer, buffsize, datalen);
+  if (resp == NULL) {
+    return 0;
+  }
+  resp->offset = offset;
+  resp->next = next;
+
+  return hmtl_msg_finish<msg_dumpconfig_response_t>(buffer, address,
+                                                    flags | MSG_FLAG_ACK,
+                                                    datalen);
+}
 
-  if (buffsize < HMTL_MSG_DUMPCONFIG_MIN_LEN) {
-    DEBUG_ERR("hmtl_dumpconfig_fmt: buff too small");
-    DEBUG_ERR_STATE(1);
+/* Request a dump of a module's message trace */
+uint16_t hmtl_trace_request_fmt(byte *buffer, uint16_t buffsize,
+                                socket_addr_t address, uint16_t offset,
+                                uint8_t pages, uint8_t control) {
+  msg_trace_request_t *request =
+          hmtl_msg_build<msg_trace_request_t>(buffer, buffsize);
+  if (request == NULL) {
+    return 0;
   }
+  request->offset = offset;
+  request->pages = pages;
+  request->control = control;
 
-  uint16_t len = HMTL_MSG_DUMPCONFIG_MIN_LEN + datalen;
+  return hmtl_msg_finish<msg_trace_request_t>(buffer, address,
+                                              MSG_FLAG_RESPONSE);
+}
 
-  hmtl_msg_fmt(msg_hdr, address, len, MSG_TYPE_DUMP_CONFIG,
-               flags | MSG_FLAG_ACK);
+/* Perform the basic formatting for a page of a message trace */
+uint16_t hmtl_trace_fmt(byte *buffer, uint16_t buffsize, socket_addr_t address,
+                        byte flags, uint16_t offset, uint16_t length,
+                        byte datalen) {
+  msg_trace_response_t *resp =
+          hmtl_msg_build<msg_trace_response_t>(buffer, buffsize, datalen);
+  if (resp == NULL) {
+    return 0;
+  }
+  resp->offset = offset;
+  resp->length = length;
 
-  return len;
+  return hmtl_msg_finish<msg_trace_response_t>(buffer, address,
+                                               flags | MSG_FLAG_ACK, datalen);
 }
 
 /*
  * Format a sensor response message.  The caller will fill in the actual sensor
- * data after the header.
+ * data after the header and then set the CRC with hmtl_msg_set_crc().
  */
 uint16_t hmtl_sensor_fmt(byte *buffer, uint16_t buffsize, uint16_t address,
                          uint8_t datalen, uint8_t **data_ptr) {
@@ -345,9 +753,8 @@ uint16_t hmtl_sensor_fmt(byte *buffer, uint16_t buffsize, uint16_t address,
 
   uint16_t len = HMTL_MSG_SENSOR_MIN_LEN + datalen;
 
-  /* Format the message header */
-  hmtl_msg_fmt(msg_hdr, address, len, MSG_TYPE_SENSOR);
-  msg_hdr->flags |= MSG_FLAG_ACK;
+  /* Format the message header, the CRC is set once the data is filled in */
+  hmtl_msg_fmt(msg_hdr, address, len, MSG_TYPE_SENSOR, MSG_FLAG_ACK);
 
   /* Set the data ptr to be returned */
   *data_ptr = (uint8_t *)&msg_sense->data;
@@ -358,19 +765,67 @@ uint16_t hmtl_sensor_fmt(byte *buffer, uint16_t buffsize, uint16_t address,
 /* Format an address setting message */
 uint16_t hmtl_set_addr_fmt(byte *buffer, uint16_t buffsize, uint16_t address,
                            uint16_t device_id, uint16_t new_address) {
-  msg_hdr_t *msg_hdr = (msg_hdr_t *)buffer;
-  msg_set_addr_t *msg_addr = (msg_set_addr_t *)(msg_hdr + 1);
-
-  if (buffsize < HMTL_MSG_SET_ADDR_LEN) {
-    DEBUG_ERR("too small size");
-    DEBUG_ERR_STATE(1);
+  msg_set_addr_t *msg_addr = hmtl_msg_build<msg_set_addr_t>(buffer, buffsize);
+  if (msg_addr == NULL) {
+    return 0;
   }
-
   msg_addr->device_id = device_id;
   msg_addr->address = new_address;
-  
-  hmtl_msg_fmt(msg_hdr, address, HMTL_MSG_SET_ADDR_LEN, MSG_TYPE_SET_ADDR);
-  return HMTL_MSG_SET_ADDR_LEN;
+
+  return hmtl_msg_finish<msg_set_addr_t>(buffer, address);
+}
+
+/* Format a broadcast announcing the groups this module belongs to */
+uint16_t hmtl_groups_fmt(byte *buffer, uint16_t buffsize,
+                         config_groups_t *groups) {
+  uint16_t datalen = groups->num_groups * sizeof (socket_addr_t);
+  msg_groups_t *msg_groups = hmtl_msg_build<msg_groups_t>(buffer, buffsize,
+                                                          datalen);
+  if (msg_groups == NULL) {
+    return 0;
+  }
+
+  msg_groups->count = groups->num_groups;
+  msg_groups->reserved = 0;
+  memcpy(msg_groups->groups, groups->groups, datalen);
+
+  return hmtl_msg_finish<msg_groups_t>(buffer, SOCKET_ADDR_ANY, 0, datalen);
+}
+
+/* Format the acknowledgement of a reliable message */
+uint16_t hmtl_delivered_fmt(byte *buffer, uint16_t buffsize,
+                            socket_addr_t address, const msg_hdr_t *msg_hdr) {
+  msg_delivered_t *delivered = hmtl_msg_build<msg_delivered_t>(buffer,
+                                                               buffsize);
+  if (delivered == NULL) {
+    return 0;
+  }
+  delivered->sequence = msg_hdr->sequence;
+  delivered->retry = HMTL_MSG_RETRY(msg_hdr);
+
+  return hmtl_msg_finish<msg_delivered_t>(buffer, address, MSG_FLAG_PRIORITY);
+}
+
+/* Format a fragment carrying a run of a larger message's bytes */
+uint16_t hmtl_fragment_fmt(byte *buffer, uint16_t buffsize,
+                           socket_addr_t address, byte flags,
+                           socket_addr_t origin, uint8_t sequence,
+                           uint16_t length, uint16_t offset,
+                           const byte *data, uint16_t datalen) {
+  msg_fragment_t *fragment = hmtl_msg_build<msg_fragment_t>(buffer, buffsize,
+                                                             datalen);
+  if (fragment == NULL) {
+    return 0;
+  }
+
+  fragment->origin = origin;
+  fragment->sequence = sequence;
+  fragment->reserved = 0;
+  fragment->length = length;
+  fragment->offset = offset;
+  memcpy(fragment->data, data, datalen);
+
+  return hmtl_msg_finish<msg_fragment_t>(buffer, address, flags, datalen);
 }
 
 /***** Wrapper functions for sending HMTL Messages ****************************/
@@ -384,6 +839,9 @@ void hmtl_send_value(Socket *socket, byte *buff, byte buff_len,
 
   uint16_t len = hmtl_value_fmt(buff, buff_len,
                                 address, output, value);
+  if (len == 0) {
+    return;
+  }
   socket->sendMsgTo(address, buff, len);
 }
 
@@ -398,9 +856,70 @@ void hmtl_send_rgb(Socket *socket, byte *buff, byte buff_len,
 
   uint16_t len = hmtl_rgb_fmt(buff, buff_len,
                               address, output, r, g, b);
+  if (len == 0) {
+    return;
+  }
   socket->sendMsgTo(address, buff, len);
 }
 
+uint8_t hmtl_send_fragments(Socket *socket, const msg_hdr_t *msg_hdr,
+                            socket_addr_t source) {
+  socket_addr_t origin = msg_hdr->origin;
+  uint8_t sequence = msg_hdr->sequence;
+  uint16_t length = hmtl_msg_length(msg_hdr);
+  uint16_t offset = 0;
+  const byte *data = (const byte *)msg_hdr;
+  uint16_t datalen = length;
+  uint8_t ttl = msg_hdr->ttl;
+
+  if (msg_hdr->type == MSG_TYPE_FRAGMENT) {
+    /* Split the fragment's run of the message into smaller ones */
+    const msg_fragment_t *fragment = (const msg_fragment_t *)(msg_hdr + 1);
+    origin = fragment->origin;
+    sequence = fragment->sequence;
+    length = fragment->length;
+    offset = fragment->offset;
+    data = fragment->data;
+    datalen = msg_hdr->length - HMTL_MSG_FRAGMENT_MIN_LEN;
+  } else if (msg_hdr->version == HMTL_MSG_VERSION_LONG) {
+    ttl = HMTL_MSG_DEFAULT_TTL;
+  }
+
+  if (socket->send_data_size <= HMTL_MSG_FRAGMENT_MIN_LEN) {
+    DEBUG1_VALUELN("hmtl_send_fragments: buffer too small ",
+                   socket->send_data_size);
+    return 0;
+  }
+  uint16_t max_data = HMTL_FRAGMENT_DATA(socket->send_data_size);
+
+  uint8_t sent = 0;
+  while (datalen > 0) {
+    uint16_t fraglen = (datalen < max_data ? datalen : max_data);
+    uint16_t len = hmtl_fragment_fmt(socket->send_buffer,
+                                     socket->send_data_size,
+                                     msg_hdr->address,
+                                     msg_hdr->flags & MSG_FLAG_PRIORITY,
+                                     origin, sequence, length, offset,
+                                     data, fraglen);
+    if (len == 0) {
+      break;
+    }
+
+    msg_hdr_t *fragment_hdr = (msg_hdr_t *)socket->send_buffer;
+    fragment_hdr->origin = source;
+    fragment_hdr->ttl = ttl;
+    hmtl_msg_set_crc(fragment_hdr);
+    socket->sendMsgTo(msg_hdr->address, socket->send_buffer, len);
+
+    data += fraglen;
+    offset += fraglen;
+    datalen -= fraglen;
+    sent++;
+  }
+
+  return sent;
+}
+
 
 /*******************************************************************************
  * Data processing helper functions
@@ -414,11 +933,11 @@ msg_sensor_data_t* hmtl_next_sensor(msg_hdr_t *msg, msg_sensor_data_t *current)
 
   if (current) {
     next = (byte *)current + sizeof (msg_sensor_data_t) + current->data_len;
-    if (next >= (byte *)msg + msg->length) {
+    if (next >= (byte *)msg + hmtl_msg_length(msg)) {
       next = NULL;
     }
   } else {
-    if (msg->length >= sizeof (msg_hdr_t) + sizeof (msg_sensor_data_t)) {
+    if (hmtl_msg_length(msg) >= sizeof (msg_hdr_t) + sizeof (msg_sensor_data_t)) {
       next = (byte *)(msg + 1);
     }
   }
@@ -430,7 +949,7 @@ msg_sensor_data_t* hmtl_next_sensor(msg_hdr_t *msg, msg_sensor_data_t *current)
     }
 
     if (next) {
-      if (next + sizeof (msg_sensor_data_t) + ((msg_sensor_data_t*)next)->data_len > (byte *)msg + msg->length) {
+      if (next + sizeof (msg_sensor_data_t) + ((msg_sensor_data_t*)next)->data_len > (byte *)msg + hmtl_msg_length(msg)) {
         DEBUG1_PRINTLN("Invalid sensor message");
         next = NULL;
       }
@@ -439,3 +958,63 @@ msg_sensor_data_t* hmtl_next_sensor(msg_hdr_t *msg, msg_sensor_data_t *current)
 
   return (msg_sensor_data_t*)next;
 }
+
+/*
+ * Return the next record from a batch message, or NULL if there are no more
+ */
+msg_batch_record_t* hmtl_next_batch_record(msg_hdr_t *msg,
+                                           msg_batch_record_t *current) {
+  byte *next;
+  byte *end = (byte *)msg + hmtl_msg_length(msg);
+
+  if (current) {
+    next = (byte *)current + sizeof (uint8_t) + current->length;
+  } else {
+    next = (byte *)(msg + 1);
+  }
+
+  if (next + sizeof (msg_batch_record_t) > end) {
+    return NULL;
+  }
+
+  msg_batch_record_t *record = (msg_batch_record_t *)next;
+  if ((record->length < sizeof (output_hdr_t)) ||
+      (next + sizeof (uint8_t) + record->length > end)) {
+    DEBUG1_PRINTLN("Invalid batch record");
+    return NULL;
+  }
+
+  return record;
+}
+
+uint8_t hmtl_poll_discover_slot(msg_hdr_t *msg_hdr, socket_addr_t address,
+                                uint16_t device_id) {
+  msg_poll_discover_t *discover = (msg_poll_discover_t *)(msg_hdr + 1);
+
+  uint16_t bit = address - discover->known_base;
+  if ((address >= discover->known_base) &&
+      (bit / 8 < msg_hdr->length - HMTL_MSG_POLL_DISCOVER_MIN_LEN) &&
+      (discover->known[bit / 8] & (1 << (bit % 8)))) {
+    return HMTL_DISCOVER_QUIET;
+  }
+
+  if (discover->slots <= 1) {
+    return 0;
+  }
+
+  if (discover->flags & HMTL_DISCOVER_BY_ADDRESS) {
+    return (uint16_t)(address - discover->known_base) % discover->slots;
+  }
+
+  /*
+   * Modules with adjacent addresses and IDs must land in unrelated slots, so
+   * mix the values with a multiplicative hash rather than using them directly
+   */
+  uint32_t hash = ((uint32_t)address << 16) | device_id;
+  hash ^= (uint32_t)discover->nonce * 0x9E3779B9UL;
+  hash *= 0x85EBCA6BUL;
+  hash ^= hash >> 15;
+  hash *= 0xC2B2AE35UL;
+  hash ^= hash >> 16;
+  return hash % discover->slots;
+}
@@ -13,8 +13,28 @@
 #include "RS485Utils.h"
 #include "HMTLTypes.h"
 
-// Uncomment this line to enable CRC checking of messages
-//#define HMTL_USE_CRC
+// Uncomment this line to disable CRC generation and checking of messages
+//#define HMTL_DISABLE_CRC
+#ifndef HMTL_DISABLE_CRC
+#define HMTL_USE_CRC
+#endif
+
+// Uncomment this line to drop version 2 messages rather than upgrading them
+//#define HMTL_DISABLE_V2_COMPAT
+#ifndef HMTL_DISABLE_V2_COMPAT
+#define HMTL_USE_V2_COMPAT
+#endif
+
+/*
+ * Uncomment this line to trust the caller's buffer size when building a
+ * message with hmtl_msg_build() rather than checking it at runtime.  Buffers
+ * whose size is known at compile time are always checked when compiling, and
+ * messages with variable length data are always checked at runtime.
+ */
+//#define HMTL_DISABLE_SIZE_CHECKS
+#ifndef HMTL_DISABLE_SIZE_CHECKS
+#define HMTL_USE_SIZE_CHECKS
+#endif
 
 /******************************************************************************
  * Transport-agnostic message types
@@ -25,8 +45,19 @@
  * depending on the header's type and flag fields.
  *
  * Message header:
- * 8B:  |startcode |   crc    | version  | length   |
+ * 12B: |startcode |   crc    | version  | length   |
  *      |  type    |  flags   |       address       |
+ *      |       origin        | sequence |   ttl    |
+ *
+ * The origin and sequence number identify a message as it is forwarded
+ * across the network so that each module handles it only once, the ttl is the
+ * number of times it may still be forwarded.
+ *
+ * Messages longer than 255 bytes use a version 4 header, which is the same
+ * except that the ttl holds the high byte of the length.  These are never
+ * sent as is but only as MSG_TYPE_FRAGMENT messages, each with a version 3
+ * header and its own ttl, so modules that only know version 3 still forward
+ * them.
  *
  * Output message adds output_hdr_t + output-type specific data
  * 2B:  |   type   |  output  | ...
@@ -36,7 +67,29 @@
 
 #define HMTL_MSG_START 0xFC
 
-#define HMTL_MSG_VERSION 2
+#define HMTL_MSG_VERSION 3
+
+/*
+ * Version 4 headers are those of messages longer than 255 bytes, whose ttl
+ * holds the high byte of the length.  Such a message never crosses a socket
+ * whole, it is only sent within MSG_TYPE_FRAGMENT messages with version 3
+ * headers and is seen whole only by the module that reassembles it, so there
+ * is no ttl of its own to keep and the length can grow without changing the
+ * header that every module parses.
+ */
+#define HMTL_MSG_VERSION_LONG 4
+
+/*
+ * Version 2 headers, from modules built before the origin, sequence and ttl
+ * were added, are the first 8 bytes of the current header and have no CRC.
+ * They are upgraded to the current version when received, and messages sent
+ * or forwarded to a module heard sending them are downgraded in return.
+ */
+#define HMTL_MSG_VERSION_2 2
+#define HMTL_MSG_V2_HDR_LEN 8
+
+/* Number of times a message may be forwarded unless set otherwise */
+#define HMTL_MSG_DEFAULT_TTL 8
 typedef struct {
   uint8_t startcode;
   uint8_t crc;
@@ -51,6 +104,11 @@ typedef struct {
   // serial).
   socket_addr_t address;
 
+  // Module that first sent the message, SOCKET_ADDR_INVALID until it has been
+  // assigned by the first module to receive or forward it.
+  socket_addr_t origin;
+  uint8_t sequence;
+  uint8_t ttl;
 } msg_hdr_t;
 
 /* Message type codes */
@@ -59,33 +117,68 @@ typedef struct {
 #define MSG_TYPE_SET_ADDR    0x03
 #define MSG_TYPE_SENSOR      0x04
 #define MSG_TYPE_TIMESYNC    0x05
-
-#define MSG_TYPE_DONT_FORWARD 0xE0 // Msg types past this should not be forwarded
+#define MSG_TYPE_STATS       0x06
+#define MSG_TYPE_BATCH       0x07
+#define MSG_TYPE_PIXEL_FRAME 0x08
+#define MSG_TYPE_FRAGMENT    0x09
+#define MSG_TYPE_GROUPS      0x0A
+#define MSG_TYPE_DELIVERED   0x0B
+
+#define MSG_TYPE_DONT_FORWARD 0xE0 // Broadcasts of msg types past this are not forwarded
 #define MSG_TYPE_DUMP_CONFIG  0xE0
+#define MSG_TYPE_TRACE        0xE1
 
 /* Message flags */
 #define MSG_FLAG_ACK        (1 << 0) // This message is an acknowledgement
 #define MSG_FLAG_RESPONSE   (1 << 1) // This message expects a response
 #define MSG_FLAG_MORE_DATA  (1 << 2) // This message has followup messages
 #define MSG_FLAG_ERROR      (1 << 3) // This message indicates an error
+#define MSG_FLAG_PRIORITY   (1 << 4) // Handle and forward ahead of bulk traffic
+#define MSG_FLAG_RELIABLE   (1 << 5) // Acknowledge delivery with MSG_TYPE_DELIVERED
+#define MSG_FLAG_RETRY      (3 << 6) // Retransmission count of a reliable message
+
+#define HMTL_MSG_RETRY(hdr) (((hdr)->flags & MSG_FLAG_RETRY) >> 6)
+#define HMTL_MSG_MAX_RETRY  3
 
 #define HMTL_MSG_SIZE(msgtype) (sizeof (msg_hdr_t) + sizeof (msgtype))
+
+/*
+ * Each message payload structure is declared with HMTL_MSG_PAYLOAD() along
+ * with its message type, and output type if it is an output message, so that
+ * the length of a message carrying it is known at compile time by the
+ * builders and views at the end of this file.  For payloads ending in a
+ * variable length array the length is the minimum one.
+ */
+template <typename T> struct hmtl_msg_payload;
+
+#define HMTL_MSG_PAYLOAD(payload_type, msg_type, output_type) \
+  template <> struct hmtl_msg_payload<payload_type> {         \
+    enum {                                                    \
+      type = (msg_type),                                      \
+      output = (output_type),                                 \
+      length = HMTL_MSG_SIZE(payload_type)                    \
+    };                                                        \
+  }
+
 /*******************************************************************************
  * Message formats for messages of type MSG_TYPE_OUTPUT
  */
 
-typedef struct {
+/* Packed as it follows the byte-aligned output header within a message */
+typedef struct __attribute__((__packed__)) {
   output_hdr_t hdr;
   uint16_t value : 13; // 13 bits provide values up to 8192
   uint16_t flags :  3;
 } msg_value_t;
 #define HMTL_MSG_VALUE_LEN (sizeof (msg_hdr_t) + sizeof (msg_value_t))
+HMTL_MSG_PAYLOAD(msg_value_t, MSG_TYPE_OUTPUT, HMTL_OUTPUT_VALUE);
 
 typedef struct {
   output_hdr_t hdr;
   uint8_t values[3];
 } msg_rgb_t;
 #define HMTL_MSG_RGB_LEN (sizeof (msg_hdr_t) + sizeof (msg_rgb_t))
+HMTL_MSG_PAYLOAD(msg_rgb_t, MSG_TYPE_OUTPUT, HMTL_OUTPUT_RGB);
 
 #define MAX_PROGRAM_VAL 32
 typedef struct {
@@ -94,6 +187,29 @@ typedef struct {
   uint8_t values[MAX_PROGRAM_VAL];
 } msg_program_t;
 #define HMTL_MSG_PROGRAM_LEN (sizeof (msg_hdr_t) + sizeof (msg_program_t))
+HMTL_MSG_PAYLOAD(msg_program_t, MSG_TYPE_OUTPUT, HMTL_OUTPUT_PROGRAM);
+
+/*******************************************************************************
+ * Message format for MSG_TYPE_BATCH
+ *
+ * A batch carries a sequence of output messages under a single header, each
+ * prefixed by its length so that shortened program messages can be included.
+ *
+ * 1B:  |  length  | output_hdr_t + output-type specific data ...
+ */
+
+typedef struct {
+  uint8_t length; // Length of the output message, excluding this field
+  output_hdr_t hdr;
+} msg_batch_record_t;
+typedef struct {
+  uint8_t data[0];  // msg_batch_record_t records
+} msg_batch_t;
+#define HMTL_MSG_BATCH_MIN_LEN (sizeof (msg_hdr_t) + sizeof (msg_batch_t))
+HMTL_MSG_PAYLOAD(msg_batch_t, MSG_TYPE_BATCH, HMTL_OUTPUT_NONE);
+
+// Largest batch a module will accept, sized to fit a 64 byte socket buffer
+#define HMTL_MSG_BATCH_MAX_LEN 64
 
 /*******************************************************************************
  * Message format for MSG_TYPE_POLL
@@ -103,19 +219,167 @@ typedef struct {
   config_hdr_t config;
   uint16_t object_type;
   uint16_t recv_buffer_size;
-  uint8_t msg_version;
+  uint8_t msg_version; // HMTL_MSG_VERSION_LONG if it reassembles fragments
   uint8_t data[0];
 } msg_poll_response_t;
 #define HMTL_MSG_POLL_MIN_LEN (sizeof (msg_hdr_t) + sizeof (msg_poll_response_t))
+HMTL_MSG_PAYLOAD(msg_poll_response_t, MSG_TYPE_POLL, HMTL_OUTPUT_NONE);
+
+/*
+ * The response's data describes the module's outputs, so that a single poll
+ * is enough to know what each module can display.  If the descriptors don't
+ * fit in one message the response is split across several, each starting
+ * with the index of its first descriptor and all but the last having
+ * MSG_FLAG_MORE_DATA set.
+ *
+ * 2B:  |  first   |  count   |
+ * 4B:  |   type   |  output  |       pixels        | for each output
+ *
+ * Outputs that failed to be configured have type HMTL_OUTPUT_NONE.
+ */
+
+typedef struct {
+  uint8_t type;
+  uint8_t output;
+  uint16_t pixels;  // Number of pixels on a pixel output, otherwise 0
+} msg_poll_output_t;
+
+typedef struct {
+  uint8_t first;    // Index of the first output described
+  uint8_t count;    // Number of outputs described in this message
+  msg_poll_output_t outputs[0];
+} msg_poll_outputs_t;
+#define HMTL_MSG_POLL_OUTPUTS_MIN_LEN \
+  (sizeof (msg_hdr_t) + offsetof(msg_poll_response_t, data) + \
+   sizeof (msg_poll_outputs_t))
+
+/* Number of output descriptors that fit in a poll response of the given size */
+#define HMTL_POLL_OUTPUTS(size) \
+  (((size) - HMTL_MSG_POLL_OUTPUTS_MIN_LEN) / sizeof (msg_poll_output_t))
+
+/*
+ * A broadcast poll may carry a discovery request.  Rather than responding in
+ * a slot based on their address, modules pick one of the request's slots
+ * pseudo-randomly from their address, device ID and the request's nonce, so
+ * that a scan takes a time proportional to the number of modules rather than
+ * to the range of their addresses.  Modules whose address is set in the
+ * known bitmap don't respond at all, which allows follow up rounds with a new
+ * nonce to find only the modules that were missed or collided.
+ *
+ * Random slots collide however they are sized, so finding N modules takes
+ * about e * N slots.  When the controller already knows the range of
+ * addresses, as when rescanning, HMTL_DISCOVER_BY_ADDRESS instead has each
+ * module respond in the slot of its address's offset from known_base, modulo
+ * the slots.  Addresses are unique, so a round with a slot for every address
+ * in the range has no collisions.  Modules sharing an address are only
+ * separated by rounds without the flag.
+ *
+ * Slots must be longer than a response.  With HMTL_DISCOVER_BRIEF modules
+ * respond without output descriptors, which are left for a poll of each
+ * module found.  This shortens responses enough for 4ms slots at 115200 baud.
+ *
+ * 6B:  |  nonce   |  slots   | slot_ms  |  flags   |     known_base      |
+ *      | known bitmap ...
+ *
+ * Bit n of the bitmap (byte n / 8, bit n % 8) is address known_base + n.
+ */
+
+#define HMTL_DISCOVER_BY_ADDRESS 0x01
+#define HMTL_DISCOVER_BRIEF      0x02
+
+typedef struct {
+  uint8_t nonce;    // Varies the slot each module picks between rounds
+  uint8_t slots;    // Number of response slots
+  uint8_t slot_ms;  // Length of each slot
+  uint8_t flags;    // HMTL_DISCOVER_* flags
+  socket_addr_t known_base;
+  uint8_t known[0];
+} msg_poll_discover_t;
+#define HMTL_MSG_POLL_DISCOVER_MIN_LEN (sizeof (msg_hdr_t) + sizeof (msg_poll_discover_t))
+HMTL_MSG_PAYLOAD(msg_poll_discover_t, MSG_TYPE_POLL, HMTL_OUTPUT_NONE);
 
 /*******************************************************************************
  * Message format for MSG_TYPE_DUMP_CONFIG
+ *
+ * The configuration is stored in EEPROM as a sequence of objects, each of
+ * which is sent as a single page.  A request may include the EEPROM offset of
+ * the page to start at, zero for the start of the configuration, and the
+ * number of pages to send, zero for all that remain.  The module sends one
+ * page per loop with MSG_FLAG_MORE_DATA set on all but the last, and each page
+ * gives its own offset and that of the following page, or zero if there is
+ * none, so that a requester can ask again for any pages it missed.
+ *
+ * Request 4B:   |       offset        |  pages   | reserved |
+ * Response 4B:  |       offset        |        next         | data ...
  */
 
 typedef struct {
+  uint16_t offset;
+  uint8_t pages;
+  uint8_t reserved;
+} msg_dumpconfig_request_t;
+HMTL_MSG_PAYLOAD(msg_dumpconfig_request_t, MSG_TYPE_DUMP_CONFIG,
+                 HMTL_OUTPUT_NONE);
+
+typedef struct {
+  uint16_t offset;
+  uint16_t next;
   uint8_t data[0];
 } msg_dumpconfig_response_t;
 #define HMTL_MSG_DUMPCONFIG_MIN_LEN (sizeof (msg_hdr_t) + sizeof (msg_dumpconfig_response_t))
+HMTL_MSG_PAYLOAD(msg_dumpconfig_response_t, MSG_TYPE_DUMP_CONFIG,
+                 HMTL_OUTPUT_NONE);
+
+/*******************************************************************************
+ * Message format for MSG_TYPE_TRACE
+ *
+ * Modules built with a message trace keep the most recent messages they
+ * received in a ring buffer, each as a record of the timesync time it arrived,
+ * the index of the socket it came in on, or HMTL_TRACE_SERIAL, the address it
+ * was sent from over that socket, and the message exactly as received.  A
+ * request dumps the trace as a stream of these records, oldest first, split
+ * into pages of as much as fits in a response.  As with configuration dumps
+ * a page is sent per loop with MSG_FLAG_MORE_DATA set on all but the last,
+ * and each gives its offset in the stream and the stream's total length.
+ *
+ * Recording stops while the trace is dumped and resumes after the last page,
+ * unless the request has HMTL_TRACE_HOLD, which leaves it stopped so that
+ * missed pages can be requested again, and HMTL_TRACE_CLEAR empties the trace
+ * once the last page is sent.  A request starting past the end of the trace
+ * is answered with a single empty page.
+ *
+ * Request 4B:   |       offset        |  pages   | control  |
+ * Response 4B:  |       offset        |       length        | data ...
+ * Record 9B:    |                     ms                    |        length       |
+ *               |  source  |        sender       | msg ...
+ */
+#define HMTL_TRACE_HOLD    0x1 // Leave recording stopped after the dump
+#define HMTL_TRACE_CLEAR   0x2 // Empty the trace after the dump
+
+#define HMTL_TRACE_SERIAL  0xFF // Source of messages from the serial device
+
+typedef struct {
+  uint16_t offset;
+  uint8_t pages;
+  uint8_t control;
+} msg_trace_request_t;
+#define HMTL_MSG_TRACE_REQUEST_LEN HMTL_MSG_SIZE(msg_trace_request_t)
+HMTL_MSG_PAYLOAD(msg_trace_request_t, MSG_TYPE_TRACE, HMTL_OUTPUT_NONE);
+
+typedef struct {
+  uint16_t offset;
+  uint16_t length; // Length of the whole trace
+  uint8_t data[0];
+} msg_trace_response_t;
+#define HMTL_MSG_TRACE_MIN_LEN (sizeof (msg_hdr_t) + sizeof (msg_trace_response_t))
+HMTL_MSG_PAYLOAD(msg_trace_response_t, MSG_TYPE_TRACE, HMTL_OUTPUT_NONE);
+
+typedef struct __attribute__((__packed__)) {
+  uint32_t ms;     // timesync.ms() when the message was received
+  uint16_t length; // Length of the message that follows
+  uint8_t source;
+  socket_addr_t sender; // SOCKET_ADDR_INVALID for the serial device
+} msg_trace_record_t;
 
 
 /*******************************************************************************
@@ -127,14 +391,16 @@ typedef struct {
   socket_addr_t address;
 } msg_set_addr_t;
 #define HMTL_MSG_SET_ADDR_LEN (sizeof (msg_hdr_t) + sizeof (msg_set_addr_t))
+HMTL_MSG_PAYLOAD(msg_set_addr_t, MSG_TYPE_SET_ADDR, HMTL_OUTPUT_NONE);
 
 /*******************************************************************************
  * Message format for MSG_TYPE_SENSOR
  */
 typedef struct {
-  uint8_t data[];
+  uint8_t data[0];
 } msg_sensor_response_t;
 #define HMTL_MSG_SENSOR_MIN_LEN (sizeof (msg_hdr_t) + sizeof (msg_sensor_response_t))
+HMTL_MSG_PAYLOAD(msg_sensor_response_t, MSG_TYPE_SENSOR, HMTL_OUTPUT_NONE);
 
 typedef struct {
   uint8_t sensor_type;
@@ -154,12 +420,128 @@ typedef msg_program_t msg_max_t;
  * Message format for MSG_TYPE_TIMESYNC in TimeSync.h
  */
 
+/*******************************************************************************
+ * Message format for MSG_TYPE_STATS in LoopStats.h
+ */
+
+/*******************************************************************************
+ * Message format for MSG_TYPE_PIXEL_FRAME in PixelFrame.h
+ */
+
+
+/*******************************************************************************
+ * Message format for MSG_TYPE_FRAGMENT
+ *
+ * A message too large for a socket's send buffer is sent as a series of
+ * fragments, each carrying the next run of the message's bytes starting from
+ * its header.  The fragments of a message are identified by its origin and
+ * sequence number and must be sent in order starting from offset 0, each
+ * starting where the previous one's data ends.  Fragments that are too large
+ * for a socket they are forwarded over are split again.
+ *
+ * 8B:  |       origin        | sequence | reserved |
+ *      |       length        |       offset        |
+ *      | data ...
+ */
+typedef struct {
+  socket_addr_t origin;   // Origin and sequence of the fragmented message
+  uint8_t sequence;
+  uint8_t reserved;
+  uint16_t length;        // Length of the fragmented message
+  uint16_t offset;        // Offset of this fragment's data in the message
+  uint8_t data[0];
+} msg_fragment_t;
+#define HMTL_MSG_FRAGMENT_MIN_LEN (sizeof (msg_hdr_t) + sizeof (msg_fragment_t))
+HMTL_MSG_PAYLOAD(msg_fragment_t, MSG_TYPE_FRAGMENT, HMTL_OUTPUT_NONE);
+
+/* Number of bytes of the fragmented message that fit in a message this size */
+#define HMTL_FRAGMENT_DATA(size) ((size) - HMTL_MSG_FRAGMENT_MIN_LEN)
+
+/*******************************************************************************
+ * Message format for MSG_TYPE_GROUPS
+ *
+ * Broadcast periodically by modules that belong to groups (see
+ * config_groups_t), so that modules forwarding messages to a group only send
+ * them over sockets that its members have been heard on.
+ *
+ * 2B:  |  count   | reserved | group (2B) ...
+ */
+typedef struct {
+  uint8_t count;
+  uint8_t reserved;
+  socket_addr_t groups[0];
+} msg_groups_t;
+#define HMTL_MSG_GROUPS_MIN_LEN (sizeof (msg_hdr_t) + sizeof (msg_groups_t))
+HMTL_MSG_PAYLOAD(msg_groups_t, MSG_TYPE_GROUPS, HMTL_OUTPUT_NONE);
+
+/*******************************************************************************
+ * Message format for MSG_TYPE_DELIVERED
+ *
+ * Sent by the destination of a message with MSG_FLAG_RELIABLE back to the
+ * message's origin, acknowledging it by sequence number.  The acknowledgement
+ * is sent again if a retransmission of the message arrives, as that means
+ * the first one was lost.
+ *
+ * 2B:  | sequence |  retry   |
+ */
+typedef struct {
+  uint8_t sequence;
+  uint8_t retry; // Retransmission count of the copy being acknowledged
+} msg_delivered_t;
+#define HMTL_MSG_DELIVERED_LEN HMTL_MSG_SIZE(msg_delivered_t)
+HMTL_MSG_PAYLOAD(msg_delivered_t, MSG_TYPE_DELIVERED, HMTL_OUTPUT_NONE);
+
+/* A broadcast or group address, whose messages may be for several modules */
+#define HMTL_IS_MULTICAST(addr) \
+  (((addr) == SOCKET_ADDR_ANY) || HMTL_IS_GROUP(addr))
+
+/*******************************************************************************
+ * Counts of received messages that were dropped as invalid
+ */
+typedef struct {
+  uint16_t bad_crc;
+  uint16_t bad_version;
+  uint16_t duplicate; // Already received over another path
+} msg_drop_counts_t;
 
 /*******************************************************************************
  * Utility functions
  */
 uint16_t hmtl_msg_size(output_hdr_t *output);
 
+/* Return a message's length, which is 16 bits in a version 4 header */
+static inline uint16_t hmtl_msg_length(const msg_hdr_t *msg_hdr) {
+  if (msg_hdr->version == HMTL_MSG_VERSION_LONG) {
+    return ((uint16_t)msg_hdr->ttl << 8) | msg_hdr->length;
+  }
+  return msg_hdr->length;
+}
+
+/*
+ * Compute a message's CRC, which covers the entire message with the CRC field
+ * treated as zero.
+ */
+byte hmtl_msg_crc(const msg_hdr_t *msg_hdr);
+
+/*
+ * Set the CRC of a message, required if a message is modified after being
+ * formatted.
+ */
+void hmtl_msg_set_crc(msg_hdr_t *msg_hdr);
+
+/*
+ * Check the CRC and version of a received message, updating the drop counts
+ * if provided.
+ */
+boolean hmtl_msg_valid(const msg_hdr_t *msg_hdr,
+                       msg_drop_counts_t *drops = NULL);
+
+/* Process a single output message, as in a MSG_TYPE_OUTPUT or batch record */
+int hmtl_handle_output(output_hdr_t *msg,
+                       byte num_objects,
+                       output_hdr_t *outputs[],
+                       void *objects[] = NULL);
+
 /* Process a HMTL formatted message */
 int hmtl_handle_output_msg(msg_hdr_t *msg_hdr,
                            byte num_objects,
@@ -167,17 +549,52 @@ int hmtl_handle_output_msg(msg_hdr_t *msg_hdr,
                            void *objects[] = NULL);
 
 /* Receive a message over the serial interface */
-boolean hmtl_serial_getmsg(byte *msg, byte msg_len, byte *offset_ptr);
+boolean hmtl_serial_getmsg(byte *msg, byte msg_len, byte *offset_ptr,
+                           msg_drop_counts_t *drops = NULL);
 
-/* Receive a message over the socket interface */
+/*
+ * Receive a message over the socket interface.  A version 2 message is
+ * upgraded into the upgrade buffer with its sender as the origin, and is
+ * dropped if no upgrade buffer is given.
+ *
+ * Returns NULL with msglen zero if no message is waiting, or with msglen the
+ * length of the frame read if it was dropped as invalid, in which case more
+ * messages may still be waiting.
+ */
 msg_hdr_t *hmtl_socket_getmsg(Socket *socket, unsigned int *msglen,
-                             socket_addr_t address = SOCKET_ADDR_INVALID);
+                             socket_addr_t address = SOCKET_ADDR_INVALID,
+                             msg_drop_counts_t *drops = NULL,
+                             byte *upgrade = NULL,
+                             uint16_t upgrade_size = 0);
+
+/*
+ * Rewrite a version 2 message into buffer, which may hold the message itself,
+ * with a current header.  The message is given the origin with a new sequence
+ * number, or if the origin is invalid is left for the receiver to assign.
+ * Returns the upgraded message's length, or 0 if it doesn't fit.
+ */
+uint16_t hmtl_msg_upgrade(const msg_hdr_t *msg_hdr, byte *buffer,
+                          uint16_t buffsize,
+                          socket_addr_t origin = SOCKET_ADDR_INVALID);
+
+/*
+ * Rewrite a current message in place with a version 2 header, dropping its
+ * origin, sequence and ttl, for a module that only understands those.
+ * Returns the downgraded message's length, or 0 if it isn't a version 3
+ * message.
+ */
+uint16_t hmtl_msg_downgrade(msg_hdr_t *msg_hdr);
 
 
 /*******************************************************************************
  * Formatting for individual messages
  */
-void hmtl_msg_fmt(msg_hdr_t *msg_hdr, socket_addr_t address, uint8_t length,
+
+/* Return the next sequence number for messages sent by this module */
+uint8_t hmtl_next_sequence();
+
+/* Messages longer than 255 bytes are given a version 4 header */
+void hmtl_msg_fmt(msg_hdr_t *msg_hdr, socket_addr_t address, uint16_t length,
                   uint8_t type, uint8_t flags = 0);
 
 uint16_t hmtl_value_fmt(byte *buffer, uint16_t buffsize,
@@ -185,16 +602,55 @@ uint16_t hmtl_value_fmt(byte *buffer, uint16_t buffsize,
 uint16_t hmtl_rgb_fmt(byte *buffer, uint16_t buffsize,
                       socket_addr_t address, uint8_t output,
                       uint8_t r, uint8_t g, uint8_t b);
+
+/*
+ * Format a poll response describing the outputs starting from first_output,
+ * setting MSG_FLAG_MORE_DATA if the remaining outputs didn't fit.  The
+ * msg_version is the highest header version the module accepts.
+ */
 uint16_t hmtl_poll_fmt(byte *buffer, uint16_t buffsize, socket_addr_t address,
                        byte flags, uint16_t object_type,
                        config_hdr_t *config, output_hdr_t *outputs[],
-                       uint16_t recv_buffer_size);
+                       uint8_t num_outputs, uint8_t first_output,
+                       uint16_t recv_buffer_size,
+                       uint8_t msg_version = HMTL_MSG_VERSION);
+uint16_t hmtl_poll_discover_fmt(byte *buffer, uint16_t buffsize,
+                                uint8_t nonce, uint8_t slots, uint8_t slot_ms,
+                                socket_addr_t known_base,
+                                const byte *known, uint8_t known_len,
+                                uint8_t flags = 0);
 uint16_t hmtl_set_addr_fmt(byte *buffer, uint16_t buffsize,
                            socket_addr_t address,
                            uint16_t device_id, socket_addr_t new_address);
+uint16_t hmtl_dumpconfig_request_fmt(byte *buffer, uint16_t buffsize,
+                                     socket_addr_t address,
+                                     uint16_t offset, uint8_t pages);
+/* The page's data must already be in place following the response header */
 uint16_t hmtl_dumpconfig_fmt(byte *buffer, uint16_t buffsize, uint16_t address,
-                             byte flags,
+                             byte flags, uint16_t offset, uint16_t next,
                              byte datalen);
+uint16_t hmtl_trace_request_fmt(byte *buffer, uint16_t buffsize,
+                                socket_addr_t address, uint16_t offset,
+                                uint8_t pages, uint8_t control);
+/* The page's data must already be in place following the response header */
+uint16_t hmtl_trace_fmt(byte *buffer, uint16_t buffsize, socket_addr_t address,
+                        byte flags, uint16_t offset, uint16_t length,
+                        byte datalen);
+uint16_t hmtl_groups_fmt(byte *buffer, uint16_t buffsize,
+                         config_groups_t *groups);
+uint16_t hmtl_delivered_fmt(byte *buffer, uint16_t buffsize,
+                            socket_addr_t address, const msg_hdr_t *msg_hdr);
+uint16_t hmtl_batch_fmt(byte *buffer, uint16_t buffsize,
+                        socket_addr_t address);
+uint16_t hmtl_batch_add(byte *buffer, uint16_t buffsize,
+                        output_hdr_t *output, uint8_t length);
+uint16_t hmtl_batch_finish(byte *buffer, uint8_t flags = 0);
+uint16_t hmtl_fragment_fmt(byte *buffer, uint16_t buffsize,
+                           socket_addr_t address, byte flags,
+                           socket_addr_t origin, uint8_t sequence,
+                           uint16_t length, uint16_t offset,
+                           const byte *data, uint16_t datalen);
+/* The sensor data must be followed by hmtl_msg_set_crc() once filled in */
 uint16_t hmtl_sensor_fmt(byte *buffer, uint16_t buffsize, socket_addr_t address,
                          uint8_t datalen, uint8_t **data_ptr);
 
@@ -214,9 +670,135 @@ void hmtl_send_poll_request(Socket *socket, byte *buff, byte buff_len,
 void hmtl_send_sensor_request(Socket *socket, byte *buff, byte buff_len,
                               socket_addr_t address);
 
+/*
+ * Send a message that is too large for the socket's send buffer as fragments
+ * formatted in that buffer, or split a fragment into smaller ones.  The
+ * fragments are sent from source with the message's ttl, or the default ttl
+ * for a version 4 message.  This is the only way to send a version 4 message.
+ *
+ * Returns the number of fragments sent.
+ */
+uint8_t hmtl_send_fragments(Socket *socket, const msg_hdr_t *msg_hdr,
+                            socket_addr_t source);
+
 /*******************************************************************************
  * Data processing helper functions
  */
 msg_sensor_data_t* hmtl_next_sensor(msg_hdr_t *msg, msg_sensor_data_t *current);
+msg_batch_record_t* hmtl_next_batch_record(msg_hdr_t *msg,
+                                           msg_batch_record_t *current);
+
+/*
+ * Returns the slot a module should respond to a discovery request in, or
+ * HMTL_DISCOVER_QUIET if it is in the known bitmap.
+ */
+#define HMTL_DISCOVER_QUIET 0xFF
+uint8_t hmtl_poll_discover_slot(msg_hdr_t *msg_hdr, socket_addr_t address,
+                                uint16_t device_id);
+
+/*******************************************************************************
+ * Typed construction and access of messages declared with HMTL_MSG_PAYLOAD()
+ *
+ * A message is built by getting its payload with hmtl_msg_build(), or
+ * hmtl_output_build() for output messages, filling it in, and then calling
+ * hmtl_msg_finish() to format the header, which returns the message length.
+ * Building returns NULL if the buffer is too small, so callers must check for
+ * it, and a fmt function returning 0 must not be sent:
+ *
+ *   msg_rgb_t *rgb = hmtl_output_build<msg_rgb_t>(buffer, buffsize, output);
+ *   if (rgb == NULL) return 0;
+ *   rgb->values[0] = ...
+ *   len = hmtl_msg_finish<msg_rgb_t>(buffer, address);
+ *
+ * Payloads ending in variable length data are built and finished with the
+ * length of that data.
+ *
+ * hmtl_msg_view() returns the payload of a received message, or NULL if the
+ * message isn't of the payload's type or is too short to hold it.
+ */
+
+/* Report a buffer too small for the message being built in it, not fatal */
+void hmtl_msg_build_error(uint16_t buffsize, uint16_t length);
+
+template <typename T>
+inline T *hmtl_msg_build(byte *buffer, uint16_t buffsize) {
+#ifdef HMTL_USE_SIZE_CHECKS
+  if (buffsize < (uint16_t)hmtl_msg_payload<T>::length) {
+    hmtl_msg_build_error(buffsize, hmtl_msg_payload<T>::length);
+    return NULL;
+  }
+#endif
+  return (T *)(buffer + sizeof (msg_hdr_t));
+}
+
+template <typename T>
+inline T *hmtl_msg_build(byte *buffer, uint16_t buffsize, uint16_t datalen) {
+  uint16_t length = hmtl_msg_payload<T>::length + datalen;
+  if (buffsize < length) {
+    hmtl_msg_build_error(buffsize, length);
+    return NULL;
+  }
+  return (T *)(buffer + sizeof (msg_hdr_t));
+}
+
+/* A buffer whose size is known is checked at compile time */
+template <typename T, size_t N>
+inline T *hmtl_msg_build(byte (&buffer)[N]) {
+  static_assert(N >= (size_t)hmtl_msg_payload<T>::length,
+                "buffer too small for message");
+  return (T *)(buffer + sizeof (msg_hdr_t));
+}
+
+template <typename T>
+inline T *hmtl_output_build(byte *buffer, uint16_t buffsize, uint8_t output) {
+  T *payload = hmtl_msg_build<T>(buffer, buffsize);
+  if (payload == NULL) {
+    return NULL;
+  }
+  payload->hdr.type = hmtl_msg_payload<T>::output;
+  payload->hdr.output = output;
+  return payload;
+}
+
+template <typename T, size_t N>
+inline T *hmtl_output_build(byte (&buffer)[N], uint8_t output) {
+  T *payload = hmtl_msg_build<T>(buffer);
+  payload->hdr.type = hmtl_msg_payload<T>::output;
+  payload->hdr.output = output;
+  return payload;
+}
+
+template <typename T>
+inline uint16_t hmtl_msg_finish(byte *buffer, socket_addr_t address,
+                                uint8_t flags = 0) {
+  hmtl_msg_fmt((msg_hdr_t *)buffer, address, hmtl_msg_payload<T>::length,
+               hmtl_msg_payload<T>::type, flags);
+  return hmtl_msg_payload<T>::length;
+}
+
+template <typename T>
+inline uint16_t hmtl_msg_finish(byte *buffer, socket_addr_t address,
+                                uint8_t flags, uint16_t datalen) {
+  uint16_t length = hmtl_msg_payload<T>::length + datalen;
+  hmtl_msg_fmt((msg_hdr_t *)buffer, address, length,
+               hmtl_msg_payload<T>::type, flags);
+  return length;
+}
+
+template <typename T>
+inline T *hmtl_msg_view(msg_hdr_t *msg_hdr) {
+  if ((msg_hdr->type != hmtl_msg_payload<T>::type) ||
+      (hmtl_msg_length(msg_hdr) < (uint16_t)hmtl_msg_payload<T>::length)) {
+    return NULL;
+  }
+
+  T *payload = (T *)(msg_hdr + 1);
+  if ((hmtl_msg_payload<T>::output != HMTL_OUTPUT_NONE) &&
+      (((output_hdr_t *)payload)->type !=
+       (uint8_t)hmtl_msg_payload<T>::output)) {
+    return NULL;
+  }
+  return payload;
+}
 
 #endif
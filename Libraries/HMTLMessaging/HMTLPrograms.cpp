@@ -34,29 +34,29 @@
  * Message formatting for program messages
  */
 
-void hmtl_program_fmt(msg_program_t *msg_program, uint8_t output,
-                      uint8_t program, uint16_t buffsize) {
-  DEBUG_COMMAND(DEBUG_ERROR,
-                if (buffsize < HMTL_MSG_PROGRAM_LEN) {
-                  DEBUG_ERR("hmtl_program_fmt: too small size");
-                  DEBUG_ERR_STATE(1);
-                }
-                );
-
-  msg_program->hdr.type = HMTL_OUTPUT_PROGRAM;
-  msg_program->hdr.output = output;
+/*
+ * Start a program message, which is completed with hmtl_msg_finish().
+ * Returns NULL if the buffer is too small.
+ */
+static msg_program_t *hmtl_program_build(byte *buffer, uint16_t buffsize,
+                                         uint8_t output, uint8_t program) {
+  msg_program_t *msg_program = hmtl_output_build<msg_program_t>(buffer,
+                                                                buffsize,
+                                                                output);
+  if (msg_program == NULL) {
+    return NULL;
+  }
   msg_program->type = program;
+  return msg_program;
 }
 
 /* Format a cancel message */
 uint16_t hmtl_program_cancel_fmt(byte *buffer, uint16_t buffsize,
                                  uint16_t address, uint8_t output) {
-  msg_hdr_t *msg_hdr = (msg_hdr_t *)buffer;
-  msg_program_t *msg_program = (msg_program_t *)(msg_hdr + 1);
-
-  hmtl_program_fmt(msg_program, output, HMTL_PROGRAM_NONE, buffsize);
-  hmtl_msg_fmt(msg_hdr, address, HMTL_MSG_PROGRAM_LEN, MSG_TYPE_OUTPUT);
-  return HMTL_MSG_PROGRAM_LEN;
+  if (hmtl_program_build(buffer, buffsize, output, HMTL_PROGRAM_NONE) == NULL) {
+    return 0;
+  }
+  return hmtl_msg_finish<msg_program_t>(buffer, address);
 }
 
 
@@ -67,10 +67,11 @@ uint16_t hmtl_program_blink_fmt(byte *buffer, uint16_t buffsize,
                                 uint32_t on_color,
                                 uint16_t off_period,
                                 uint32_t off_color) {
-  msg_hdr_t *msg_hdr = (msg_hdr_t *)buffer;
-  msg_program_t *msg_program = (msg_program_t *)(msg_hdr + 1);
-
-  hmtl_program_fmt(msg_program, output, HMTL_PROGRAM_BLINK, buffsize);
+  msg_program_t *msg_program = hmtl_program_build(buffer, buffsize, output,
+                                                 HMTL_PROGRAM_BLINK);
+  if (msg_program == NULL) {
+    return 0;
+  }
 
   hmtl_program_blink_t *blink = (hmtl_program_blink_t *)msg_program->values;
   blink->on_period = on_period;
@@ -82,8 +83,7 @@ uint16_t hmtl_program_blink_fmt(byte *buffer, uint16_t buffsize,
   blink->off_value[1] = pixel_green(off_color);
   blink->off_value[2] = pixel_blue(off_color);
 
-  hmtl_msg_fmt(msg_hdr, address, HMTL_MSG_PROGRAM_LEN, MSG_TYPE_OUTPUT);
-  return HMTL_MSG_PROGRAM_LEN;
+  return hmtl_msg_finish<msg_program_t>(buffer, address);
 }
 
 /* Format a timed change program message */
@@ -92,10 +92,11 @@ uint16_t hmtl_program_timed_change_fmt(byte *buffer, uint16_t buffsize,
                                        uint32_t change_period,
                                        uint32_t start_color,
                                        uint32_t stop_color) {
-  msg_hdr_t *msg_hdr = (msg_hdr_t *)buffer;
-  msg_program_t *msg_program = (msg_program_t *)(msg_hdr + 1);
-
-  hmtl_program_fmt(msg_program, output, HMTL_PROGRAM_TIMED_CHANGE, buffsize);
+  msg_program_t *msg_program = hmtl_program_build(buffer, buffsize, output,
+                                                 HMTL_PROGRAM_TIMED_CHANGE);
+  if (msg_program == NULL) {
+    return 0;
+  }
 
   hmtl_program_timed_change_t *program =
     (hmtl_program_timed_change_t *)msg_program->values;
@@ -107,8 +108,29 @@ uint16_t hmtl_program_timed_change_fmt(byte *buffer, uint16_t buffsize,
   program->stop_value[1] = pixel_green(stop_color);
   program->stop_value[2] = pixel_blue(stop_color);
 
-  hmtl_msg_fmt(msg_hdr, address, HMTL_MSG_PROGRAM_LEN, MSG_TYPE_OUTPUT);
-  return HMTL_MSG_PROGRAM_LEN;
+  return hmtl_msg_finish<msg_program_t>(buffer, address);
+}
+
+/* Format a fade program message */
+uint16_t hmtl_program_fade_fmt(byte *buffer, uint16_t buffsize,
+                               uint16_t address, uint8_t output,
+                               uint32_t period,
+                               uint32_t start_color,
+                               uint32_t stop_color,
+                               uint8_t flags) {
+  msg_program_t *msg_program = hmtl_program_build(buffer, buffsize, output,
+                                                 HMTL_PROGRAM_FADE);
+  if (msg_program == NULL) {
+    return 0;
+  }
+
+  hmtl_program_fade_t *program = (hmtl_program_fade_t *)msg_program->values;
+  program->period = period;
+  program->start_value = CRGB(start_color);
+  program->stop_value = CRGB(stop_color);
+  program->flags = flags;
+
+  return hmtl_msg_finish<msg_program_t>(buffer, address);
 }
 
 /* Format a sparkle program message */
@@ -125,16 +147,16 @@ uint16_t program_sparkle_fmt(byte *buffer, uint16_t buffsize,
                              uint8_t val_min = 0,
                              uint8_t val_max = 255){
 
-  msg_hdr_t *msg_hdr = (msg_hdr_t *)buffer;
-  msg_program_t *msg_program = (msg_program_t *)(msg_hdr + 1);
-
-  hmtl_program_fmt(msg_program, output, HMTL_PROGRAM_SPARKLE, buffsize);
+  msg_program_t *msg_program = hmtl_program_build(buffer, buffsize, output,
+                                                 HMTL_PROGRAM_SPARKLE);
+  if (msg_program == NULL) {
+    return 0;
+  }
 
+  /* If the other values are set then don't memset */
+  memset(msg_program->values, 0, MAX_PROGRAM_VAL);
   hmtl_program_sparkle_t *program =
           (hmtl_program_sparkle_t *)msg_program->values;
-
-  /* If the other values are set then don't memset */
-  memset(program, 0, MAX_PROGRAM_VAL);
   program->period = period;
   program->bgColor = bgColor;
   program->sparkle_threshold = sparkle_threshold;
@@ -146,40 +168,64 @@ uint16_t program_sparkle_fmt(byte *buffer, uint16_t buffsize,
   program->val_min = val_min;
   program->val_max = val_max;
 
-  hmtl_msg_fmt(msg_hdr, address, HMTL_MSG_PROGRAM_LEN, MSG_TYPE_OUTPUT);
-  return HMTL_MSG_PROGRAM_LEN;
+  return hmtl_msg_finish<msg_program_t>(buffer, address);
 }
 
+/* Format a message to set the color of a range of pixels */
+uint16_t program_color_fmt(byte *buffer, uint16_t buffsize,
+                           uint16_t address, uint8_t output,
+                           CRGB color, pixel_range_t range) {
+  msg_program_t *msg_program = hmtl_program_build(buffer, buffsize, output,
+                                                 PROGRAM_COLOR);
+  if (msg_program == NULL) {
+    return 0;
+  }
+
+  memset(msg_program->values, 0, MAX_PROGRAM_VAL);
+  hmtl_program_color_t *program = (hmtl_program_color_t *)msg_program->values;
+  program->color = color;
+  program->range = range;
+
+  return hmtl_msg_finish<msg_program_t>(buffer, address);
+}
 
 /* Format a circular program message */
 uint16_t program_circular_fmt(byte *buffer, uint16_t buffsize,
                               uint16_t address, uint8_t output,
                               uint16_t period, uint16_t length, CRGB bgColor,
                               uint8_t pattern, uint8_t flags) {
-  msg_hdr_t *msg_hdr = (msg_hdr_t *)buffer;
-  msg_program_t *msg_program = (msg_program_t *)(msg_hdr + 1);
-
-  hmtl_program_fmt(msg_program, output, HMTL_PROGRAM_CIRCULAR, buffsize);
+  msg_program_t *msg_program = hmtl_program_build(buffer, buffsize, output,
+                                                 HMTL_PROGRAM_CIRCULAR);
+  if (msg_program == NULL) {
+    return 0;
+  }
 
+  /* If the other values are set then don't memset */
+  memset(msg_program->values, 0, MAX_PROGRAM_VAL);
   hmtl_program_circular_t *program =
           (hmtl_program_circular_t *)msg_program->values;
-
-  /* If the other values are set then don't memset */
-  memset(program, 0, MAX_PROGRAM_VAL);
   program->period = period;
   program->length = length;
   program->bgColor = bgColor;
   program->pattern = pattern;
   program->flags = flags;
 
-  hmtl_msg_fmt(msg_hdr, address, HMTL_MSG_PROGRAM_LEN, MSG_TYPE_OUTPUT);
-  return HMTL_MSG_PROGRAM_LEN;
+  return hmtl_msg_finish<msg_program_t>(buffer, address);
 }
 
 /*******************************************************************************
  * Wrapper functions for sending HMTL program messages
  */
 
+/*
+ * Mark a formatted message as priority traffic, so that modules handle and
+ * forward it ahead of any queued bulk traffic.
+ */
+static void set_priority(byte *buff) {
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)buff;
+  msg_hdr->flags |= MSG_FLAG_PRIORITY;
+  hmtl_msg_set_crc(msg_hdr);
+}
 
 /* Send a message that clears any program for the output */
 void hmtl_send_cancel(Socket *socket, byte *buff, byte buff_len,
@@ -189,6 +235,10 @@ void hmtl_send_cancel(Socket *socket, byte *buff, byte buff_len,
 
   uint16_t len = hmtl_program_cancel_fmt(buff, buff_len,
                                          address, output);
+  if (len == 0) {
+    return;
+  }
+  set_priority(buff);
   socket->sendMsgTo(address, buff, len);
 }
 
@@ -206,6 +256,9 @@ void hmtl_send_blink(Socket *socket, byte *buff, byte buff_len,
                                         on_color,
                                         off_period,
                                         off_color);
+  if (len == 0) {
+    return;
+  }
   socket->sendMsgTo(address, buff, len);
 }
 
@@ -225,6 +278,10 @@ void hmtl_send_timed_change(Socket *socket, byte *buff, byte buff_len,
                                                change_period,
                                                start_color,
                                                stop_color);
+  if (len == 0) {
+    return;
+  }
+  set_priority(buff);
   socket->sendMsgTo(address, buff, len);
 }
 
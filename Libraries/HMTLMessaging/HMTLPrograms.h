@@ -80,6 +80,7 @@ uint16_t hmtl_program_timed_change_fmt(byte *buffer, uint16_t buffsize,
 				       uint32_t change_period,
 				       uint32_t start_color,
 				       uint32_t stop_color);
+/* Timed changes drive poofers and so are sent as priority traffic */
 void hmtl_send_timed_change(Socket *socket, byte *buff, byte buff_len,
 			    uint16_t address, uint8_t output,
 			    uint32_t change_period,
@@ -188,6 +189,9 @@ typedef struct {
   CRGB color;
   pixel_range_t range;
 } hmtl_program_color_t;
+uint16_t program_color_fmt(byte *buffer, uint16_t buffsize,
+                           uint16_t address, uint8_t output,
+                           CRGB color, pixel_range_t range);
 boolean program_color(msg_program_t *msg, program_tracker_t *tracker,
                       output_hdr_t *output, void *object,
                       ProgramManager *manager);
@@ -228,7 +232,8 @@ boolean program_circular(output_hdr_t *output, void *object,
 uint16_t hmtl_program_cancel_fmt(byte *buffer, uint16_t buffsize,
                                  uint16_t address, uint8_t output);
 
-// Send a request to cancel any program running on an output
+// Send a request to cancel any program running on an output, as priority
+// traffic
 void hmtl_send_cancel(Socket *socket, byte *buff, byte buff_len,
                       uint16_t address, uint8_t output);
 
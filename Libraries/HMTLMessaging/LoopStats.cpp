@@ -0,0 +1,120 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Timing of the phases of a module's main loop
+ ******************************************************************************/
+
+#include <Arduino.h>
+
+#ifndef DEBUG_LEVEL
+  #define DEBUG_LEVEL DEBUG_ERROR
+#endif
+#include "Debug.h"
+
+#include "HMTLMessaging.h"
+#include "LoopStats.h"
+
+LoopStats::LoopStats() {
+  reset();
+}
+
+void LoopStats::reset() {
+#ifdef USE_LOOP_STATS
+  memset(phases, 0, sizeof (phases));
+  loop_start = micros();
+  phase_start = loop_start;
+#endif
+}
+
+#ifdef USE_LOOP_STATS
+void LoopStats::begin() {
+  loop_start = micros();
+  phase_start = loop_start;
+}
+
+void LoopStats::mark(byte phase) {
+  unsigned long now = micros();
+  record(&phases[phase], now - phase_start);
+  phase_start = now;
+}
+
+void LoopStats::end() {
+  record(&phases[LOOP_PHASE_TOTAL], micros() - loop_start);
+}
+
+void LoopStats::backlog(uint16_t msgs) {
+  record(&phases[LOOP_PHASE_BACKLOG], msgs, LOOP_BACKLOG_BUCKET_SHIFT);
+}
+
+void LoopStats::record(loop_phase_stats_t *stats, unsigned long elapsed,
+                       byte shift) {
+  byte bucket = 0;
+  unsigned long limit = elapsed >> shift;
+  while (limit && (bucket < LOOP_STATS_BUCKETS - 1)) {
+    limit >>= 1;
+    bucket++;
+  }
+
+  /*
+   * Rather than overflowing halve the counts, which retains the average and
+   * the shape of the histogram.
+   */
+  if ((stats->total_us > 0xFFFFFFFF - elapsed) ||
+      (stats->buckets[bucket] == 0xFFFF)) {
+    stats->count >>= 1;
+    stats->total_us >>= 1;
+    for (byte i = 0; i < LOOP_STATS_BUCKETS; i++) {
+      stats->buckets[i] >>= 1;
+    }
+  }
+
+  uint16_t elapsed16 = (elapsed > 0xFFFF ? 0xFFFF : (uint16_t)elapsed);
+  if ((stats->count == 0) || (elapsed16 < stats->min_us)) {
+    stats->min_us = elapsed16;
+  }
+  if (elapsed16 > stats->max_us) {
+    stats->max_us = elapsed16;
+  }
+
+  stats->count++;
+  stats->total_us += elapsed;
+  stats->buckets[bucket]++;
+}
+#endif
+
+/*
+ * Format the response to a stats request for a single phase.  If statistics
+ * are not available the response has no phases and the error flag set.
+ */
+uint16_t hmtl_stats_fmt(byte *buffer, uint16_t buffsize,
+                        socket_addr_t address, byte flags,
+                        LoopStats *stats, byte phase) {
+  msg_stats_response_t *msg_stats =
+          hmtl_msg_build<msg_stats_response_t>(buffer, buffsize);
+  if (msg_stats == NULL) {
+    return 0;
+  }
+
+  memset(msg_stats, 0, sizeof (msg_stats_response_t));
+  msg_stats->phase = phase;
+  msg_stats->num_buckets = LOOP_STATS_BUCKETS;
+  msg_stats->bucket_shift = (phase == LOOP_PHASE_BACKLOG ?
+                             LOOP_BACKLOG_BUCKET_SHIFT :
+                             LOOP_STATS_BUCKET_SHIFT);
+
+#ifdef USE_LOOP_STATS
+  if ((stats != NULL) && (phase < LOOP_NUM_PHASES)) {
+    msg_stats->num_phases = LOOP_NUM_PHASES;
+    memcpy(&msg_stats->stats, &stats->phases[phase],
+           sizeof (loop_phase_stats_t));
+  } else
+#endif
+  {
+    flags |= MSG_FLAG_ERROR;
+  }
+
+  return hmtl_msg_finish<msg_stats_response_t>(buffer, address,
+                                               flags | MSG_FLAG_ACK);
+}
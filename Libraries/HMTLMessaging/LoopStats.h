@@ -0,0 +1,122 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Timing of the phases of a module's main loop.  Each phase records the
+ * number of executions, the min/max/total time in microseconds and a
+ * histogram, which can be retrieved remotely with a MSG_TYPE_STATS request.
+ *
+ * The backlog is recorded alongside the phases, with each check counting the
+ * number of messages it handled rather than its time.
+ ******************************************************************************/
+
+#ifndef HMTL_LOOP_STATS_H
+#define HMTL_LOOP_STATS_H
+
+#include "HMTLMessaging.h"
+
+/*
+ * Loop timing takes 176 bytes of RAM, so AVR modules only keep it if
+ * ENABLE_LOOP_STATS is defined and other modules unless DISABLE_LOOP_STATS is.
+ */
+//#define ENABLE_LOOP_STATS
+//#define DISABLE_LOOP_STATS
+#if defined(ENABLE_LOOP_STATS) || \
+    (!defined(__AVR__) && !defined(DISABLE_LOOP_STATS))
+#define USE_LOOP_STATS
+#endif
+
+/* Phases of HMTL_Module's loop() */
+#define LOOP_PHASE_CHECK      0 // MessageHandler::check()
+#define LOOP_PHASE_ADDITIONAL 1 // Sketch specific work
+#define LOOP_PHASE_PROGRAMS   2 // ProgramManager::run()
+#define LOOP_PHASE_OUTPUTS    3 // hmtl_update_output() on all outputs
+#define LOOP_PHASE_TOTAL      4 // The entire loop
+#define LOOP_PHASE_BACKLOG    5 // Messages handled per check(), not times
+#define LOOP_NUM_PHASES       6
+
+/*
+ * Histogram buckets are powers of two, the first counting loops shorter than
+ * 1 << LOOP_STATS_BUCKET_SHIFT us and the last counting all longer loops.
+ */
+#define LOOP_STATS_BUCKETS      8
+#define LOOP_STATS_BUCKET_SHIFT 8
+
+/* The backlog's buckets start with checks that handled no messages */
+#define LOOP_BACKLOG_BUCKET_SHIFT 0
+
+typedef struct {
+  uint32_t count;
+  uint32_t total_us;
+  uint16_t min_us; // Saturates at 65535
+  uint16_t max_us;
+  uint16_t buckets[LOOP_STATS_BUCKETS];
+} loop_phase_stats_t;
+
+class LoopStats {
+ public:
+  LoopStats();
+
+  void reset();
+
+#ifdef USE_LOOP_STATS
+  /* Mark the start of the loop */
+  void begin();
+
+  /* Record the time since the previous mark as the indicated phase */
+  void mark(byte phase);
+
+  /* Record the entire loop */
+  void end();
+
+  /* Record the number of messages handled by a single check */
+  void backlog(uint16_t msgs);
+
+  loop_phase_stats_t phases[LOOP_NUM_PHASES];
+#else
+  void begin() {}
+  void mark(byte phase) {}
+  void end() {}
+  void backlog(uint16_t msgs) {}
+#endif
+
+ private:
+#ifdef USE_LOOP_STATS
+  unsigned long loop_start;
+  unsigned long phase_start;
+
+  void record(loop_phase_stats_t *stats, unsigned long elapsed,
+              byte shift = LOOP_STATS_BUCKET_SHIFT);
+#endif
+};
+
+/*******************************************************************************
+ * Message format for MSG_TYPE_STATS
+ *
+ * A request may include a msg_stats_request_t, the module responds with one
+ * message per phase with MSG_FLAG_MORE_DATA set on all but the last.
+ */
+
+#define LOOP_STATS_RESET 0x1 // Clear the statistics once they've been sent
+
+typedef struct {
+  uint8_t flags;
+} msg_stats_request_t;
+HMTL_MSG_PAYLOAD(msg_stats_request_t, MSG_TYPE_STATS, HMTL_OUTPUT_NONE);
+
+typedef struct {
+  uint8_t phase;
+  uint8_t num_phases;
+  uint8_t num_buckets;
+  uint8_t bucket_shift;
+  loop_phase_stats_t stats;
+} msg_stats_response_t;
+#define HMTL_MSG_STATS_LEN (sizeof (msg_hdr_t) + sizeof (msg_stats_response_t))
+HMTL_MSG_PAYLOAD(msg_stats_response_t, MSG_TYPE_STATS, HMTL_OUTPUT_NONE);
+
+uint16_t hmtl_stats_fmt(byte *buffer, uint16_t buffsize,
+                        socket_addr_t address, byte flags,
+                        LoopStats *stats, byte phase);
+
+#endif
@@ -30,21 +30,80 @@
 #endif
 
 MessageHandler::MessageHandler() {
-  address = SOCKET_ADDR_INVALID;
+  init(SOCKET_ADDR_INVALID, NULL, NULL, 0);
 }
 
 MessageHandler::MessageHandler(socket_addr_t _address, ProgramManager *_manager,
                                Socket *_sockets[], uint8_t _num_sockets) {
+  init(_address, _manager, _sockets, _num_sockets);
+}
+
+void MessageHandler::init(socket_addr_t _address, ProgramManager *_manager,
+                          Socket *_sockets[], uint8_t _num_sockets) {
   address = _address;
   manager = _manager;
   sockets = _sockets;
   num_sockets = _num_sockets;
+  loop_stats = NULL;
+  pixel_frame = PixelFrame();
+  deferred_update = false;
+  check_budget_us = MSG_CHECK_BUDGET_US;
+  received = 0;
+  budget_overruns = 0;
+  hop_limited = 0;
+  memset(&serial_drops, 0, sizeof (serial_drops));
+  memset(socket_drops, 0, sizeof (socket_drops));
+  init_seen();
+  init_routes();
+  init_handlers();
+  groups = NULL;
+  groups_announced = false;
+  groups_announce_ms = 0;
+  memset(deferred, 0, sizeof (deferred));
+  memset(&dump, 0, sizeof (dump));
+  low_head = 0;
+  low_count = 0;
+  queue_order = 0;
+#ifdef USE_COALESCING
+  memset(state_queue, 0, sizeof (state_queue));
+  state_count = 0;
+#endif
+  low_queued = 0;
+  coalesced = 0;
+  fragmented = 0;
+  reassembled = 0;
+  reassembly_dropped = 0;
+#ifdef USE_REASSEMBLY
+  memset(&reassembly, 0, sizeof (reassembly));
+  reassembly.origin = SOCKET_ADDR_INVALID;
+#endif
+  retransmitted = 0;
+  undelivered = 0;
+  reliable_full = 0;
+#ifdef USE_RELIABLE
+  memset(reliable, 0, sizeof (reliable));
+#endif
+  untraced = 0;
+  init_trace();
 
   serial_msg_offset = 0;
   last_serial_ms = 0;
   last_ready_ms = 0;
 }
 
+void MessageHandler::set_loop_stats(LoopStats *stats) {
+  loop_stats = stats;
+}
+
+void MessageHandler::set_groups(config_groups_t *_groups) {
+  groups = _groups;
+  groups_announced = false;
+}
+
+void MessageHandler::set_check_budget(uint16_t budget_us) {
+  check_budget_us = budget_us;
+}
+
 /*
  * Check is a serial-ready messages should be sent over the serial port
  */
@@ -65,206 +124,781 @@ void MessageHandler::serial_ready() {
   }
 }
 
+/*
+ * Handlers for the built-in message types, in program memory and indexed by
+ * handler_index().  The sketch can add or replace handlers with
+ * register_handler().
+ */
+#define MSG_HANDLER_TYPES (MSG_TYPE_DELIVERED + 1)
+#define MSG_HANDLER_LOCAL_TYPES (MSG_TYPE_TRACE - MSG_TYPE_DONT_FORWARD + 1)
+
+const msg_handler_func MessageHandler::default_handlers[] PROGMEM = {
+  NULL,
+  MessageHandler::handle_output_msg,      // MSG_TYPE_OUTPUT
+  MessageHandler::handle_poll_msg,        // MSG_TYPE_POLL
+  MessageHandler::handle_set_addr_msg,    // MSG_TYPE_SET_ADDR
+  MessageHandler::handle_sensor_msg,      // MSG_TYPE_SENSOR
+  MessageHandler::handle_timesync_msg,    // MSG_TYPE_TIMESYNC
+  MessageHandler::handle_stats_msg,       // MSG_TYPE_STATS
+  MessageHandler::handle_batch_msg,       // MSG_TYPE_BATCH
+  MessageHandler::handle_pixel_frame_msg, // MSG_TYPE_PIXEL_FRAME
+  MessageHandler::handle_fragment_msg,    // MSG_TYPE_FRAGMENT
+  MessageHandler::handle_groups_msg,      // MSG_TYPE_GROUPS
+  MessageHandler::handle_delivered_msg,   // MSG_TYPE_DELIVERED
+  MessageHandler::handle_dump_config_msg, // MSG_TYPE_DUMP_CONFIG
+#ifdef USE_TRACE
+  MessageHandler::handle_trace_msg,       // MSG_TYPE_TRACE
+#else
+  NULL,
+#endif
+};
+void MessageHandler::init_handlers() {
+  static_assert(sizeof (default_handlers) ==
+                (MSG_HANDLER_TYPES + MSG_HANDLER_LOCAL_TYPES) *
+                sizeof (msg_handler_func),
+                "default_handlers must have an entry for each type");
+  num_overrides = 0;
+}
+
+/*
+ * Map a message type to its entry in the handler table, the regular types
+ * followed by those that are not forwarded.
+ */
+int8_t MessageHandler::handler_index(uint8_t type) {
+  if (type < MSG_HANDLER_TYPES) {
+    return type;
+  }
+  if ((type >= MSG_TYPE_DONT_FORWARD) &&
+      (type < MSG_TYPE_DONT_FORWARD + MSG_HANDLER_LOCAL_TYPES)) {
+    return MSG_HANDLER_TYPES + (type - MSG_TYPE_DONT_FORWARD);
+  }
+  return -1;
+}
+
+/* Return the registered handler for a type, or else the built-in one */
+msg_handler_func MessageHandler::lookup_handler(uint8_t type) {
+  for (uint8_t i = 0; i < num_overrides; i++) {
+    if (handler_overrides[i].type == type) {
+      return handler_overrides[i].function;
+    }
+  }
+
+  int8_t index = handler_index(type);
+  if (index < 0) {
+    return NULL;
+  }
+  return (msg_handler_func)pgm_read_ptr(&default_handlers[index]);
+}
+
+boolean MessageHandler::register_handler(uint8_t type,
+                                         msg_handler_func function) {
+  uint8_t i;
+  for (i = 0; i < num_overrides; i++) {
+    if (handler_overrides[i].type == type) {
+      break;
+    }
+  }
+  if (i == MSG_HANDLER_OVERRIDES) {
+    DEBUG1_VALUELN("No handler slot for type ", type);
+    return false;
+  }
+
+  handler_overrides[i].type = type;
+  handler_overrides[i].function = function;
+  if (i == num_overrides) {
+    num_overrides++;
+  }
+  return true;
+}
+
 /* Process a message if it is for this module */
 boolean MessageHandler::process_msg(msg_hdr_t *msg_hdr, Socket *src,
                                     Socket *serial_socket,
                                     config_hdr_t *config) {
-  if (msg_hdr->version != HMTL_MSG_VERSION) {
-    DEBUG_ERR("Invalid message version");
+  /* Test if the message is for this device or one of its groups */
+  if ((msg_hdr->address != address) &&
+      (msg_hdr->address != SOCKET_ADDR_ANY) &&
+      ((groups == NULL) || !hmtl_in_group(groups, msg_hdr->address))) {
     return false;
   }
 
-  /* Test if the message is for this device */
-  if ((msg_hdr->address == address) ||
-      (msg_hdr->address == SOCKET_ADDR_ANY)) {
+  if ((msg_hdr->flags & MSG_FLAG_RELIABLE) && (msg_hdr->address == address)) {
+    record_delivered(msg_hdr);
+    send_delivered(msg_hdr, src);
+  }
 
-    if ((msg_hdr->flags & MSG_FLAG_ACK) &&
-        (msg_hdr->address != SOCKET_ADDR_ANY)) {
-      /*
-       * This is an ack message that is not for us, resend it over serial in
-       * case that was the original source.
-       * TODO: Maybe this should check address as well, and serial needs to be
-       * assigned an address?
-       */
-      DEBUG4_PRINTLN("Forwarding ack to serial");
-      Serial.write((byte *)msg_hdr, msg_hdr->length);
+  if ((msg_hdr->flags & MSG_FLAG_ACK) &&
+      !HMTL_IS_MULTICAST(msg_hdr->address)) {
+    /*
+     * This is an ack message that is not for us, resend it over serial in
+     * case that was the original source.
+     * TODO: Maybe this should check address as well, and serial needs to be
+     * assigned an address?
+     */
+    DEBUG4_PRINTLN("Forwarding ack to serial");
+    Serial.write((byte *)msg_hdr, hmtl_msg_length(msg_hdr));
 
-      if (msg_hdr->type != MSG_TYPE_SENSOR) { // Sensor broadcasts are for everyone
-        return false;
-      }
+    if (msg_hdr->type != MSG_TYPE_SENSOR) { // Sensor broadcasts are for everyone
+      return false;
     }
+  }
 
-    switch (msg_hdr->type) {
+  msg_handler_func function = lookup_handler(msg_hdr->type);
+  if (function == NULL) {
+    DEBUG2_VALUELN("No handler for type ", msg_hdr->type);
+    return false;
+  }
 
-      case MSG_TYPE_OUTPUT: {
-        output_hdr_t *out_hdr = (output_hdr_t *)(msg_hdr + 1);
-        if (out_hdr->type == HMTL_OUTPUT_PROGRAM) {
-          manager->handle_msg((msg_program_t *)out_hdr);
-        } else {
-          hmtl_handle_output_msg(msg_hdr, manager->num_outputs,
-                                 manager->outputs, manager->objects);
-        }
+  return function(this, msg_hdr, src, serial_socket, config);
+}
 
-        return true;
-      }
+/*
+ * Return the socket a response should be sent over and the address to send
+ * it to, or the serial socket whose buffer is used for a response over the
+ * Serial device.
+ */
+static Socket *response_socket(msg_hdr_t *msg_hdr, Socket *src,
+                               Socket *serial_socket,
+                               uint16_t *source_address) {
+  if (src != NULL) {
+    // The response will be going over a socket, send it to the request's
+    // origin so that it is routed back across any modules that forwarded it
+    *source_address = msg_hdr->origin;
+    if (*source_address == SOCKET_ADDR_INVALID) {
+      *source_address = src->sourceFromData(msg_hdr);
+    }
+    return src;
+  }
+
+  // The data will be sent back to the indicated Serial device.  A socket
+  // still needs to be specified in order to have a buffer to fill.
+  *source_address = 0;
+  return serial_socket;
+}
 
-      case MSG_TYPE_POLL: {
-        // Generate a response to a poll message
-        uint16_t source_address = 0;
-        Socket *sock;
+/*
+ * Socket whose buffer is used for responses to the Serial device, or NULL if
+ * the module has no sockets.
+ */
+Socket *MessageHandler::serial_buffer_socket() {
+  return (num_sockets > 0 ? sockets[0] : NULL);
+}
 
-        if (src != NULL) {
-          // The response will be going over a socket, get the source address
-          source_address = src->sourceFromData(msg_hdr);
-          sock = src;
-        } else {
-          // The data will be sent back to the indicated Serial device.  A
-          // socket still needs to be specified in order to have a buffer to
-          // fill.
-          sock = serial_socket;
-        }
+/* Acknowledge a reliable message to its origin */
+void MessageHandler::send_delivered(msg_hdr_t *msg_hdr, Socket *src) {
+  uint16_t source_address;
+  Socket *sock = response_socket(msg_hdr, src, serial_buffer_socket(),
+                                 &source_address);
+  if (sock == NULL) {
+    return;
+  }
 
-        DEBUG3_VALUELN("Poll req src:", source_address);
+  uint16_t len = hmtl_delivered_fmt(sock->send_buffer, sock->send_data_size,
+                                    source_address, msg_hdr);
+  if (len == 0) {
+    return;
+  }
+  msg_hdr_t *ack_hdr = (msg_hdr_t *)sock->send_buffer;
+  ack_hdr->origin = address;
+  hmtl_msg_set_crc(ack_hdr);
+
+  DEBUG4_VALUELN("Delivered ack for ", msg_hdr->sequence);
+  if (src != NULL) {
+    send_to(src, source_address, sock->send_buffer, len);
+  } else {
+    Serial.write(sock->send_buffer, len);
+  }
+}
+
+boolean MessageHandler::handle_output_msg(MessageHandler *handler,
+                                          msg_hdr_t *msg_hdr, Socket *src,
+                                          Socket *serial_socket,
+                                          config_hdr_t *config) {
+  handler->handle_output((output_hdr_t *)(msg_hdr + 1));
+  return true;
+}
+
+boolean MessageHandler::handle_batch_msg(MessageHandler *handler,
+                                         msg_hdr_t *msg_hdr, Socket *src,
+                                         Socket *serial_socket,
+                                         config_hdr_t *config) {
+  /* Apply each of the batch's output messages in place */
+  boolean update = false;
+  msg_batch_record_t *record = NULL;
+  while ((record = hmtl_next_batch_record(msg_hdr, record))) {
+    handler->handle_output(&record->hdr);
+    update = true;
+  }
+  return update;
+}
+
+boolean MessageHandler::handle_pixel_frame_msg(MessageHandler *handler,
+                                               msg_hdr_t *msg_hdr, Socket *src,
+                                               Socket *serial_socket,
+                                               config_hdr_t *config) {
+  /* Only a completed frame requires the outputs to be updated */
+  ProgramManager *manager = handler->manager;
+  return handler->pixel_frame.handle_msg(msg_hdr, manager->num_outputs,
+                                         manager->outputs, manager->objects);
+}
+
+boolean MessageHandler::handle_poll_msg(MessageHandler *handler,
+                                        msg_hdr_t *msg_hdr, Socket *src,
+                                        Socket *serial_socket,
+                                        config_hdr_t *config) {
+  // Generate a response to a poll message
+  uint16_t source_address;
+  Socket *sock = response_socket(msg_hdr, src, serial_socket, &source_address);
+
+  DEBUG3_VALUELN("Poll req src:", source_address);
+
+  unsigned long delay_ms = (unsigned long)handler->address *
+                           MSG_RESPONSE_SLOT_MS;
+  uint8_t request_flags = 0;
+  msg_poll_discover_t *discover = hmtl_msg_view<msg_poll_discover_t>(msg_hdr);
+  if ((msg_hdr->address == SOCKET_ADDR_ANY) && (discover != NULL)) {
+    // Discovery request, respond in the request's slot for us unless known
+    uint8_t slot = hmtl_poll_discover_slot(msg_hdr, handler->address,
+                                           config->device_id);
+    if (slot == HMTL_DISCOVER_QUIET) {
+      return false;
+    }
+    delay_ms = (unsigned long)slot * discover->slot_ms;
+    request_flags = discover->flags & HMTL_DISCOVER_BRIEF;
+  }
+
+  if ((src != NULL) && HMTL_IS_MULTICAST(msg_hdr->address)) {
+    // If this was a broadcast address then do not respond immediately,
+    // send once this module's response slot comes.
+    if (!handler->defer_response(MSG_TYPE_POLL, src, source_address,
+                                 msg_hdr->flags, request_flags, delay_ms)) {
+      // Respond immediately rather than not at all
+      handler->send_response(MSG_TYPE_POLL, src, sock, source_address,
+                             msg_hdr->flags, request_flags, config);
+    }
+  } else {
+    handler->send_response(MSG_TYPE_POLL, src, sock, source_address,
+                           msg_hdr->flags, request_flags, config);
+  }
+
+  return false;
+}
+
+boolean MessageHandler::handle_stats_msg(MessageHandler *handler,
+                                         msg_hdr_t *msg_hdr, Socket *src,
+                                         Socket *serial_socket,
+                                         config_hdr_t *config) {
+  /*
+   * Respond with the loop timing statistics.  As with a poll the response
+   * goes to the requesting socket or the Serial device, and responses to a
+   * broadcast are deferred.
+   */
+  uint16_t source_address;
+  Socket *sock = response_socket(msg_hdr, src, serial_socket, &source_address);
+
+  DEBUG3_VALUELN("Stats req src:", source_address);
+
+  uint8_t request_flags = 0;
+  msg_stats_request_t *request = hmtl_msg_view<msg_stats_request_t>(msg_hdr);
+  if (request != NULL) {
+    request_flags = request->flags;
+  }
+
+  if ((src != NULL) && HMTL_IS_MULTICAST(msg_hdr->address)) {
+    if (!handler->defer_response(MSG_TYPE_STATS, src, source_address,
+                                 msg_hdr->flags, request_flags,
+                                 (unsigned long)handler->address *
+                                 MSG_RESPONSE_SLOT_MS)) {
+      handler->send_response(MSG_TYPE_STATS, src, sock, source_address,
+                             msg_hdr->flags, request_flags, config);
+    }
+  } else {
+    handler->send_response(MSG_TYPE_STATS, src, sock, source_address,
+                           msg_hdr->flags, request_flags, config);
+  }
 
-        // Format the poll response
+  return false;
+}
+
+/*
+ * Send the response to a poll or stats request
+ *   src: Socket to respond over, or NULL to respond over the Serial device
+ *   sock: Socket whose buffer the response is constructed in
+ */
+void MessageHandler::send_response(uint8_t type, Socket *src, Socket *sock,
+                                   socket_addr_t dest, uint8_t flags,
+                                   uint8_t request_flags,
+                                   config_hdr_t *config) {
+  if (sock == NULL) {
+    // No buffer to respond to the Serial device with
+    return;
+  }
+
+  switch (type) {
+    case MSG_TYPE_POLL: {
+      // Format the poll response, split if the outputs don't all fit.  A
+      // brief discovery response describes none of them.
+      uint8_t num_outputs = (request_flags & HMTL_DISCOVER_BRIEF ?
+                             0 : manager->num_outputs);
+      uint8_t first = 0;
+      do {
         uint16_t len = hmtl_poll_fmt(sock->send_buffer,
                                      sock->send_data_size,
-                                     source_address,
-                                     msg_hdr->flags, OBJECT_TYPE,
+                                     dest,
+                                     flags, OBJECT_TYPE,
                                      config,
                                      manager->outputs,
-                                     sock->recvLimit);
+                                     num_outputs,
+                                     first,
+                                     sock->recvLimit,
+                                     MSG_ACCEPTED_VERSION);
+        if (len == 0) {
+          break;
+        }
 
         // Respond to the appropriate source
         if (src != NULL) {
-          if (msg_hdr->address == SOCKET_ADDR_ANY) {
-            // If this was a broadcast address then do not respond immediately,
-            // delay for time based on our address.
-            int delayMs = address * 2;
-            DEBUG3_VALUELN("Delay resp: ", delayMs)
-            delay(delayMs); // TODO: This blocks any running program?  Use a timer
-          }
-
-          src->sendMsgTo(source_address, sock->send_buffer, len);
+          send_to(src, dest, sock->send_buffer, len);
         } else {
           // Send the response on the serial device
           Serial.write(sock->send_buffer, len);
         }
 
-        break;
-      }
+        first += ((msg_poll_outputs_t *)
+                  ((msg_poll_response_t *)(sock->send_buffer +
+                                           sizeof (msg_hdr_t)))->data)->count;
+      } while (((msg_hdr_t *)sock->send_buffer)->flags & MSG_FLAG_MORE_DATA);
+      break;
+    }
 
-      case MSG_TYPE_SET_ADDR: {
-        /* Handle an address change message */
-        msg_set_addr_t *set_addr = (msg_set_addr_t *)(msg_hdr + 1);
-        if ((set_addr->device_id == 0) ||
-            (set_addr->device_id == config->device_id)) {
-          address = set_addr->address;
-          src->sourceAddress = address;
-          DEBUG2_VALUELN("Address changed to ", address);
+    case MSG_TYPE_STATS: {
+      // One message per phase
+      byte num_phases = (loop_stats != NULL ? LOOP_NUM_PHASES : 1);
+      for (byte phase = 0; phase < num_phases; phase++) {
+        byte phase_flags = flags & ~MSG_FLAG_MORE_DATA;
+        if (phase < num_phases - 1) {
+          phase_flags |= MSG_FLAG_MORE_DATA;
         }
-        break;
-      }
 
-      case MSG_TYPE_SENSOR: {
-        if (msg_hdr->flags & MSG_FLAG_ACK) {
-          /*
-           * This is a sensor response, record relevant values for usage
-           * elsewhere.
-           */
-          msg_sensor_data_t *sensor = NULL;
-          while ((sensor = hmtl_next_sensor(msg_hdr, sensor))) {
-            // Call the ProgramManager's handler for the sensor function
-            manager->run_program(PROGRAM_SENSOR_DATA, sensor);
-          }
-          DEBUG_PRINT_END();
+        uint16_t len = hmtl_stats_fmt(sock->send_buffer,
+                                      sock->send_data_size,
+                                      dest, phase_flags,
+                                      loop_stats, phase);
+        if (len == 0) {
+          break;
+        }
+        if (src != NULL) {
+          send_to(src, dest, sock->send_buffer, len);
+        } else {
+          Serial.write(sock->send_buffer, len);
         }
-        break;
       }
 
-      case MSG_TYPE_TIMESYNC: {
-        /*
-         * This is a time synchronization message, send to the ProgramManager's
-         * TimeSync object.
-         */
-        timesync.synchronize(src, SOCKET_ADDR_INVALID, msg_hdr);
-        break;
+      if ((loop_stats != NULL) && (request_flags & LOOP_STATS_RESET)) {
+        loop_stats->reset();
       }
+      break;
+    }
+  }
+}
 
-      case MSG_TYPE_DUMP_CONFIG: {
-        /*
-         * This is a request to dump the EEPROM objects to the serial device.
-         *
-         * TODO: This could be made to work remotely rather than only to requests
-         * from the serial device.
-         */
-        uint16_t source_address = 0;
-
-        DEBUG3_VALUELN("Dump req src:", source_address);
-
-        /*
-         * The response will be a typical message header followed by the raw data
-         * from EEPROM.
-         */
-        msg_dumpconfig_response_t *resp = (msg_dumpconfig_response_t *)(serial_socket->send_buffer + sizeof (msg_hdr_t));
-
-        int location = HMTL_CONFIG_ADDR; // Starting location in EEPROM
-        int next_addr = 0;
-        uint8_t flags;
-
-        do {
-          uint16_t len;
-          flags = msg_hdr->flags;
-
-          next_addr = EEPROM_safe_read(location, resp->data,
-                                       serial_socket->send_data_size -
-                                           HMTL_MSG_DUMPCONFIG_MIN_LEN);
-          if (next_addr > 0) {
-            uint16_t datalen = (uint16_t)EEPROM_DATA_SIZE(next_addr - location);
-
-            DEBUG4_VALUELN("Dump config:", location);
-
-            /*
-             * Check if the next address is a valid structure and if so indicate
-             * that there will be additional messages.
-             */
-            if (EEPROM_check_address(next_addr)) {
-              flags |= MSG_FLAG_MORE_DATA;
-            } else {
-              DEBUG4_PRINTLN("Dump final message")
-            }
-
-            // Now that the length of the data is known construct the message
-            len = hmtl_dumpconfig_fmt(serial_socket->send_buffer,
-                                      serial_socket->send_data_size,
-                                      source_address,
-                                      flags,
-                                      datalen);
-
-            location = next_addr;
-          } else {
-            /*
-             * There was an error, respond with an error flag
-             */
-            flags |= MSG_FLAG_ERROR;
-
-            len = hmtl_dumpconfig_fmt(serial_socket->send_buffer,
-                                      serial_socket->send_data_size,
-                                      source_address,
-                                      flags,
-                                      0);
-          }
+/*
+ * Queue a response to a broadcast request to be sent after delay_ms, the
+ * start of this module's response slot, so that modules don't all respond at
+ * once.  A repeated request replaces one still waiting.
+ *
+ * Returns false if the queue is full.
+ */
+boolean MessageHandler::defer_response(uint8_t type, Socket *socket,
+                                       socket_addr_t dest, uint8_t flags,
+                                       uint8_t request_flags,
+                                       unsigned long delay_ms) {
+  msg_deferred_t *entry = NULL;
+  for (uint8_t i = 0; i < MSG_DEFERRED_ENTRIES; i++) {
+    if ((deferred[i].socket == socket) && (deferred[i].type == type)) {
+      entry = &deferred[i];
+      break;
+    }
+    if ((deferred[i].socket == NULL) && (entry == NULL)) {
+      entry = &deferred[i];
+    }
+  }
+
+  if (entry == NULL) {
+    DEBUG1_VALUELN("Deferred queue full: ", type);
+    return false;
+  }
 
-          Serial.write(serial_socket->send_buffer, len);
+  DEBUG3_VALUELN("Delay resp: ", delay_ms);
 
-        } while (flags & MSG_FLAG_MORE_DATA);
+  entry->socket = socket;
+  entry->dest = dest;
+  entry->send_ms = millis() + delay_ms;
+  entry->type = type;
+  entry->flags = flags;
+  entry->request_flags = request_flags;
+  return true;
+}
 
-        break;
+/* Send any deferred responses whose time has come */
+void MessageHandler::send_deferred(config_hdr_t *config) {
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < MSG_DEFERRED_ENTRIES; i++) {
+    msg_deferred_t *entry = &deferred[i];
+    if ((entry->socket != NULL) && ((long)(now - entry->send_ms) >= 0)) {
+      Socket *socket = entry->socket;
+      entry->socket = NULL;
+      send_response(entry->type, socket, socket, entry->dest,
+                    entry->flags, entry->request_flags, config);
+    }
+  }
+}
+
+boolean MessageHandler::handle_set_addr_msg(MessageHandler *handler,
+                                            msg_hdr_t *msg_hdr, Socket *src,
+                                            Socket *serial_socket,
+                                            config_hdr_t *config) {
+  /* Handle an address change message */
+  msg_set_addr_t *set_addr = hmtl_msg_view<msg_set_addr_t>(msg_hdr);
+  if (set_addr == NULL) {
+    DEBUG1_VALUELN("Set address msg too short:", msg_hdr->length);
+    return false;
+  }
+
+  if ((set_addr->device_id == 0) ||
+      (set_addr->device_id == config->device_id)) {
+    handler->address = set_addr->address;
+    src->sourceAddress = handler->address;
+    DEBUG2_VALUELN("Address changed to ", handler->address);
+  }
+  return false;
+}
+
+boolean MessageHandler::handle_sensor_msg(MessageHandler *handler,
+                                          msg_hdr_t *msg_hdr, Socket *src,
+                                          Socket *serial_socket,
+                                          config_hdr_t *config) {
+  if (msg_hdr->flags & MSG_FLAG_ACK) {
+    /*
+     * This is a sensor response, record relevant values for usage
+     * elsewhere.
+     */
+    msg_sensor_data_t *sensor = NULL;
+    while ((sensor = hmtl_next_sensor(msg_hdr, sensor))) {
+      // Call the ProgramManager's handler for the sensor function
+      handler->manager->run_program(PROGRAM_SENSOR_DATA, sensor);
+    }
+    DEBUG_PRINT_END();
+  }
+  return false;
+}
+
+boolean MessageHandler::handle_timesync_msg(MessageHandler *handler,
+                                            msg_hdr_t *msg_hdr, Socket *src,
+                                            Socket *serial_socket,
+                                            config_hdr_t *config) {
+  /*
+   * This is a time synchronization message, send to the ProgramManager's
+   * TimeSync object.
+   */
+#ifdef HMTL_USE_V2_COMPAT
+  if ((byte *)msg_hdr == handler->upgrade_msg) {
+    // An upgraded copy isn't in the socket's data, its origin is the sender
+    timesync.synchronize(src, msg_hdr->origin, msg_hdr, HMTL_MSG_VERSION_2);
+    return false;
+  }
+#endif
+  timesync.synchronize(src, SOCKET_ADDR_INVALID, msg_hdr);
+  return false;
+}
+
+boolean MessageHandler::handle_dump_config_msg(MessageHandler *handler,
+                                               msg_hdr_t *msg_hdr, Socket *src,
+                                               Socket *serial_socket,
+                                               config_hdr_t *config) {
+  /*
+   * This is a request to dump the EEPROM objects to the requester.  Rather
+   * than blocking until the whole configuration is sent, a page is sent by
+   * each following check().  A new request replaces any dump in progress.
+   */
+  msg_dump_t *dump = &handler->dump;
+  dump->src = src;
+  dump->sock = response_socket(msg_hdr, src, serial_socket, &dump->dest);
+  dump->offset = HMTL_CONFIG_ADDR;
+  dump->pages = 0;
+  dump->flags = msg_hdr->flags;
+
+  msg_dumpconfig_request_t *request =
+          hmtl_msg_view<msg_dumpconfig_request_t>(msg_hdr);
+  if (request != NULL) {
+    if (request->offset != 0) {
+      dump->offset = request->offset;
+    }
+    dump->pages = request->pages;
+  }
+
+  DEBUG3_VALUE("Dump req src:", dump->dest);
+  DEBUG3_VALUELN(" offset:", dump->offset);
+
+  return false;
+}
+
+/* Send the next page of a configuration dump in progress */
+void MessageHandler::send_dump_page() {
+  if (dump.sock == NULL) {
+    return;
+  }
+
+  /*
+   * The response will be a typical message header followed by the page's
+   * offsets and then the raw data from EEPROM.
+   */
+  Socket *sock = dump.sock;
+  msg_dumpconfig_response_t *resp =
+          (msg_dumpconfig_response_t *)(sock->send_buffer + sizeof (msg_hdr_t));
+
+  uint8_t flags = dump.flags & ~MSG_FLAG_MORE_DATA;
+  uint16_t datalen = 0;
+  uint16_t next = 0;
+
+  int next_addr = EEPROM_safe_read(dump.offset, resp->data,
+                                   sock->send_data_size -
+                                       HMTL_MSG_DUMPCONFIG_MIN_LEN);
+  if (next_addr > 0) {
+    datalen = (uint16_t)EEPROM_DATA_SIZE(next_addr - dump.offset);
+
+    DEBUG4_VALUELN("Dump config:", dump.offset);
+
+    /*
+     * Check if the next address is a valid structure and if so indicate
+     * that there will be additional messages.
+     */
+    if (EEPROM_check_address(next_addr)) {
+      next = next_addr;
+      if (dump.pages != 1) {
+        flags |= MSG_FLAG_MORE_DATA;
       }
+    } else {
+      DEBUG4_PRINTLN("Dump final message");
+    }
+  } else {
+    /*
+     * There was an error, respond with an error flag
+     */
+    flags |= MSG_FLAG_ERROR;
+  }
+
+  // Now that the length of the data is known construct the message
+  uint16_t len = hmtl_dumpconfig_fmt(sock->send_buffer, sock->send_data_size,
+                                     dump.dest, flags, dump.offset, next,
+                                     datalen);
+  if (len == 0) {
+    dump.sock = NULL;
+    return;
+  }
+  if (dump.src != NULL) {
+    send_to(dump.src, dump.dest, sock->send_buffer, len);
+  } else {
+    Serial.write(sock->send_buffer, len);
+  }
+
+  if (flags & MSG_FLAG_MORE_DATA) {
+    dump.offset = next;
+    if (dump.pages != 0) {
+      dump.pages--;
+    }
+  } else {
+    dump.sock = NULL;
+  }
+}
+
+boolean MessageHandler::handle_fragment_msg(MessageHandler *handler,
+                                            msg_hdr_t *msg_hdr, Socket *src,
+                                            Socket *serial_socket,
+                                            config_hdr_t *config) {
+  return handler->reassemble(msg_hdr, src, serial_socket, config);
+}
+
+/* Learn the sockets that lead to the members of the announced groups */
+boolean MessageHandler::handle_groups_msg(MessageHandler *handler,
+                                          msg_hdr_t *msg_hdr, Socket *src,
+                                          Socket *serial_socket,
+                                          config_hdr_t *config) {
+  msg_groups_t *msg_groups = hmtl_msg_view<msg_groups_t>(msg_hdr);
+  if ((src == NULL) || (msg_groups == NULL)) {
+    return false;
+  }
+
+  if (HMTL_MSG_GROUPS_MIN_LEN + msg_groups->count * sizeof (socket_addr_t) >
+      msg_hdr->length) {
+    DEBUG1_VALUELN("Groups msg too short:", msg_hdr->length);
+    return false;
+  }
+
+  for (uint8_t i = 0; i < msg_groups->count; i++) {
+    handler->learn_group(msg_groups->groups[i], src);
+  }
+  return false;
+}
+
+/* Remove an acknowledged message from the reliable window */
+boolean MessageHandler::handle_delivered_msg(MessageHandler *handler,
+                                             msg_hdr_t *msg_hdr, Socket *src,
+                                             Socket *serial_socket,
+                                             config_hdr_t *config) {
+  msg_delivered_t *delivered = hmtl_msg_view<msg_delivered_t>(msg_hdr);
+  if (delivered == NULL) {
+    return false;
+  }
+
+#ifdef USE_RELIABLE
+  for (uint8_t i = 0; i < MSG_RELIABLE_ENTRIES; i++) {
+    msg_hdr_t *sent = (msg_hdr_t *)handler->reliable[i].msg;
+    if (handler->reliable[i].used &&
+        (sent->address == msg_hdr->origin) &&
+        (sent->sequence == delivered->sequence)) {
+      DEBUG4_VALUELN("Delivered ", delivered->sequence);
+      handler->reliable[i].used = false;
+      break;
+    }
+  }
+#endif
+
+  return false;
+}
+
+/*
+ * Start dumping the message trace to the requester, stopping recording until
+ * the dump is complete.  A new request replaces any dump in progress.
+ */
+boolean MessageHandler::handle_trace_msg(MessageHandler *handler,
+                                         msg_hdr_t *msg_hdr, Socket *src,
+                                         Socket *serial_socket,
+                                         config_hdr_t *config) {
+#ifdef USE_TRACE
+  /* Pages of another module's trace are the same size as a request */
+  msg_trace_request_t *request = hmtl_msg_view<msg_trace_request_t>(msg_hdr);
+  if ((request == NULL) || (msg_hdr->flags & MSG_FLAG_ACK)) {
+    return false;
+  }
+
+  msg_trace_dump_t *dump = &handler->trace_dump;
+  dump->src = src;
+  dump->sock = response_socket(msg_hdr, src, serial_socket, &dump->dest);
+  dump->offset = request->offset;
+  dump->pages = request->pages;
+  dump->flags = msg_hdr->flags;
+  dump->control = request->control;
+  handler->trace_stopped = (dump->sock != NULL);
+
+  DEBUG3_VALUE("Trace req src:", dump->dest);
+  DEBUG3_VALUELN(" offset:", dump->offset);
+#endif
+
+  return false;
+}
+
+/*
+ * Add a fragment to the message being reassembled, and once it is complete
+ * process the message as if it had been received whole.
+ */
+boolean MessageHandler::reassemble(msg_hdr_t *msg_hdr, Socket *src,
+                                   Socket *serial_socket,
+                                   config_hdr_t *config) {
+#ifdef USE_REASSEMBLY
+  msg_fragment_t *fragment = hmtl_msg_view<msg_fragment_t>(msg_hdr);
+  if (fragment == NULL) {
+    DEBUG1_VALUELN("Fragment too short:", msg_hdr->length);
+    return false;
+  }
+
+  uint16_t datalen = msg_hdr->length - HMTL_MSG_FRAGMENT_MIN_LEN;
+  boolean current = (fragment->origin == reassembly.origin) &&
+                    (fragment->sequence == reassembly.sequence) &&
+                    (fragment->length == reassembly.length);
+
+  if (fragment->offset == 0) {
+    if (current) {
+      // A copy of the first fragment that arrived over another path
+      return false;
+    }
+
+    if (reassembly.next < reassembly.length) {
+      DEBUG1_VALUELN("Incomplete fragmented msg from ", reassembly.origin);
+      reassembly_dropped++;
+    }
+
+    reassembly.origin = fragment->origin;
+    reassembly.sequence = fragment->sequence;
+    reassembly.length = fragment->length;
+    reassembly.next = 0;
+
+    if ((fragment->length > MSG_REASSEMBLY_LEN) ||
+        (fragment->length < sizeof (msg_hdr_t))) {
+      DEBUG1_VALUELN("Fragmented msg too long:", fragment->length);
+      reassembly_dropped++;
+      reassembly.next = reassembly.length; // Ignore the rest of it
+      return false;
     }
+  } else if (!current || (fragment->offset < reassembly.next) ||
+             (reassembly.next == reassembly.length)) {
+    // Not being reassembled, or a copy of a fragment already received
+    return false;
+  }
+
+  if ((fragment->offset != reassembly.next) ||
+      (fragment->offset + datalen > reassembly.length)) {
+    DEBUG1_VALUELN("Missed fragment at ", reassembly.next);
+    reassembly_dropped++;
+    reassembly.next = reassembly.length;
+    return false;
+  }
+
+  memcpy(&reassembly.msg[reassembly.next], fragment->data, datalen);
+  reassembly.next += datalen;
+  if (reassembly.next < reassembly.length) {
+    return false;
   }
 
+  msg_hdr_t *whole = (msg_hdr_t *)reassembly.msg;
+  if (((whole->version != HMTL_MSG_VERSION) &&
+       (whole->version != HMTL_MSG_VERSION_LONG)) ||
+      (hmtl_msg_length(whole) != reassembly.length) ||
+      (whole->type == MSG_TYPE_FRAGMENT)) {
+    DEBUG1_VALUELN("Invalid fragmented msg from ", reassembly.origin);
+    reassembly_dropped++;
+    return false;
+  }
+#ifdef HMTL_USE_CRC
+  if (whole->crc != hmtl_msg_crc(whole)) {
+    DEBUG1_HEXVALLN("Fragmented msg bad crc ", whole->crc);
+    reassembly_dropped++;
+    return false;
+  }
+#endif
+
+  if (whole->origin == SOCKET_ADDR_INVALID) {
+    // From a serial device, which entered the network with the fragments
+    whole->origin = msg_hdr->origin;
+    hmtl_msg_set_crc(whole);
+  }
+
+  DEBUG4_VALUELN("Reassembled msg len=", reassembly.length);
+  reassembled++;
+  return process_msg(whole, src, serial_socket, config);
+#else
   return false;
+#endif
+}
+
+/* Apply a single output message to the outputs or the program manager */
+void MessageHandler::handle_output(output_hdr_t *out_hdr) {
+  if (out_hdr->type == HMTL_OUTPUT_PROGRAM) {
+    manager->handle_msg((msg_program_t *)out_hdr);
+  } else {
+    hmtl_handle_output(out_hdr, manager->num_outputs,
+                       manager->outputs, manager->objects);
+  }
 }
 
 /*
@@ -280,7 +914,8 @@ boolean MessageHandler::check_serial(config_hdr_t *config) {
 
   /* Check for messages on the serial interface */
   msg_hdr_t *msg_hdr = (msg_hdr_t *)serial_msg;
-  if (hmtl_serial_getmsg(serial_msg, MSG_MAX_SZ, &serial_msg_offset)) {
+  if (hmtl_serial_getmsg(serial_msg, MSG_MAX_SZ, &serial_msg_offset,
+                         &serial_drops)) {
     /* Received a complete message */
     DEBUG5_VALUE("Received msg len=", serial_msg_offset);
     DEBUG5_PRINT(" ");
@@ -289,17 +924,24 @@ boolean MessageHandler::check_serial(config_hdr_t *config) {
     );
     DEBUG_PRINT_END();
     Serial.println(F(HMTL_ACK));
+    received++;
+    trace(msg_hdr, NULL, SOCKET_ADDR_INVALID);
 
-    /* Check if the message should be forwarded to any sockets */
-    for (uint8_t i = 0; i < num_sockets; i++) {
-      if (sockets[i] != NULL) {
-        check_and_forward(msg_hdr, sockets[i]);
-      }
+    if (!check_seen(msg_hdr, NULL)) {
+      serial_msg_offset = 0;
+      return false;
+    }
+
+    if ((msg_hdr->flags & MSG_FLAG_RELIABLE) &&
+        (msg_hdr->origin == address) &&
+        (msg_hdr->address != address) &&
+        !HMTL_IS_MULTICAST(msg_hdr->address)) {
+      // Retransmit on behalf of the serial device until acknowledged
+      track_reliable(msg_hdr);
     }
 
-    // Todo: Should this really use the first socket's buffer?  What if there
-    // are no sockets configured?
-    if (process_msg(msg_hdr, NULL, sockets[0], config)) {
+    // Responses to the serial device are built in the first socket's buffer
+    if (receive(msg_hdr, NULL, serial_buffer_socket(), config)) {
       update = true;
     }
 
@@ -320,7 +962,24 @@ boolean MessageHandler::check_serial(config_hdr_t *config) {
 boolean MessageHandler::check_socket(Socket *socket, Socket *serial_socket,
                                      config_hdr_t *config) {
   unsigned int msglen;
-  msg_hdr_t *msg_hdr = hmtl_socket_getmsg(socket, &msglen);
+  msg_hdr_t *msg_hdr;
+  do {
+    // Invalid frames are dropped and the next one read in their place
+#ifdef HMTL_USE_V2_COMPAT
+    msg_hdr = hmtl_socket_getmsg(socket, &msglen, SOCKET_ADDR_INVALID,
+                                 drop_counts(socket),
+                                 upgrade_msg, MSG_MAX_SZ);
+#else
+    msg_hdr = hmtl_socket_getmsg(socket, &msglen, SOCKET_ADDR_INVALID,
+                                 drop_counts(socket));
+#endif
+  } while ((msg_hdr == NULL) && (msglen != 0));
+
+#ifdef HMTL_USE_V2_COMPAT
+  boolean upgraded = ((byte *)msg_hdr == upgrade_msg);
+#else
+  boolean upgraded = false;
+#endif
   if (msg_hdr != NULL) {
     DEBUG5_VALUE("Rcv socket msg len=", msglen);
     DEBUG5_PRINT(" ");
@@ -329,14 +988,38 @@ boolean MessageHandler::check_socket(Socket *socket, Socket *serial_socket,
     );
     DEBUG_PRINT_END();
 
-    /* Check if the message should be forwarded to any sockets */
-    for (uint8_t i = 0; i < num_sockets; i++) {
-      if ((sockets[i] != NULL) && (sockets[i] != socket)) {
-        check_and_forward(msg_hdr, sockets[i]);
+    /*
+     * An upgraded version 2 message is a copy of the socket's data with the
+     * sender as its origin and a new sequence number, so it is never a
+     * duplicate.
+     */
+    socket_addr_t sender = (upgraded ? msg_hdr->origin :
+                            socket->sourceFromData(msg_hdr));
+    received++;
+    trace(msg_hdr, socket, sender);
+
+    if (upgraded) {
+      if (sender == SOCKET_ADDR_INVALID) {
+        // Replies need the sender, which the socket couldn't tell
+        return false;
       }
+    } else if (!check_seen(msg_hdr, socket)) {
+      return false;
+    }
+
+    /*
+     * The sender and the message's origin can be reached over this socket,
+     * and the sender must be sent the header version it sends
+     */
+    learn_route(sender, socket, upgraded);
+    learn_route(msg_hdr->origin, socket, upgraded);
+
+    if (upgraded) {
+      // The upgrade buffer is shared by all sockets, so is never queued
+      return dispatch(msg_hdr, socket, serial_socket, config);
     }
 
-    if (process_msg(msg_hdr, socket, serial_socket, config)) {
+    if (receive(msg_hdr, socket, serial_socket, config)) {
       return true;
     }
   }
@@ -345,48 +1028,1029 @@ boolean MessageHandler::check_socket(Socket *socket, Socket *serial_socket,
 }
 
 /*
- * Check the serial device and all sockets for messsages
+ * Bulk traffic is anything that carries output state, which can wait behind
+ * priority messages without changing its effect.  Other messages may depend
+ * on the socket they arrived on, such as time syncs, so are never queued.
+ */
+static boolean is_low_priority(msg_hdr_t *msg_hdr) {
+  if (msg_hdr->flags & MSG_FLAG_PRIORITY) {
+    return false;
+  }
+
+  switch (msg_hdr->type) {
+    case MSG_TYPE_OUTPUT:
+    case MSG_TYPE_BATCH:
+    case MSG_TYPE_PIXEL_FRAME:
+      return true;
+    default:
+      return false;
+  }
+}
+
+#ifdef USE_COALESCING
+/*
+ * Returns the output record of a message that sets the complete state of an
+ * output, or NULL for any other message.  Messages requesting an ack or
+ * reliable delivery are never coalesced so that each one is delivered, and
+ * any too long for a state queue entry are queued as other bulk traffic.
+ */
+static output_hdr_t *state_output(msg_hdr_t *msg_hdr) {
+  if ((msg_hdr->type != MSG_TYPE_OUTPUT) ||
+      (msg_hdr->flags & (MSG_FLAG_ACK | MSG_FLAG_RESPONSE |
+                         MSG_FLAG_RELIABLE)) ||
+      (msg_hdr->length < HMTL_MSG_VALUE_LEN) ||
+      (msg_hdr->length > HMTL_MSG_RGB_LEN)) {
+    return NULL;
+  }
+
+  output_hdr_t *out_hdr = (output_hdr_t *)(msg_hdr + 1);
+  switch (out_hdr->type) {
+    case HMTL_OUTPUT_VALUE:
+      return out_hdr;
+    case HMTL_OUTPUT_RGB:
+      return (msg_hdr->length == HMTL_MSG_RGB_LEN ? out_hdr : NULL);
+    default:
+      return NULL;
+  }
+}
+
+/*
+ * Queue a value or RGB message in the state queue, overwriting any queued
+ * message for the same address and output.  If there is no room the oldest
+ * queued messages are handled until there is.
+ */
+boolean MessageHandler::queue_state(msg_hdr_t *msg_hdr, Socket *src,
+                                    config_hdr_t *config) {
+  output_hdr_t *newer = state_output(msg_hdr);
+  msg_state_queued_t *slot = NULL;
+  for (uint8_t i = 0; i < MSG_STATE_QUEUE_ENTRIES; i++) {
+    msg_state_queued_t *entry = &state_queue[i];
+    if (!entry->used) {
+      continue;
+    }
+
+    msg_hdr_t *queued = (msg_hdr_t *)entry->msg;
+    output_hdr_t *older = (output_hdr_t *)(queued + 1);
+    if ((queued->address == msg_hdr->address) &&
+        ((older->output == newer->output) ||
+         (newer->output == HMTL_ALL_OUTPUTS))) {
+      DEBUG4_VALUELN("Coalesced output ", older->output);
+      coalesced++;
+      if (slot == NULL) {
+        slot = entry;
+      } else {
+        entry->used = false;
+        state_count--;
+      }
+    }
+  }
+
+  boolean update = false;
+  while ((slot == NULL) && (state_count == MSG_STATE_QUEUE_ENTRIES)) {
+    if (handle_low(config)) update = true;
+  }
+
+  for (uint8_t i = 0; (slot == NULL) && (i < MSG_STATE_QUEUE_ENTRIES); i++) {
+    if (!state_queue[i].used) {
+      slot = &state_queue[i];
+      slot->used = true;
+      state_count++;
+    }
+  }
+
+  slot->src = src;
+  slot->order = queue_order++;
+  memcpy(slot->msg, msg_hdr, msg_hdr->length);
+  low_queued++;
+
+  return update;
+}
+#endif
+
+/*
+ * Handle a newly received message, forwarding and processing it immediately
+ * unless it is bulk traffic, which is added to the low priority queue where
+ * it was received.  If the queue is full its oldest message is handled to
+ * make room.
+ *
+ * Returns true if processing a message resulted in some change that may
+ * require the device's outputs to be updated.
+ */
+boolean MessageHandler::receive(msg_hdr_t *msg_hdr, Socket *src,
+                                Socket *serial_socket, config_hdr_t *config) {
+  if (!is_low_priority(msg_hdr)) {
+    return dispatch(msg_hdr, src, serial_socket, config);
+  }
+
+  boolean update = false;
+#ifdef USE_COALESCING
+  if (state_output(msg_hdr) != NULL) {
+    return queue_state(msg_hdr, src, config);
+  }
+#endif
+
+  while (low_count == MSG_LOW_QUEUE_ENTRIES) {
+    if (handle_low(config)) update = true;
+  }
+
+  msg_queued_t *entry =
+          &low_queue[(low_head + low_count) % MSG_LOW_QUEUE_ENTRIES];
+  entry->src = src;
+  entry->order = queue_order++;
+  entry->msg = msg_hdr;
+  low_count++;
+  low_queued++;
+
+  return update;
+}
+
+/* Number of messages in the low priority and state queues */
+uint8_t MessageHandler::low_pending() {
+#ifdef USE_COALESCING
+  return low_count + state_count;
+#else
+  return low_count;
+#endif
+}
+
+/*
+ * Returns true if a message from the source, NULL for the serial port, is
+ * waiting in the low priority queue and so still in its receive buffer
+ */
+boolean MessageHandler::low_held(Socket *src) {
+  for (uint8_t i = 0; i < low_count; i++) {
+    if (low_queue[(low_head + i) % MSG_LOW_QUEUE_ENTRIES].src == src) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Forward a message and then process it */
+boolean MessageHandler::dispatch(msg_hdr_t *msg_hdr, Socket *src,
+                                 Socket *serial_socket, config_hdr_t *config) {
+  /* Check if the message should be forwarded to any sockets */
+  forward(msg_hdr, src);
+
+  return process_msg(msg_hdr, src, serial_socket, config);
+}
+
+/*
+ * Forward and process the oldest message in the low priority and state
+ * queues, which the order stamps identify as the one queued longest ago.
+ */
+boolean MessageHandler::handle_low(config_hdr_t *config) {
+#ifdef USE_COALESCING
+  msg_state_queued_t *oldest = NULL;
+  uint8_t oldest_age = 0;
+  if (low_count > 0) {
+    oldest_age = queue_order - low_queue[low_head].order;
+  }
+  for (uint8_t i = 0; i < MSG_STATE_QUEUE_ENTRIES; i++) {
+    if (!state_queue[i].used) {
+      continue;
+    }
+
+    uint8_t age = queue_order - state_queue[i].order;
+    if (((oldest == NULL) && (low_count == 0)) || (age > oldest_age)) {
+      oldest = &state_queue[i];
+      oldest_age = age;
+    }
+  }
+
+  if (oldest != NULL) {
+    oldest->used = false;
+    state_count--;
+    return dispatch((msg_hdr_t *)oldest->msg, oldest->src,
+                    (oldest->src != NULL ? oldest->src :
+                     serial_buffer_socket()), config);
+  }
+#endif
+
+  msg_queued_t *entry = &low_queue[low_head];
+  low_head = (low_head + 1) % MSG_LOW_QUEUE_ENTRIES;
+  low_count--;
+
+  return dispatch(entry->msg, entry->src,
+                  (entry->src != NULL ? entry->src : serial_buffer_socket()),
+                  config);
+}
+
+/*
+ * Check the serial device and all sockets for messages, receiving one from
+ * each per pass until they are all empty or the check budget is used.
+ * Priority traffic is handled as it is received, and the bulk traffic
+ * queued behind it once the sources have been checked or are all waiting on
+ * their queued messages.
  */
 boolean MessageHandler::check(config_hdr_t *config) {
   boolean update = false;
+  unsigned long start = micros();
+  uint16_t start_received = received;
+  uint16_t start_frames = pixel_frame.frames;
+  boolean overrun = false;
 
-  if (check_serial(config)) {
-    update = true;
+  while (true) {
+    uint16_t pass_received = received;
+
+    if (!low_held(NULL) && check_serial(config)) {
+      update = true;
+    }
+
+    for (uint8_t socket = 0; socket < num_sockets; socket++) {
+      if ((sockets[socket] != NULL) && !low_held(sockets[socket]) &&
+          (check_socket(sockets[socket], sockets[socket], config))) {
+        update = true;
+      }
+    }
+
+    if (received == pass_received) {
+      if (low_count == 0) {
+        // All sources are empty
+        break;
+      }
+
+      // The others are empty, handle the queued messages holding sources
+      while ((low_count > 0) && (pixel_frame.frames == start_frames)) {
+        if (handle_low(config)) {
+          update = true;
+        }
+      }
+    }
+
+    if (pixel_frame.frames != start_frames) {
+      /*
+       * Return so that a completed frame is shown before the next one starts,
+       * which would otherwise hold off the update.
+       */
+      break;
+    }
+
+    if (micros() - start >= check_budget_us) {
+      // Leave any remaining messages for the next loop
+      overrun = true;
+      break;
+    }
   }
 
-  for (uint8_t socket = 0; socket < num_sockets; socket++) {
-    if ((sockets[socket] != NULL) &&
-        (check_socket(sockets[socket], sockets[socket], config))) {
+  send_deferred(config);
+  send_dump_page();
+  send_trace_page();
+  send_groups();
+  send_retries();
+
+  /*
+   * Handle the queued bulk traffic, at least one message per check so that
+   * it can't be held off indefinitely.
+   */
+  while ((low_pending() > 0) && (pixel_frame.frames == start_frames)) {
+    if (handle_low(config)) {
       update = true;
     }
+
+    if ((low_pending() > 0) && (micros() - start >= check_budget_us)) {
+      overrun = true;
+      break;
+    }
+  }
+
+  if (overrun) {
+    budget_overruns++;
+  }
+
+  if (loop_stats != NULL) {
+    loop_stats->backlog(received - start_received);
+  }
+
+  return update;
+}
+
+/*
+ * Hold off output updates while a pixel frame is partially received
+ */
+boolean MessageHandler::check_update(boolean update) {
+  if (pixel_frame.pending()) {
+    if (update) deferred_update = true;
+    return false;
+  }
+
+  if (deferred_update) {
+    deferred_update = false;
+    return true;
   }
 
   return update;
 }
 
+/*
+ * Return the drop counts for a socket or the serial device
+ */
+msg_drop_counts_t *MessageHandler::drop_counts(Socket *socket) {
+  if (socket == NULL) {
+    return &serial_drops;
+  }
+
+  for (uint8_t i = 0; (i < num_sockets) && (i < MAX_SOCKETS); i++) {
+    if (sockets[i] == socket) {
+      return &socket_drops[i];
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Forward a message towards its destination, sending it only over the socket
+ * the destination was last heard on when that is known, or for a group the
+ * sockets its members were heard on.
+ */
+void MessageHandler::forward(msg_hdr_t *msg_hdr, Socket *src) {
+  if (!should_forward(msg_hdr)) {
+    return;
+  }
+
+  Socket *route = NULL;
+  uint8_t members = (uint8_t)-1;
+  if (HMTL_IS_GROUP(msg_hdr->address)) {
+    members = lookup_group(msg_hdr->address);
+  } else if (msg_hdr->address != SOCKET_ADDR_ANY) {
+    route = lookup_route(msg_hdr->address);
+    if ((route != NULL) && (route == src)) {
+      // The destination already received it if it is on the source's socket
+      return;
+    }
+  }
+
+  /*
+   * Update the header in place once, rather than in a copy for each socket
+   * it is sent over.
+   */
+  if (msg_hdr->origin == SOCKET_ADDR_INVALID) {
+    // This module's own message
+    msg_hdr->origin = address;
+  }
+  msg_hdr->ttl--;
+  hmtl_msg_set_crc(msg_hdr);
+
+  if (route != NULL) {
+    send_forward(msg_hdr, route);
+    return;
+  }
+
+  for (uint8_t i = 0; i < num_sockets; i++) {
+    if ((sockets[i] != NULL) && (sockets[i] != src) &&
+        (members & (1 << i))) {
+      send_forward(msg_hdr, sockets[i]);
+    }
+  }
+}
+
+/*
+ * Returns socket->sendsAnyBuffer() if the Socket interface being built
+ * against declares it, or false for a version of the interface without it.
+ */
+template <typename S>
+static auto socket_sends_any_buffer(S *socket, int)
+    -> decltype(socket->sendsAnyBuffer()) {
+  return socket->sendsAnyBuffer();
+}
+
+template <typename S>
+static boolean socket_sends_any_buffer(S *socket, long) {
+  return false;
+}
+
+/*
+ * Transmit a message whose header has already been updated for forwarding.
+ * Sockets that can send from any buffer are handed the message where it was
+ * received, others require it to be copied into their send buffer.
+ */
+void MessageHandler::send_forward(msg_hdr_t *msg_hdr, Socket *socket) {
+  if (msg_hdr->length > socket->send_data_size) {
+    DEBUG4_VALUELN("Fragmenting msg len=", msg_hdr->length);
+    if (hmtl_send_fragments(socket, msg_hdr, address) > 0) {
+      fragmented++;
+    }
+    return;
+  }
+
+  DEBUG4_VALUELN("Forwarding msg to ", msg_hdr->address);
+  if (socket_sends_any_buffer(socket, 0) && !sends_v2(msg_hdr->address)) {
+    socket->sendMsgTo(msg_hdr->address, (byte *)msg_hdr, msg_hdr->length);
+    return;
+  }
+
+  memcpy(socket->send_buffer, msg_hdr, msg_hdr->length);
+  send_to(socket, msg_hdr->address, socket->send_buffer, msg_hdr->length);
+}
+
+/*
+ * Send a message formatted in a socket's send buffer, first downgrading it
+ * to a version 2 header if that is what its destination sends.
+ */
+void MessageHandler::send_to(Socket *socket, socket_addr_t dest, byte *msg,
+                             uint16_t len) {
+  if (sends_v2(dest)) {
+    len = hmtl_msg_downgrade((msg_hdr_t *)msg);
+    if (len == 0) {
+      return;
+    }
+  }
+  socket->sendMsgTo(dest, msg, len);
+}
+
+void MessageHandler::init_routes() {
+  for (uint8_t i = 0; i < MSG_ROUTE_ENTRIES; i++) {
+    routes[i].address = SOCKET_ADDR_INVALID;
+  }
+  for (uint8_t i = 0; i < MSG_GROUP_ROUTE_ENTRIES; i++) {
+    group_routes[i].group = SOCKET_ADDR_INVALID;
+  }
+}
+
+/*
+ * Record the socket an address was heard on and whether it sent a version 2
+ * header, replacing the least recently heard route if the address isn't
+ * already known.
+ */
+void MessageHandler::learn_route(socket_addr_t route_address, Socket *socket,
+                                 boolean v2) {
+  if ((route_address == SOCKET_ADDR_INVALID) ||
+      (route_address == SOCKET_ADDR_ANY) ||
+      (route_address == address)) {
+    return;
+  }
+
+  uint8_t index;
+  for (index = 0; index < num_sockets; index++) {
+    if (sockets[index] == socket) break;
+  }
+  if (index == num_sockets) return;
+
+  uint16_t now = (uint16_t)(millis() >> 10);
+  msg_route_t *route = NULL; // The address's entry or an unused one
+  msg_route_t *oldest = &routes[0];
+  for (uint8_t i = 0; i < MSG_ROUTE_ENTRIES; i++) {
+    if (routes[i].address == route_address) {
+      route = &routes[i];
+      break;
+    }
+    if (routes[i].address == SOCKET_ADDR_INVALID) {
+      if (route == NULL) route = &routes[i];
+    } else if ((uint16_t)(now - routes[i].heard) >
+               (uint16_t)(now - oldest->heard)) {
+      oldest = &routes[i];
+    }
+  }
+  if (route == NULL) {
+    route = oldest;
+  }
+
+  if ((route->address != route_address) || (route->socket != index)) {
+    DEBUG4_VALUE("Route to ", route_address);
+    DEBUG4_VALUELN(" via ", index);
+  }
+  route->address = route_address;
+  route->socket = index;
+  route->heard = now;
+#ifdef HMTL_USE_V2_COMPAT
+  route->v2 = v2;
+#endif
+}
+
+/* Returns true if an address was last heard sending version 2 headers */
+boolean MessageHandler::sends_v2(socket_addr_t route_address) {
+#ifdef HMTL_USE_V2_COMPAT
+  for (uint8_t i = 0; i < MSG_ROUTE_ENTRIES; i++) {
+    if (routes[i].address == route_address) {
+      return routes[i].v2;
+    }
+  }
+#endif
+  return false;
+}
+
+Socket *MessageHandler::lookup_route(socket_addr_t route_address) {
+  uint16_t now = (uint16_t)(millis() >> 10);
+  for (uint8_t i = 0; i < MSG_ROUTE_ENTRIES; i++) {
+    if (routes[i].address == route_address) {
+      if ((uint16_t)(now - routes[i].heard) > MSG_ROUTE_TIMEOUT_S) {
+        // Stale, the module may have moved
+        routes[i].address = SOCKET_ADDR_INVALID;
+        return NULL;
+      }
+      return sockets[routes[i].socket];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Record a socket that a member of a group was heard on, replacing the least
+ * recently heard group if it isn't already known.  Sockets are forgotten
+ * along with the group once none of its members have been heard from.
+ */
+void MessageHandler::learn_group(socket_addr_t group, Socket *socket) {
+  uint8_t index;
+  for (index = 0; index < num_sockets; index++) {
+    if (sockets[index] == socket) break;
+  }
+  if ((index == num_sockets) || !HMTL_IS_GROUP(group)) return;
+
+  uint16_t now = (uint16_t)(millis() >> 10);
+  msg_group_route_t *route = NULL; // The group's entry or an unused one
+  msg_group_route_t *oldest = &group_routes[0];
+  for (uint8_t i = 0; i < MSG_GROUP_ROUTE_ENTRIES; i++) {
+    if (group_routes[i].group == group) {
+      route = &group_routes[i];
+      break;
+    }
+    if (group_routes[i].group == SOCKET_ADDR_INVALID) {
+      if (route == NULL) route = &group_routes[i];
+    } else if ((uint16_t)(now - group_routes[i].heard) >
+               (uint16_t)(now - oldest->heard)) {
+      oldest = &group_routes[i];
+    }
+  }
+  if (route == NULL) {
+    route = oldest;
+  }
+
+  if ((route->group != group) ||
+      ((uint16_t)(now - route->heard) > MSG_ROUTE_TIMEOUT_S)) {
+    route->group = group;
+    route->sockets = 0;
+  }
+  if (!(route->sockets & (1 << index))) {
+    DEBUG4_VALUE("Group ", group);
+    DEBUG4_VALUELN(" via ", index);
+  }
+  route->sockets |= (1 << index);
+  route->heard = now;
+}
+
+uint8_t MessageHandler::lookup_group(socket_addr_t group) {
+  uint16_t now = (uint16_t)(millis() >> 10);
+  for (uint8_t i = 0; i < MSG_GROUP_ROUTE_ENTRIES; i++) {
+    if (group_routes[i].group == group) {
+      if ((uint16_t)(now - group_routes[i].heard) > MSG_ROUTE_TIMEOUT_S) {
+        // Stale, the members may have moved
+        group_routes[i].group = SOCKET_ADDR_INVALID;
+        break;
+      }
+      return group_routes[i].sockets;
+    }
+  }
+  return (uint8_t)-1;
+}
+
+/* Announce this module's groups over every socket when they are due */
+void MessageHandler::send_groups() {
+  if ((groups == NULL) || (groups->num_groups == 0)) {
+    return;
+  }
+
+  unsigned long now = millis();
+  if (groups_announced &&
+      (now - groups_announce_ms < MSG_GROUP_ANNOUNCE_S * 1000UL)) {
+    return;
+  }
+  groups_announced = true;
+  groups_announce_ms = now;
+
+  /* The same sequence over each socket, so that copies are dropped */
+  uint8_t sequence = hmtl_next_sequence();
+  for (uint8_t i = 0; i < num_sockets; i++) {
+    Socket *socket = sockets[i];
+    if (socket == NULL) continue;
+
+    uint16_t len = hmtl_groups_fmt(socket->send_buffer,
+                                   socket->send_data_size, groups);
+    if (len == 0) continue;
+    msg_hdr_t *msg_hdr = (msg_hdr_t *)socket->send_buffer;
+    msg_hdr->origin = address;
+    msg_hdr->sequence = sequence;
+    hmtl_msg_set_crc(msg_hdr);
+    socket->sendMsgTo(SOCKET_ADDR_ANY, socket->send_buffer, len);
+  }
+}
+
+boolean MessageHandler::send_reliable(msg_hdr_t *msg_hdr) {
+  if (HMTL_IS_MULTICAST(msg_hdr->address) ||
+      (msg_hdr->address == address) ||
+      (msg_hdr->address == SOCKET_ADDR_INVALID)) {
+    return false;
+  }
+
+  msg_hdr->flags = (msg_hdr->flags & ~MSG_FLAG_RETRY) | MSG_FLAG_RELIABLE;
+  msg_hdr->origin = address;
+  msg_hdr->sequence = hmtl_next_sequence();
+  hmtl_msg_set_crc(msg_hdr);
+
+  if (!track_reliable(msg_hdr)) {
+    return false;
+  }
+
+  forward(msg_hdr, NULL);
+  return true;
+}
+
+uint8_t MessageHandler::reliable_pending() {
+  uint8_t pending = 0;
+#ifdef USE_RELIABLE
+  for (uint8_t i = 0; i < MSG_RELIABLE_ENTRIES; i++) {
+    if (reliable[i].used) pending++;
+  }
+#endif
+  return pending;
+}
+
+/*
+ * Keep a copy of a reliable message for retransmission.  Returns false if
+ * there was no room for it.
+ */
+boolean MessageHandler::track_reliable(msg_hdr_t *msg_hdr) {
+#ifdef USE_RELIABLE
+  if ((msg_hdr->version != HMTL_MSG_VERSION) ||
+      (msg_hdr->length > MSG_MAX_SZ)) {
+    return false;
+  }
+
+  for (uint8_t i = 0; i < MSG_RELIABLE_ENTRIES; i++) {
+    if (!reliable[i].used) {
+      reliable[i].used = true;
+      reliable[i].sent_ms = millis();
+      memcpy(reliable[i].msg, msg_hdr, msg_hdr->length);
+      return true;
+    }
+  }
+
+  DEBUG4_VALUELN("Reliable window full ", msg_hdr->sequence);
+  reliable_full++;
+#endif
+  return false;
+}
+
+/*
+ * Retransmit reliable messages whose acknowledgement hasn't arrived in time,
+ * giving up on those that have been sent the maximum number of times.
+ */
+void MessageHandler::send_retries() {
+#ifdef USE_RELIABLE
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < MSG_RELIABLE_ENTRIES; i++) {
+    if (!reliable[i].used) continue;
+
+    msg_hdr_t *msg_hdr = (msg_hdr_t *)reliable[i].msg;
+    uint8_t retry = HMTL_MSG_RETRY(msg_hdr);
+    if (now - reliable[i].sent_ms < ((unsigned long)MSG_RELIABLE_TIMEOUT_MS <<
+                                     retry)) {
+      continue;
+    }
+
+    if (retry == HMTL_MSG_MAX_RETRY) {
+      DEBUG2_VALUELN("Undelivered ", msg_hdr->sequence);
+      reliable[i].used = false;
+      undelivered++;
+      continue;
+    }
+
+    /* forward() updates the ttl in place, keep the original for next time */
+    uint8_t ttl = msg_hdr->ttl;
+    msg_hdr->flags = (msg_hdr->flags & ~MSG_FLAG_RETRY) | ((retry + 1) << 6);
+    hmtl_msg_set_crc(msg_hdr);
+    forward(msg_hdr, NULL);
+    msg_hdr->ttl = ttl;
+
+    reliable[i].sent_ms = now;
+    retransmitted++;
+  }
+#endif
+}
+
+void MessageHandler::init_trace() {
+#ifdef USE_TRACE
+  trace_start = 0;
+  trace_used = 0;
+  trace_stopped = false;
+  memset(&trace_dump, 0, sizeof (trace_dump));
+#endif
+}
+
+uint16_t MessageHandler::trace_length() {
+#ifdef USE_TRACE
+  return trace_used;
+#else
+  return 0;
+#endif
+}
+
+uint16_t MessageHandler::read_trace(uint16_t offset, byte *data,
+                                    uint16_t length) {
+#ifdef USE_TRACE
+  if (offset >= trace_used) {
+    return 0;
+  }
+  if (length > trace_used - offset) {
+    length = trace_used - offset;
+  }
+
+  uint16_t pos = (trace_start + offset) % MSG_TRACE_BYTES;
+  uint16_t first = MSG_TRACE_BYTES - pos;
+  if (first > length) {
+    first = length;
+  }
+  memcpy(data, trace_buffer + pos, first);
+  memcpy(data + first, trace_buffer, length - first);
+  return length;
+#else
+  return 0;
+#endif
+}
+
+/* Copy data into the trace at an offset from its oldest record */
+void MessageHandler::trace_write(uint16_t offset, const void *data,
+                                 uint16_t length) {
+#ifdef USE_TRACE
+  uint16_t pos = (trace_start + offset) % MSG_TRACE_BYTES;
+  uint16_t first = MSG_TRACE_BYTES - pos;
+  if (first > length) {
+    first = length;
+  }
+  memcpy(trace_buffer + pos, data, first);
+  memcpy(trace_buffer, (const byte *)data + first, length - first);
+#endif
+}
+
+/*
+ * Record a received message in the trace, dropping the oldest records until
+ * there is room for it.
+ */
+void MessageHandler::trace(msg_hdr_t *msg_hdr, Socket *src,
+                           socket_addr_t sender) {
+#ifdef USE_TRACE
+  if (trace_stopped) {
+    return;
+  }
+
+  msg_trace_record_t record;
+  record.ms = timesync.ms();
+  record.length = hmtl_msg_length(msg_hdr);
+  record.source = HMTL_TRACE_SERIAL;
+  record.sender = sender;
+  if (src != NULL) {
+    for (uint8_t i = 0; i < num_sockets; i++) {
+      if (sockets[i] == src) {
+        record.source = i;
+        break;
+      }
+    }
+  }
+
+  uint16_t needed = sizeof (record) + record.length;
+  if (needed > MSG_TRACE_BYTES) {
+    untraced++;
+    return;
+  }
+
+  while (trace_used + needed > MSG_TRACE_BYTES) {
+    msg_trace_record_t oldest;
+    read_trace(0, (byte *)&oldest, sizeof (oldest));
+    uint16_t oldest_len = sizeof (oldest) + oldest.length;
+    trace_start = (trace_start + oldest_len) % MSG_TRACE_BYTES;
+    trace_used -= oldest_len;
+  }
+
+  trace_write(trace_used, &record, sizeof (record));
+  trace_write(trace_used + sizeof (record), msg_hdr, record.length);
+  trace_used += needed;
+#endif
+}
+
+/* Send the next page of a trace dump in progress */
+void MessageHandler::send_trace_page() {
+#ifdef USE_TRACE
+  if (trace_dump.sock == NULL) {
+    return;
+  }
+
+  Socket *sock = trace_dump.sock;
+  msg_trace_response_t *resp =
+          (msg_trace_response_t *)(sock->send_buffer + sizeof (msg_hdr_t));
+
+  /* Pages are sent as short messages, whatever the size of the buffer */
+  uint16_t size = sock->send_data_size;
+  if (size > 0xFF) {
+    size = 0xFF;
+  }
+  byte datalen = read_trace(trace_dump.offset, resp->data,
+                            size - HMTL_MSG_TRACE_MIN_LEN);
+
+  uint8_t flags = trace_dump.flags & ~MSG_FLAG_MORE_DATA;
+  uint16_t next = trace_dump.offset + datalen;
+  if ((datalen > 0) && (next < trace_used) && (trace_dump.pages != 1)) {
+    flags |= MSG_FLAG_MORE_DATA;
+  }
+
+  uint16_t len = hmtl_trace_fmt(sock->send_buffer, sock->send_data_size,
+                                trace_dump.dest, flags, trace_dump.offset,
+                                trace_used, datalen);
+  if (len == 0) {
+    trace_dump.sock = NULL;
+    return;
+  }
+  if (trace_dump.src != NULL) {
+    send_to(trace_dump.src, trace_dump.dest, sock->send_buffer, len);
+  } else {
+    Serial.write(sock->send_buffer, len);
+  }
+
+  if (flags & MSG_FLAG_MORE_DATA) {
+    trace_dump.offset = next;
+    if (trace_dump.pages != 0) {
+      trace_dump.pages--;
+    }
+  } else {
+    trace_dump.sock = NULL;
+    if (trace_dump.control & HMTL_TRACE_CLEAR) {
+      trace_start = 0;
+      trace_used = 0;
+    }
+    trace_stopped = (trace_dump.control & HMTL_TRACE_HOLD);
+  }
+#endif
+}
+
+/*
+ * Messages that are not to this module's address or are on the broadcast
+ * address should be forwarded, except for broadcasts of types that should
+ * only be handled by the module that received them and messages that have
+ * reached their hop limit.  Version 4 messages, whose ttl byte holds the high
+ * byte of their length, are never forwarded whole and must be sent with
+ * hmtl_send_fragments() by the module that formatted them.
+ */
+boolean MessageHandler::should_forward(msg_hdr_t *msg_hdr) {
+  if (msg_hdr->version == HMTL_MSG_VERSION_LONG) {
+    DEBUG1_VALUELN("Not forwarding long msg len=", hmtl_msg_length(msg_hdr));
+    return false;
+  }
+
+  if (HMTL_IS_MULTICAST(msg_hdr->address) ?
+      (msg_hdr->type >= MSG_TYPE_DONT_FORWARD) : (msg_hdr->address == address)) {
+    return false;
+  }
+
+  if (msg_hdr->ttl == 0) {
+    DEBUG4_VALUELN("Hop limit reached from ", msg_hdr->origin);
+    hop_limited++;
+    return false;
+  }
+
+  return true;
+}
+
 /*
  * Check if a message should be forwarded and transmit it over
  * the indicated socket if so.
  */
 boolean MessageHandler::check_and_forward(msg_hdr_t *msg_hdr, Socket *socket) {
-  if (((msg_hdr->address != address) || (msg_hdr->address == SOCKET_ADDR_ANY)) &&
-          (msg_hdr->type < MSG_TYPE_DONT_FORWARD)) {
-    /*
-     * Messages that are not to this module's address or are on the broadcast
-     * address should be forwarded.
-     */
-    if (msg_hdr->length > socket->send_data_size) {
-      DEBUG1_VALUELN("Message larger than send buffer:", msg_hdr->length);
+  if (!should_forward(msg_hdr)) {
+    return false;
+  }
+
+  if (msg_hdr->length > socket->send_data_size) {
+    DEBUG1_VALUELN("Message larger than send buffer:", msg_hdr->length);
+    return false;
+  }
+
+  DEBUG4_VALUELN("Forwarding msg to ", msg_hdr->address);
+  memcpy(socket->send_buffer, msg_hdr, msg_hdr->length);
+
+  msg_hdr_t *forward_hdr = (msg_hdr_t *)socket->send_buffer;
+  if (forward_hdr->origin == SOCKET_ADDR_INVALID) {
+    // This module's own message
+    forward_hdr->origin = address;
+  }
+  forward_hdr->ttl--;
+  hmtl_msg_set_crc(forward_hdr);
+
+  send_to(socket, msg_hdr->address, socket->send_buffer, msg_hdr->length);
+  return true;
+}
+
+void MessageHandler::init_seen() {
+  for (uint8_t i = 0; i < MSG_SEEN_ENTRIES; i++) {
+    seen[i].origin = SOCKET_ADDR_INVALID;
+  }
+  seen_next = 0;
+
+  for (uint8_t i = 0; i < MSG_DELIVERED_ENTRIES; i++) {
+    last_delivered[i].origin = SOCKET_ADDR_INVALID;
+  }
+  delivered_next = 0;
+}
+
+/*
+ * Check if a retransmitted reliable message is the last one delivered to this
+ * module from its origin.
+ */
+boolean MessageHandler::check_delivered(msg_hdr_t *msg_hdr) {
+  for (uint8_t i = 0; i < MSG_DELIVERED_ENTRIES; i++) {
+    if (last_delivered[i].origin == msg_hdr->origin) {
+      return (last_delivered[i].sequence == msg_hdr->sequence);
+    }
+  }
+  return false;
+}
+
+/* Remember the last reliable message delivered from a message's origin */
+void MessageHandler::record_delivered(msg_hdr_t *msg_hdr) {
+  if (msg_hdr->origin == SOCKET_ADDR_INVALID) {
+    return;
+  }
+
+  for (uint8_t i = 0; i < MSG_DELIVERED_ENTRIES; i++) {
+    if (last_delivered[i].origin == msg_hdr->origin) {
+      last_delivered[i].sequence = msg_hdr->sequence;
+      return;
+    }
+  }
+
+  last_delivered[delivered_next].origin = msg_hdr->origin;
+  last_delivered[delivered_next].sequence = msg_hdr->sequence;
+  delivered_next = (delivered_next + 1) % MSG_DELIVERED_ENTRIES;
+}
+
+/*
+ * Assign an origin to a received message if it doesn't have one, then check
+ * if it has already been received over another path and record it if not.
+ *
+ * Returns false if the message is a duplicate and should be dropped.
+ */
+boolean MessageHandler::check_seen(msg_hdr_t *msg_hdr, Socket *src) {
+  if (msg_hdr->origin == SOCKET_ADDR_INVALID) {
+    if (src != NULL) {
+      // Sent directly by the neighbor, which numbered the message
+      msg_hdr->origin = src->sourceFromData(msg_hdr);
     } else {
-      DEBUG4_VALUELN("Forwarding msg to ", msg_hdr->address);
-      memcpy(socket->send_buffer, msg_hdr, msg_hdr->length);
-      socket->sendMsgTo(msg_hdr->address, socket->send_buffer, msg_hdr->length);
+      // Messages from the serial device enter the network at this module
+      msg_hdr->origin = address;
+      msg_hdr->sequence = hmtl_next_sequence();
+    }
+    hmtl_msg_set_crc(msg_hdr);
+
+    if (msg_hdr->origin == SOCKET_ADDR_INVALID) {
+      // The sender has no address so the message can't be identified
       return true;
     }
+  } else if ((src != NULL) && (msg_hdr->origin == address)) {
+    // One of this module's own messages that has come back around
+    DEBUG4_VALUELN("Own msg returned ", msg_hdr->sequence);
+    goto DUPLICATE;
   }
 
-  // The message was not forwarded over the socket
-  return false;
-}
+  {
+    uint16_t now = (uint16_t)millis();
+    for (uint8_t i = 0; i < MSG_SEEN_ENTRIES; i++) {
+      if ((seen[i].origin == msg_hdr->origin) &&
+          (seen[i].sequence == msg_hdr->sequence) &&
+          ((uint16_t)(now - seen[i].ms) < MSG_SEEN_TIMEOUT_MS)) {
+        if (HMTL_MSG_RETRY(msg_hdr) > seen[i].retry) {
+          /*
+           * A retransmission of a reliable message, which is forwarded again.
+           * If this module is its destination the acknowledgement was lost,
+           * so only that is sent again.
+           */
+          seen[i].retry = HMTL_MSG_RETRY(msg_hdr);
+          if (msg_hdr->address != address) {
+            return true;
+          }
+          send_delivered(msg_hdr, src);
+        }
+        DEBUG4_VALUELN("Duplicate msg from ", msg_hdr->origin);
+        goto DUPLICATE;
+      }
+    }
 
+    if ((msg_hdr->address == address) && (HMTL_MSG_RETRY(msg_hdr) > 0) &&
+        (msg_hdr->flags & MSG_FLAG_RELIABLE) && check_delivered(msg_hdr)) {
+      // A retransmission no longer seen, whose ack was lost
+      DEBUG4_VALUELN("Redelivered msg from ", msg_hdr->origin);
+      send_delivered(msg_hdr, src);
+      goto DUPLICATE;
+    }
+
+    seen[seen_next].origin = msg_hdr->origin;
+    seen[seen_next].sequence = msg_hdr->sequence;
+    seen[seen_next].retry = HMTL_MSG_RETRY(msg_hdr);
+    seen[seen_next].ms = now;
+    seen_next = (seen_next + 1) % MSG_SEEN_ENTRIES;
+  }
 
+  return true;
+
+ DUPLICATE:
+  msg_drop_counts_t *drops = drop_counts(src);
+  if (drops != NULL) drops->duplicate++;
+  return false;
+}
@@ -12,15 +12,219 @@
 
 #include "HMTLMessaging.h"
 #include "ProgramManager.h"
+#include "LoopStats.h"
+#include "PixelFrame.h"
 
-// TODO: Rather than a monolithic process_msg function, instead provide
-//       an array of handler functions for each message type
-typedef boolean (*msg_handler_func)(Socket *src, msg_hdr_t *msg);
+/*
+ * Time that a single check() may spend handling queued messages before
+ * returning to the rest of the loop.
+ */
+#ifndef MSG_CHECK_BUDGET_US
+#define MSG_CHECK_BUDGET_US 2000
+#endif
+
+/*
+ * Number of recently received messages remembered in order to drop copies
+ * that arrive again over another path, and how long they are remembered.
+ */
+#ifndef MSG_SEEN_ENTRIES
+#ifdef __AVR__
+#define MSG_SEEN_ENTRIES 4
+#else
+#define MSG_SEEN_ENTRIES 8
+#endif
+#endif
+#define MSG_SEEN_TIMEOUT_MS 1000
+
+/*
+ * Number of origins for which the last reliable message delivered to this
+ * module is remembered, so that a retransmission sent after its ack was lost
+ * is acknowledged again rather than handled twice once it has been pushed
+ * out of the seen messages.
+ */
+#ifndef MSG_DELIVERED_ENTRIES
+#ifdef __AVR__
+#define MSG_DELIVERED_ENTRIES 2
+#else
+#define MSG_DELIVERED_ENTRIES 4
+#endif
+#endif
+
+/*
+ * Number of addresses for which the socket they were last heard on is
+ * remembered, and how long until a route is forgotten and messages to the
+ * address are again sent over every socket.  A route also records whether
+ * the module was last heard sending version 2 headers, in which case
+ * responses and forwarded messages sent to it are downgraded to them.
+ */
+#ifndef MSG_ROUTE_ENTRIES
+#ifdef __AVR__
+#define MSG_ROUTE_ENTRIES 4
+#else
+#define MSG_ROUTE_ENTRIES 32
+#endif
+#endif
+#define MSG_ROUTE_TIMEOUT_S 60
+
+/*
+ * Modules that belong to groups broadcast them this often.  The sockets that
+ * a group's members were heard on are remembered for up to
+ * MSG_GROUP_ROUTE_ENTRIES groups, and messages to a group are only forwarded
+ * over those sockets, or over every socket if no members are known.
+ */
+#define MSG_GROUP_ANNOUNCE_S 20
+#ifndef MSG_GROUP_ROUTE_ENTRIES
+#ifdef __AVR__
+#define MSG_GROUP_ROUTE_ENTRIES 2
+#else
+#define MSG_GROUP_ROUTE_ENTRIES 8
+#endif
+#endif
+
+/*
+ * Responses to broadcast polls and stats requests are delayed by this many
+ * milliseconds per unit of the module's address so that modules don't all
+ * respond at once, unless the poll is a discovery request which specifies
+ * its own slots.  Up to MSG_DEFERRED_ENTRIES are queued and sent by check()
+ * once their time comes.
+ */
+#define MSG_RESPONSE_SLOT_MS 2
+#ifndef MSG_DEFERRED_ENTRIES
+#define MSG_DEFERRED_ENTRIES 2
+#endif
+
+/*
+ * Bulk traffic (output, batch and pixel frame messages) without
+ * MSG_FLAG_PRIORITY is held in a queue of this many messages while the
+ * sockets are being checked, so that priority messages received from the
+ * other sources are forwarded and handled first.  Other message types are
+ * handled as they arrive.  The queue refers to each message where it was
+ * received rather than copying it, so a source isn't read again until its
+ * queued message has been handled.
+ */
+#ifndef MSG_LOW_QUEUE_ENTRIES
+#define MSG_LOW_QUEUE_ENTRIES 2
+#endif
+
+/*
+ * Value and RGB output messages replace the state of their output, so rather
+ * than the low priority queue they are held in a queue of
+ * MSG_STATE_QUEUE_ENTRIES small entries.  A newer message for an address and
+ * output already queued overwrites it in place, and one for all outputs
+ * drops the others queued for its address.  Neither the superseded message's
+ * update nor its forward takes place, which keeps a sweeping control from
+ * flooding the module and bus.  Both queues are handled in the order their
+ * messages arrived, an overwritten entry taking the place of the newest.
+ */
+// Uncomment this line to apply every queued output message in turn
+//#define DISABLE_COALESCING
+#ifndef DISABLE_COALESCING
+#define USE_COALESCING
+#endif
+
+#ifndef MSG_STATE_QUEUE_ENTRIES
+#ifdef __AVR__
+#define MSG_STATE_QUEUE_ENTRIES 2
+#else
+#define MSG_STATE_QUEUE_ENTRIES 4
+#endif
+#endif
+
+/*
+ * Messages too large for a socket are always forwarded over it in fragments.
+ * Fragmented messages to this module of up to MSG_REASSEMBLY_LEN bytes are put
+ * back together and handled once complete, which costs a buffer of that size,
+ * so AVR modules only do so if ENABLE_REASSEMBLY is defined and other modules
+ * unless DISABLE_REASSEMBLY is.  One message is reassembled at a time, the
+ * first fragment of another replacing any incomplete one.  Modules advertise
+ * reassembly in their poll response's msg_version, so that senders know
+ * whether fragments of long messages will be put back together.
+ */
+//#define ENABLE_REASSEMBLY
+//#define DISABLE_REASSEMBLY
+#if defined(ENABLE_REASSEMBLY) || \
+    (!defined(__AVR__) && !defined(DISABLE_REASSEMBLY))
+#define USE_REASSEMBLY
+#define MSG_ACCEPTED_VERSION HMTL_MSG_VERSION_LONG
+#else
+#define MSG_ACCEPTED_VERSION HMTL_MSG_VERSION
+#endif
+
+#ifndef MSG_REASSEMBLY_LEN
+#define MSG_REASSEMBLY_LEN 256
+#endif
+
+/*
+ * If enabled, messages sent with send_reliable(), or received over serial
+ * with MSG_FLAG_RELIABLE set, are kept in a window of MSG_RELIABLE_ENTRIES
+ * until their destination acknowledges them.  Each is retransmitted up to
+ * HMTL_MSG_MAX_RETRY times, the timeout doubling after each.  Destinations
+ * recognize retransmissions of the last reliable message from each origin
+ * (see MSG_DELIVERED_ENTRIES) and of any other within MSG_SEEN_TIMEOUT_MS.
+ * Modules acknowledge reliable messages whether or not this is enabled.
+ */
+// Uncomment this line to retransmit reliable messages
+//#define ENABLE_RELIABLE
+#ifdef ENABLE_RELIABLE
+#define USE_RELIABLE
+#endif
+
+#ifndef MSG_RELIABLE_ENTRIES
+#define MSG_RELIABLE_ENTRIES 4
+#endif
+#ifndef MSG_RELIABLE_TIMEOUT_MS
+#define MSG_RELIABLE_TIMEOUT_MS 100
+#endif
+
+/*
+ * Received messages may be recorded in a trace of MSG_TRACE_BYTES, dropping
+ * the oldest to make room, which is dumped in response to MSG_TYPE_TRACE so
+ * that the traffic a module saw can be replayed elsewhere.  Messages are
+ * recorded as they arrive, including copies that are then dropped as seen.
+ */
+// Uncomment this line to keep a trace of received messages
+//#define ENABLE_TRACE
+#ifdef ENABLE_TRACE
+#define USE_TRACE
+#endif
+
+#ifndef MSG_TRACE_BYTES
+#define MSG_TRACE_BYTES 512
+#endif
+
+class MessageHandler;
+
+/*
+ * Handler for a single message type, called for messages addressed to this
+ * module or broadcast.
+ *   handler: The MessageHandler processing the message
+ *   msg_hdr: The message to be processed
+ *   src: Socket the message came in on, or NULL if message was from the
+ *        serial port.
+ *   serial_socket: Socket whose data buffer is used to construct a response
+ *                  to the Serial device.
+ *   config: The device configuration
+ *
+ * Returns true if processing the message resulted in some change that may
+ * require the device's outputs to be updated.
+ */
+typedef boolean (*msg_handler_func)(MessageHandler *handler, msg_hdr_t *msg_hdr,
+                                    Socket *src, Socket *serial_socket,
+                                    config_hdr_t *config);
 typedef struct {
   uint8_t type;
   msg_handler_func function;
 } msg_handler_t;
 
+/*
+ * The built-in handlers are in a table in program memory, handlers set by the
+ * sketch with register_handler() are kept in a list of this many entries that
+ * is checked first.
+ */
+#ifndef MSG_HANDLER_OVERRIDES
+#define MSG_HANDLER_OVERRIDES 2
+#endif
+
 /*
  * This class is for processing socket messages
  */
@@ -30,19 +234,64 @@ public:
   MessageHandler(socket_addr_t _address, ProgramManager *_manager,
                  Socket *_sockets[], uint8_t _num_sockets);
 
+  /*
+   * (Re)initialize the handler in place, as the constructor does, so that a
+   * global handler can be set up without building a temporary copy of it.
+   */
+  void init(socket_addr_t _address, ProgramManager *_manager,
+            Socket *_sockets[], uint8_t _num_sockets);
+
+  /*
+   * Set the loop timing statistics reported in response to MSG_TYPE_STATS
+   */
+  void set_loop_stats(LoopStats *stats);
+
+  /*
+   * Set the groups this module belongs to, as read from its configuration.
+   * Messages to any of them are processed and the groups are announced to
+   * the other modules.
+   */
+  void set_groups(config_groups_t *groups);
+
+  /*
+   * Set the time in microseconds that check() may spend handling messages,
+   * zero limits it to a single message from each source.
+   */
+  void set_check_budget(uint16_t budget_us);
+
   /*
    * Check if a serial-ready messages should be sent over the serial port
    */
   void serial_ready();
 
   /*
-   * Check the serial device and all sockets for messages.
+   * Check the serial device and all sockets for messages, continuing until
+   * no more messages are waiting or the check budget is used, then send any
+   * deferred responses that are due and handle the queued bulk traffic with
+   * the rest of the budget.  The number of messages received is recorded as
+   * the loop's backlog.
    *
    * Returns true if processing the message resulted in some change that may
    * require the device's outputs to be updated.
    */
   boolean check(config_hdr_t *config);
 
+  /*
+   * Determine if the outputs should be updated.  Updates are held off while
+   * a pixel frame is partially received, so that it is not shown until
+   * complete, and then applied once it is.
+   */
+  boolean check_update(boolean update);
+
+  /*
+   * Set the handler for a message type, replacing any existing one, or
+   * remove it if function is NULL.  This allows sketches to add their own
+   * message types or override the built-in handling.
+   *
+   * Returns false if MSG_HANDLER_OVERRIDES handlers are already registered.
+   */
+  boolean register_handler(uint8_t type, msg_handler_func function);
+
   /*
    * Process a single message
    *   msg_hdr: The message to be processed
@@ -82,24 +331,342 @@ public:
 
   /*
    * Check if a message should be forwarded and transmit it over
-   * the indicated socket if so.
+   * the indicated socket if so.  The forwarded copy's ttl is decremented, and
+   * messages whose ttl has reached zero are not forwarded.
    */
   boolean check_and_forward(msg_hdr_t *msg_hdr, Socket *socket);
 
+  /*
+   * Forward a received message over the socket its destination was last
+   * heard on, or over every socket other than the one it arrived on if that
+   * is not known or it is a broadcast.  The message's header is updated for
+   * forwarding in place, so its ttl is decremented on return.
+   *   src: Socket the message came in on, or NULL for the serial port
+   */
+  void forward(msg_hdr_t *msg_hdr, Socket *src);
+
+  /*
+   * Return the socket that messages from an address were last received on,
+   * or NULL if it isn't known.
+   */
+  Socket *lookup_route(socket_addr_t address);
+
+  /*
+   * Return a bitmap of the sockets that members of a group were last heard
+   * on, or of all sockets if none are known.
+   */
+  uint8_t lookup_group(socket_addr_t group);
+
+  /*
+   * Send a message to a single module with MSG_FLAG_RELIABLE set, assigning
+   * it this module's origin and a new sequence.  It is retransmitted by
+   * check() until acknowledged, so the caller never waits on delivery.
+   *
+   * Returns false without sending if the message isn't to a single other
+   * module or the window of unacknowledged messages is full.
+   */
+  boolean send_reliable(msg_hdr_t *msg_hdr);
+
+  /* Number of reliable messages waiting to be acknowledged */
+  uint8_t reliable_pending();
+
+  /* Number of bytes of records in the message trace */
+  uint16_t trace_length();
+
+  /*
+   * Copy up to length bytes of the trace's records, starting at offset bytes
+   * from the oldest, into data.  Returns the number of bytes copied.
+   */
+  uint16_t read_trace(uint16_t offset, byte *data, uint16_t length);
+
+  /*
+   * Counts of messages received and dropped due to a bad CRC or version on
+   * the indicated socket, or the serial device if NULL.  Returns NULL for
+   * sockets past MAX_SOCKETS.
+   */
+  msg_drop_counts_t *drop_counts(Socket *socket);
+
+  static const uint8_t MAX_SOCKETS = 4;
+
+  uint16_t budget_overruns; // Checks that ran out of time while receiving
+  uint16_t hop_limited;     // Messages not forwarded due to their ttl
+  uint16_t low_queued;      // Bulk messages held behind priority traffic
+  uint16_t coalesced;       // Queued output messages replaced by newer ones
+  uint16_t fragmented;      // Messages forwarded in fragments
+  uint16_t reassembled;     // Fragmented messages handled once complete
+  uint16_t reassembly_dropped; // Fragmented messages missing data or too long
+  uint16_t retransmitted;   // Retransmissions of unacknowledged messages
+  uint16_t undelivered;     // Reliable messages never acknowledged
+  uint16_t reliable_full;   // Reliable messages not kept, the window was full
+  uint16_t untraced;        // Messages too long to be kept in the trace
+
 private:
   ProgramManager *manager;
   socket_addr_t address;
   Socket **sockets;
   uint8_t num_sockets;
+  LoopStats *loop_stats;
+
+  PixelFrame pixel_frame;
+  boolean deferred_update;
+
+  uint16_t check_budget_us;
+  uint16_t received; // Messages received by check_serial and check_socket
+
+  msg_drop_counts_t serial_drops;
+  msg_drop_counts_t socket_drops[MAX_SOCKETS];
+
+  typedef struct {
+    socket_addr_t origin;
+    uint8_t sequence;
+    uint8_t retry; // Highest retransmission of a reliable message received
+    uint16_t ms;
+  } msg_seen_t;
+  msg_seen_t seen[MSG_SEEN_ENTRIES];
+  uint8_t seen_next;
+
+  typedef struct {
+    socket_addr_t origin;
+    uint8_t sequence;
+  } msg_last_delivered_t;
+  msg_last_delivered_t last_delivered[MSG_DELIVERED_ENTRIES];
+  uint8_t delivered_next;
+
+  boolean check_delivered(msg_hdr_t *msg_hdr);
+  void record_delivered(msg_hdr_t *msg_hdr);
+
+  void init_seen();
+  boolean check_seen(msg_hdr_t *msg_hdr, Socket *src);
+
+  typedef struct {
+    socket_addr_t address;
+    uint8_t socket;
+    uint16_t heard; // Time last heard in units of 1024ms
+#ifdef HMTL_USE_V2_COMPAT
+    boolean v2; // Last heard sending version 2 headers
+#endif
+  } msg_route_t;
+  msg_route_t routes[MSG_ROUTE_ENTRIES];
+
+  void init_routes();
+  void learn_route(socket_addr_t route_address, Socket *socket,
+                   boolean v2 = false);
+  boolean sends_v2(socket_addr_t route_address);
+  void send_to(Socket *socket, socket_addr_t dest, byte *msg, uint16_t len);
+
+  config_groups_t *groups;
+  boolean groups_announced;
+  unsigned long groups_announce_ms;
+
+  typedef struct {
+    socket_addr_t group;
+    uint8_t sockets; // Bitmap of the sockets members were heard on
+    uint16_t heard;  // Time last heard in units of 1024ms
+  } msg_group_route_t;
+  msg_group_route_t group_routes[MSG_GROUP_ROUTE_ENTRIES];
+
+  void learn_group(socket_addr_t group, Socket *socket);
+  void send_groups();
+
+  boolean should_forward(msg_hdr_t *msg_hdr);
+  void send_forward(msg_hdr_t *msg_hdr, Socket *socket);
+
+  void handle_output(output_hdr_t *out_hdr);
+
+  boolean receive(msg_hdr_t *msg_hdr, Socket *src, Socket *serial_socket,
+                  config_hdr_t *config);
+  boolean dispatch(msg_hdr_t *msg_hdr, Socket *src, Socket *serial_socket,
+                   config_hdr_t *config);
+  boolean handle_low(config_hdr_t *config);
+  uint8_t low_pending();
+  boolean low_held(Socket *src);
+  boolean queue_state(msg_hdr_t *msg_hdr, Socket *src, config_hdr_t *config);
+
+  msg_handler_t handler_overrides[MSG_HANDLER_OVERRIDES];
+  uint8_t num_overrides;
+  static const msg_handler_func default_handlers[];
+
+  void init_handlers();
+  static int8_t handler_index(uint8_t type);
+  msg_handler_func lookup_handler(uint8_t type);
+
+  typedef struct {
+    Socket *socket; // NULL if the entry is unused
+    socket_addr_t dest;
+    unsigned long send_ms;
+    uint8_t type;
+    uint8_t flags;
+    uint8_t request_flags;
+  } msg_deferred_t;
+  msg_deferred_t deferred[MSG_DEFERRED_ENTRIES];
+
+  void send_response(uint8_t type, Socket *src, Socket *sock,
+                     socket_addr_t dest, uint8_t flags, uint8_t request_flags,
+                     config_hdr_t *config);
+  boolean defer_response(uint8_t type, Socket *socket, socket_addr_t dest,
+                         uint8_t flags, uint8_t request_flags,
+                         unsigned long delay_ms);
+  void send_deferred(config_hdr_t *config);
+
+  /* A configuration dump in progress, sent a page per check() */
+  typedef struct {
+    Socket *src;        // Socket to respond over, NULL for the Serial device
+    Socket *sock;       // Socket whose buffer is used, NULL if no dump
+    socket_addr_t dest;
+    uint16_t offset;    // EEPROM offset of the next page to send
+    uint8_t pages;      // Pages remaining, zero for all
+    uint8_t flags;
+  } msg_dump_t;
+  msg_dump_t dump;
+
+  void send_dump_page();
+
+#ifdef USE_REASSEMBLY
+  /* The fragmented message being reassembled */
+  typedef struct {
+    socket_addr_t origin; // Origin and sequence from the fragments
+    uint8_t sequence;
+    uint16_t length;      // Length of the whole message
+    uint16_t next;        // Offset of the next fragment, length once complete
+    byte msg[MSG_REASSEMBLY_LEN];
+  } msg_reassembly_t;
+  msg_reassembly_t reassembly;
+#endif
+
+  boolean reassemble(msg_hdr_t *msg_hdr, Socket *src, Socket *serial_socket,
+                     config_hdr_t *config);
+
+  /* Handlers for the built-in message types */
+  static boolean handle_output_msg(MessageHandler *handler, msg_hdr_t *msg_hdr,
+                                   Socket *src, Socket *serial_socket,
+                                   config_hdr_t *config);
+  static boolean handle_batch_msg(MessageHandler *handler, msg_hdr_t *msg_hdr,
+                                  Socket *src, Socket *serial_socket,
+                                  config_hdr_t *config);
+  static boolean handle_pixel_frame_msg(MessageHandler *handler,
+                                        msg_hdr_t *msg_hdr,
+                                        Socket *src, Socket *serial_socket,
+                                        config_hdr_t *config);
+  static boolean handle_poll_msg(MessageHandler *handler, msg_hdr_t *msg_hdr,
+                                 Socket *src, Socket *serial_socket,
+                                 config_hdr_t *config);
+  static boolean handle_stats_msg(MessageHandler *handler, msg_hdr_t *msg_hdr,
+                                  Socket *src, Socket *serial_socket,
+                                  config_hdr_t *config);
+  static boolean handle_set_addr_msg(MessageHandler *handler,
+                                     msg_hdr_t *msg_hdr,
+                                     Socket *src, Socket *serial_socket,
+                                     config_hdr_t *config);
+  static boolean handle_sensor_msg(MessageHandler *handler, msg_hdr_t *msg_hdr,
+                                   Socket *src, Socket *serial_socket,
+                                   config_hdr_t *config);
+  static boolean handle_timesync_msg(MessageHandler *handler,
+                                     msg_hdr_t *msg_hdr,
+                                     Socket *src, Socket *serial_socket,
+                                     config_hdr_t *config);
+  static boolean handle_dump_config_msg(MessageHandler *handler,
+                                        msg_hdr_t *msg_hdr,
+                                        Socket *src, Socket *serial_socket,
+                                        config_hdr_t *config);
+  static boolean handle_fragment_msg(MessageHandler *handler,
+                                     msg_hdr_t *msg_hdr,
+                                     Socket *src, Socket *serial_socket,
+                                     config_hdr_t *config);
+  static boolean handle_groups_msg(MessageHandler *handler,
+                                   msg_hdr_t *msg_hdr,
+                                   Socket *src, Socket *serial_socket,
+                                   config_hdr_t *config);
+  static boolean handle_delivered_msg(MessageHandler *handler,
+                                      msg_hdr_t *msg_hdr,
+                                      Socket *src, Socket *serial_socket,
+                                      config_hdr_t *config);
+  static boolean handle_trace_msg(MessageHandler *handler,
+                                  msg_hdr_t *msg_hdr,
+                                  Socket *src, Socket *serial_socket,
+                                  config_hdr_t *config);
 
   /*
    * Messages from a serial interface may come in across multiple calls to
-   * check serial and so must be buffered.
+   * check serial and so must be buffered.  The buffer must hold either the
+   * largest single message or the largest batch.
    */
-  static const uint8_t MSG_MAX_SZ = (sizeof(msg_hdr_t) + sizeof(msg_max_t));
+  static const uint8_t MSG_MAX_SZ =
+          (HMTL_MSG_BATCH_MAX_LEN > sizeof(msg_hdr_t) + sizeof(msg_max_t) ?
+           HMTL_MSG_BATCH_MAX_LEN : sizeof(msg_hdr_t) + sizeof(msg_max_t));
   byte serial_msg[MSG_MAX_SZ];
   byte serial_msg_offset;
 
+#ifdef HMTL_USE_V2_COMPAT
+  /* Version 2 messages from a socket are upgraded into a copy */
+  byte upgrade_msg[MSG_MAX_SZ];
+#endif
+
+  /*
+   * Bulk traffic waiting to be forwarded and handled, oldest first, each
+   * message left in its source's receive buffer
+   */
+  typedef struct {
+    Socket *src; // Socket the message came in on, NULL for the serial port
+    uint8_t order; // Stamp from queue_order when queued
+    msg_hdr_t *msg;
+  } msg_queued_t;
+  msg_queued_t low_queue[MSG_LOW_QUEUE_ENTRIES];
+  uint8_t low_head;
+  uint8_t low_count;
+  uint8_t queue_order;
+
+#ifdef USE_COALESCING
+  /* Value and RGB messages waiting, in no order but their stamps */
+  typedef struct {
+    Socket *src;
+    uint8_t order;
+    boolean used;
+    byte msg[HMTL_MSG_RGB_LEN];
+  } msg_state_queued_t;
+  msg_state_queued_t state_queue[MSG_STATE_QUEUE_ENTRIES];
+  uint8_t state_count;
+#endif
+
+#ifdef USE_RELIABLE
+  /* Reliable messages waiting to be acknowledged */
+  typedef struct {
+    boolean used;
+    unsigned long sent_ms; // Time of the latest transmission
+    byte msg[MSG_MAX_SZ];
+  } msg_reliable_t;
+  msg_reliable_t reliable[MSG_RELIABLE_ENTRIES];
+#endif
+
+  boolean track_reliable(msg_hdr_t *msg_hdr);
+  void send_retries();
+  void send_delivered(msg_hdr_t *msg_hdr, Socket *src);
+  Socket *serial_buffer_socket();
+
+#ifdef USE_TRACE
+  /* Records of received messages, oldest first from trace_start */
+  byte trace_buffer[MSG_TRACE_BYTES];
+  uint16_t trace_start;
+  uint16_t trace_used;
+  boolean trace_stopped;
+
+  /* A trace dump in progress, sent a page per check() */
+  typedef struct {
+    Socket *src;        // Socket to respond over, NULL for the Serial device
+    Socket *sock;       // Socket whose buffer is used, NULL if no dump
+    socket_addr_t dest;
+    uint16_t offset;    // Offset in the trace of the next page to send
+    uint8_t pages;      // Pages remaining, zero for all
+    uint8_t flags;
+    uint8_t control;
+  } msg_trace_dump_t;
+  msg_trace_dump_t trace_dump;
+#endif
+
+  void init_trace();
+  void trace(msg_hdr_t *msg_hdr, Socket *src, socket_addr_t sender);
+  void trace_write(uint16_t offset, const void *data, uint16_t length);
+  void send_trace_page();
+
   /*
    * Parameters for determining if a "ready" message should be sent to the
    * serial port.
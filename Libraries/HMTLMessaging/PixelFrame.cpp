@@ -0,0 +1,220 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Reception of raw pixel frames streamed to a pixel output
+ ******************************************************************************/
+
+#include <Arduino.h>
+
+#ifndef DEBUG_LEVEL
+  #define DEBUG_LEVEL DEBUG_ERROR
+#endif
+#include "Debug.h"
+
+#include "HMTLMessaging.h"
+#include "PixelFrame.h"
+#include "ProgramManager.h"
+
+#ifdef USE_PIXELUTIL
+#include "PixelUtil.h"
+#endif
+
+PixelFrame::PixelFrame() {
+  frames = 0;
+  dropped = 0;
+#ifdef USE_PIXEL_FRAME
+  receiving = false;
+  last_ms = 0;
+  have_last = false;
+#endif
+}
+
+#if defined(USE_PIXEL_FRAME) && defined(USE_PIXELUTIL)
+/*
+ * Decode a message's data into the pixel array starting at pixel pos,
+ * returning the position following the last pixel or PIXEL_DECODE_ERROR if
+ * the data is invalid.  Pixels past the end of the array are discarded.
+ */
+#define PIXEL_DECODE_ERROR 0xFFFF
+
+static uint16_t decode_pixels(PixelUtil *pixels, uint16_t pos,
+                              uint8_t encoding,
+                              const byte *data, const byte *end) {
+  uint16_t num_pixels = pixels->numPixels();
+
+  switch (encoding) {
+    case PIXEL_FRAME_RAW: {
+      uint16_t count = (end - data) / 3;
+      if (pos < num_pixels) {
+        memcpy(&pixels->leds[pos], data,
+               (pos + count > num_pixels ? num_pixels - pos : count) * 3);
+      }
+      return pos + count;
+    }
+
+    case PIXEL_FRAME_RLE: {
+      while (data + 4 <= end) {
+        uint8_t count = data[0];
+        CRGB color(data[1], data[2], data[3]);
+        for (uint8_t i = 0; (i < count) && (pos + i < num_pixels); i++) {
+          pixels->leds[pos + i] = color;
+        }
+        pos += count;
+        data += 4;
+      }
+      break;
+    }
+
+    case PIXEL_FRAME_DELTA: {
+      while (data + 2 <= end) {
+        uint8_t count = data[1];
+        pos += data[0];
+        data += 2;
+        if (data + count * 3 > end) {
+          return PIXEL_DECODE_ERROR;
+        }
+        if (pos < num_pixels) {
+          memcpy(&pixels->leds[pos], data,
+                 (pos + count > num_pixels ? num_pixels - pos : count) * 3);
+        }
+        pos += count;
+        data += count * 3;
+      }
+      break;
+    }
+
+    default:
+      return PIXEL_DECODE_ERROR;
+  }
+
+  if (data != end) {
+    return PIXEL_DECODE_ERROR;
+  }
+  return pos;
+}
+#endif
+
+boolean PixelFrame::handle_msg(msg_hdr_t *msg_hdr, byte num_outputs,
+                               output_hdr_t *outputs[], void *objects[]) {
+#if defined(USE_PIXEL_FRAME) && defined(USE_PIXELUTIL)
+  msg_pixel_frame_t *msg = hmtl_msg_view<msg_pixel_frame_t>(msg_hdr);
+  if (msg == NULL) {
+    DEBUG_ERR("PixelFrame: msg too short");
+    return false;
+  }
+
+  if ((msg->output >= num_outputs) || (outputs[msg->output] == NULL) ||
+      (outputs[msg->output]->type != HMTL_OUTPUT_PIXELS) ||
+      (objects == NULL) || (objects[msg->output] == NULL)) {
+    DEBUG1_VALUELN("PixelFrame: invalid output ", msg->output);
+    return false;
+  }
+
+  if (msg->offset == 0) {
+    /* Start of a new frame, replacing any incomplete one */
+    if (pending()) {
+      dropped++;
+    }
+
+    if ((msg->encoding == PIXEL_FRAME_DELTA) &&
+        (!have_last || (msg->output != last_output) ||
+         (msg->base != last_frame))) {
+      /* The pixels don't hold the frame this is relative to */
+      DEBUG1_VALUELN("PixelFrame: no delta base ", msg->base);
+      dropped++;
+      return false;
+    }
+
+    receiving = true;
+    have_last = false;
+    output = msg->output;
+    frame = msg->frame;
+    next_offset = 0;
+  } else if (!receiving || (msg->frame != frame) || (msg->output != output) ||
+             (msg->offset != next_offset)) {
+    /* A fragment was missed, ignore the rest of this frame */
+    if (receiving) {
+      DEBUG1_VALUELN("PixelFrame: missed fragment ", next_offset);
+      receiving = false;
+      dropped++;
+    }
+    return false;
+  }
+
+  next_offset = decode_pixels((PixelUtil *)objects[output], next_offset,
+                              msg->encoding, msg->data,
+                              (byte *)msg_hdr + hmtl_msg_length(msg_hdr));
+  if (next_offset == PIXEL_DECODE_ERROR) {
+    DEBUG1_VALUELN("PixelFrame: invalid data ", msg->encoding);
+    receiving = false;
+    dropped++;
+    return false;
+  }
+  last_ms = timesync.ms();
+
+  if (!(msg_hdr->flags & MSG_FLAG_MORE_DATA)) {
+    DEBUG4_VALUELN("PixelFrame: complete ", frame);
+    receiving = false;
+    frames++;
+
+    have_last = true;
+    last_output = output;
+    last_frame = frame;
+    return true;
+  }
+#endif
+
+  return false;
+}
+
+boolean PixelFrame::pending() {
+#ifdef USE_PIXEL_FRAME
+  if (receiving && (timesync.ms() - last_ms > PIXEL_FRAME_TIMEOUT_MS)) {
+    DEBUG1_VALUELN("PixelFrame: timed out ", frame);
+    receiving = false;
+    dropped++;
+  }
+  return receiving;
+#else
+  return false;
+#endif
+}
+
+/* Format a message with the RGB values for a run of pixels */
+uint16_t hmtl_pixel_frame_fmt(byte *buffer, uint16_t buffsize,
+                              socket_addr_t address, byte flags,
+                              uint8_t output, uint8_t frame, uint16_t offset,
+                              const byte *rgb, uint16_t num_pixels) {
+  return hmtl_pixel_frame_encoded_fmt(buffer, buffsize, address, flags,
+                                      output, frame, offset,
+                                      PIXEL_FRAME_RAW, 0,
+                                      rgb, num_pixels * 3);
+}
+
+/* Format a message with already encoded pixel data */
+uint16_t hmtl_pixel_frame_encoded_fmt(byte *buffer, uint16_t buffsize,
+                                      socket_addr_t address, byte flags,
+                                      uint8_t output, uint8_t frame,
+                                      uint16_t offset,
+                                      uint8_t encoding, uint8_t base,
+                                      const byte *data, uint16_t datalen) {
+  if (buffsize > HMTL_MAX_MSG_LEN) {
+    buffsize = HMTL_MAX_MSG_LEN;
+  }
+  msg_pixel_frame_t *msg_frame =
+          hmtl_msg_build<msg_pixel_frame_t>(buffer, buffsize, datalen);
+  if (msg_frame == NULL) {
+    return 0;
+  }
+
+  msg_frame->output = output;
+  msg_frame->frame = frame;
+  msg_frame->offset = offset;
+  msg_frame->encoding = encoding;
+  msg_frame->base = base;
+  memcpy(msg_frame->data, data, datalen);
+
+  return hmtl_msg_finish<msg_pixel_frame_t>(buffer, address, flags, datalen);
+}
@@ -0,0 +1,119 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Reception of pixel frames streamed to a pixel output.  A frame is split
+ * across as many MSG_TYPE_PIXEL_FRAME messages as needed, with the RGB values
+ * of each being decoded directly into the PixelUtil's pixel array.
+ *
+ * While a frame is partially received output updates are held off so that
+ * partial frames are not shown.  Any program running on the output will
+ * overwrite streamed frames and should be cleared first.
+ ******************************************************************************/
+
+#ifndef HMTL_PIXEL_FRAME_H
+#define HMTL_PIXEL_FRAME_H
+
+#include "HMTLMessaging.h"
+
+// Uncomment this line to remove pixel frame streaming
+//#define DISABLE_PIXEL_FRAME
+#ifndef DISABLE_PIXEL_FRAME
+#define USE_PIXEL_FRAME
+#endif
+
+/*
+ * If the rest of a frame hasn't arrived within this time then it is
+ * abandoned and output updates resume.
+ */
+#define PIXEL_FRAME_TIMEOUT_MS 250
+
+class PixelFrame {
+ public:
+  PixelFrame();
+
+  /*
+   * Copy the pixels from a MSG_TYPE_PIXEL_FRAME message into the output.
+   *
+   * Returns true if this message completed a frame.
+   */
+  boolean handle_msg(msg_hdr_t *msg_hdr, byte num_outputs,
+                     output_hdr_t *outputs[], void *objects[]);
+
+  /* Returns true while a frame is partially received */
+  boolean pending();
+
+  uint16_t frames;  // Frames completely received
+  uint16_t dropped; // Frames abandoned due to a missing fragment or timeout
+
+ private:
+#ifdef USE_PIXEL_FRAME
+  boolean receiving;
+  uint8_t output;
+  uint8_t frame;
+  uint16_t next_offset;
+  unsigned long last_ms;
+
+  /* The last complete frame, which delta encoded frames are applied to */
+  boolean have_last;
+  uint8_t last_output;
+  uint8_t last_frame;
+#endif
+};
+
+/*******************************************************************************
+ * Message format for MSG_TYPE_PIXEL_FRAME
+ *
+ * Each message carries the values for a run of pixels starting at offset, all
+ * messages of a frame have the same frame id and must be sent in order
+ * starting from offset 0, each starting where the previous one's pixels end.
+ * MSG_FLAG_MORE_DATA is set on all but the last.
+ *
+ * 6B:  |  output  |  frame   |       offset        |
+ *      | encoding |   base   | data ...
+ *
+ * The data depends on the encoding:
+ *   RAW:   | R | G | B | for each pixel
+ *   RLE:   | count | R | G | B | for each run of a single color
+ *   DELTA: | skip | count | R | G | B | ... for each span, leaving skip pixels
+ *          unchanged and then setting count pixels.  Pixels are left as in the
+ *          frame identified by base, which must be the last one received.
+ */
+
+#define PIXEL_FRAME_RAW   0x0
+#define PIXEL_FRAME_RLE   0x1
+#define PIXEL_FRAME_DELTA 0x2
+
+typedef struct {
+  uint8_t output;
+  uint8_t frame;
+  uint16_t offset;
+  uint8_t encoding;
+  uint8_t base;     // Frame that a delta encoding is relative to
+  uint8_t data[0];
+} msg_pixel_frame_t;
+#define HMTL_MSG_PIXEL_FRAME_MIN_LEN (sizeof (msg_hdr_t) + sizeof (msg_pixel_frame_t))
+HMTL_MSG_PAYLOAD(msg_pixel_frame_t, MSG_TYPE_PIXEL_FRAME, HMTL_OUTPUT_NONE);
+
+/* Number of raw pixels that fit in a single message of the indicated size */
+#define HMTL_PIXEL_FRAME_PIXELS(size) \
+  (((size) - HMTL_MSG_PIXEL_FRAME_MIN_LEN) / 3)
+
+uint16_t hmtl_pixel_frame_fmt(byte *buffer, uint16_t buffsize,
+                              socket_addr_t address, byte flags,
+                              uint8_t output, uint8_t frame, uint16_t offset,
+                              const byte *rgb, uint16_t num_pixels);
+
+/*
+ * Format a message with pre-encoded data, as produced by the python library's
+ * encoder.
+ */
+uint16_t hmtl_pixel_frame_encoded_fmt(byte *buffer, uint16_t buffsize,
+                                      socket_addr_t address, byte flags,
+                                      uint8_t output, uint8_t frame,
+                                      uint16_t offset,
+                                      uint8_t encoding, uint8_t base,
+                                      const byte *data, uint16_t datalen);
+
+#endif
@@ -82,7 +82,7 @@ void hmtl_dump_config() {
  * what was read.
  */
 int hmtl_read_config(config_hdr_t *hdr, config_max_t outputs[],
-                     int max_outputs) 
+                     int max_outputs, config_groups_t *groups)
 {
   int addr;
 
@@ -124,6 +124,34 @@ int hmtl_read_config(config_hdr_t *hdr, config_max_t outputs[],
         return -5;
       }
     }
+  } else if (hdr->flags & HMTL_FLAG_GROUPS) {
+    /* Skip the outputs to reach the groups following them */
+    for (int i = 0; i < hdr->num_outputs; i++) {
+      config_max_t skipped;
+      addr = EEPROM_safe_read(addr, (uint8_t *)&skipped, sizeof (skipped));
+      if (addr <= 0) {
+        DEBUG_ERR("hmtl_read_config: error skipping outputs");
+        return -5;
+      }
+    }
+  }
+
+  if (groups != NULL) {
+    groups->type = HMTL_CONFIG_GROUPS;
+    groups->num_groups = 0;
+  }
+  if (hdr->flags & HMTL_FLAG_GROUPS) {
+    /*
+     * The groups follow the outputs, so that firmware predating them reads
+     * the same layout.  They are skipped if not wanted.
+     */
+    config_groups_t read_groups;
+    if (groups == NULL) groups = &read_groups;
+    addr = EEPROM_safe_read(addr, (uint8_t *)groups, sizeof (config_groups_t));
+    if ((addr <= 0) || !hmtl_validate_groups(groups)) {
+      DEBUG_ERR("hmtl_read_config: error reading groups");
+      return -6;
+    }
   }
 
   EEPROM_end();
@@ -139,7 +167,8 @@ int hmtl_read_config(config_hdr_t *hdr, config_max_t outputs[],
  * Write out the HMTL config, returning the EEProm address following
  * what was written.
  */
-int hmtl_write_config(config_hdr_t *hdr, output_hdr_t *outputs[])
+int hmtl_write_config(config_hdr_t *hdr, output_hdr_t *outputs[],
+                      config_groups_t *groups)
 {
   int addr;
 
@@ -147,6 +176,11 @@ int hmtl_write_config(config_hdr_t *hdr, output_hdr_t *outputs[])
 
   hdr->magic = HMTL_CONFIG_MAGIC;
   hdr->protocol_version = HMTL_CONFIG_VERSION;
+  if ((groups != NULL) && (groups->num_groups > 0)) {
+    hdr->flags |= HMTL_FLAG_GROUPS;
+  } else {
+    hdr->flags &= ~HMTL_FLAG_GROUPS;
+  }
   addr = EEPROM_safe_write(HMTL_CONFIG_ADDR,
                            (uint8_t *)hdr, sizeof (config_hdr_t));
   if (addr < 0) {
@@ -166,6 +200,16 @@ int hmtl_write_config(config_hdr_t *hdr, output_hdr_t *outputs[])
     }
   }
 
+  if (hdr->flags & HMTL_FLAG_GROUPS) {
+    groups->type = HMTL_CONFIG_GROUPS;
+    addr = EEPROM_safe_write(addr, (uint8_t *)groups,
+                             sizeof (config_groups_t));
+    if (addr < 0) {
+      DEBUG_ERR("hmtl_write_config: failed to write groups to EEProm");
+      return -3;
+    }
+  }
+
   EEPROM_end();
 
   DEBUG2_VALUE("hmtl_write_config: size=", addr - HMTL_CONFIG_ADDR);
@@ -485,6 +529,15 @@ boolean hmtl_validate_xbee(config_xbee_t *xbee) {
   return true;
 }
 
+boolean hmtl_validate_groups(config_groups_t *groups) {
+  if (groups->type != HMTL_CONFIG_GROUPS) return false;
+  if (groups->num_groups > HMTL_MAX_GROUPS) return false;
+  for (uint8_t i = 0; i < groups->num_groups; i++) {
+    if (!HMTL_IS_GROUP(groups->groups[i])) return false;
+  }
+  return true;
+}
+
 boolean hmtl_validate_config(config_hdr_t *hdr, output_hdr_t *outputs[],
                              int num_outputs) {
   uint32_t pinmap = 0;
@@ -602,6 +655,23 @@ void hmtl_print_header(config_hdr_t *hdr) {
 #endif
 }
 
+void hmtl_print_groups(config_groups_t *groups) {
+#if DEBUG_LEVEL >= 3
+  DEBUG3_PRINT("  groups:");
+  for (uint8_t i = 0; i < groups->num_groups; i++) {
+    DEBUG3_VALUE(" ", groups->groups[i]);
+  }
+  DEBUG_PRINT_END();
+#endif
+}
+
+boolean hmtl_in_group(config_groups_t *groups, uint16_t address) {
+  for (uint8_t i = 0; i < groups->num_groups; i++) {
+    if (groups->groups[i] == address) return true;
+  }
+  return false;
+}
+
 void hmtl_print_output(output_hdr_t *out) {
 #if DEBUG_LEVEL >= 3
   DEBUG3_VALUE("  output ", out->output);
@@ -719,13 +789,15 @@ int32_t hmtl_setup(config_hdr_t *config,
                    config_rgb_t *rgb_output,
                    config_value_t *value_output,
 		   
-                   int *configOffset
+                   int *configOffset,
+                   config_groups_t *groups
                    ) {
   int32_t outputs_found = 0;
 
   int offset = hmtl_read_config(config,
                                 readoutputs, 
-                                num_outputs);
+                                num_outputs,
+                                groups);
   if (offset < 0) {
     DEBUG_ERR("Failed to read configuration");
     DEBUG_ERR_STATE(12);
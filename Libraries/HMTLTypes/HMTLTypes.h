@@ -109,6 +109,7 @@ typedef struct {
 
 #define HMTL_FLAG_MASTER 0x1
 #define HMTL_FLAG_SERIAL 0x2
+#define HMTL_FLAG_GROUPS 0x4 // A config_groups_t follows the outputs
 
 #define HMTL_NO_OUTPUT (uint8_t)-1
 #define HMTL_ALL_OUTPUTS (uint8_t)-2
@@ -165,20 +166,41 @@ typedef struct __attribute__((__packed__)) {
 
 typedef config_mpr121_t config_max_t; // Set to the largest output structure
 
+/*
+ * Group addresses that a module belongs to in addition to its own address,
+ * stored following the outputs when HMTL_FLAG_GROUPS is set.  Group addresses
+ * are those from HMTL_GROUP_BASE up to just below the invalid address.
+ */
+#define HMTL_CONFIG_GROUPS 0xE3 // Type of the object, as its config command
+#define HMTL_MAX_GROUPS 4
+#define HMTL_GROUP_BASE (uint16_t)0xFF00
+#define HMTL_IS_GROUP(addr) \
+  (((uint16_t)(addr) >= HMTL_GROUP_BASE) && ((uint16_t)(addr) < 0xFFFE))
+
+typedef struct __attribute__((__packed__)) {
+  byte type;
+  uint8_t num_groups;
+  uint16_t groups[HMTL_MAX_GROUPS];
+} config_groups_t;
+
 /* Dump the entire raw configuration to serial */
 void hmtl_dump_config();
 
+/* The groups are read into groups if provided */
 int hmtl_read_config(config_hdr_t *hdr, config_max_t outputs[],
-                     int max_outputs);
+                     int max_outputs, config_groups_t *groups = NULL);
 
 int32_t hmtl_setup(config_hdr_t *config, 
                    config_max_t readoutputs[], output_hdr_t *outputs[], 
                    void *objects[], byte num_outputs, 
                    void *rs485, void *xbee, void *pixels, void *mpr121,
                    config_rgb_t *rgb_output, config_value_t *value_output,
-                   int *configOffset);
+                   int *configOffset,
+                   config_groups_t *groups = NULL);
 
-int hmtl_write_config(config_hdr_t *hdr, output_hdr_t *outputs[]);
+/* Groups are written and HMTL_FLAG_GROUPS set if any are provided */
+int hmtl_write_config(config_hdr_t *hdr, output_hdr_t *outputs[],
+                      config_groups_t *groups = NULL);
 int hmtl_setup_output(config_hdr_t *config, output_hdr_t *hdr, void *data);
 int hmtl_update_output(output_hdr_t *hdr, void *data);
 
@@ -194,6 +216,7 @@ boolean hmtl_validate_pixels(config_pixels_t *pixels);
 boolean hmtl_validate_mpr121(config_mpr121_t *mpr121);
 boolean hmtl_validate_rs485(config_rs485_t *rs485);
 boolean hmtl_validate_xbee(config_xbee_t *xbee);
+boolean hmtl_validate_groups(config_groups_t *groups);
 boolean hmtl_validate_config(config_hdr_t *config_hdr, output_hdr_t *outputs[],
                              int num_outputs);
 
@@ -201,5 +224,9 @@ boolean hmtl_validate_config(config_hdr_t *config_hdr, output_hdr_t *outputs[],
 void hmtl_print_config(config_hdr_t *hdr, output_hdr_t *outputs[]);
 void hmtl_print_header(config_hdr_t *hdr);
 void hmtl_print_output(output_hdr_t *val);
+void hmtl_print_groups(config_groups_t *groups);
+
+/* Returns true if the address is one of the groups */
+boolean hmtl_in_group(config_groups_t *groups, uint16_t address);
 
 #endif
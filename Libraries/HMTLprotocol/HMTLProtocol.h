@@ -23,6 +23,7 @@
 #define HMTL_COMMAND_ADDRESS   0xE0
 #define HMTL_COMMAND_DEVICE_ID 0xE1
 #define HMTL_COMMAND_BAUD      0xE2
+#define HMTL_COMMAND_GROUPS    0xE3 // Count byte followed by the groups
 
 /* Terminator indicating that a complete command has been received */
 #define HMTL_TERMINATOR   (uint32_t)(0xFEFEFEFE)
@@ -74,7 +74,8 @@ unsigned long TimeSync::s() {
   return ms() / 1000;
 }
 
-void TimeSync::sendSyncMsg(Socket *socket, socket_addr_t target, byte phase, int adjustment = 0) {
+void TimeSync::sendSyncMsg(Socket *socket, socket_addr_t target, byte phase, int adjustment = 0,
+                           byte version) {
   if (socket->send_data_size < HMTL_MSG_SIZE(msg_time_sync_t)) {
     DEBUG1_VALUELN("sync buf too small: ", socket->send_data_size);
     //    DEBUG_ERR("startsync to small");
@@ -87,10 +88,15 @@ void TimeSync::sendSyncMsg(Socket *socket, socket_addr_t target, byte phase, int
   msg_time->timestamp = ms() + adjustment;
 
   hmtl_msg_fmt(msg_hdr, target, HMTL_MSG_SIZE(msg_time_sync_t), MSG_TYPE_TIMESYNC);
-  socket->sendMsgTo(target, socket->send_buffer, HMTL_MSG_SIZE(msg_time_sync_t));
 
   DEBUG3_VALUE(" phase:", phase);
   DEBUG3_VALUE(" time:", msg_time->timestamp);
+
+  uint16_t len = HMTL_MSG_SIZE(msg_time_sync_t);
+  if (version == HMTL_MSG_VERSION_2) {
+    len = hmtl_msg_downgrade(msg_hdr);
+  }
+  socket->sendMsgTo(target, socket->send_buffer, len);
 }
 
 /*
@@ -102,7 +108,8 @@ void TimeSync::sendSyncMsg(Socket *socket, socket_addr_t target, byte phase, int
 // TODO: Static method?
 boolean TimeSync::synchronize(Socket *socket,
                               socket_addr_t target,
-                              msg_hdr_t *msg_hdr) {
+                              msg_hdr_t *msg_hdr,
+                              byte version) {
   if (msg_hdr == NULL) {
     /* This was called to synchronize the times to a remote address */
     if (state != STATE_IDLE) {
@@ -123,7 +130,8 @@ boolean TimeSync::synchronize(Socket *socket,
 
     unsigned long now = millis();
     msg_time_sync_t *msg_time = (msg_time_sync_t *)(msg_hdr + 1);
-    socket_addr_t source = socket->sourceFromData(msg_hdr);
+    socket_addr_t source = (target != SOCKET_ADDR_INVALID ? target :
+                            socket->sourceFromData(msg_hdr));
 
     switch (msg_time->sync_phase) {
       case TIMESYNC_CHECK: {
@@ -133,7 +141,7 @@ boolean TimeSync::synchronize(Socket *socket,
           DEBUG3_VALUE(" ms:", local_now);
           DEBUG3_VALUE(" diff:", (long)(msg_time->timestamp + latency - local_now));
         );
-        sendSyncMsg(socket, source, TIMESYNC_ACK, latency);
+        sendSyncMsg(socket, source, TIMESYNC_ACK, latency, version);
         break;
       }
 
@@ -146,7 +154,7 @@ boolean TimeSync::synchronize(Socket *socket,
             latency = now;
 
             // Reply with ack
-            sendSyncMsg(socket, source, TIMESYNC_ACK);
+            sendSyncMsg(socket, source, TIMESYNC_ACK, 0, version);
             state = STATE_AWAITING_SET;
             break;
           }
@@ -170,7 +178,7 @@ boolean TimeSync::synchronize(Socket *socket,
         DEBUG3_VALUE("ACK from:", source);
         if (state == STATE_AWAITING_ACK) {
           // Send TIMESYNC_SET
-          sendSyncMsg(socket, source, TIMESYNC_SET);
+          sendSyncMsg(socket, source, TIMESYNC_SET, 0, version);
           state = STATE_IDLE;
         } else {
           DEBUG3_COMMAND(unsigned long local_now = ms();
@@ -30,9 +30,16 @@ class TimeSync {
   unsigned long s();
   void set(unsigned long time);
 
+  /*
+   * Begin synchronizing with target if msg_hdr is NULL, otherwise handle a
+   * received sync message.  A received message that isn't in the socket's
+   * data, such as an upgraded version 2 message, gives its sender as target
+   * and the header version to reply with.
+   */
   boolean synchronize(Socket *socket,
                       socket_addr_t target,
-                      msg_hdr_t *msg_hdr);
+                      msg_hdr_t *msg_hdr,
+                      byte version = HMTL_MSG_VERSION);
   void resynchronize(Socket *socket,
                      socket_addr_t target);
   void check(Socket *socket, socket_addr_t target);
@@ -43,7 +50,8 @@ class TimeSync {
   byte state;
   unsigned long last_msg_time;
 
-  void sendSyncMsg(Socket *socket, socket_addr_t target, byte phase, int adjustment);
+  void sendSyncMsg(Socket *socket, socket_addr_t target, byte phase, int adjustment,
+                   byte version = HMTL_MSG_VERSION);
 };
 
 /*******************************************************************************
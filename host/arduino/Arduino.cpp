@@ -0,0 +1,261 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Host (Linux) stand-in for the subset of the Arduino core used by the HMTL
+ * libraries.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+
+HardwareSerial Serial;
+
+/*******************************************************************************
+ * Timing
+ */
+
+static boolean clock_is_manual = false;
+static uint64_t manual_us = 0;
+static uint64_t start_us = 0;
+
+static uint64_t monotonic_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  uint64_t now = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  if (start_us == 0) start_us = now;
+  return now - start_us;
+}
+
+uint64_t host_clock_us() {
+  if (clock_is_manual) return manual_us;
+  return monotonic_us();
+}
+
+void host_clock_manual(boolean manual) {
+  if (manual && !clock_is_manual) manual_us = monotonic_us();
+  clock_is_manual = manual;
+}
+
+void host_clock_advance_us(uint32_t us) {
+  manual_us += us;
+}
+
+void host_clock_set_us(uint64_t us) {
+  manual_us = us;
+}
+
+unsigned long millis() {
+  return (unsigned long)(host_clock_us() / 1000);
+}
+
+unsigned long micros() {
+  return (unsigned long)host_clock_us();
+}
+
+void delay(unsigned long ms) {
+  if (clock_is_manual) {
+    manual_us += (uint64_t)ms * 1000;
+  } else {
+    usleep(ms * 1000);
+  }
+}
+
+void delayMicroseconds(unsigned int us) {
+  if (clock_is_manual) {
+    manual_us += us;
+  } else {
+    usleep(us);
+  }
+}
+
+/*******************************************************************************
+ * Math and random numbers
+ *
+ * random() matches the avr-libc generator so that programs see the same
+ * sequence and per-call cost shape as on the modules.
+ */
+
+static int32_t random_ctx = 1;
+
+static int32_t do_random(int32_t *ctx) {
+  int32_t hi, lo, x;
+
+  x = *ctx;
+  if (x == 0) x = 123459876L;
+  hi = x / 127773L;
+  lo = x % 127773L;
+  x = 16807L * lo - 2836L * hi;
+  if (x < 0) x += 0x7fffffffL;
+  return (*ctx = x) % 0x80000000UL;
+}
+
+long random(long howbig) {
+  if (howbig == 0) return 0;
+  return do_random(&random_ctx) % howbig;
+}
+
+long random(long howsmall, long howbig) {
+  if (howsmall >= howbig) return howsmall;
+  return random(howbig - howsmall) + howsmall;
+}
+
+void randomSeed(unsigned long seed) {
+  if (seed != 0) random_ctx = (int32_t)seed;
+}
+
+long map(long x, long in_min, long in_max, long out_min, long out_max) {
+  /* The AVR does not trap on division by zero, the host would */
+  if (in_max == in_min) return out_min;
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+/*******************************************************************************
+ * Pins, all of which are no-ops on the host
+ */
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+void digitalWrite(uint8_t pin, uint8_t val) {}
+int digitalRead(uint8_t pin) { return LOW; }
+void analogWrite(uint8_t pin, int val) {}
+int analogRead(uint8_t pin) { return 0; }
+
+/*******************************************************************************
+ * Serial device
+ */
+
+HardwareSerial::HardwareSerial() {
+  reset();
+  echo_enabled = false;
+}
+
+void HardwareSerial::begin(unsigned long baud) {}
+
+void HardwareSerial::reset() {
+  rx_head = 0;
+  rx_tail = 0;
+  rx_bytes = 0;
+  tx_bytes = 0;
+}
+
+void HardwareSerial::echo(boolean enabled) {
+  echo_enabled = enabled;
+}
+
+int HardwareSerial::available() {
+  return (uint16_t)(rx_head - rx_tail) % RX_BUFFER_SIZE;
+}
+
+int HardwareSerial::read() {
+  if (rx_head == rx_tail) return -1;
+  byte val = rx_buffer[rx_tail];
+  rx_tail = (rx_tail + 1) % RX_BUFFER_SIZE;
+  return val;
+}
+
+int HardwareSerial::peek() {
+  if (rx_head == rx_tail) return -1;
+  return rx_buffer[rx_tail];
+}
+
+size_t HardwareSerial::readBytes(byte *buffer, size_t length) {
+  size_t count = 0;
+  while ((count < length) && (rx_head != rx_tail)) {
+    buffer[count++] = (byte)read();
+  }
+  return count;
+}
+
+/*
+ * Add data to the receive buffer, returning the number of bytes that fit
+ */
+uint16_t HardwareSerial::inject(const byte *data, uint16_t length) {
+  uint16_t count = 0;
+  while (count < length) {
+    uint16_t next = (rx_head + 1) % RX_BUFFER_SIZE;
+    if (next == rx_tail) break;
+    rx_buffer[rx_head] = data[count++];
+    rx_head = next;
+  }
+  rx_bytes += count;
+  return count;
+}
+
+size_t HardwareSerial::write(byte val) {
+  return write(&val, 1);
+}
+
+size_t HardwareSerial::write(const byte *buffer, size_t size) {
+  tx_bytes += size;
+  if (echo_enabled) fwrite(buffer, 1, size, stdout);
+  return size;
+}
+
+size_t HardwareSerial::write(const char *str) {
+  return write((const byte *)str, strlen(str));
+}
+
+static size_t format_number(HardwareSerial *serial, unsigned long val,
+                            int base, boolean negative) {
+  char buf[8 * sizeof (long) + 2];
+  char *str = &buf[sizeof (buf) - 1];
+  *str = '\0';
+
+  if (base < 2) base = 10;
+  do {
+    unsigned long digit = val % base;
+    *--str = (char)(digit < 10 ? digit + '0' : digit + 'A' - 10);
+    val /= base;
+  } while (val);
+
+  if (negative) *--str = '-';
+  return serial->write(str);
+}
+
+size_t HardwareSerial::print(const char *str) { return write(str); }
+size_t HardwareSerial::print(char c) { return write((byte)c); }
+size_t HardwareSerial::print(int val, int base) { return print((long)val, base); }
+size_t HardwareSerial::print(unsigned int val, int base) {
+  return print((unsigned long)val, base);
+}
+size_t HardwareSerial::print(long val, int base) {
+  if ((base == DEC) && (val < 0)) {
+    return format_number(this, (unsigned long)-val, base, true);
+  }
+  return format_number(this, (unsigned long)val, base, false);
+}
+size_t HardwareSerial::print(unsigned long val, int base) {
+  return format_number(this, val, base, false);
+}
+size_t HardwareSerial::print(double val, int digits) {
+  char buf[32];
+  snprintf(buf, sizeof (buf), "%.*f", digits, val);
+  return write(buf);
+}
+
+size_t HardwareSerial::println() { return write("\r\n"); }
+size_t HardwareSerial::println(const char *str) { return print(str) + println(); }
+size_t HardwareSerial::println(char c) { return print(c) + println(); }
+size_t HardwareSerial::println(int val, int base) {
+  return print(val, base) + println();
+}
+size_t HardwareSerial::println(unsigned int val, int base) {
+  return print(val, base) + println();
+}
+size_t HardwareSerial::println(long val, int base) {
+  return print(val, base) + println();
+}
+size_t HardwareSerial::println(unsigned long val, int base) {
+  return print(val, base) + println();
+}
+size_t HardwareSerial::println(double val, int digits) {
+  return print(val, digits) + println();
+}
+
+void HardwareSerial::flush() {
+  if (echo_enabled) fflush(stdout);
+}
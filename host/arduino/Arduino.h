@@ -0,0 +1,140 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Host (Linux) stand-in for the subset of the Arduino core used by the HMTL
+ * libraries.  This allows the libraries to be compiled and exercised natively
+ * for benchmarking and simulation.
+ ******************************************************************************/
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <algorithm>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+using std::min;
+using std::max;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x0
+#define OUTPUT       0x1
+#define INPUT_PULLUP 0x2
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_ptr(addr) (*(void * const *)(addr))
+#define F(string_literal) (string_literal)
+
+/*******************************************************************************
+ * Timing
+ *
+ * By default the clock follows the host's monotonic clock.  Simulations can
+ * switch it to a manually advanced clock so that many modules share a single
+ * deterministic timeline.
+ */
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void host_clock_manual(boolean manual);
+void host_clock_advance_us(uint32_t us);
+void host_clock_set_us(uint64_t us);
+uint64_t host_clock_us();
+
+/*******************************************************************************
+ * Math and random numbers
+ */
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+long map(long x, long in_min, long in_max, long out_min, long out_max);
+
+#define constrain(amt, low, high) \
+  ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+/*******************************************************************************
+ * Pins
+ */
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+void analogWrite(uint8_t pin, int val);
+int analogRead(uint8_t pin);
+
+/*******************************************************************************
+ * Serial device
+ *
+ * Received data is supplied by the host with inject(), transmitted data is
+ * counted and discarded unless echo is enabled.
+ */
+class HardwareSerial {
+ public:
+  static const uint16_t RX_BUFFER_SIZE = 4096;
+
+  HardwareSerial();
+
+  void begin(unsigned long baud);
+  int available();
+  int read();
+  int peek();
+  size_t readBytes(byte *buffer, size_t length);
+
+  size_t write(byte val);
+  size_t write(const byte *buffer, size_t size);
+  size_t write(const char *str);
+
+  size_t print(const char *str);
+  size_t print(char c);
+  size_t print(int val, int base = DEC);
+  size_t print(unsigned int val, int base = DEC);
+  size_t print(long val, int base = DEC);
+  size_t print(unsigned long val, int base = DEC);
+  size_t print(double val, int digits = 2);
+
+  size_t println();
+  size_t println(const char *str);
+  size_t println(char c);
+  size_t println(int val, int base = DEC);
+  size_t println(unsigned int val, int base = DEC);
+  size_t println(long val, int base = DEC);
+  size_t println(unsigned long val, int base = DEC);
+  size_t println(double val, int digits = 2);
+
+  void flush();
+
+  /* Host controls */
+  uint16_t inject(const byte *data, uint16_t length);
+  void reset();
+  void echo(boolean enabled);
+
+  uint32_t rx_bytes;
+  uint32_t tx_bytes;
+
+ private:
+  byte rx_buffer[RX_BUFFER_SIZE];
+  uint16_t rx_head;
+  uint16_t rx_tail;
+  boolean echo_enabled;
+};
+
+extern HardwareSerial Serial;
+
+#endif
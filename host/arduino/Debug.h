@@ -0,0 +1,127 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Host stand-in for the ArduinoLibs debugging macros.  As on the modules the
+ * level is selected by defining DEBUG_LEVEL before including this file, and
+ * all output goes to the Serial device.
+ ******************************************************************************/
+
+#ifndef HOST_DEBUG_H
+#define HOST_DEBUG_H
+
+#include "Arduino.h"
+
+#define DEBUG_NONE  0
+#define DEBUG_ERROR 1
+#define DEBUG_LOW   2
+#define DEBUG_MID   3
+#define DEBUG_HIGH  4
+#define DEBUG_TRACE 5
+
+#ifndef DEBUG_LEVEL
+  #define DEBUG_LEVEL DEBUG_ERROR
+#endif
+
+void debug_err_state(int code);
+
+#define DEBUG_PRINT_END() { if (DEBUG_LEVEL > DEBUG_NONE) Serial.println(); }
+
+#define DEBUG_COMMAND(level, ...) { if ((level) <= DEBUG_LEVEL) { __VA_ARGS__ } }
+
+#define DEBUG_ERR_STATE(code) { debug_err_state(code); }
+
+#if DEBUG_LEVEL >= DEBUG_ERROR
+  #define DEBUG_ERR(x) { Serial.print("ERROR:"); Serial.println(x); }
+  #define DEBUG1_PRINT(x) { Serial.print(x); }
+  #define DEBUG1_PRINTLN(x) { Serial.println(x); }
+  #define DEBUG1_VALUE(x, v) { Serial.print(x); Serial.print(v); }
+  #define DEBUG1_VALUELN(x, v) { Serial.print(x); Serial.println(v); }
+  #define DEBUG1_HEXVAL(x, v) { Serial.print(x); Serial.print(v, HEX); }
+  #define DEBUG1_HEXVALLN(x, v) { Serial.print(x); Serial.println(v, HEX); }
+  #define DEBUG1_COMMAND(...) { __VA_ARGS__ }
+#else
+  #define DEBUG_ERR(x)
+  #define DEBUG1_PRINT(x)
+  #define DEBUG1_PRINTLN(x)
+  #define DEBUG1_VALUE(x, v)
+  #define DEBUG1_VALUELN(x, v)
+  #define DEBUG1_HEXVAL(x, v)
+  #define DEBUG1_HEXVALLN(x, v)
+  #define DEBUG1_COMMAND(...)
+#endif
+
+#if DEBUG_LEVEL >= DEBUG_LOW
+  #define DEBUG2_PRINT(x) { Serial.print(x); }
+  #define DEBUG2_PRINTLN(x) { Serial.println(x); }
+  #define DEBUG2_VALUE(x, v) { Serial.print(x); Serial.print(v); }
+  #define DEBUG2_VALUELN(x, v) { Serial.print(x); Serial.println(v); }
+  #define DEBUG2_HEXVAL(x, v) { Serial.print(x); Serial.print(v, HEX); }
+  #define DEBUG2_HEXVALLN(x, v) { Serial.print(x); Serial.println(v, HEX); }
+  #define DEBUG2_COMMAND(...) { __VA_ARGS__ }
+#else
+  #define DEBUG2_PRINT(x)
+  #define DEBUG2_PRINTLN(x)
+  #define DEBUG2_VALUE(x, v)
+  #define DEBUG2_VALUELN(x, v)
+  #define DEBUG2_HEXVAL(x, v)
+  #define DEBUG2_HEXVALLN(x, v)
+  #define DEBUG2_COMMAND(...)
+#endif
+
+#if DEBUG_LEVEL >= DEBUG_MID
+  #define DEBUG3_PRINT(x) { Serial.print(x); }
+  #define DEBUG3_PRINTLN(x) { Serial.println(x); }
+  #define DEBUG3_VALUE(x, v) { Serial.print(x); Serial.print(v); }
+  #define DEBUG3_VALUELN(x, v) { Serial.print(x); Serial.println(v); }
+  #define DEBUG3_HEXVAL(x, v) { Serial.print(x); Serial.print(v, HEX); }
+  #define DEBUG3_HEXVALLN(x, v) { Serial.print(x); Serial.println(v, HEX); }
+  #define DEBUG3_COMMAND(...) { __VA_ARGS__ }
+#else
+  #define DEBUG3_PRINT(x)
+  #define DEBUG3_PRINTLN(x)
+  #define DEBUG3_VALUE(x, v)
+  #define DEBUG3_VALUELN(x, v)
+  #define DEBUG3_HEXVAL(x, v)
+  #define DEBUG3_HEXVALLN(x, v)
+  #define DEBUG3_COMMAND(...)
+#endif
+
+#if DEBUG_LEVEL >= DEBUG_HIGH
+  #define DEBUG4_PRINT(x) { Serial.print(x); }
+  #define DEBUG4_PRINTLN(x) { Serial.println(x); }
+  #define DEBUG4_VALUE(x, v) { Serial.print(x); Serial.print(v); }
+  #define DEBUG4_VALUELN(x, v) { Serial.print(x); Serial.println(v); }
+  #define DEBUG4_HEXVAL(x, v) { Serial.print(x); Serial.print(v, HEX); }
+  #define DEBUG4_HEXVALLN(x, v) { Serial.print(x); Serial.println(v, HEX); }
+  #define DEBUG4_COMMAND(...) { __VA_ARGS__ }
+#else
+  #define DEBUG4_PRINT(x)
+  #define DEBUG4_PRINTLN(x)
+  #define DEBUG4_VALUE(x, v)
+  #define DEBUG4_VALUELN(x, v)
+  #define DEBUG4_HEXVAL(x, v)
+  #define DEBUG4_HEXVALLN(x, v)
+  #define DEBUG4_COMMAND(...)
+#endif
+
+#if DEBUG_LEVEL >= DEBUG_TRACE
+  #define DEBUG5_PRINT(x) { Serial.print(x); }
+  #define DEBUG5_PRINTLN(x) { Serial.println(x); }
+  #define DEBUG5_VALUE(x, v) { Serial.print(x); Serial.print(v); }
+  #define DEBUG5_VALUELN(x, v) { Serial.print(x); Serial.println(v); }
+  #define DEBUG5_HEXVAL(x, v) { Serial.print(x); Serial.print(v, HEX); }
+  #define DEBUG5_HEXVALLN(x, v) { Serial.print(x); Serial.println(v, HEX); }
+  #define DEBUG5_COMMAND(...) { __VA_ARGS__ }
+#else
+  #define DEBUG5_PRINT(x)
+  #define DEBUG5_PRINTLN(x)
+  #define DEBUG5_VALUE(x, v)
+  #define DEBUG5_VALUELN(x, v)
+  #define DEBUG5_HEXVAL(x, v)
+  #define DEBUG5_HEXVALLN(x, v)
+  #define DEBUG5_COMMAND(...)
+#endif
+
+#endif
@@ -0,0 +1,85 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Host stand-in for the ArduinoLibs EEPROM utilities, backed by a RAM image
+ ******************************************************************************/
+
+#include "Arduino.h"
+#include "GeneralUtils.h"
+#include "EEPromUtils.h"
+
+byte host_eeprom[EEPROM_SIZE];
+
+void EEPROM_init() {}
+void EEPROM_end() {}
+
+/* CRC-8 with polynomial 0x8C, bitwise as in the ArduinoLibs implementation */
+byte EEPROM_crc(const void *data, uint16_t length) {
+  const byte *ptr = (const byte *)data;
+  byte crc = 0;
+
+  while (length--) {
+    byte inbyte = *ptr++;
+    for (byte i = 8; i; i--) {
+      byte mix = (crc ^ inbyte) & 0x01;
+      crc >>= 1;
+      if (mix) crc ^= 0x8C;
+      inbyte >>= 1;
+    }
+  }
+
+  return crc;
+}
+
+/*
+ * Write a data object, returning the address following it or -1 on error
+ */
+int EEPROM_safe_write(int address, uint8_t *data, int datalen) {
+  if ((address < 0) || (datalen > 255) ||
+      (address + datalen + EEPROM_OVERHEAD > EEPROM_SIZE)) {
+    return -1;
+  }
+
+  host_eeprom[address] = EEPROM_SAFE_MAGIC;
+  host_eeprom[address + 1] = (byte)datalen;
+  memcpy(&host_eeprom[address + 2], data, datalen);
+  host_eeprom[address + 2 + datalen] = EEPROM_crc(data, datalen);
+
+  return address + datalen + EEPROM_OVERHEAD;
+}
+
+/*
+ * Read a data object of at most maxlen bytes, returning the address following
+ * it or a negative value on error
+ */
+int EEPROM_safe_read(int address, uint8_t *data, int maxlen) {
+  if (!EEPROM_check_address(address)) return -1;
+
+  int datalen = host_eeprom[address + 1];
+  if (datalen > maxlen) return -2;
+
+  memcpy(data, &host_eeprom[address + 2], datalen);
+  if (EEPROM_crc(data, datalen) != host_eeprom[address + 2 + datalen]) {
+    return -3;
+  }
+
+  return address + datalen + EEPROM_OVERHEAD;
+}
+
+/* Check whether a valid object starts at the address */
+boolean EEPROM_check_address(int address) {
+  if ((address < 0) || (address + EEPROM_OVERHEAD > EEPROM_SIZE)) return false;
+  if (host_eeprom[address] != EEPROM_SAFE_MAGIC) return false;
+  return (address + host_eeprom[address + 1] + EEPROM_OVERHEAD <= EEPROM_SIZE);
+}
+
+void EEPROM_dump(int address) {
+  while (EEPROM_check_address(address)) {
+    int length = host_eeprom[address + 1] + EEPROM_OVERHEAD;
+    print_hex_buffer((const char *)&host_eeprom[address], length);
+    Serial.println();
+    address += length;
+  }
+}
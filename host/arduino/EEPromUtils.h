@@ -0,0 +1,35 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Host stand-in for the ArduinoLibs EEPROM utilities, backed by a RAM image.
+ *
+ * Each "safe" object is stored as:
+ *   | magic | length | data ... | crc |
+ ******************************************************************************/
+
+#ifndef HOST_EEPROMUTILS_H
+#define HOST_EEPROMUTILS_H
+
+#include "Arduino.h"
+
+#define EEPROM_SIZE       1024
+#define EEPROM_SAFE_MAGIC 0xAB
+#define EEPROM_OVERHEAD   3
+#define EEPROM_DATA_SIZE(total) ((total) - EEPROM_OVERHEAD)
+
+void EEPROM_init();
+void EEPROM_end();
+
+byte EEPROM_crc(const void *data, uint16_t length);
+
+int EEPROM_safe_write(int address, uint8_t *data, int datalen);
+int EEPROM_safe_read(int address, uint8_t *data, int maxlen);
+boolean EEPROM_check_address(int address);
+void EEPROM_dump(int address);
+
+/* Host access to the raw image */
+extern byte host_eeprom[EEPROM_SIZE];
+
+#endif
@@ -0,0 +1,65 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Host stand-in for the portions of FastLED used by the HMTL libraries
+ ******************************************************************************/
+
+#include "FastLED.h"
+
+CFastLED FastLED;
+
+/*
+ * Convert HSV to RGB using FastLED's eight section "rainbow" hue mapping
+ */
+void hsv2rgb_rainbow(const CHSV &hsv, CRGB &rgb) {
+  uint8_t hue = hsv.h;
+  uint8_t sat = hsv.s;
+  uint8_t val = hsv.v;
+
+  uint8_t offset8 = (hue & 0x1F) << 3;
+  uint8_t third = scale8(offset8, (256 / 3));
+  uint8_t twothirds = scale8(offset8, ((256 * 2) / 3));
+
+  uint8_t r, g, b;
+
+  switch (hue >> 5) {
+    case 0: r = 255 - third;       g = third;             b = 0;              break;
+    case 1: r = 171;               g = 85 + third;        b = 0;              break;
+    case 2: r = 171 - twothirds;   g = 170 + third;       b = 0;              break;
+    case 3: r = 0;                 g = 255 - third;       b = third;          break;
+    case 4: r = 0;                 g = 171 - twothirds;   b = 85 + twothirds; break;
+    case 5: r = third;             g = 0;                 b = 255 - third;    break;
+    case 6: r = 85 + third;        g = 0;                 b = 171 - third;    break;
+    default: r = 170 + third;      g = 0;                 b = 85 - third;     break;
+  }
+
+  if (sat != 255) {
+    if (sat == 0) {
+      r = 255; g = 255; b = 255;
+    } else {
+      uint8_t desat = 255 - sat;
+      desat = scale8_video(desat, desat);
+      uint8_t satscale = 255 - desat;
+      r = scale8(r, satscale) + desat;
+      g = scale8(g, satscale) + desat;
+      b = scale8(b, satscale) + desat;
+    }
+  }
+
+  if (val != 255) {
+    val = scale8_video(val, val);
+    if (val == 0) {
+      r = 0; g = 0; b = 0;
+    } else {
+      r = scale8(r, val);
+      g = scale8(g, val);
+      b = scale8(b, val);
+    }
+  }
+
+  rgb.r = r;
+  rgb.g = g;
+  rgb.b = b;
+}
@@ -0,0 +1,118 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Host stand-in for the portions of FastLED used by the HMTL libraries: the
+ * CRGB/CHSV types, 8-bit scaling and blending, and the global controller.
+ * The HSV conversion follows FastLED's "rainbow" mapping closely enough that
+ * rendering costs are comparable.
+ ******************************************************************************/
+
+#ifndef HOST_FASTLED_H
+#define HOST_FASTLED_H
+
+#include "Arduino.h"
+
+typedef uint8_t fract8;
+
+static inline uint8_t scale8(uint8_t i, fract8 scale) {
+  return (uint8_t)(((uint16_t)i * (1 + (uint16_t)scale)) >> 8);
+}
+
+static inline uint8_t scale8_video(uint8_t i, fract8 scale) {
+  return (uint8_t)((((int)i * (int)scale) >> 8) + ((i && scale) ? 1 : 0));
+}
+
+static inline uint8_t blend8(uint8_t a, uint8_t b, uint8_t amountOfB) {
+  uint16_t partial = (uint16_t)((a << 8) | b);
+  partial += (uint16_t)(b * amountOfB);
+  partial -= (uint16_t)(a * amountOfB);
+  return (uint8_t)(partial >> 8);
+}
+
+struct CHSV {
+  union {
+    struct {
+      uint8_t h;
+      uint8_t s;
+      uint8_t v;
+    };
+    uint8_t raw[3];
+  };
+
+  CHSV() {}
+  CHSV(uint8_t ih, uint8_t is, uint8_t iv) : h(ih), s(is), v(iv) {}
+};
+
+struct CRGB;
+void hsv2rgb_rainbow(const CHSV &hsv, CRGB &rgb);
+
+struct CRGB {
+  union {
+    struct {
+      uint8_t r;
+      uint8_t g;
+      uint8_t b;
+    };
+    uint8_t raw[3];
+  };
+
+  typedef enum {
+    Black = 0x000000,
+    White = 0xFFFFFF,
+    Red   = 0xFF0000,
+    Green = 0x008000,
+    Blue  = 0x0000FF
+  } HTMLColorCode;
+
+  CRGB() {}
+  CRGB(uint8_t ir, uint8_t ig, uint8_t ib) : r(ir), g(ig), b(ib) {}
+  CRGB(uint32_t colorcode)
+    : r((colorcode >> 16) & 0xFF), g((colorcode >> 8) & 0xFF),
+      b(colorcode & 0xFF) {}
+  CRGB(HTMLColorCode colorcode)
+    : r((colorcode >> 16) & 0xFF), g((colorcode >> 8) & 0xFF),
+      b(colorcode & 0xFF) {}
+  CRGB(const CHSV &hsv) { hsv2rgb_rainbow(hsv, *this); }
+
+  uint8_t &operator[](uint8_t x) { return raw[x]; }
+  const uint8_t &operator[](uint8_t x) const { return raw[x]; }
+
+  CRGB &nscale8(uint8_t scaledown) {
+    r = scale8(r, scaledown);
+    g = scale8(g, scaledown);
+    b = scale8(b, scaledown);
+    return *this;
+  }
+
+  bool operator==(const CRGB &rhs) const {
+    return (r == rhs.r) && (g == rhs.g) && (b == rhs.b);
+  }
+  bool operator!=(const CRGB &rhs) const { return !(*this == rhs); }
+};
+
+inline CRGB blend(const CRGB &p1, const CRGB &p2, fract8 amountOfP2) {
+  return CRGB(blend8(p1.r, p2.r, amountOfP2),
+              blend8(p1.g, p2.g, amountOfP2),
+              blend8(p1.b, p2.b, amountOfP2));
+}
+
+/*
+ * Global controller, only the brightness and show calls are modeled
+ */
+class CFastLED {
+ public:
+  CFastLED() : brightness(255), shows(0) {}
+
+  void setBrightness(uint8_t scale) { brightness = scale; }
+  uint8_t getBrightness() { return brightness; }
+  void show() { shows++; }
+
+  uint8_t brightness;
+  uint32_t shows;
+};
+
+extern CFastLED FastLED;
+
+#endif
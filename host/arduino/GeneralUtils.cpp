@@ -0,0 +1,37 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Host stand-in for the ArduinoLibs general utility functions
+ ******************************************************************************/
+
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "Debug.h"
+#include "GeneralUtils.h"
+
+/* Print a buffer as a contiguous string of hex values */
+void print_hex_string(const byte *data, int length) {
+  for (int i = 0; i < length; i++) {
+    if (data[i] < 0x10) Serial.print('0');
+    Serial.print((unsigned int)data[i], HEX);
+  }
+}
+
+/* Print a buffer as space separated hex values, 16 per line */
+void print_hex_buffer(const char *data, int length) {
+  for (int i = 0; i < length; i++) {
+    if ((i != 0) && (i % 16 == 0)) Serial.println();
+    if ((byte)data[i] < 0x10) Serial.print('0');
+    Serial.print((unsigned int)(byte)data[i], HEX);
+    Serial.print(' ');
+  }
+}
+
+/* On the modules this blinks the error code forever, on the host just exit */
+void debug_err_state(int code) {
+  fprintf(stderr, "debug_err_state: %d\n", code);
+  exit(code);
+}
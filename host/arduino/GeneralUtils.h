@@ -0,0 +1,17 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Host stand-in for the ArduinoLibs general utility functions
+ ******************************************************************************/
+
+#ifndef HOST_GENERALUTILS_H
+#define HOST_GENERALUTILS_H
+
+#include "Arduino.h"
+
+void print_hex_string(const byte *data, int length);
+void print_hex_buffer(const char *data, int length);
+
+#endif
@@ -0,0 +1,155 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * In-memory Socket implementation for the host build
+ ******************************************************************************/
+
+#include "HostSocket.h"
+
+HostSocket::HostSocket() {
+  init(SOCKET_ADDR_INVALID);
+  is_initialized = false;
+}
+
+HostSocket::HostSocket(socket_addr_t address, uint16_t recv_limit) {
+  init(address, recv_limit);
+}
+
+void HostSocket::init(socket_addr_t address, uint16_t recv_limit) {
+  sourceAddress = address;
+  recvLimit = recv_limit;
+  send_buffer = NULL;
+  send_data_size = 0;
+
+  xmit = NULL;
+  xmit_arg = NULL;
+  is_initialized = true;
+
+  clear();
+  sent_msgs = 0;
+  sent_bytes = 0;
+  recv_msgs = 0;
+  recv_bytes = 0;
+  overflows = 0;
+}
+
+boolean HostSocket::initialized() {
+  return is_initialized;
+}
+
+void HostSocket::setup() {}
+
+/*
+ * Setup the send buffer, data must be at least HOST_BUFFER_TOTAL(data_size)
+ */
+byte *HostSocket::initBuffer(byte *data, uint16_t data_size) {
+  send_buffer = data + sizeof (host_socket_hdr_t);
+  send_data_size = (byte)(data_size > 255 ? 255 : data_size);
+  return send_buffer;
+}
+
+void HostSocket::setTransmit(host_xmit_func func, void *arg) {
+  xmit = func;
+  xmit_arg = arg;
+}
+
+void HostSocket::sendMsgTo(uint16_t address, const byte *data,
+                           const byte datalength) {
+  host_socket_hdr_t hdr;
+  hdr.source = sourceAddress;
+  hdr.dest = address;
+  hdr.length = datalength;
+
+  sent_msgs++;
+  sent_bytes += sizeof (hdr) + datalength;
+
+  if (xmit) xmit(this, &hdr, data, xmit_arg);
+}
+
+/*
+ * Queue a frame as if it had been received, returns false if the receive
+ * queue is full or the frame is too large.
+ */
+boolean HostSocket::deliver(socket_addr_t source, socket_addr_t dest,
+                            const byte *data, uint16_t length) {
+  uint8_t next = (queue_head + 1) % HOST_SOCKET_QUEUE;
+  if ((next == queue_tail) || (length > HOST_SOCKET_MAX_FRAME)) {
+    overflows++;
+    return false;
+  }
+
+  host_frame_t *frame = &queue[queue_head];
+  frame->hdr.source = source;
+  frame->hdr.dest = dest;
+  frame->hdr.length = length;
+  memcpy(frame->data, data, length);
+  queue_head = next;
+
+  return true;
+}
+
+uint16_t HostSocket::pending() {
+  return (uint8_t)(queue_head - queue_tail + HOST_SOCKET_QUEUE) %
+         HOST_SOCKET_QUEUE;
+}
+
+void HostSocket::clear() {
+  queue_head = 0;
+  queue_tail = 0;
+}
+
+/*
+ * Return the next received frame regardless of its destination, as a bus
+ * transceiver sees all traffic.
+ */
+const byte *HostSocket::getMsg(unsigned int *retlen) {
+  return getMsg(SOCKET_ADDR_ANY, retlen);
+}
+
+/*
+ * Return the next received frame for the indicated address, frames for other
+ * addresses are discarded.
+ */
+const byte *HostSocket::getMsg(uint16_t address, unsigned int *retlen) {
+  while (queue_tail != queue_head) {
+    host_frame_t *frame = &queue[queue_tail];
+    queue_tail = (queue_tail + 1) % HOST_SOCKET_QUEUE;
+
+    if ((address != SOCKET_ADDR_ANY) &&
+        (frame->hdr.dest != address) &&
+        (frame->hdr.dest != SOCKET_ADDR_ANY)) {
+      continue;
+    }
+
+    current.hdr = frame->hdr;
+    memcpy(current.data, frame->data, frame->hdr.length);
+
+    recv_msgs++;
+    recv_bytes += sizeof (host_socket_hdr_t) + frame->hdr.length;
+
+    *retlen = current.hdr.length;
+    return current.data;
+  }
+
+  *retlen = 0;
+  return NULL;
+}
+
+socket_addr_t HostSocket::sourceFromData(void *data) {
+  host_socket_hdr_t *hdr =
+    (host_socket_hdr_t *)((byte *)data - sizeof (host_socket_hdr_t));
+  return hdr->source;
+}
+
+socket_addr_t HostSocket::destFromData(void *data) {
+  host_socket_hdr_t *hdr =
+    (host_socket_hdr_t *)((byte *)data - sizeof (host_socket_hdr_t));
+  return hdr->dest;
+}
+
+/* Frames are passed to the transmit callback from wherever they are */
+boolean HostSocket::sendsAnyBuffer() {
+  return true;
+}
@@ -0,0 +1,89 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * In-memory Socket implementation for the host build.  Frames handed to
+ * deliver() are queued as though they had arrived from the wire, and frames
+ * sent by the module are passed to an optional transmit callback.
+ *
+ * As with the RS485 socket the data returned by getMsg() and the send buffer
+ * are both immediately preceded by the socket header, which is how
+ * sourceFromData() locates the sender.
+ ******************************************************************************/
+
+#ifndef HOST_SOCKET_IMPL_H
+#define HOST_SOCKET_IMPL_H
+
+#include "Arduino.h"
+#include "Socket.h"
+
+#define HOST_SOCKET_MAX_FRAME 256
+#define HOST_SOCKET_QUEUE     64
+
+typedef struct {
+  socket_addr_t source;
+  socket_addr_t dest;
+  uint16_t length;
+} host_socket_hdr_t;
+
+#define HOST_BUFFER_TOTAL(data_size) \
+  (uint16_t)(sizeof (host_socket_hdr_t) + (data_size))
+
+class HostSocket;
+typedef void (*host_xmit_func)(HostSocket *socket,
+                               const host_socket_hdr_t *hdr,
+                               const byte *data,
+                               void *arg);
+
+class HostSocket : public Socket {
+ public:
+  HostSocket();
+  HostSocket(socket_addr_t address, uint16_t recv_limit = HOST_SOCKET_MAX_FRAME);
+
+  void init(socket_addr_t address, uint16_t recv_limit = HOST_SOCKET_MAX_FRAME);
+
+  /* Socket interface */
+  boolean initialized();
+  void setup();
+  byte *initBuffer(byte *data, uint16_t data_size);
+
+  void sendMsgTo(uint16_t address, const byte *data, const byte datalength);
+  const byte *getMsg(unsigned int *retlen);
+  const byte *getMsg(uint16_t address, unsigned int *retlen);
+
+  socket_addr_t sourceFromData(void *data);
+  socket_addr_t destFromData(void *data);
+  boolean sendsAnyBuffer();
+
+  /* Host controls */
+  boolean deliver(socket_addr_t source, socket_addr_t dest,
+                  const byte *data, uint16_t length);
+  void setTransmit(host_xmit_func func, void *arg);
+  uint16_t pending();
+  void clear();
+
+  uint32_t sent_msgs;
+  uint32_t sent_bytes;
+  uint32_t recv_msgs;
+  uint32_t recv_bytes;
+  uint32_t overflows;
+
+ private:
+  typedef struct {
+    host_socket_hdr_t hdr;
+    byte data[HOST_SOCKET_MAX_FRAME];
+  } host_frame_t;
+
+  host_frame_t queue[HOST_SOCKET_QUEUE];
+  uint8_t queue_head;
+  uint8_t queue_tail;
+
+  host_frame_t current;
+
+  host_xmit_func xmit;
+  void *xmit_arg;
+  boolean is_initialized;
+};
+
+#endif
@@ -0,0 +1,90 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Host stand-in for the ArduinoLibs PixelUtil class
+ ******************************************************************************/
+
+#include "PixelUtil.h"
+
+PixelUtil::PixelUtil() {
+  leds = NULL;
+  num_pixels = 0;
+  updates = 0;
+}
+
+PixelUtil::PixelUtil(uint16_t numPixels, uint8_t dataPin, uint8_t clockPin,
+                     uint8_t type) {
+  leds = NULL;
+  num_pixels = 0;
+  init(numPixels, dataPin, clockPin, type);
+}
+
+PixelUtil::~PixelUtil() {
+  free(leds);
+}
+
+void PixelUtil::init(uint16_t numPixels, uint8_t dataPin, uint8_t clockPin,
+                     uint8_t type) {
+  free(leds);
+  num_pixels = numPixels;
+  leds = (CRGB *)calloc(numPixels, sizeof (CRGB));
+  updates = 0;
+}
+
+uint16_t PixelUtil::numPixels() {
+  return num_pixels;
+}
+
+void PixelUtil::setPixelRGB(PIXEL_ADDR_TYPE led, byte r, byte g, byte b) {
+  if (led >= num_pixels) return;
+  leds[led] = CRGB(r, g, b);
+}
+
+void PixelUtil::setPixelRGB(PIXEL_ADDR_TYPE led, uint32_t color) {
+  if (led >= num_pixels) return;
+  leds[led] = CRGB(color);
+}
+
+void PixelUtil::setPixelRGB(PIXEL_ADDR_TYPE led, CRGB color) {
+  if (led >= num_pixels) return;
+  leds[led] = color;
+}
+
+void PixelUtil::setAllRGB(byte r, byte g, byte b) {
+  for (PIXEL_ADDR_TYPE led = 0; led < num_pixels; led++) {
+    leds[led] = CRGB(r, g, b);
+  }
+}
+
+void PixelUtil::setAllRGB(uint32_t color) {
+  setAllRGB(pixel_red(color), pixel_green(color), pixel_blue(color));
+}
+
+void PixelUtil::setRangeRGB(pixel_range_t range, CRGB color) {
+  for (PIXEL_ADDR_TYPE led = range.start;
+       (led < range.start + range.length) && (led < num_pixels);
+       led++) {
+    leds[led] = color;
+  }
+}
+
+/* Set the individual channels of the strip as though they were single LEDs */
+void PixelUtil::setDistinct(PIXEL_ADDR_TYPE led, byte value) {
+  if (led / 3 >= num_pixels) return;
+  leds[led / 3].raw[led % 3] = value;
+}
+
+CRGB PixelUtil::getPixel(PIXEL_ADDR_TYPE led) {
+  return leds[led];
+}
+
+uint32_t PixelUtil::pixelColor(PIXEL_ADDR_TYPE led) {
+  return pixel_color(leds[led].r, leds[led].g, leds[led].b);
+}
+
+void PixelUtil::update() {
+  updates++;
+  FastLED.show();
+}
@@ -0,0 +1,62 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Host stand-in for the ArduinoLibs PixelUtil class.  Pixel data is kept in a
+ * CRGB array exactly as on the modules, while update() only counts frames.
+ ******************************************************************************/
+
+#ifndef HOST_PIXELUTIL_H
+#define HOST_PIXELUTIL_H
+
+#include "Arduino.h"
+#include "FastLED.h"
+
+#define PIXEL_ADDR_TYPE uint16_t
+
+typedef struct {
+  PIXEL_ADDR_TYPE start;
+  PIXEL_ADDR_TYPE length;
+} pixel_range_t;
+
+static inline uint32_t pixel_color(byte r, byte g, byte b) {
+  return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
+}
+static inline byte pixel_red(uint32_t color) { return (color >> 16) & 0xFF; }
+static inline byte pixel_green(uint32_t color) { return (color >> 8) & 0xFF; }
+static inline byte pixel_blue(uint32_t color) { return color & 0xFF; }
+
+class PixelUtil {
+ public:
+  PixelUtil();
+  PixelUtil(uint16_t numPixels, uint8_t dataPin, uint8_t clockPin,
+            uint8_t type);
+  ~PixelUtil();
+
+  void init(uint16_t numPixels, uint8_t dataPin, uint8_t clockPin,
+            uint8_t type);
+
+  uint16_t numPixels();
+
+  void setPixelRGB(PIXEL_ADDR_TYPE led, byte r, byte g, byte b);
+  void setPixelRGB(PIXEL_ADDR_TYPE led, uint32_t color);
+  void setPixelRGB(PIXEL_ADDR_TYPE led, CRGB color);
+  void setAllRGB(byte r, byte g, byte b);
+  void setAllRGB(uint32_t color);
+  void setRangeRGB(pixel_range_t range, CRGB color);
+  void setDistinct(PIXEL_ADDR_TYPE led, byte value);
+
+  CRGB getPixel(PIXEL_ADDR_TYPE led);
+  uint32_t pixelColor(PIXEL_ADDR_TYPE led);
+
+  void update();
+
+  CRGB *leds;
+  uint32_t updates;
+
+ private:
+  uint16_t num_pixels;
+};
+
+#endif
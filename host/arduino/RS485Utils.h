@@ -0,0 +1,28 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Host stand-in for the ArduinoLibs RS485 socket definitions.  The host build
+ * is configured with DISABLE_RS485, only the framing definitions referenced
+ * by the HMTL headers are provided here.  See HostSocket.h for the in-memory
+ * transport used on the host.
+ ******************************************************************************/
+
+#ifndef HOST_RS485UTILS_H
+#define HOST_RS485UTILS_H
+
+#include "Socket.h"
+
+typedef struct {
+  byte start;
+  socket_addr_t source;
+  socket_addr_t address;
+  byte length;
+} rs485_socket_hdr_t;
+
+#define RS485_RECV_BUFFER 64
+#define RS485_BUFFER_TOTAL(data_size) \
+  (uint16_t)(sizeof (rs485_socket_hdr_t) + (data_size))
+
+#endif
@@ -0,0 +1,52 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Host copy of the ArduinoLibs abstract Socket interface that all HMTL
+ * transports (RS485, XBee, RFM69, TCP) implement.
+ ******************************************************************************/
+
+#ifndef HOST_SOCKET_H
+#define HOST_SOCKET_H
+
+#include "Arduino.h"
+
+typedef uint16_t socket_addr_t;
+#define SOCKET_ADDR_ANY     ((socket_addr_t)-1)
+#define SOCKET_ADDR_INVALID ((socket_addr_t)-2)
+
+class Socket {
+ public:
+  virtual ~Socket() {}
+
+  virtual boolean initialized() = 0;
+  virtual void setup() = 0;
+  virtual byte *initBuffer(byte *data, uint16_t data_size) = 0;
+
+  virtual void sendMsgTo(uint16_t address, const byte *data,
+                         const byte datalength) = 0;
+  virtual const byte *getMsg(unsigned int *retlen) = 0;
+  virtual const byte *getMsg(uint16_t address, unsigned int *retlen) = 0;
+
+  virtual socket_addr_t sourceFromData(void *data) = 0;
+  virtual socket_addr_t destFromData(void *data) = 0;
+
+  /*
+   * Returns true if sendMsgTo() can transmit data from any buffer rather than
+   * only from send_buffer, which allows messages to be forwarded without
+   * first being copied.  Sockets that frame messages in place ahead of
+   * send_buffer, such as RS485Socket, keep the default, while those that pass
+   * the data on to their transport, such as RFM69Socket and XBeeSocket, can
+   * return true.  MessageHandler also builds against Socket interfaces that
+   * predate this, treating their sockets as sending only from send_buffer.
+   */
+  virtual boolean sendsAnyBuffer() { return false; }
+
+  socket_addr_t sourceAddress;
+  byte *send_buffer;
+  byte send_data_size;
+  uint16_t recvLimit;
+};
+
+#endif
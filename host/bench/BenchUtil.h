@@ -0,0 +1,51 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Helpers shared by the host benchmark drivers
+ ******************************************************************************/
+
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <stdio.h>
+#include <time.h>
+
+#include "Arduino.h"
+
+/* Wall-clock nanoseconds, independent of the (possibly manual) Arduino clock */
+static inline uint64_t bench_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Keep the compiler from discarding a computed value */
+template <typename T>
+static inline void bench_keep(T const &value) {
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+typedef struct {
+  const char *path;
+  const char *name;
+  uint32_t count;
+  uint64_t elapsed_ns;
+} bench_result_t;
+
+static inline void bench_print_header() {
+  printf("%-10s %-12s %10s %10s %12s\n",
+         "path", "type", "msgs", "ns/msg", "msgs/sec");
+}
+
+static inline void bench_print_result(const bench_result_t *result) {
+  double ns = result->count ?
+              (double)result->elapsed_ns / result->count : 0.0;
+  double rate = result->elapsed_ns ?
+                result->count * 1e9 / (double)result->elapsed_ns : 0.0;
+  printf("%-10s %-12s %10u %10.1f %12.0f\n",
+         result->path, result->name, result->count, ns, rate);
+}
+
+#endif
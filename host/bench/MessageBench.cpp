@@ -0,0 +1,420 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Message path throughput benchmark for the host build.
+ *
+ * Synthetic traffic of each message type is pushed through the receive paths
+ * of a single host module:
+ *   serial  - hmtl_serial_getmsg() parsing bytes from the Serial device
+ *   socket  - hmtl_socket_getmsg() receiving frames from a socket
+ *   process - MessageHandler::process_msg() on an already received message
+ *   check   - MessageHandler::check(), receive + forward + process
+ *
+ * The "custom" type is handled by a no-op handler registered as a sketch
+ * would, so its process time is the cost of dispatch alone.
+ *
+ * The module has two sockets unless set with -s, messages for other modules
+ * are forwarded from the first to each of the others as a bridge would.
+ *
+ * Usage: MessageBench [-n msgs] [-p path] [-t type] [-s sockets]
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "HMTLTypes.h"
+#include "HMTLMessaging.h"
+#include "HMTLPrograms.h"
+#include "TimeSync.h"
+#include "PixelFrame.h"
+
+#include "HostModule.h"
+#include "BenchUtil.h"
+
+#define MODULE_ADDRESS   0x40
+#define MODULE_DEVICE_ID 100
+#define OTHER_ADDRESS    0x41
+#define SENDER_ADDRESS   0x01
+#define NUM_PIXELS       150
+
+#define BENCH_MSG_TYPE   0x0F // Message type registered by the benchmark
+
+#define PATH_SERIAL  (1 << 0)
+#define PATH_SOCKET  (1 << 1)
+#define PATH_PROCESS (1 << 2)
+#define PATH_CHECK   (1 << 3)
+#define PATH_ALL     (PATH_SERIAL | PATH_SOCKET | PATH_PROCESS | PATH_CHECK)
+
+typedef uint16_t (*bench_fmt_func)(byte *buffer, uint16_t buffsize);
+
+typedef struct {
+  const char *name;
+  bench_fmt_func fmt;
+  byte paths;
+} bench_msg_t;
+
+/*******************************************************************************
+ * Synthetic messages
+ */
+
+static uint16_t fmt_value(byte *buffer, uint16_t buffsize) {
+  return hmtl_value_fmt(buffer, buffsize, MODULE_ADDRESS,
+                        HOST_OUTPUT_VALUE, 128);
+}
+
+static uint16_t fmt_rgb(byte *buffer, uint16_t buffsize) {
+  hmtl_rgb_fmt(buffer, buffsize, MODULE_ADDRESS, HOST_OUTPUT_RGB,
+               255, 128, 0);
+  return ((msg_hdr_t *)buffer)->length;
+}
+
+static uint16_t fmt_batch(byte *buffer, uint16_t buffsize) {
+  /* Eight value and RGB updates, as would otherwise take eight messages */
+  hmtl_batch_fmt(buffer, buffsize, MODULE_ADDRESS);
+  for (byte i = 0; i < 4; i++) {
+    msg_value_t value;
+    value.hdr.type = HMTL_OUTPUT_VALUE;
+    value.hdr.output = HOST_OUTPUT_VALUE;
+    value.value = 32 * i;
+    hmtl_batch_add(buffer, buffsize, &value.hdr, sizeof (value));
+
+    msg_rgb_t rgb;
+    rgb.hdr.type = HMTL_OUTPUT_RGB;
+    rgb.hdr.output = HOST_OUTPUT_RGB;
+    rgb.values[0] = 255;
+    rgb.values[1] = 32 * i;
+    rgb.values[2] = 0;
+    hmtl_batch_add(buffer, buffsize, &rgb.hdr, sizeof (rgb));
+  }
+  return hmtl_batch_finish(buffer);
+}
+
+static uint16_t fmt_frame(byte *buffer, uint16_t buffsize) {
+  /* A complete frame for the first pixels, as fits a 64 byte socket buffer */
+  byte rgb[HMTL_PIXEL_FRAME_PIXELS(64) * 3];
+  for (uint16_t i = 0; i < sizeof (rgb); i++) {
+    rgb[i] = i;
+  }
+  return hmtl_pixel_frame_fmt(buffer, buffsize, MODULE_ADDRESS, 0,
+                              HOST_OUTPUT_PIXELS, 1, 0,
+                              rgb, HMTL_PIXEL_FRAME_PIXELS(64));
+}
+
+static uint16_t fmt_blink(byte *buffer, uint16_t buffsize) {
+  return hmtl_program_blink_fmt(buffer, buffsize, MODULE_ADDRESS,
+                                HOST_OUTPUT_RGB,
+                                500, pixel_color(255, 0, 0),
+                                500, pixel_color(0, 0, 255));
+}
+
+static uint16_t fmt_sparkle(byte *buffer, uint16_t buffsize) {
+  return program_sparkle_fmt(buffer, buffsize, MODULE_ADDRESS,
+                             HOST_OUTPUT_PIXELS,
+                             50, CRGB(0, 0, 0), 0, 0, 0, 255, 0, 255, 0, 255);
+}
+
+static uint16_t fmt_poll(byte *buffer, uint16_t buffsize) {
+  hmtl_msg_fmt((msg_hdr_t *)buffer, MODULE_ADDRESS, sizeof (msg_hdr_t),
+               MSG_TYPE_POLL, MSG_FLAG_RESPONSE);
+  return sizeof (msg_hdr_t);
+}
+
+static uint16_t fmt_stats(byte *buffer, uint16_t buffsize) {
+  hmtl_msg_fmt((msg_hdr_t *)buffer, MODULE_ADDRESS, sizeof (msg_hdr_t),
+               MSG_TYPE_STATS, MSG_FLAG_RESPONSE);
+  return sizeof (msg_hdr_t);
+}
+
+static uint16_t fmt_set_addr(byte *buffer, uint16_t buffsize) {
+  /* Addressed to a different device ID so the module address is unchanged */
+  return hmtl_set_addr_fmt(buffer, buffsize, MODULE_ADDRESS,
+                           MODULE_DEVICE_ID + 1, MODULE_ADDRESS);
+}
+
+static uint16_t fmt_sensor(byte *buffer, uint16_t buffsize) {
+  uint8_t *data;
+  uint16_t datalen = sizeof (msg_sensor_data_t) + sizeof (uint16_t);
+  uint16_t len = hmtl_sensor_fmt(buffer, buffsize, MODULE_ADDRESS,
+                                 datalen, &data);
+  msg_sensor_data_t *sensor = (msg_sensor_data_t *)data;
+  sensor->sensor_type = HMTL_SENSOR_LIGHT;
+  sensor->data_len = sizeof (uint16_t);
+  uint16_t light = 512;
+  memcpy(sensor->data, &light, sizeof (light));
+  hmtl_msg_set_crc((msg_hdr_t *)buffer);
+  return len;
+}
+
+static uint16_t fmt_timesync(byte *buffer, uint16_t buffsize) {
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)buffer;
+  msg_time_sync_t *msg_time = (msg_time_sync_t *)(msg_hdr + 1);
+  msg_time->sync_phase = TIMESYNC_CHECK;
+  msg_time->timestamp = 0;
+  hmtl_msg_fmt(msg_hdr, MODULE_ADDRESS, HMTL_MSG_SIZE(msg_time_sync_t),
+               MSG_TYPE_TIMESYNC);
+  return HMTL_MSG_SIZE(msg_time_sync_t);
+}
+
+static uint16_t fmt_forward(byte *buffer, uint16_t buffsize) {
+  /* A message for another module, which is only forwarded */
+  return hmtl_value_fmt(buffer, buffsize, OTHER_ADDRESS,
+                        HOST_OUTPUT_VALUE, 128);
+}
+
+static uint16_t fmt_fwd_frame(byte *buffer, uint16_t buffsize) {
+  /* A full pixel frame message for another module */
+  byte rgb[HMTL_PIXEL_FRAME_PIXELS(64) * 3];
+  for (uint16_t i = 0; i < sizeof (rgb); i++) {
+    rgb[i] = i;
+  }
+  return hmtl_pixel_frame_fmt(buffer, buffsize, OTHER_ADDRESS, 0,
+                              HOST_OUTPUT_PIXELS, 1, 0,
+                              rgb, HMTL_PIXEL_FRAME_PIXELS(64));
+}
+
+static uint16_t fmt_custom(byte *buffer, uint16_t buffsize) {
+  hmtl_msg_fmt((msg_hdr_t *)buffer, MODULE_ADDRESS, sizeof (msg_hdr_t),
+               BENCH_MSG_TYPE);
+  return sizeof (msg_hdr_t);
+}
+
+static boolean handle_custom(MessageHandler *handler, msg_hdr_t *msg_hdr,
+                             Socket *src, Socket *serial_socket,
+                             config_hdr_t *config) {
+  return true;
+}
+
+/*
+ * TIMESYNC is excluded from the serial paths as there is no socket to respond
+ * over for a message received from the serial device.
+ */
+static const bench_msg_t bench_msgs[] = {
+  { "value",    fmt_value,    PATH_ALL },
+  { "rgb",      fmt_rgb,      PATH_ALL },
+  { "batch",    fmt_batch,    PATH_ALL },
+  { "frame",    fmt_frame,    PATH_ALL },
+  { "blink",    fmt_blink,    PATH_ALL },
+  { "sparkle",  fmt_sparkle,  PATH_ALL },
+  { "poll",     fmt_poll,     PATH_ALL },
+  { "stats",    fmt_stats,    PATH_ALL },
+  { "set_addr", fmt_set_addr, PATH_ALL },
+  { "sensor",   fmt_sensor,   PATH_ALL },
+  { "timesync", fmt_timesync, PATH_SOCKET | PATH_PROCESS | PATH_CHECK },
+  { "forward",  fmt_forward,  PATH_ALL },
+  { "fwd_frame", fmt_fwd_frame, PATH_ALL },
+  { "custom",   fmt_custom,   PATH_ALL },
+};
+#define NUM_BENCH_MSGS (sizeof (bench_msgs) / sizeof (bench_msg_t))
+
+/*******************************************************************************
+ * Benchmarks for each path
+ */
+
+static HostModule module;
+
+/* Messages are built after a socket header so that sourceFromData() works */
+static byte frame[HOST_BUFFER_TOTAL(HOST_SOCKET_MAX_FRAME)];
+static byte *const msg_buffer = frame + sizeof (host_socket_hdr_t);
+
+static uint64_t bench_serial(const byte *msg, uint16_t len, uint32_t count) {
+  static byte serial_msg[HMTL_MSG_BATCH_MAX_LEN];
+  byte offset = 0;
+  uint32_t done = 0;
+  uint64_t elapsed = 0;
+
+  Serial.reset();
+  while (done < count) {
+    /* Fill the serial receive buffer with whole messages */
+    uint32_t batch = 0;
+    while ((done + batch < count) &&
+           (Serial.available() + len < HardwareSerial::RX_BUFFER_SIZE - 1)) {
+      Serial.inject(msg, len);
+      batch++;
+    }
+
+    uint64_t start = bench_now_ns();
+    uint32_t received = 0;
+    while (received < batch) {
+      if (hmtl_serial_getmsg(serial_msg, sizeof (serial_msg), &offset)) {
+        offset = 0;
+        received++;
+      }
+    }
+    elapsed += bench_now_ns() - start;
+
+    done += batch;
+  }
+
+  return elapsed;
+}
+
+static uint64_t bench_socket(const byte *msg, uint16_t len, uint32_t count) {
+  HostSocket *socket = &module.host_sockets[0];
+  uint32_t done = 0;
+  uint64_t elapsed = 0;
+
+  socket->clear();
+  while (done < count) {
+    uint32_t batch = 0;
+    while ((done + batch < count) &&
+           socket->deliver(SENDER_ADDRESS, ((msg_hdr_t *)msg)->address,
+                           msg, len)) {
+      batch++;
+    }
+
+    uint64_t start = bench_now_ns();
+    unsigned int msglen;
+    while (hmtl_socket_getmsg(socket, &msglen) != NULL) {
+      bench_keep(msglen);
+    }
+    elapsed += bench_now_ns() - start;
+
+    done += batch;
+  }
+
+  return elapsed;
+}
+
+static uint64_t bench_process(const byte *msg, uint16_t len, uint32_t count) {
+  host_socket_hdr_t *hdr = (host_socket_hdr_t *)frame;
+  hdr->source = SENDER_ADDRESS;
+  hdr->dest = MODULE_ADDRESS;
+  hdr->length = len;
+
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)msg_buffer;
+  Socket *socket = module.sockets[0];
+
+  uint64_t start = bench_now_ns();
+  for (uint32_t i = 0; i < count; i++) {
+    boolean update = module.handler.process_msg(msg_hdr, socket, socket,
+                                                &module.config);
+    bench_keep(update);
+  }
+  return bench_now_ns() - start;
+}
+
+/*
+ * Deliver a copy of the message with a new sequence number, as the handler
+ * drops repeated copies of the same message as duplicates.
+ */
+static boolean deliver_numbered(HostSocket *socket, const byte *msg,
+                                uint16_t len) {
+  static byte copy[HOST_SOCKET_MAX_FRAME];
+  static uint8_t sequence = 0;
+
+  memcpy(copy, msg, len);
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)copy;
+  msg_hdr->sequence = sequence++;
+  hmtl_msg_set_crc(msg_hdr);
+
+  return socket->deliver(SENDER_ADDRESS, msg_hdr->address, copy, len);
+}
+
+static uint64_t bench_check(const byte *msg, uint16_t len, uint32_t count) {
+  HostSocket *socket = &module.host_sockets[0];
+  uint32_t done = 0;
+  uint64_t elapsed = 0;
+
+  socket->clear();
+  while (done < count) {
+    uint32_t batch = 0;
+    while ((done + batch < count) && deliver_numbered(socket, msg, len)) {
+      batch++;
+    }
+
+    uint64_t start = bench_now_ns();
+    while (socket->pending()) {
+      boolean update = module.handler.check(&module.config);
+      bench_keep(update);
+    }
+    elapsed += bench_now_ns() - start;
+
+    done += batch;
+  }
+
+  return elapsed;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-n msgs] [-p serial|socket|process|check] "
+          "[-t type] [-s sockets]\n", name);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  uint32_t count = 200000;
+  byte paths = PATH_ALL;
+  const char *type = NULL;
+  byte num_sockets = 2;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:p:t:s:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        count = strtoul(optarg, NULL, 0);
+        break;
+      case 'p':
+        if (!strcmp(optarg, "serial")) paths = PATH_SERIAL;
+        else if (!strcmp(optarg, "socket")) paths = PATH_SOCKET;
+        else if (!strcmp(optarg, "process")) paths = PATH_PROCESS;
+        else if (!strcmp(optarg, "check")) paths = PATH_CHECK;
+        else usage(argv[0]);
+        break;
+      case 't':
+        type = optarg;
+        break;
+      case 's':
+        num_sockets = strtoul(optarg, NULL, 0);
+        if ((num_sockets == 0) ||
+            (num_sockets > HostModule::MAX_SOCKETS)) usage(argv[0]);
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+
+  for (byte s = 0; s < num_sockets; s++) {
+    module.addSocket();
+  }
+  module.setup(MODULE_ADDRESS, MODULE_DEVICE_ID, NUM_PIXELS);
+  module.handler.register_handler(BENCH_MSG_TYPE, handle_custom);
+
+  bench_print_header();
+
+  static const struct {
+    byte path;
+    const char *name;
+    uint64_t (*func)(const byte *msg, uint16_t len, uint32_t count);
+  } bench_paths[] = {
+    { PATH_SERIAL,  "serial",  bench_serial },
+    { PATH_SOCKET,  "socket",  bench_socket },
+    { PATH_PROCESS, "process", bench_process },
+    { PATH_CHECK,   "check",   bench_check },
+  };
+
+  for (byte p = 0; p < sizeof (bench_paths) / sizeof (bench_paths[0]); p++) {
+    if (!(paths & bench_paths[p].path)) continue;
+
+    for (byte m = 0; m < NUM_BENCH_MSGS; m++) {
+      const bench_msg_t *bench_msg = &bench_msgs[m];
+      if (!(bench_msg->paths & bench_paths[p].path)) continue;
+      if (type && strcmp(type, bench_msg->name)) continue;
+
+      memset(frame, 0, sizeof (frame));
+      uint16_t len = bench_msg->fmt(msg_buffer, HOST_SOCKET_MAX_FRAME);
+
+      bench_result_t result;
+      result.path = bench_paths[p].name;
+      result.name = bench_msg->name;
+      result.count = count;
+      result.elapsed_ns = bench_paths[p].func(msg_buffer, len, count);
+      bench_print_result(&result);
+    }
+  }
+
+  return 0;
+}
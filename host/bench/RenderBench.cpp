@@ -0,0 +1,220 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Rendering benchmark for the built-in pixel programs.
+ *
+ * Each program is started on the pixel output of a host module through the
+ * ProgramManager, and the time to render a frame is measured across a sweep
+ * of strip lengths.  The clock is advanced by the program's period before
+ * every frame so that each frame does a full update.
+ *
+ * Results are reported as us/frame and the frame rate that rendering alone
+ * allows, along with the rate once the time to clock the data out to a
+ * WS2812 strip (30us per pixel) is included.
+ *
+ * Usage: RenderBench [-n frames] [-p program] [-l pixels[,pixels...]]
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "HMTLTypes.h"
+#include "HMTLMessaging.h"
+#include "HMTLPrograms.h"
+
+#include "HostModule.h"
+#include "BenchUtil.h"
+
+#define MODULE_ADDRESS   0x40
+#define MODULE_DEVICE_ID 100
+
+#define WS2812_US_PER_PIXEL 30
+
+#define MAX_LENGTHS 16
+
+typedef uint16_t (*render_fmt_func)(byte *buffer, uint16_t buffsize,
+                                    uint16_t num_pixels);
+
+typedef struct {
+  const char *name;
+  render_fmt_func fmt;
+  uint32_t period_ms;   // Time to advance the clock for each frame
+  boolean one_shot;     // Program only runs when its message is handled
+} render_program_t;
+
+/*******************************************************************************
+ * Program messages
+ */
+
+static uint16_t fmt_sparkle(byte *buffer, uint16_t buffsize,
+                            uint16_t num_pixels) {
+  /* Zero values select the program's defaults */
+  return program_sparkle_fmt(buffer, buffsize, MODULE_ADDRESS,
+                             HOST_OUTPUT_PIXELS,
+                             50, CRGB(0, 0, 0), 0, 0, 0, 255, 0, 255, 0, 255);
+}
+
+static uint16_t fmt_circular(byte *buffer, uint16_t buffsize,
+                             uint16_t num_pixels) {
+  return program_circular_fmt(buffer, buffsize, MODULE_ADDRESS,
+                              HOST_OUTPUT_PIXELS,
+                              100, 10, CRGB(0, 0, 0), 0, 0);
+}
+
+static uint16_t fmt_fade(byte *buffer, uint16_t buffsize,
+                         uint16_t num_pixels) {
+  return hmtl_program_fade_fmt(buffer, buffsize, MODULE_ADDRESS,
+                               HOST_OUTPUT_PIXELS,
+                               1000, pixel_color(255, 0, 0),
+                               pixel_color(0, 0, 255),
+                               HMTL_FADE_FLAG_CYCLE);
+}
+
+static uint16_t fmt_blink(byte *buffer, uint16_t buffsize,
+                          uint16_t num_pixels) {
+  return hmtl_program_blink_fmt(buffer, buffsize, MODULE_ADDRESS,
+                                HOST_OUTPUT_PIXELS,
+                                10, pixel_color(255, 255, 255),
+                                10, pixel_color(0, 0, 0));
+}
+
+static uint16_t fmt_color(byte *buffer, uint16_t buffsize,
+                          uint16_t num_pixels) {
+  pixel_range_t range = { 0, num_pixels };
+  return program_color_fmt(buffer, buffsize, MODULE_ADDRESS,
+                           HOST_OUTPUT_PIXELS, CRGB(0, 255, 0), range);
+}
+
+static const render_program_t render_programs[] = {
+  { "sparkle",  fmt_sparkle,  50,   false },
+  { "circular", fmt_circular, 100,  false },
+  { "fade",     fmt_fade,     10,   false },
+  { "blink",    fmt_blink,    10,   false },
+  { "color",    fmt_color,    0,    true },
+};
+#define NUM_RENDER_PROGRAMS (sizeof (render_programs) / sizeof (render_program_t))
+
+static const uint16_t default_lengths[] = {
+  50, 100, 150, 300, 500, 1000, 2000
+};
+
+/*******************************************************************************
+ * Benchmark
+ */
+
+static byte msg_buffer[sizeof (msg_hdr_t) + sizeof (msg_max_t)];
+
+static uint64_t bench_render(const render_program_t *program,
+                             uint16_t num_pixels, uint32_t frames) {
+  HostModule *module = new HostModule();
+  module->addSocket();
+  module->setup(MODULE_ADDRESS, MODULE_DEVICE_ID, num_pixels);
+
+  randomSeed(1);
+
+  program->fmt(msg_buffer, sizeof (msg_buffer), num_pixels);
+  msg_program_t *msg_program = (msg_program_t *)(msg_buffer +
+                                                 sizeof (msg_hdr_t));
+  module->manager.handle_msg(msg_program);
+
+  uint64_t period_us = (uint64_t)program->period_ms * 1000;
+  uint64_t elapsed = 0;
+
+  if (program->one_shot) {
+    /* The program renders as part of handling its message */
+    uint64_t start = bench_now_ns();
+    for (uint32_t frame = 0; frame < frames; frame++) {
+      bench_keep(module->manager.handle_msg(msg_program));
+    }
+    elapsed = bench_now_ns() - start;
+  } else {
+    uint64_t start = bench_now_ns();
+    for (uint32_t frame = 0; frame < frames; frame++) {
+      host_clock_advance_us(period_us);
+      bench_keep(module->manager.run());
+    }
+    elapsed = bench_now_ns() - start;
+  }
+
+  bench_keep(module->pixels.leds[num_pixels - 1]);
+  delete module;
+
+  return elapsed;
+}
+
+static void print_header() {
+  printf("%-10s %8s %8s %12s %12s %12s\n",
+         "program", "pixels", "frames", "us/frame", "fps", "ws2812 fps");
+}
+
+static void print_result(const char *name, uint16_t num_pixels,
+                         uint32_t frames, uint64_t elapsed_ns) {
+  double us = frames ? elapsed_ns / 1000.0 / frames : 0.0;
+  double fps = (us > 0.0) ? 1000000.0 / us : 0.0;
+  double wire_fps = 1000000.0 / (us + (double)num_pixels * WS2812_US_PER_PIXEL);
+  printf("%-10s %8u %8u %12.2f %12.0f %12.1f\n",
+         name, num_pixels, frames, us, fps, wire_fps);
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-n frames] [-p program] "
+          "[-l pixels[,pixels...]]\n", name);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  uint32_t frames = 1000;
+  const char *name = NULL;
+
+  uint16_t lengths[MAX_LENGTHS];
+  byte num_lengths = sizeof (default_lengths) / sizeof (default_lengths[0]);
+  memcpy(lengths, default_lengths, sizeof (default_lengths));
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:p:l:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        frames = strtoul(optarg, NULL, 0);
+        break;
+      case 'p':
+        name = optarg;
+        break;
+      case 'l': {
+        num_lengths = 0;
+        char *save;
+        for (char *tok = strtok_r(optarg, ",", &save);
+             (tok != NULL) && (num_lengths < MAX_LENGTHS);
+             tok = strtok_r(NULL, ",", &save)) {
+          uint16_t length = strtoul(tok, NULL, 0);
+          if (length == 0) usage(argv[0]);
+          lengths[num_lengths++] = length;
+        }
+        break;
+      }
+      default:
+        usage(argv[0]);
+    }
+  }
+  if ((frames == 0) || (num_lengths == 0)) usage(argv[0]);
+
+  /* Programs see a deterministic clock advanced once per frame */
+  host_clock_manual(true);
+
+  print_header();
+  for (byte p = 0; p < NUM_RENDER_PROGRAMS; p++) {
+    const render_program_t *program = &render_programs[p];
+    if (name && strcmp(name, program->name)) continue;
+
+    for (byte l = 0; l < num_lengths; l++) {
+      uint64_t elapsed = bench_render(program, lengths[l], frames);
+      print_result(program->name, lengths[l], frames, elapsed);
+    }
+  }
+
+  return 0;
+}
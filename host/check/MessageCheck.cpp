@@ -0,0 +1,2206 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Correctness checks of the message paths for the host build.
+ *
+ * Each check drives the message functions or host modules through a scenario
+ * and verifies the outcome, printing what it saw.  The exit status is nonzero
+ * if any check fails so that `make check` fails with it.
+ *
+ *   serial_resync - Messages behind noise and false start codes over serial
+ *   batch         - Outputs of a batch applied, a record overrunning it not
+ *   raw_frame     - Raw frames over a socket written into the pixels in place
+ *   pixel_frame   - Raw, RLE and delta encoded frames decoded into the pixels
+ *   crc           - Corrupted messages dropped over serial and sockets
+ *   budget        - Queued messages drained by one check within its budget
+ *   dedup_ttl     - Duplicates over two paths, the hop limit and v2 upgrades
+ *   routing       - Unicast sent only where its target was heard until stale
+ *   dispatch      - Built-in, registered and unknown message types handled
+ *   deferred_poll - Broadcast polls answered in the module's slot, not blocking
+ *   discovery     - Discovery slots spread, by address and silenced if known
+ *   dump_config   - Config dumped a page per loop and continued from a page
+ *   poll_outputs  - Output descriptors split over poll responses in order
+ *   zero_copy     - Messages forwarded to every socket from the receive buffer
+ *   groups        - Group messages applied by members, sent towards members
+ *   v2_peers      - Replies and forwards to a v2 module in version 2 headers
+ *   reassembly    - A message too large for a socket forwarded in fragments
+ *   reliable      - Reliable messages delivered once despite lost frames
+ *   low_queue     - Bulk traffic handled after priority traffic from others
+ *   coalescing    - Newer output messages replacing queued ones in their order
+ *   builders      - Messages built and viewed by type, refused if too small
+ *   trace_wrap    - The newest messages kept in the trace, read oldest first
+ *
+ * Usage: MessageCheck [-t check]
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "HMTLTypes.h"
+#include "HMTLMessaging.h"
+#include "PixelFrame.h"
+#include "TimeSync.h"
+
+#include "HostModule.h"
+
+#define MODULE_ADDRESS   0x40
+#define SENDER_ADDRESS   0x10
+#define OTHER_ADDRESS    0x50
+#define MODULE_DEVICE_ID 100
+
+/* Fixed so that every run sees the same noise */
+#define CHECK_SEED 1
+
+typedef boolean (*check_func)();
+
+/*******************************************************************************
+ * Serial parsing
+ */
+
+#define RESYNC_MSGS      100
+#define RESYNC_MAX_NOISE 40
+
+/*
+ * Precede each message with noise in which a quarter of the bytes are start
+ * codes, and check that every message is still received intact and in order.
+ */
+static boolean check_serial_resync() {
+  static byte msgs[RESYNC_MSGS][HMTL_MSG_RGB_LEN];
+
+  srand(CHECK_SEED);
+  Serial.reset();
+  for (int i = 0; i < RESYNC_MSGS; i++) {
+    byte noise[RESYNC_MAX_NOISE];
+    int noise_len = rand() % RESYNC_MAX_NOISE;
+    for (int j = 0; j < noise_len; j++) {
+      noise[j] = (rand() % 4 == 0) ? HMTL_MSG_START : rand();
+    }
+    Serial.inject(noise, noise_len);
+
+    hmtl_rgb_fmt(msgs[i], sizeof (msgs[i]), MODULE_ADDRESS, 0,
+                 i, i * 2, i * 3);
+    Serial.inject(msgs[i], sizeof (msgs[i]));
+  }
+
+  byte buffer[HMTL_MAX_MSG_LEN];
+  byte offset = 0;
+  msg_drop_counts_t drops;
+  memset(&drops, 0, sizeof (drops));
+  int received = 0;
+  int unexpected = 0;
+  while (Serial.available()) {
+    if (!hmtl_serial_getmsg(buffer, sizeof (buffer), &offset, &drops)) {
+      continue;
+    }
+
+    if ((received < RESYNC_MSGS) && (offset == HMTL_MSG_RGB_LEN) &&
+        (memcmp(buffer, msgs[received], HMTL_MSG_RGB_LEN) == 0)) {
+      received++;
+    } else {
+      unexpected++;
+    }
+    offset = 0;
+  }
+
+  printf("  %d of %d received, %d unexpected, %u bad crc, %u bad version\n",
+         received, RESYNC_MSGS, unexpected, drops.bad_crc, drops.bad_version);
+  return (received == RESYNC_MSGS);
+}
+
+/*******************************************************************************
+ * Pixel frames
+ *
+ * Frames are encoded as the python library's encoders do, see HMTLprotocol.py,
+ * split into messages of FRAME_MSG_LEN bytes.
+ */
+
+#define FRAME_PIXELS   300
+#define FRAME_MSG_LEN  64
+#define FRAME_MAX_DATA (FRAME_MSG_LEN - HMTL_MSG_PIXEL_FRAME_MIN_LEN)
+#define FRAME_MAX_MSGS 64
+
+typedef struct {
+  uint16_t offset;
+  uint16_t length;
+  byte data[FRAME_MAX_DATA];
+} frame_chunk_t;
+
+static frame_chunk_t frame_chunks[FRAME_MAX_MSGS];
+static uint8_t num_chunks;
+
+static void frame_next(uint16_t pixel) {
+  frame_chunk_t *chunk = &frame_chunks[num_chunks++];
+  chunk->offset = pixel;
+  chunk->length = 0;
+}
+
+static uint16_t frame_room() {
+  return FRAME_MAX_DATA - frame_chunks[num_chunks - 1].length;
+}
+
+/* Start the next chunk if the current one doesn't have room for length */
+static byte *frame_append(uint16_t pixel, uint16_t length) {
+  if (frame_room() < length) {
+    frame_next(pixel);
+  }
+  frame_chunk_t *chunk = &frame_chunks[num_chunks - 1];
+  chunk->length += length;
+  return &chunk->data[chunk->length - length];
+}
+
+static void frame_start() {
+  num_chunks = 0;
+  frame_next(0);
+}
+
+static void encode_raw(const CRGB *pixels) {
+  frame_start();
+  for (uint16_t i = 0; i < FRAME_PIXELS; i++) {
+    memcpy(frame_append(i, 3), pixels[i].raw, 3);
+  }
+}
+
+static void encode_rle(const CRGB *pixels) {
+  frame_start();
+  for (uint16_t i = 0; i < FRAME_PIXELS; ) {
+    uint16_t j = i;
+    while ((j < FRAME_PIXELS) && (j - i < 255) && (pixels[j] == pixels[i])) {
+      j++;
+    }
+    byte *run = frame_append(i, 4);
+    run[0] = j - i;
+    memcpy(&run[1], pixels[i].raw, 3);
+    i = j;
+  }
+}
+
+static void encode_delta(const CRGB *pixels, const CRGB *previous) {
+  frame_start();
+  uint16_t last = 0; // Pixel following the previous span
+  for (uint16_t i = 0; i < FRAME_PIXELS; ) {
+    if (pixels[i] == previous[i]) {
+      i++;
+      continue;
+    }
+
+    /* Skips longer than a span allows are made with empty spans */
+    while (i - last > 255) {
+      byte *span = frame_append(last, 2);
+      span[0] = 255;
+      span[1] = 0;
+      last += 255;
+    }
+
+    /* Send at least one pixel per span */
+    if (frame_room() < 5) {
+      frame_next(last);
+    }
+    uint16_t count = 0;
+    uint16_t max_count = (frame_room() - 2) / 3;
+    while ((i + count < FRAME_PIXELS) && (count < 255) &&
+           (count < max_count) && !(pixels[i + count] == previous[i + count])) {
+      count++;
+    }
+
+    byte *span = frame_append(last, 2 + count * 3);
+    span[0] = i - last;
+    span[1] = count;
+    memcpy(&span[2], pixels[i].raw, count * 3);
+    i += count;
+    last = i;
+  }
+}
+
+/*
+ * Send the encoded chunks of a frame to the pixel output, returning the
+ * number of frames completed.
+ */
+static uint16_t frame_send(HostModule *module, PixelFrame *receiver,
+                           uint8_t encoding, uint8_t frame) {
+  uint16_t completed = 0;
+  for (uint8_t c = 0; c < num_chunks; c++) {
+    byte msg[FRAME_MSG_LEN];
+    hmtl_pixel_frame_encoded_fmt(msg, sizeof (msg), MODULE_ADDRESS,
+                                 (c < num_chunks - 1 ? MSG_FLAG_MORE_DATA : 0),
+                                 HOST_OUTPUT_PIXELS, frame,
+                                 frame_chunks[c].offset, encoding, frame - 1,
+                                 frame_chunks[c].data, frame_chunks[c].length);
+    if (receiver->handle_msg((msg_hdr_t *)msg, HMTL_MAX_OUTPUTS,
+                             module->outputs, module->objects)) {
+      completed++;
+    }
+  }
+  return completed;
+}
+
+/* Fill pixels with runs of a few colors */
+static void frame_fill(CRGB *pixels) {
+  static const CRGB colors[] = {
+    CRGB(0, 0, 0), CRGB(255, 0, 0), CRGB(0, 128, 255), CRGB(20, 40, 60)
+  };
+  for (uint16_t i = 0; i < FRAME_PIXELS; ) {
+    uint16_t run = 1 + rand() % 40;
+    CRGB color = colors[rand() % 4];
+    for (uint16_t j = 0; (j < run) && (i < FRAME_PIXELS); j++, i++) {
+      pixels[i] = color;
+    }
+  }
+}
+
+static boolean frame_matches(HostModule *module, const CRGB *pixels) {
+  return memcmp(module->pixels.leds, pixels, FRAME_PIXELS * 3) == 0;
+}
+
+/*
+ * Send a raw keyframe followed by RLE and delta frames, including a delta
+ * with a skip too long for a single span, and check that the output holds
+ * each frame once received.  A delta relative to a frame the output doesn't
+ * hold must be dropped.
+ */
+static boolean check_pixel_frame() {
+  static HostModule module;
+  module.addSocket();
+  module.setup(MODULE_ADDRESS, MODULE_DEVICE_ID, FRAME_PIXELS);
+  PixelFrame receiver;
+
+  srand(CHECK_SEED);
+  CRGB previous[FRAME_PIXELS];
+  CRGB pixels[FRAME_PIXELS];
+  boolean passed = true;
+  uint8_t frame = 1;
+
+  frame_fill(pixels);
+  encode_raw(pixels);
+  uint16_t completed = frame_send(&module, &receiver, PIXEL_FRAME_RAW, frame);
+  boolean matched = frame_matches(&module, pixels);
+  printf("  raw:   %u msgs, %s\n", num_chunks, matched ? "match" : "differ");
+  passed = passed && matched && (completed == 1);
+
+  memcpy(previous, pixels, sizeof (pixels));
+  frame_fill(pixels);
+  encode_rle(pixels);
+  completed = frame_send(&module, &receiver, PIXEL_FRAME_RLE, ++frame);
+  matched = frame_matches(&module, pixels);
+  printf("  rle:   %u msgs, %s\n", num_chunks, matched ? "match" : "differ");
+  passed = passed && matched && (completed == 1);
+
+  /* Change a few spans, the last far enough along to need an empty span */
+  memcpy(previous, pixels, sizeof (pixels));
+  for (uint16_t i = 5; i < 30; i++) pixels[i] = CRGB(i, 1, 2);
+  pixels[35] = CRGB(1, 2, 3);
+  for (uint16_t i = 297; i < FRAME_PIXELS; i++) pixels[i] = CRGB(9, 9, i);
+  encode_delta(pixels, previous);
+  completed = frame_send(&module, &receiver, PIXEL_FRAME_DELTA, ++frame);
+  matched = frame_matches(&module, pixels);
+  printf("  delta: %u msgs, %s\n", num_chunks, matched ? "match" : "differ");
+  passed = passed && matched && (completed == 1);
+
+  /* A delta against a frame that was never received */
+  memcpy(previous, pixels, sizeof (pixels));
+  pixels[0] = CRGB(7, 7, 7);
+  encode_delta(pixels, previous);
+  frame += 2;
+  uint16_t dropped = receiver.dropped;
+  completed = frame_send(&module, &receiver, PIXEL_FRAME_DELTA, frame);
+  matched = frame_matches(&module, previous);
+  printf("  stale delta: %s\n", (matched && (completed == 0) &&
+                                 (receiver.dropped > dropped)) ?
+         "dropped" : "applied");
+  passed = passed && matched && (completed == 0);
+
+  return passed;
+}
+
+static void module_run(HostModule *module) {
+  for (int i = 0; i < 4; i++) {
+    module->loop();
+  }
+}
+
+#define RAW_FRAME_PIXELS     30
+#define RAW_FRAME_MSG_PIXELS 12
+
+/*
+ * Send one part of a raw frame of RAW_FRAME_MSG_PIXELS pixels starting at
+ * offset, the last part if it reaches num_pixels, to a module's socket
+ */
+static void raw_frame_send(HostModule *module, const CRGB *pixels,
+                           uint8_t frame, uint16_t offset,
+                           uint16_t num_pixels) {
+  uint16_t count = num_pixels - offset;
+  if (count > RAW_FRAME_MSG_PIXELS) count = RAW_FRAME_MSG_PIXELS;
+  byte msg[HMTL_MSG_PIXEL_FRAME_MIN_LEN + RAW_FRAME_MSG_PIXELS * 3];
+  uint16_t len = hmtl_pixel_frame_fmt(msg, sizeof (msg), MODULE_ADDRESS,
+                                      (offset + count < num_pixels ?
+                                       MSG_FLAG_MORE_DATA : 0),
+                                      HOST_OUTPUT_PIXELS, frame, offset,
+                                      (const byte *)&pixels[offset], count);
+  module->host_sockets[0].deliver(SENDER_ADDRESS, MODULE_ADDRESS, msg, len);
+  module_run(module);
+}
+
+static boolean raw_frame_matches(HostModule *module, const CRGB *pixels,
+                                 uint16_t first, uint16_t count) {
+  return memcmp(&module->pixels.leds[first], &pixels[first], count * 3) == 0;
+}
+
+/*
+ * Send raw frames in parts through a module's message handler and check that
+ * each part is in the pixels as soon as it is received, that the rest of a
+ * frame missing a part is ignored, and that pixels beyond the output's are
+ * discarded.
+ */
+static boolean check_raw_frame() {
+  static HostModule module;
+  module.addSocket();
+  module.setup(MODULE_ADDRESS, MODULE_DEVICE_ID, RAW_FRAME_PIXELS);
+  boolean passed = true;
+
+  CRGB pixels[RAW_FRAME_PIXELS + RAW_FRAME_MSG_PIXELS];
+  for (uint16_t i = 0; i < RAW_FRAME_PIXELS + RAW_FRAME_MSG_PIXELS; i++) {
+    pixels[i] = CRGB(i, 2 * i, 3 * i);
+  }
+
+  raw_frame_send(&module, pixels, 1, 0, RAW_FRAME_PIXELS);
+  boolean in_place = raw_frame_matches(&module, pixels, 0,
+                                       RAW_FRAME_MSG_PIXELS);
+  raw_frame_send(&module, pixels, 1, RAW_FRAME_MSG_PIXELS, RAW_FRAME_PIXELS);
+  raw_frame_send(&module, pixels, 1, 2 * RAW_FRAME_MSG_PIXELS,
+                 RAW_FRAME_PIXELS);
+  boolean matched = raw_frame_matches(&module, pixels, 0, RAW_FRAME_PIXELS);
+  printf("  first part %s, whole frame %s\n",
+         in_place ? "in the pixels" : "not in the pixels",
+         matched ? "match" : "differ");
+  passed = passed && in_place && matched;
+
+  /* A frame missing its second part, the third must not be applied */
+  CRGB previous[RAW_FRAME_PIXELS];
+  memcpy(previous, pixels, sizeof (previous));
+  for (uint16_t i = 0; i < RAW_FRAME_PIXELS; i++) {
+    pixels[i] = CRGB(255 - i, 0, i);
+  }
+  raw_frame_send(&module, pixels, 2, 0, RAW_FRAME_PIXELS);
+  raw_frame_send(&module, pixels, 2, 2 * RAW_FRAME_MSG_PIXELS,
+                 RAW_FRAME_PIXELS);
+  boolean ignored = raw_frame_matches(&module, pixels, 0,
+                                      RAW_FRAME_MSG_PIXELS) &&
+                    raw_frame_matches(&module, previous,
+                                      RAW_FRAME_MSG_PIXELS,
+                                      RAW_FRAME_PIXELS -
+                                      RAW_FRAME_MSG_PIXELS);
+  printf("  part after a missing one %s\n", ignored ? "ignored" : "applied");
+  passed = passed && ignored;
+
+  /* A frame longer than the output, whose last part is partly beyond it */
+  for (uint16_t i = 0; i < RAW_FRAME_PIXELS + RAW_FRAME_MSG_PIXELS; i++) {
+    pixels[i] = CRGB(i, 0, 255 - i);
+  }
+  uint16_t num_pixels = RAW_FRAME_PIXELS + RAW_FRAME_MSG_PIXELS / 2;
+  for (uint16_t offset = 0; offset < num_pixels;
+       offset += RAW_FRAME_MSG_PIXELS) {
+    raw_frame_send(&module, pixels, 3, offset, num_pixels);
+  }
+  matched = raw_frame_matches(&module, pixels, 0, RAW_FRAME_PIXELS);
+  printf("  %u pixels to a %u pixel output: %s\n", num_pixels,
+         RAW_FRAME_PIXELS, matched ? "match" : "differ");
+  passed = passed && matched;
+
+  return passed;
+}
+
+/*******************************************************************************
+ * Message CRCs
+ */
+
+static boolean module_rgb_is(HostModule *module, byte r, byte g, byte b) {
+  config_rgb_t *rgb = (config_rgb_t *)module->outputs[HOST_OUTPUT_RGB];
+  return (rgb->values[0] == r) && (rgb->values[1] == g) &&
+         (rgb->values[2] == b);
+}
+
+/*
+ * Corrupt a byte of the payload and then of the CRC itself in messages sent
+ * over serial and a socket, and check that each is dropped and counted while
+ * the intact messages around them are accepted.
+ */
+static boolean check_crc() {
+  boolean passed = true;
+
+  byte valid[HMTL_MSG_RGB_LEN];
+  byte bad_data[HMTL_MSG_RGB_LEN];
+  byte bad_crc[HMTL_MSG_RGB_LEN];
+  hmtl_rgb_fmt(valid, sizeof (valid), MODULE_ADDRESS, HOST_OUTPUT_RGB,
+               1, 2, 3);
+  hmtl_rgb_fmt(bad_data, sizeof (bad_data), MODULE_ADDRESS, HOST_OUTPUT_RGB,
+               4, 5, 6);
+  bad_data[HMTL_MSG_RGB_LEN - 1] ^= 0x10;
+  memcpy(bad_crc, valid, sizeof (valid));
+  ((msg_hdr_t *)bad_crc)->crc ^= 0x01;
+
+  /* Serial, with the corrupted messages between intact ones */
+  Serial.reset();
+  Serial.inject(valid, sizeof (valid));
+  Serial.inject(bad_data, sizeof (bad_data));
+  Serial.inject(bad_crc, sizeof (bad_crc));
+  Serial.inject(valid, sizeof (valid));
+
+  byte buffer[HMTL_MAX_MSG_LEN];
+  byte offset = 0;
+  msg_drop_counts_t drops;
+  memset(&drops, 0, sizeof (drops));
+  int received = 0;
+  while (Serial.available()) {
+    if (hmtl_serial_getmsg(buffer, sizeof (buffer), &offset, &drops)) {
+      if (memcmp(buffer, valid, sizeof (valid)) == 0) received++;
+      offset = 0;
+    }
+  }
+  printf("  serial: %d of 2 received, %u bad crc\n", received, drops.bad_crc);
+  passed = passed && (received == 2) && (drops.bad_crc == 2);
+
+  /* A module's socket, where a corrupted message must not reach the output */
+  static HostModule module;
+  module.addSocket();
+  module.setup(MODULE_ADDRESS, MODULE_DEVICE_ID, 0);
+
+  module.host_sockets[0].deliver(SENDER_ADDRESS, MODULE_ADDRESS,
+                                 valid, sizeof (valid));
+  module_run(&module);
+  boolean applied = module_rgb_is(&module, 1, 2, 3);
+
+  module.host_sockets[0].deliver(SENDER_ADDRESS, MODULE_ADDRESS,
+                                 bad_data, sizeof (bad_data));
+  module.host_sockets[0].deliver(SENDER_ADDRESS, MODULE_ADDRESS,
+                                 bad_crc, sizeof (bad_crc));
+  module_run(&module);
+  boolean unchanged = module_rgb_is(&module, 1, 2, 3);
+
+  msg_drop_counts_t *socket_drops =
+    module.handler.drop_counts(module.sockets[0]);
+  printf("  socket: valid %s, corrupted %s, %u bad crc\n",
+         applied ? "applied" : "dropped", unchanged ? "dropped" : "applied",
+         socket_drops->bad_crc);
+  passed = passed && applied && unchanged && (socket_drops->bad_crc == 2);
+
+  /* A message behind a corrupted one is still received by the same check */
+  byte after[HMTL_MSG_RGB_LEN];
+  hmtl_rgb_fmt(after, sizeof (after), MODULE_ADDRESS, HOST_OUTPUT_RGB,
+               7, 8, 9);
+  module.host_sockets[0].deliver(SENDER_ADDRESS, MODULE_ADDRESS,
+                                 bad_data, sizeof (bad_data));
+  module.host_sockets[0].deliver(SENDER_ADDRESS, MODULE_ADDRESS,
+                                 after, sizeof (after));
+  module.loop();
+  applied = module_rgb_is(&module, 7, 8, 9);
+  printf("  after a drop: %s in the same check\n",
+         applied ? "received" : "not received");
+  passed = passed && applied;
+
+  /* A module without sockets acknowledges reliable serial messages over it */
+  static HostModule serial_only;
+  serial_only.setup(MODULE_ADDRESS, MODULE_DEVICE_ID, 0);
+  hmtl_rgb_fmt(after, sizeof (after), MODULE_ADDRESS, HOST_OUTPUT_RGB,
+               10, 11, 12);
+  msg_hdr_t *after_hdr = (msg_hdr_t *)after;
+  after_hdr->flags |= MSG_FLAG_RELIABLE;
+  hmtl_msg_set_crc(after_hdr);
+  Serial.reset();
+  Serial.inject(after, sizeof (after));
+  module_run(&serial_only);
+  applied = module_rgb_is(&serial_only, 10, 11, 12);
+  printf("  no sockets: reliable serial msg %s\n",
+         applied ? "applied" : "dropped");
+  passed = passed && applied;
+
+  return passed;
+}
+
+/*******************************************************************************
+ * Batches
+ */
+
+static boolean module_value_is(HostModule *module, uint16_t value) {
+  return ((config_value_t *)module->outputs[HOST_OUTPUT_VALUE])->value ==
+         value;
+}
+
+/*
+ * Send a batch updating the value and RGB outputs followed by a record whose
+ * length runs past the end of the message, and check that both outputs are
+ * set by the one message and the overrunning record is not applied.
+ */
+static boolean check_batch() {
+  static HostModule module;
+  module.addSocket();
+  module.setup(MODULE_ADDRESS, MODULE_DEVICE_ID, 0);
+
+  byte msg[HMTL_MSG_BATCH_MAX_LEN];
+  msg_value_t value = { { HMTL_OUTPUT_VALUE, HOST_OUTPUT_VALUE }, 30, 0 };
+  msg_rgb_t rgb = { { HMTL_OUTPUT_RGB, HOST_OUTPUT_RGB }, { 7, 8, 9 } };
+  hmtl_batch_fmt(msg, sizeof (msg), MODULE_ADDRESS);
+  hmtl_batch_add(msg, sizeof (msg), &value.hdr, sizeof (value));
+  hmtl_batch_add(msg, sizeof (msg), &rgb.hdr, sizeof (rgb));
+  uint16_t len = hmtl_batch_finish(msg);
+  module.host_sockets[0].deliver(SENDER_ADDRESS, MODULE_ADDRESS, msg, len);
+  module_run(&module);
+  boolean applied = module_value_is(&module, 30) &&
+                    module_rgb_is(&module, 7, 8, 9);
+  printf("  %u byte batch of value and rgb: %s\n", len,
+         applied ? "both applied" : "not applied");
+
+  /* The last record claims more bytes than the message holds */
+  value.value = 40;
+  rgb.values[0] = 1;
+  hmtl_batch_fmt(msg, sizeof (msg), MODULE_ADDRESS);
+  hmtl_batch_add(msg, sizeof (msg), &value.hdr, sizeof (value));
+  hmtl_batch_add(msg, sizeof (msg), &rgb.hdr, sizeof (rgb));
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)msg;
+  msg_batch_record_t *overrun =
+    (msg_batch_record_t *)(msg + msg_hdr->length - sizeof (uint8_t) -
+                           sizeof (rgb));
+  overrun->length = sizeof (rgb) + 1;
+  len = hmtl_batch_finish(msg);
+  module.host_sockets[0].deliver(SENDER_ADDRESS, MODULE_ADDRESS, msg, len);
+  module_run(&module);
+  boolean truncated = module_value_is(&module, 40) &&
+                      module_rgb_is(&module, 7, 8, 9);
+  printf("  overrunning record: %s\n",
+         truncated ? "dropped" : "applied");
+
+  return applied && truncated;
+}
+
+/*******************************************************************************
+ * Check budget
+ */
+
+#define BUDGET_MSGS   20
+#define BUDGET_MSG_US 500
+
+/* Messages handled, each taking budget_msg_us of the manual clock */
+static uint16_t budget_handled;
+static uint32_t budget_msg_us;
+
+static boolean count_budget(MessageHandler *handler, msg_hdr_t *msg_hdr,
+                            Socket *src, Socket *serial_socket,
+                            config_hdr_t *config) {
+  budget_handled++;
+  host_clock_advance_us(budget_msg_us);
+  return false;
+}
+
+/*
+ * Queue messages for a module and return the number its next loop handles.
+ * They are batches, which unlike single outputs aren't coalesced.
+ */
+static uint16_t budget_loop(HostModule *module) {
+  byte msg[HMTL_MSG_BATCH_MAX_LEN];
+  for (uint16_t i = 0; i < BUDGET_MSGS; i++) {
+    msg_rgb_t rgb = { { HMTL_OUTPUT_RGB, HOST_OUTPUT_RGB }, { (uint8_t)i } };
+    hmtl_batch_fmt(msg, sizeof (msg), MODULE_ADDRESS);
+    hmtl_batch_add(msg, sizeof (msg), &rgb.hdr, sizeof (rgb));
+    uint16_t len = hmtl_batch_finish(msg);
+    module->host_sockets[0].deliver(SENDER_ADDRESS, MODULE_ADDRESS,
+                                    msg, len);
+  }
+  budget_handled = 0;
+  module->loop();
+  return budget_handled;
+}
+
+/*
+ * Queue messages on a module's socket and check that a single loop drains
+ * them all when they are quick to handle, stops once the check budget is
+ * used when they are slow, and handles one per check with no budget.
+ */
+static boolean check_budget() {
+  static HostModule module;
+  module.addSocket();
+  module.setup(MODULE_ADDRESS, MODULE_DEVICE_ID, 0);
+  module.handler.register_handler(MSG_TYPE_BATCH, count_budget);
+  host_clock_manual(true);
+  module.loop();
+  boolean passed = true;
+
+  budget_msg_us = 0;
+  uint16_t handled = budget_loop(&module);
+  printf("  instant messages: %u of %u in one loop\n", handled, BUDGET_MSGS);
+  passed = passed && (handled == BUDGET_MSGS);
+
+  budget_msg_us = BUDGET_MSG_US;
+  uint16_t overruns = module.handler.budget_overruns;
+  handled = budget_loop(&module);
+  uint16_t loops = 1;
+  while ((budget_handled < BUDGET_MSGS) && (loops < 2 * BUDGET_MSGS)) {
+    module.loop();
+    loops++;
+  }
+  printf("  %u us messages: %u in the first loop, all in %u loops, "
+         "%u overruns\n", BUDGET_MSG_US, handled, loops,
+         module.handler.budget_overruns - overruns);
+  passed = passed && (handled == MSG_CHECK_BUDGET_US / BUDGET_MSG_US) &&
+           (budget_handled == BUDGET_MSGS) &&
+           (module.handler.budget_overruns > overruns);
+
+  module.handler.set_check_budget(0);
+  handled = budget_loop(&module);
+  printf("  no budget: %u in the first loop\n", handled);
+  passed = passed && (handled == 1);
+  module.host_sockets[0].clear();
+  host_clock_manual(false);
+
+  return passed;
+}
+
+/*******************************************************************************
+ * Duplicates, hop limits and version 2 messages
+ */
+
+/* Output messages a module transmitted, other traffic is ignored */
+typedef struct {
+  uint16_t count;
+  byte last[HMTL_MAX_MSG_LEN];
+} sent_outputs_t;
+
+static void collect_output(HostSocket *socket, const host_socket_hdr_t *hdr,
+                           const byte *data, void *arg) {
+  sent_outputs_t *sent = (sent_outputs_t *)arg;
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)data;
+  if ((hdr->length <= sizeof (sent->last)) &&
+      (msg_hdr->type == MSG_TYPE_OUTPUT)) {
+    sent->count++;
+    memcpy(sent->last, data, hdr->length);
+  }
+}
+
+/* The first frame a module transmitted to an address since count was reset */
+typedef struct {
+  socket_addr_t dest;
+  uint16_t count;
+  uint16_t length;
+  byte last[HOST_SOCKET_MAX_FRAME];
+} sent_frames_t;
+
+static void collect_frame(HostSocket *socket, const host_socket_hdr_t *hdr,
+                          const byte *data, void *arg) {
+  sent_frames_t *sent = (sent_frames_t *)arg;
+  if ((hdr->dest == sent->dest) && (sent->count++ == 0)) {
+    // Only the first, the later parts of a response aren't checked
+    sent->length = hdr->length;
+    memcpy(sent->last, data, hdr->length);
+  }
+}
+
+/* Format an RGB message as sent by another module */
+static void format_forwarded(byte *msg, socket_addr_t address,
+                             uint8_t sequence, uint8_t ttl, byte r) {
+  hmtl_rgb_fmt(msg, HMTL_MSG_RGB_LEN, address, HOST_OUTPUT_RGB, r, 0, 0);
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)msg;
+  msg_hdr->origin = SENDER_ADDRESS;
+  msg_hdr->sequence = sequence;
+  msg_hdr->ttl = ttl;
+  hmtl_msg_set_crc(msg_hdr);
+}
+
+/*
+ * Send a module copies of a message over both of its sockets, as when it can
+ * be reached over two paths, and check that only the first is handled.  Then
+ * check that a message with no hops left isn't forwarded while one with a
+ * hop left is, and that version 2 messages are handled and forwarded with the
+ * current header identifying their sender as the origin.
+ */
+static boolean check_dedup_ttl() {
+  static HostModule module;
+  sent_outputs_t sent;
+  memset(&sent, 0, sizeof (sent));
+  module.addSocket();
+  module.addSocket()->setTransmit(collect_output, &sent);
+  module.setup(MODULE_ADDRESS, MODULE_DEVICE_ID, 0);
+  boolean passed = true;
+
+  byte msg[HMTL_MSG_RGB_LEN];
+  format_forwarded(msg, MODULE_ADDRESS, 1, HMTL_MSG_DEFAULT_TTL, 10);
+  module.host_sockets[0].deliver(SENDER_ADDRESS, MODULE_ADDRESS,
+                                 msg, sizeof (msg));
+  module_run(&module);
+  boolean applied = module_rgb_is(&module, 10, 0, 0);
+
+  /* The second copy is changed so that handling it would be seen */
+  format_forwarded(msg, MODULE_ADDRESS, 1, HMTL_MSG_DEFAULT_TTL, 20);
+  module.host_sockets[1].deliver(OTHER_ADDRESS, MODULE_ADDRESS,
+                                 msg, sizeof (msg));
+  module_run(&module);
+  boolean dropped = module_rgb_is(&module, 10, 0, 0);
+  uint16_t duplicates =
+    module.handler.drop_counts(module.sockets[1])->duplicate;
+  printf("  copies: first %s, second %s, %u duplicate\n",
+         applied ? "applied" : "dropped", dropped ? "dropped" : "applied",
+         duplicates);
+  passed = passed && applied && dropped && (duplicates == 1);
+
+  /* Messages for another module arriving with one hop left and with none */
+  format_forwarded(msg, OTHER_ADDRESS, 2, 1, 30);
+  module.host_sockets[0].deliver(SENDER_ADDRESS, OTHER_ADDRESS,
+                                 msg, sizeof (msg));
+  module_run(&module);
+  uint16_t forwarded = sent.count;
+  uint8_t forwarded_ttl = ((msg_hdr_t *)sent.last)->ttl;
+
+  format_forwarded(msg, OTHER_ADDRESS, 3, 0, 40);
+  uint16_t hop_limited = module.handler.hop_limited;
+  module.host_sockets[0].deliver(SENDER_ADDRESS, OTHER_ADDRESS,
+                                 msg, sizeof (msg));
+  module_run(&module);
+  printf("  ttl 1: %u forwarded with ttl %u, ttl 0: %u forwarded\n",
+         forwarded, forwarded_ttl, sent.count - forwarded);
+  passed = passed && (forwarded == 1) && (forwarded_ttl == 0) &&
+           (sent.count == forwarded) &&
+           (module.handler.hop_limited == hop_limited + 1);
+
+  /* Version 2 messages, for this module and for another */
+  byte v2_msg[HMTL_MSG_RGB_LEN];
+  uint8_t v2_len =
+    HMTL_MSG_RGB_LEN - (sizeof (msg_hdr_t) - HMTL_MSG_V2_HDR_LEN);
+  hmtl_rgb_fmt(msg, sizeof (msg), MODULE_ADDRESS, HOST_OUTPUT_RGB, 50, 0, 0);
+  memcpy(v2_msg, msg, HMTL_MSG_V2_HDR_LEN);
+  memcpy(v2_msg + HMTL_MSG_V2_HDR_LEN, msg + sizeof (msg_hdr_t),
+         v2_len - HMTL_MSG_V2_HDR_LEN);
+  msg_hdr_t *v2_hdr = (msg_hdr_t *)v2_msg;
+  v2_hdr->crc = 0;
+  v2_hdr->version = HMTL_MSG_VERSION_2;
+  v2_hdr->length = v2_len;
+  module.host_sockets[0].deliver(SENDER_ADDRESS, MODULE_ADDRESS,
+                                 v2_msg, v2_len);
+  module_run(&module);
+  applied = module_rgb_is(&module, 50, 0, 0);
+
+  v2_hdr->address = OTHER_ADDRESS;
+  forwarded = sent.count;
+  module.host_sockets[0].deliver(SENDER_ADDRESS, OTHER_ADDRESS,
+                                 v2_msg, v2_len);
+  module_run(&module);
+  msg_hdr_t *upgraded = (msg_hdr_t *)sent.last;
+  boolean upgrade_ok = (sent.count == forwarded + 1) &&
+    (upgraded->version == HMTL_MSG_VERSION) &&
+    (upgraded->length == HMTL_MSG_RGB_LEN) &&
+    (upgraded->origin == SENDER_ADDRESS) &&
+    (upgraded->crc == hmtl_msg_crc(upgraded));
+  printf("  v2: %s, forwarded as version %u from 0x%x\n",
+         applied ? "applied" : "dropped", upgraded->version, upgraded->origin);
+  passed = passed && applied && upgrade_ok;
+
+  return passed;
+}
+
+/*******************************************************************************
+ * Routing
+ */
+
+#define ROUTING_SOCKETS 3
+
+/*
+ * Deliver a message for OTHER_ADDRESS to a module's socket and return the
+ * sockets it was forwarded over as a bitmask
+ */
+static uint8_t routing_forwarded(HostModule *module, sent_outputs_t *sent,
+                                 byte socket, uint8_t sequence) {
+  uint16_t counts[ROUTING_SOCKETS];
+  for (byte i = 0; i < ROUTING_SOCKETS; i++) counts[i] = sent[i].count;
+
+  byte msg[HMTL_MSG_RGB_LEN];
+  format_forwarded(msg, OTHER_ADDRESS, sequence, HMTL_MSG_DEFAULT_TTL, 1);
+  module->host_sockets[socket].deliver(SENDER_ADDRESS, OTHER_ADDRESS,
+                                       msg, sizeof (msg));
+  module_run(module);
+
+  uint8_t forwarded = 0;
+  for (byte i = 0; i < ROUTING_SOCKETS; i++) {
+    if (sent[i].count != counts[i]) forwarded |= 1 << i;
+  }
+  return forwarded;
+}
+
+/*
+ * Send messages for an address through a module with three sockets, and
+ * check that they are sent over every other socket until the address is
+ * heard, then only over the socket it was heard on, not at all if they
+ * arrive on that socket, and over every other socket again once the route
+ * is stale.
+ */
+static boolean check_routing() {
+  static HostModule module;
+  static sent_outputs_t sent[ROUTING_SOCKETS];
+  memset(sent, 0, sizeof (sent));
+  for (byte i = 0; i < ROUTING_SOCKETS; i++) {
+    module.addSocket()->setTransmit(collect_output, &sent[i]);
+  }
+  module.setup(MODULE_ADDRESS, MODULE_DEVICE_ID, 0);
+  host_clock_manual(true);
+  boolean passed = true;
+
+  uint8_t forwarded = routing_forwarded(&module, sent, 0, 1);
+  printf("  no route: forwarded over sockets 0x%x\n", forwarded);
+  passed = passed && (forwarded == 0x6);
+
+  /* A message from the address over the third socket */
+  byte msg[HMTL_MSG_RGB_LEN];
+  format_forwarded(msg, MODULE_ADDRESS, 1, HMTL_MSG_DEFAULT_TTL, 2);
+  ((msg_hdr_t *)msg)->origin = OTHER_ADDRESS;
+  hmtl_msg_set_crc((msg_hdr_t *)msg);
+  module.host_sockets[2].deliver(OTHER_ADDRESS, MODULE_ADDRESS,
+                                 msg, sizeof (msg));
+  module_run(&module);
+  boolean learned =
+    (module.handler.lookup_route(OTHER_ADDRESS) == module.sockets[2]);
+
+  forwarded = routing_forwarded(&module, sent, 0, 2);
+  uint8_t from_route = routing_forwarded(&module, sent, 2, 3);
+  printf("  route %s: forwarded over sockets 0x%x, "
+         "from its socket over 0x%x\n",
+         learned ? "learned" : "not learned", forwarded, from_route);
+  passed = passed && learned && (forwarded == 0x4) && (from_route == 0);
+
+  host_clock_advance_us((MSG_ROUTE_TIMEOUT_S + 2) * 1024000UL);
+  forwarded = routing_forwarded(&module, sent, 0, 4);
+  printf("  stale route: forwarded over sockets 0x%x\n", forwarded);
+  passed = passed && (forwarded == 0x6);
+  host_clock_manual(false);
+
+  return passed;
+}
+
+/*******************************************************************************
+ * Dispatch
+ */
+
+#define DISPATCH_CUSTOM_TYPE 0x20
+
+/* Types handled by the registered handler, and how many */
+static uint8_t dispatched_types[4];
+static uint8_t num_dispatched;
+
+static boolean record_dispatch(MessageHandler *handler, msg_hdr_t *msg_hdr,
+                               Socket *src, Socket *serial_socket,
+                               config_hdr_t *config) {
+  if (num_dispatched < sizeof (dispatched_types)) {
+    dispatched_types[num_dispatched] = msg_hdr->type;
+  }
+  num_dispatched++;
+  return true;
+}
+
+/* Deliver a message of a type with no payload to a module */
+static void dispatch_send(HostModule *module, uint8_t type) {
+  byte msg[sizeof (msg_hdr_t)];
+  hmtl_msg_fmt((msg_hdr_t *)msg, MODULE_ADDRESS, sizeof (msg), type);
+  module->host_sockets[0].deliver(SENDER_ADDRESS, MODULE_ADDRESS,
+                                  msg, sizeof (msg));
+  module_run(module);
+}
+
+/* Deliver an RGB message to a module, returning whether it was applied */
+static boolean dispatch_rgb(HostModule *module, byte r) {
+  byte msg[HMTL_MSG_RGB_LEN];
+  hmtl_rgb_fmt(msg, sizeof (msg), MODULE_ADDRESS, HOST_OUTPUT_RGB, r, 0, 0);
+  module->host_sockets[0].deliver(SENDER_ADDRESS, MODULE_ADDRESS,
+                                  msg, sizeof (msg));
+  module_run(module);
+  return module_rgb_is(module, r, 0, 0);
+}
+
+/*
+ * Check that messages reach the built-in handler for their type, that types
+ * without a handler are ignored, and that registered handlers are called for
+ * new types and in place of built-in ones, up to MSG_HANDLER_OVERRIDES of
+ * them.  A handler registered as NULL leaves the type unhandled.
+ */
+static boolean check_dispatch() {
+  static HostModule module;
+  static sent_frames_t sent;
+  sent.dest = SENDER_ADDRESS;
+  module.addSocket()->setTransmit(collect_frame, &sent);
+  module.setup(MODULE_ADDRESS, MODULE_DEVICE_ID, 0);
+  num_dispatched = 0;
+  boolean passed = true;
+
+  boolean applied = dispatch_rgb(&module, 10);
+  sent.count = 0;
+  byte poll[sizeof (msg_hdr_t)];
+  hmtl_msg_fmt((msg_hdr_t *)poll, MODULE_ADDRESS, sizeof (poll),
+               MSG_TYPE_POLL, MSG_FLAG_RESPONSE);
+  module.host_sockets[0].deliver(SENDER_ADDRESS, MODULE_ADDRESS,
+                                 poll, sizeof (poll));
+  module_run(&module);
+  boolean polled = (sent.count > 0) &&
+                   (((msg_hdr_t *)sent.last)->type == MSG_TYPE_POLL);
+  printf("  built-in: output %s, poll %s\n",
+         applied ? "applied" : "not applied",
+         polled ? "answered" : "not answered");
+  passed = passed && applied && polled;
+
+  /* Types without a handler, a forwarded one and a local one */
+  dispatch_send(&module, DISPATCH_CUSTOM_TYPE);
+  dispatch_send(&module, MSG_TYPE_TRACE + 1);
+  applied = dispatch_rgb(&module, 11);
+  printf("  unknown types: ignored, output after them %s\n",
+         applied ? "applied" : "not applied");
+  passed = passed && applied;
+
+  boolean registered =
+    module.handler.register_handler(DISPATCH_CUSTOM_TYPE, record_dispatch) &&
+    module.handler.register_handler(MSG_TYPE_OUTPUT, record_dispatch);
+  uint8_t overrides = 2;
+  while ((overrides <= MSG_HANDLER_OVERRIDES) &&
+         module.handler.register_handler(DISPATCH_CUSTOM_TYPE + overrides,
+                                         record_dispatch)) {
+    overrides++;
+  }
+  boolean replaced = module.handler.register_handler(DISPATCH_CUSTOM_TYPE,
+                                                     record_dispatch);
+  dispatch_send(&module, DISPATCH_CUSTOM_TYPE);
+  applied = dispatch_rgb(&module, 12);
+  boolean recorded = (num_dispatched == 2) &&
+                     (dispatched_types[0] == DISPATCH_CUSTOM_TYPE) &&
+                     (dispatched_types[1] == MSG_TYPE_OUTPUT);
+  printf("  registered: %u of %u handlers, custom and output %s, "
+         "output %s\n", overrides, MSG_HANDLER_OVERRIDES,
+         recorded ? "recorded" : "not recorded",
+         applied ? "applied" : "not applied");
+  passed = passed && registered && replaced && recorded && !applied &&
+           (overrides == MSG_HANDLER_OVERRIDES);
+
+  module.handler.register_handler(MSG_TYPE_OUTPUT, NULL);
+  applied = dispatch_rgb(&module, 13);
+  printf("  NULL handler: output %s, %u recorded\n",
+         applied ? "applied" : "not applied", num_dispatched);
+  passed = passed && !applied && (num_dispatched == 2);
+
+  return passed;
+}
+
+/*******************************************************************************
+ * Deferred poll responses
+ */
+
+/* Deliver a poll to a module's socket */
+static void poll_send(HostModule *module, socket_addr_t address) {
+  byte msg[sizeof (msg_hdr_t)];
+  hmtl_msg_fmt((msg_hdr_t *)msg, address, sizeof (msg), MSG_TYPE_POLL,
+               MSG_FLAG_RESPONSE);
+  module->host_sockets[0].deliver(SENDER_ADDRESS, address, msg, sizeof (msg));
+}
+
+/*
+ * Send a module a broadcast poll and check that it only answers once its
+ * response slot has passed, handling other messages while it waits.  A
+ * second poll arriving before then restarts the wait and is answered along
+ * with the first by a single response.  A poll for its own address is
+ * answered at once.
+ */
+static boolean check_deferred_poll() {
+  static HostModule module;
+  static sent_frames_t sent;
+  sent.dest = SENDER_ADDRESS;
+  module.addSocket()->setTransmit(collect_frame, &sent);
+  module.setup(MODULE_ADDRESS, MODULE_DEVICE_ID, 0);
+  host_clock_manual(true);
+  module.loop();
+  boolean passed = true;
+
+  uint32_t slot_ms = (uint32_t)MODULE_ADDRESS * MSG_RESPONSE_SLOT_MS;
+  sent.count = 0;
+  poll_send(&module, SOCKET_ADDR_ANY);
+  module.loop();
+  uint32_t waited = 0;
+  boolean applied = false;
+  while ((sent.count == 0) && (waited <= 2 * slot_ms)) {
+    if (waited == slot_ms / 2) {
+      applied = dispatch_rgb(&module, 20);
+      poll_send(&module, SOCKET_ADDR_ANY);
+      module.loop();
+    }
+    host_clock_advance_us(1000);
+    waited++;
+    module.loop();
+  }
+  for (uint32_t i = 0; i < slot_ms; i++) {
+    host_clock_advance_us(1000);
+    module.loop();
+  }
+  printf("  broadcast: %u responses after %u ms for a %u ms slot "
+         "restarted at %u ms, output %s while waiting\n", sent.count, waited,
+         slot_ms, slot_ms / 2,
+         applied ? "applied" : "not applied");
+  passed = passed && (sent.count == 1) && applied &&
+           (waited == slot_ms / 2 + slot_ms);
+
+  sent.count = 0;
+  poll_send(&module, MODULE_ADDRESS);
+  module.loop();
+  printf("  unicast: %u responses at once\n", sent.count);
+  passed = passed && (sent.count == 1);
+  host_clock_manual(false);
+
+  return passed;
+}
+
+/*******************************************************************************
+ * Discovery
+ */
+
+#define DISCOVERY_MODULES 64
+#define DISCOVERY_SLOTS   16
+#define DISCOVERY_SLOT_MS 5
+
+/*
+ * Deliver a discovery poll to a module and return the ms until it responds,
+ * or -1 if it doesn't within the poll's slots
+ */
+static int32_t discovery_wait(HostModule *module, sent_frames_t *sent,
+                              byte *msg, uint16_t len) {
+  sent->count = 0;
+  module->host_sockets[0].deliver(SENDER_ADDRESS, SOCKET_ADDR_ANY, msg, len);
+  module->loop();
+  for (int32_t waited = 0;
+       waited <= DISCOVERY_SLOTS * DISCOVERY_SLOT_MS; waited++) {
+    if (sent->count > 0) {
+      return waited;
+    }
+    host_clock_advance_us(1000);
+    module->loop();
+  }
+  return -1;
+}
+
+/*
+ * Check that the slots picked for a discovery round are spread over the
+ * slots and change with the nonce, that a round by address gives each
+ * address its own slot, and that a module in the known bitmap is quiet.
+ * Then check that a module responds to discovery polls in its slot, briefly
+ * if asked to, and not at all once known.
+ */
+static boolean check_discovery() {
+  boolean passed = true;
+
+  byte msg[HMTL_MSG_POLL_DISCOVER_MIN_LEN + DISCOVERY_MODULES / 8];
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)msg;
+  byte known[DISCOVERY_MODULES / 8];
+  memset(known, 0, sizeof (known));
+  uint8_t used[DISCOVERY_SLOTS];
+  uint8_t empty[2] = { 0, 0 };
+  uint8_t moved = 0;
+  uint8_t slots[DISCOVERY_MODULES];
+  for (uint8_t nonce = 0; nonce < 2; nonce++) {
+    hmtl_poll_discover_fmt(msg, sizeof (msg), nonce, DISCOVERY_SLOTS,
+                           DISCOVERY_SLOT_MS, 0, known, 0);
+    memset(used, 0, sizeof (used));
+    for (uint8_t i = 0; i < DISCOVERY_MODULES; i++) {
+      uint8_t slot = hmtl_poll_discover_slot(msg_hdr, i, MODULE_DEVICE_ID + i);
+      if (slot >= DISCOVERY_SLOTS) continue;
+      used[slot]++;
+      if ((nonce == 1) && (slot != slots[i])) moved++;
+      slots[i] = slot;
+    }
+    for (uint8_t slot = 0; slot < DISCOVERY_SLOTS; slot++) {
+      if (used[slot] == 0) empty[nonce]++;
+    }
+  }
+  printf("  %u modules in %u slots: %u and %u empty, %u moved with the "
+         "nonce\n", DISCOVERY_MODULES, DISCOVERY_SLOTS, empty[0], empty[1],
+         moved);
+  passed = passed && (empty[0] == 0) && (empty[1] == 0) &&
+           (moved > DISCOVERY_MODULES / 2);
+
+  /* By address from a base, every other module already known */
+  for (uint8_t i = 0; i < DISCOVERY_MODULES; i += 2) {
+    known[i / 8] |= 1 << (i % 8);
+  }
+  hmtl_poll_discover_fmt(msg, sizeof (msg), 0, DISCOVERY_MODULES,
+                         DISCOVERY_SLOT_MS, MODULE_ADDRESS, known,
+                         sizeof (known), HMTL_DISCOVER_BY_ADDRESS);
+  uint8_t by_address = 0;
+  uint8_t quiet = 0;
+  for (uint8_t i = 0; i < DISCOVERY_MODULES; i++) {
+    uint8_t slot = hmtl_poll_discover_slot(msg_hdr, MODULE_ADDRESS + i,
+                                           MODULE_DEVICE_ID);
+    if (slot == HMTL_DISCOVER_QUIET) {
+      if (i % 2 == 0) quiet++;
+    } else if ((i % 2 == 1) && (slot == i)) {
+      by_address++;
+    }
+  }
+  printf("  by address: %u of %u in their own slot, %u of %u known quiet\n",
+         by_address, DISCOVERY_MODULES / 2, quiet, DISCOVERY_MODULES / 2);
+  passed = passed && (by_address == DISCOVERY_MODULES / 2) &&
+           (quiet == DISCOVERY_MODULES / 2);
+
+  /* A module answering discovery polls */
+  static HostModule module;
+  static sent_frames_t sent;
+  sent.dest = SENDER_ADDRESS;
+  module.addSocket()->setTransmit(collect_frame, &sent);
+  module.setup(MODULE_ADDRESS, MODULE_DEVICE_ID, 0);
+  host_clock_manual(true);
+  module.loop();
+
+  uint16_t len = hmtl_poll_discover_fmt(msg, sizeof (msg), 7,
+                                        DISCOVERY_SLOTS, DISCOVERY_SLOT_MS,
+                                        0, NULL, 0, HMTL_DISCOVER_BRIEF);
+  int32_t expected = (int32_t)hmtl_poll_discover_slot(msg_hdr, MODULE_ADDRESS,
+                                                      MODULE_DEVICE_ID) *
+                     DISCOVERY_SLOT_MS;
+  int32_t waited = discovery_wait(&module, &sent, msg, len);
+  msg_poll_response_t *poll =
+    (msg_poll_response_t *)(sent.last + sizeof (msg_hdr_t));
+  msg_poll_outputs_t *outputs = (msg_poll_outputs_t *)poll->data;
+  boolean brief = (waited >= 0) && (outputs->count == 0) &&
+                  (poll->config.num_outputs == HOST_NUM_OUTPUTS);
+  printf("  module: responded after %d ms for %d, %u outputs described "
+         "of %u\n", waited, expected, waited >= 0 ? outputs->count : 0,
+         waited >= 0 ? poll->config.num_outputs : 0);
+  passed = passed && (waited == expected) && brief;
+
+  known[0] = 0x01;
+  len = hmtl_poll_discover_fmt(msg, sizeof (msg), 8, DISCOVERY_SLOTS,
+                               DISCOVERY_SLOT_MS, MODULE_ADDRESS, known, 1);
+  waited = discovery_wait(&module, &sent, msg, len);
+  printf("  known module: %s\n", waited < 0 ? "quiet" : "responded");
+  passed = passed && (waited < 0);
+  host_clock_manual(false);
+
+  return passed;
+}
+
+/*******************************************************************************
+ * Configuration dumps
+ */
+
+#define DUMP_MAX_PAGES 8
+
+/* The pages of a dump received, each with the loop it was sent in */
+typedef struct {
+  uint8_t count;
+  uint8_t loop;
+  struct {
+    uint8_t loop;
+    uint8_t flags;
+    uint16_t offset;
+    uint16_t next;
+    uint16_t datalen;
+    byte data[HostModule::SOCKET_DATA_SIZE];
+  } pages[DUMP_MAX_PAGES];
+} dump_pages_t;
+
+static void collect_dump(HostSocket *socket, const host_socket_hdr_t *hdr,
+                         const byte *data, void *arg) {
+  dump_pages_t *dump = (dump_pages_t *)arg;
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)data;
+  msg_dumpconfig_response_t *resp =
+    hmtl_msg_view<msg_dumpconfig_response_t>(msg_hdr);
+  if ((resp == NULL) || (dump->count == DUMP_MAX_PAGES)) {
+    return;
+  }
+
+  uint16_t datalen = hdr->length - HMTL_MSG_DUMPCONFIG_MIN_LEN;
+  if (datalen > sizeof (dump->pages[0].data)) {
+    datalen = sizeof (dump->pages[0].data);
+  }
+  dump->pages[dump->count].loop = dump->loop;
+  dump->pages[dump->count].flags = msg_hdr->flags;
+  dump->pages[dump->count].offset = resp->offset;
+  dump->pages[dump->count].next = resp->next;
+  dump->pages[dump->count].datalen = datalen;
+  memcpy(dump->pages[dump->count].data, resp->data, datalen);
+  dump->count++;
+}
+
+/* Request a dump from a module and run it until the dump ends */
+static void dump_request(HostModule *module, dump_pages_t *dump,
+                         uint16_t offset, uint8_t pages) {
+  byte msg[HMTL_MSG_SIZE(msg_dumpconfig_request_t)];
+  uint16_t len = hmtl_dumpconfig_request_fmt(msg, sizeof (msg),
+                                             MODULE_ADDRESS, offset, pages);
+  memset(dump, 0, sizeof (*dump));
+  module->host_sockets[0].deliver(SENDER_ADDRESS, MODULE_ADDRESS, msg, len);
+  for (dump->loop = 0; dump->loop < 2 * DUMP_MAX_PAGES; dump->loop++) {
+    module->loop();
+  }
+}
+
+/*
+ * Dump a module's configuration and check that it is sent a page per loop,
+ * one per EEPROM object starting with the configuration header, chained by
+ * their offsets and with MSG_FLAG_MORE_DATA on all but the last.  Then
+ * request a single page from the middle, as a requester continuing a dump
+ * that lost a page does, and check that it is that page alone.
+ */
+static boolean check_dump_config() {
+  static HostModule module;
+  static dump_pages_t dump;
+  static const socket_addr_t groups[] = { HMTL_GROUP_BASE };
+  module.addSocket()->setTransmit(collect_dump, &dump);
+  module.setup(MODULE_ADDRESS, MODULE_DEVICE_ID, 0, groups, 1);
+  boolean passed = true;
+
+  /* The header, each output and the groups */
+  uint8_t objects = 1 + HOST_NUM_OUTPUTS + 1;
+  dump_request(&module, &dump, 0, 0);
+  boolean chained = (dump.count == objects) &&
+                    (dump.pages[0].offset == HMTL_CONFIG_ADDR) &&
+                    (dump.pages[0].datalen == sizeof (config_hdr_t)) &&
+                    (memcmp(dump.pages[0].data, &module.config,
+                            sizeof (config_hdr_t)) == 0);
+  for (uint8_t i = 0; chained && (i < dump.count); i++) {
+    boolean last = (i == dump.count - 1);
+    chained = (dump.pages[i].loop == dump.pages[0].loop + i) &&
+              (!(dump.pages[i].flags & MSG_FLAG_MORE_DATA) == last) &&
+              (last ? (dump.pages[i].next == 0) :
+               (dump.pages[i].next == dump.pages[i + 1].offset));
+  }
+  printf("  full dump: %u pages of %u objects, %s\n", dump.count, objects,
+         chained ? "one per loop and chained" : "not chained");
+  passed = passed && chained;
+
+  dump_pages_t full = dump;
+  uint8_t page = 2;
+  dump_request(&module, &dump, full.pages[page].offset, 1);
+  boolean resumed = (dump.count == 1) &&
+                    (dump.pages[0].offset == full.pages[page].offset) &&
+                    (dump.pages[0].next == full.pages[page].next) &&
+                    !(dump.pages[0].flags & MSG_FLAG_MORE_DATA) &&
+                    (dump.pages[0].datalen == full.pages[page].datalen) &&
+                    (memcmp(dump.pages[0].data, full.pages[page].data,
+                            full.pages[page].datalen) == 0);
+  printf("  page %u alone: %u pages, %s\n", page, dump.count,
+         resumed ? "same as in the full dump" : "differs");
+  passed = passed && resumed;
+
+  return passed;
+}
+
+/*******************************************************************************
+ * Poll output descriptors
+ */
+
+/* A socket with room for a single descriptor per poll response */
+#define POLL_OUTPUTS_SOCKET_SIZE \
+  (HMTL_MSG_POLL_OUTPUTS_MIN_LEN + sizeof (msg_poll_output_t) + 2)
+
+/* The descriptors received in poll responses, in order */
+typedef struct {
+  uint8_t responses;
+  uint8_t more_data;      // Responses with MSG_FLAG_MORE_DATA set
+  boolean in_order;       // Each response starts where the last ended
+  uint8_t num_outputs;    // Outputs the module reported having
+  uint8_t count;
+  msg_poll_output_t outputs[HMTL_MAX_OUTPUTS];
+} poll_outputs_t;
+
+static void collect_poll(HostSocket *socket, const host_socket_hdr_t *hdr,
+                         const byte *data, void *arg) {
+  poll_outputs_t *poll = (poll_outputs_t *)arg;
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)data;
+  if ((hdr->length < HMTL_MSG_POLL_OUTPUTS_MIN_LEN) ||
+      (msg_hdr->type != MSG_TYPE_POLL) || !(msg_hdr->flags & MSG_FLAG_ACK)) {
+    return;
+  }
+
+  msg_poll_response_t *resp = (msg_poll_response_t *)(msg_hdr + 1);
+  msg_poll_outputs_t *outputs = (msg_poll_outputs_t *)resp->data;
+  poll->responses++;
+  if (msg_hdr->flags & MSG_FLAG_MORE_DATA) poll->more_data++;
+  if ((outputs->first != poll->count) ||
+      (hdr->length < HMTL_MSG_POLL_OUTPUTS_MIN_LEN +
+       outputs->count * sizeof (msg_poll_output_t))) {
+    poll->in_order = false;
+    return;
+  }
+  poll->num_outputs = resp->config.num_outputs;
+  for (uint8_t i = 0; (i < outputs->count) && (poll->count < HMTL_MAX_OUTPUTS);
+       i++) {
+    poll->outputs[poll->count++] = outputs->outputs[i];
+  }
+}
+
+/*
+ * Poll a module whose socket only has room for one output descriptor per
+ * response, and check that the descriptors of all of its outputs are sent
+ * in order across responses, with MSG_FLAG_MORE_DATA on all but the last,
+ * and that they give each output's type and the number of pixels.
+ */
+static boolean check_poll_outputs() {
+  static HostModule module;
+  static poll_outputs_t poll;
+  memset(&poll, 0, sizeof (poll));
+  poll.in_order = true;
+  module.addSocket(POLL_OUTPUTS_SOCKET_SIZE)->setTransmit(collect_poll,
+                                                           &poll);
+  module.setup(MODULE_ADDRESS, MODULE_DEVICE_ID, FRAME_PIXELS);
+
+  byte msg[sizeof (msg_hdr_t)];
+  hmtl_msg_fmt((msg_hdr_t *)msg, MODULE_ADDRESS, sizeof (msg), MSG_TYPE_POLL,
+               MSG_FLAG_RESPONSE);
+  module.host_sockets[0].deliver(SENDER_ADDRESS, MODULE_ADDRESS,
+                                 msg, sizeof (msg));
+  module_run(&module);
+
+  boolean described = poll.in_order && (poll.count == HOST_NUM_OUTPUTS) &&
+    (poll.num_outputs == HOST_NUM_OUTPUTS) &&
+    (poll.outputs[HOST_OUTPUT_VALUE].type == HMTL_OUTPUT_VALUE) &&
+    (poll.outputs[HOST_OUTPUT_RGB].type == HMTL_OUTPUT_RGB) &&
+    (poll.outputs[HOST_OUTPUT_PIXELS].type == HMTL_OUTPUT_PIXELS) &&
+    (poll.outputs[HOST_OUTPUT_PIXELS].pixels == FRAME_PIXELS);
+  for (uint8_t i = 0; described && (i < poll.count); i++) {
+    described = (poll.outputs[i].output == i);
+  }
+  printf("  %u byte socket: %u responses, %u with more data, "
+         "%u of %u outputs described%s\n", (unsigned)POLL_OUTPUTS_SOCKET_SIZE,
+         poll.responses, poll.more_data, poll.count, poll.num_outputs,
+         poll.in_order ? "" : " out of order");
+
+  return described && (poll.responses == HOST_NUM_OUTPUTS) &&
+         (poll.more_data == HOST_NUM_OUTPUTS - 1);
+}
+
+/*******************************************************************************
+ * Zero-copy forwarding
+ */
+
+/* The buffer a socket was last handed to transmit, and a copy of its data */
+typedef struct {
+  uint16_t count;
+  const byte *buffer;
+  byte data[HMTL_MAX_MSG_LEN];
+} sent_buffer_t;
+
+static void collect_buffer(HostSocket *socket, const host_socket_hdr_t *hdr,
+                           const byte *data, void *arg) {
+  sent_buffer_t *sent = (sent_buffer_t *)arg;
+  sent->count++;
+  sent->buffer = data;
+  memcpy(sent->data, data, hdr->length);
+}
+
+/* Returns true if the pointer is within the socket */
+static boolean in_socket(const HostSocket *socket, const byte *ptr) {
+  return (ptr >= (const byte *)socket) &&
+         (ptr < (const byte *)socket + sizeof (*socket));
+}
+
+/*
+ * Send a broadcast through a module with three sockets and check that it is
+ * forwarded to both others from the buffer it was received in, rather than
+ * from copies in their send buffers, with its header updated for the hop.
+ */
+static boolean check_zero_copy() {
+  static HostModule module;
+  static sent_buffer_t sent[2];
+  memset(sent, 0, sizeof (sent));
+  module.addSocket();
+  module.addSocket()->setTransmit(collect_buffer, &sent[0]);
+  module.addSocket()->setTransmit(collect_buffer, &sent[1]);
+  module.setup(MODULE_ADDRESS, MODULE_DEVICE_ID, 0);
+
+  /* A batch, as single output messages are copied when coalesced */
+  byte msg[HMTL_MSG_BATCH_MAX_LEN];
+  msg_rgb_t rgb = { { HMTL_OUTPUT_RGB, HOST_OUTPUT_RGB }, { 1, 2, 3 } };
+  hmtl_batch_fmt(msg, sizeof (msg), SOCKET_ADDR_ANY);
+  hmtl_batch_add(msg, sizeof (msg), &rgb.hdr, sizeof (rgb));
+  uint16_t len = hmtl_batch_finish(msg);
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)msg;
+  msg_hdr->origin = SENDER_ADDRESS;
+  hmtl_msg_set_crc(msg_hdr);
+  module.host_sockets[0].deliver(SENDER_ADDRESS, SOCKET_ADDR_ANY, msg, len);
+  module_run(&module);
+
+  msg_hdr_t *forwarded = (msg_hdr_t *)sent[0].data;
+  boolean same = (sent[0].count == 1) && (sent[1].count == 1) &&
+                 (sent[0].buffer == sent[1].buffer);
+  boolean in_place = same && in_socket(&module.host_sockets[0],
+                                       sent[0].buffer);
+  boolean updated = same && (forwarded->ttl == msg_hdr->ttl - 1) &&
+                    (forwarded->crc == hmtl_msg_crc(forwarded)) &&
+                    (memcmp(forwarded + 1, msg_hdr + 1,
+                            len - sizeof (msg_hdr_t)) == 0);
+  printf("  forwarded %u and %u times, %s, %s, ttl %u -> %u\n",
+         sent[0].count, sent[1].count,
+         same ? "from one buffer" : "from different buffers",
+         in_place ? "the receive buffer" : "not the receive buffer",
+         msg_hdr->ttl, same ? forwarded->ttl : 0);
+
+  return same && in_place && updated && module_rgb_is(&module, 1, 2, 3);
+}
+
+/*******************************************************************************
+ * Groups
+ */
+
+#define GROUP_MEMBER (HMTL_GROUP_BASE + 1)
+#define GROUP_OTHER  (HMTL_GROUP_BASE + 2)
+
+/*
+ * Deliver an RGB message for a group to a module's first socket and return
+ * the sockets it was forwarded over as a bitmask
+ */
+static uint8_t groups_forwarded(HostModule *module, sent_outputs_t *sent,
+                                uint8_t sequence) {
+  uint16_t counts[ROUTING_SOCKETS];
+  for (byte i = 0; i < ROUTING_SOCKETS; i++) counts[i] = sent[i].count;
+
+  byte msg[HMTL_MSG_RGB_LEN];
+  format_forwarded(msg, GROUP_MEMBER, sequence, HMTL_MSG_DEFAULT_TTL, 1);
+  module->host_sockets[0].deliver(SENDER_ADDRESS, GROUP_MEMBER,
+                                  msg, sizeof (msg));
+  module_run(module);
+
+  uint8_t forwarded = 0;
+  for (byte i = 0; i < ROUTING_SOCKETS; i++) {
+    if (sent[i].count != counts[i]) forwarded |= 1 << i;
+  }
+  return forwarded;
+}
+
+/*
+ * Check that a member of a group announces it, reads it back from its
+ * config, and applies messages sent to it but not to other groups.  Then
+ * check that a module with three sockets floods messages for the group while
+ * no members are known, and sends them only over the socket the member's
+ * announcement arrived on once it is heard.
+ */
+static boolean check_groups() {
+  static HostModule member;
+  static sent_frames_t announced;
+  announced.dest = SOCKET_ADDR_ANY;
+  announced.count = 0;
+  member.addSocket()->setTransmit(collect_frame, &announced);
+  socket_addr_t member_groups[] = { GROUP_MEMBER };
+  member.setup(MODULE_ADDRESS, MODULE_DEVICE_ID, 0, member_groups, 1);
+  boolean passed = true;
+
+  module_run(&member);
+  msg_hdr_t *announce = (msg_hdr_t *)announced.last;
+  msg_groups_t *announce_groups = (announced.count > 0) ?
+    hmtl_msg_view<msg_groups_t>(announce) : NULL;
+  socket_addr_t announce_group = SOCKET_ADDR_INVALID;
+  if (announce_groups != NULL) {
+    memcpy(&announce_group, (byte *)(announce_groups + 1),
+           sizeof (announce_group));
+  }
+  boolean announce_ok = (announce_groups != NULL) &&
+    (announce_groups->count == 1) && (announce_group == GROUP_MEMBER) &&
+    (announce->origin == MODULE_ADDRESS);
+  boolean config_ok = (member.groups.num_groups == 1) &&
+    (member.groups.groups[0] == GROUP_MEMBER);
+  printf("  member: %u groups in its config, announcement %s\n",
+         member.groups.num_groups, announce_ok ? "sent" : "not sent");
+  passed = passed && announce_ok && config_ok;
+
+  byte msg[HMTL_MSG_RGB_LEN];
+  format_forwarded(msg, GROUP_MEMBER, 1, HMTL_MSG_DEFAULT_TTL, 10);
+  member.host_sockets[0].deliver(SENDER_ADDRESS, GROUP_MEMBER,
+                                 msg, sizeof (msg));
+  module_run(&member);
+  boolean applied = module_rgb_is(&member, 10, 0, 0);
+  format_forwarded(msg, GROUP_OTHER, 2, HMTL_MSG_DEFAULT_TTL, 20);
+  member.host_sockets[0].deliver(SENDER_ADDRESS, GROUP_OTHER,
+                                 msg, sizeof (msg));
+  module_run(&member);
+  boolean ignored = module_rgb_is(&member, 10, 0, 0);
+  printf("  its group: %s, another group: %s\n",
+         applied ? "applied" : "not applied",
+         ignored ? "not applied" : "applied");
+  passed = passed && applied && ignored;
+
+  /* A module that isn't a member, between the sender and the member */
+  static HostModule router;
+  static sent_outputs_t sent[ROUTING_SOCKETS];
+  memset(sent, 0, sizeof (sent));
+  for (byte i = 0; i < ROUTING_SOCKETS; i++) {
+    router.addSocket()->setTransmit(collect_output, &sent[i]);
+  }
+  router.setup(OTHER_ADDRESS, MODULE_DEVICE_ID, 0);
+  host_clock_manual(true);
+
+  uint8_t forwarded = groups_forwarded(&router, sent, 3);
+  boolean router_ignored = module_rgb_is(&router, 0, 0, 0);
+  printf("  no members: forwarded over sockets 0x%x, %s\n", forwarded,
+         router_ignored ? "not applied" : "applied");
+  passed = passed && (forwarded == 0x6) && router_ignored;
+
+  if (announce_ok) {
+    router.host_sockets[2].deliver(MODULE_ADDRESS, SOCKET_ADDR_ANY,
+                                   announced.last, announced.length);
+    module_run(&router);
+  }
+  uint8_t members = router.handler.lookup_group(GROUP_MEMBER);
+  forwarded = groups_forwarded(&router, sent, 4);
+  printf("  member heard over sockets 0x%x: forwarded over sockets 0x%x\n",
+         members, forwarded);
+  passed = passed && (members == 0x4) && (forwarded == 0x4);
+
+  host_clock_advance_us((MSG_ROUTE_TIMEOUT_S + 2) * 1024000UL);
+  forwarded = groups_forwarded(&router, sent, 5);
+  printf("  members stale: forwarded over sockets 0x%x\n", forwarded);
+  passed = passed && (forwarded == 0x6);
+  host_clock_manual(false);
+
+  return passed;
+}
+
+/*******************************************************************************
+ * Version 2 peers
+ */
+
+/*
+ * Send a message from a module that only sends version 2 headers and collect
+ * the first frame sent back to it.
+ */
+static msg_hdr_t *v2_exchange(HostModule *module, sent_frames_t *sent,
+                              byte *msg, uint16_t len, byte socket) {
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)msg;
+  if (msg_hdr->address == MODULE_ADDRESS) {
+    len = hmtl_msg_downgrade(msg_hdr);
+  }
+  sent->count = 0;
+  module->host_sockets[socket].deliver(
+    (socket == 0 ? SENDER_ADDRESS : OTHER_ADDRESS), msg_hdr->address,
+    msg, len);
+  module_run(module);
+  return (sent->count > 0 ? (msg_hdr_t *)sent->last : NULL);
+}
+
+/*
+ * Check that a module replies to a version 2 poll and time sync with
+ * version 2 headers, forwards messages to that module with them, and goes
+ * back to the current header once the module sends one.
+ */
+static boolean check_v2_peers() {
+  static HostModule module;
+  static sent_frames_t sent;
+  sent.dest = SENDER_ADDRESS;
+  module.addSocket()->setTransmit(collect_frame, &sent);
+  module.addSocket();
+  module.setup(MODULE_ADDRESS, MODULE_DEVICE_ID, 0);
+  byte v2_shrink = sizeof (msg_hdr_t) - HMTL_MSG_V2_HDR_LEN;
+  boolean passed = true;
+
+  byte msg[HMTL_MAX_MSG_LEN];
+  hmtl_msg_fmt((msg_hdr_t *)msg, MODULE_ADDRESS, sizeof (msg_hdr_t),
+               MSG_TYPE_POLL, MSG_FLAG_RESPONSE);
+  msg_hdr_t *reply = v2_exchange(&module, &sent, msg, sizeof (msg_hdr_t), 0);
+  msg_poll_response_t *poll =
+    (msg_poll_response_t *)(sent.last + HMTL_MSG_V2_HDR_LEN);
+  boolean ok = (reply != NULL) && (reply->version == HMTL_MSG_VERSION_2) &&
+    (reply->type == MSG_TYPE_POLL) && (reply->length == sent.length) &&
+    (reply->length >= HMTL_MSG_POLL_MIN_LEN - v2_shrink) &&
+    (poll->config.address == MODULE_ADDRESS);
+  printf("  poll: %u replies, version %u length %u from 0x%x\n",
+         sent.count, reply ? reply->version : 0, sent.length,
+         reply ? poll->config.address : 0);
+  passed = passed && ok;
+
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)msg;
+  msg_time_sync_t *sync = (msg_time_sync_t *)(msg_hdr + 1);
+  sync->sync_phase = TIMESYNC_SYNC;
+  sync->timestamp = 0;
+  hmtl_msg_fmt(msg_hdr, MODULE_ADDRESS, HMTL_MSG_SIZE(msg_time_sync_t),
+               MSG_TYPE_TIMESYNC);
+  reply = v2_exchange(&module, &sent, msg, HMTL_MSG_SIZE(msg_time_sync_t), 0);
+  sync = (msg_time_sync_t *)(sent.last + HMTL_MSG_V2_HDR_LEN);
+  ok = (reply != NULL) && (reply->version == HMTL_MSG_VERSION_2) &&
+    (reply->type == MSG_TYPE_TIMESYNC) &&
+    (reply->length == HMTL_MSG_SIZE(msg_time_sync_t) - v2_shrink) &&
+    (sync->sync_phase == TIMESYNC_ACK);
+  printf("  time sync: %u replies, version %u phase %u\n",
+         sent.count, reply ? reply->version : 0, reply ? sync->sync_phase : 0);
+  passed = passed && ok;
+
+  hmtl_rgb_fmt(msg, sizeof (msg), SENDER_ADDRESS, HOST_OUTPUT_RGB, 1, 2, 3);
+  reply = v2_exchange(&module, &sent, msg, HMTL_MSG_RGB_LEN, 1);
+  msg_rgb_t *rgb = (msg_rgb_t *)(sent.last + HMTL_MSG_V2_HDR_LEN);
+  ok = (reply != NULL) && (reply->version == HMTL_MSG_VERSION_2) &&
+    (reply->length == HMTL_MSG_RGB_LEN - v2_shrink) &&
+    (rgb->values[0] == 1) && (rgb->values[2] == 3);
+  printf("  forward: %u sent, version %u length %u\n",
+         sent.count, reply ? reply->version : 0, sent.length);
+  passed = passed && ok;
+
+  /* Once the module sends a current header it is sent them again */
+  hmtl_msg_fmt(msg_hdr, MODULE_ADDRESS, sizeof (msg_hdr_t),
+               MSG_TYPE_POLL, MSG_FLAG_RESPONSE);
+  sent.count = 0;
+  module.host_sockets[0].deliver(SENDER_ADDRESS, MODULE_ADDRESS,
+                                 msg, sizeof (msg_hdr_t));
+  module_run(&module);
+  reply = (msg_hdr_t *)sent.last;
+  ok = (sent.count > 0) && (reply->version == HMTL_MSG_VERSION);
+  printf("  after a version 3 poll: version %u\n",
+         sent.count ? reply->version : 0);
+  passed = passed && ok;
+
+  return passed;
+}
+
+/*******************************************************************************
+ * Fragment reassembly
+ */
+
+#define REASSEMBLY_SOCKET_SIZE 32
+#define REASSEMBLY_PIXELS      16
+
+/* Pass frames sent by one module's socket to another module's */
+static void pass_frame(HostSocket *socket, const host_socket_hdr_t *hdr,
+                       const byte *data, void *arg) {
+  HostModule *module = (HostModule *)arg;
+  module->host_sockets[0].deliver(hdr->source, hdr->dest, data, hdr->length);
+}
+
+/* Record the msg_version advertised in a module's poll response */
+static void poll_version(HostSocket *socket, const host_socket_hdr_t *hdr,
+                         const byte *data, void *arg) {
+  uint8_t *version = (uint8_t *)arg;
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)data;
+  if ((hdr->length >= HMTL_MSG_POLL_MIN_LEN) &&
+      (msg_hdr->type == MSG_TYPE_POLL) && (msg_hdr->flags & MSG_FLAG_ACK)) {
+    *version = ((msg_poll_response_t *)(msg_hdr + 1))->msg_version;
+  }
+}
+
+/*
+ * Send a pixel frame too large for the socket between two modules through
+ * the first, which must forward it in fragments, and check that the second
+ * reassembles it and sets its pixels, and that it advertises doing so in its
+ * poll response.
+ */
+static boolean check_reassembly() {
+  static HostModule forwarder;
+  static HostModule receiver;
+  uint8_t advertised = 0;
+  forwarder.addSocket();
+  forwarder.addSocket(REASSEMBLY_SOCKET_SIZE)->setTransmit(pass_frame,
+                                                           &receiver);
+  forwarder.setup(SENDER_ADDRESS, MODULE_DEVICE_ID, 0);
+  receiver.addSocket()->setTransmit(poll_version, &advertised);
+  receiver.setup(MODULE_ADDRESS, MODULE_DEVICE_ID + 1, REASSEMBLY_PIXELS);
+
+  CRGB pixels[REASSEMBLY_PIXELS];
+  for (uint16_t i = 0; i < REASSEMBLY_PIXELS; i++) {
+    pixels[i] = CRGB(i, 255 - i, i * 8);
+  }
+  byte msg[HMTL_MSG_PIXEL_FRAME_MIN_LEN + REASSEMBLY_PIXELS * 3];
+  uint16_t len = hmtl_pixel_frame_fmt(msg, sizeof (msg), MODULE_ADDRESS, 0,
+                                      HOST_OUTPUT_PIXELS, 1, 0,
+                                      (byte *)pixels, REASSEMBLY_PIXELS);
+  forwarder.host_sockets[0].deliver(OTHER_ADDRESS, MODULE_ADDRESS, msg, len);
+  module_run(&forwarder);
+  module_run(&receiver);
+
+  boolean matched = (memcmp(receiver.pixels.leds, pixels,
+                            sizeof (pixels)) == 0);
+  printf("  %u byte msg over a %u byte socket: %u fragmented, "
+         "%u reassembled, %s\n", len, REASSEMBLY_SOCKET_SIZE,
+         forwarder.handler.fragmented, receiver.handler.reassembled,
+         matched ? "match" : "differ");
+
+  byte request[sizeof (msg_hdr_t)];
+  hmtl_msg_fmt((msg_hdr_t *)request, MODULE_ADDRESS, sizeof (request),
+               MSG_TYPE_POLL, MSG_FLAG_RESPONSE);
+  receiver.host_sockets[0].deliver(OTHER_ADDRESS, MODULE_ADDRESS,
+                                   request, sizeof (request));
+  module_run(&receiver);
+  printf("  poll response msg_version %u\n", advertised);
+
+  return (len > REASSEMBLY_SOCKET_SIZE) && matched &&
+         (forwarder.handler.fragmented == 1) &&
+         (receiver.handler.reassembled == 1) &&
+         (advertised == HMTL_MSG_VERSION_LONG);
+}
+
+/*******************************************************************************
+ * Reliable delivery
+ */
+
+#define RELIABLE_VALUES 4
+
+/* A link between two modules' sockets, which may lose frames of a type */
+typedef struct {
+  HostModule *to;
+  byte socket;
+  socket_addr_t from;
+  uint8_t drop_type;
+  uint8_t drops;
+} module_link_t;
+
+static void link_frame(HostSocket *socket, const host_socket_hdr_t *hdr,
+                       const byte *data, void *arg) {
+  module_link_t *link = (module_link_t *)arg;
+  if ((link->drops > 0) && (((msg_hdr_t *)data)->type == link->drop_type)) {
+    link->drops--;
+    return;
+  }
+  link->to->host_sockets[link->socket].deliver(link->from, hdr->dest,
+                                               data, hdr->length);
+}
+
+/* Times each value was handled by the destination */
+static uint16_t values_handled[RELIABLE_VALUES];
+
+static boolean count_value(MessageHandler *handler, msg_hdr_t *msg_hdr,
+                           Socket *src, Socket *serial_socket,
+                           config_hdr_t *config) {
+  msg_value_t *value = (msg_value_t *)(msg_hdr + 1);
+  if ((value->hdr.type == HMTL_OUTPUT_VALUE) &&
+      (value->value < RELIABLE_VALUES)) {
+    values_handled[value->value]++;
+  }
+  return false;
+}
+
+static void run_modules(HostModule **modules, byte num_modules,
+                        uint16_t ms) {
+  for (uint16_t i = 0; i < ms; i++) {
+    for (byte m = 0; m < num_modules; m++) {
+      modules[m]->loop();
+    }
+    host_clock_advance_us(1000);
+  }
+}
+
+/*
+ * Send reliable messages between two modules through a third, losing first
+ * the forwarded message and then the acknowledgement, the latter also with
+ * the destination's seen list overrun before the retransmission arrives.
+ * Each must be handled exactly once and acknowledged.
+ */
+static boolean check_reliable() {
+  static HostModule source;
+  static HostModule hop;
+  static HostModule dest;
+  HostModule *modules[] = { &source, &hop, &dest };
+
+  host_clock_manual(true);
+  source.addSocket();
+  hop.addSocket();
+  hop.addSocket();
+  dest.addSocket();
+  source.setup(SENDER_ADDRESS, MODULE_DEVICE_ID, 0);
+  hop.setup(OTHER_ADDRESS, MODULE_DEVICE_ID + 1, 0);
+  dest.setup(MODULE_ADDRESS, MODULE_DEVICE_ID + 2, 0);
+  dest.handler.register_handler(MSG_TYPE_OUTPUT, count_value);
+
+  module_link_t to_hop = { &hop, 0, SENDER_ADDRESS, 0, 0 };
+  module_link_t to_source = { &source, 0, OTHER_ADDRESS, 0, 0 };
+  module_link_t to_dest = { &dest, 0, OTHER_ADDRESS, MSG_TYPE_OUTPUT, 0 };
+  module_link_t from_dest = { &hop, 1, MODULE_ADDRESS, MSG_TYPE_DELIVERED, 0 };
+  source.host_sockets[0].setTransmit(link_frame, &to_hop);
+  hop.host_sockets[0].setTransmit(link_frame, &to_source);
+  hop.host_sockets[1].setTransmit(link_frame, &to_dest);
+  dest.host_sockets[0].setTransmit(link_frame, &from_dest);
+  memset(values_handled, 0, sizeof (values_handled));
+  run_modules(modules, 3, 10);
+
+  byte msg[HMTL_MSG_VALUE_LEN];
+  for (int value = 1; value < RELIABLE_VALUES; value++) {
+    if (value == 1) {
+      to_dest.drops = 1;
+    } else {
+      from_dest.drops = 1;
+    }
+    hmtl_value_fmt(msg, sizeof (msg), MODULE_ADDRESS, HOST_OUTPUT_VALUE,
+                   value);
+    source.handler.send_reliable((msg_hdr_t *)msg);
+    run_modules(modules, 3, 20);
+
+    if (value == 3) {
+      /* Fill the destination's seen list with messages from elsewhere */
+      for (uint8_t i = 0; i < MSG_SEEN_ENTRIES + 4; i++) {
+        uint16_t len = hmtl_value_fmt(msg, sizeof (msg), MODULE_ADDRESS,
+                                      HOST_OUTPUT_VALUE, 0);
+        msg_hdr_t *msg_hdr = (msg_hdr_t *)msg;
+        msg_hdr->origin = 0x60 + i;
+        hmtl_msg_set_crc(msg_hdr);
+        dest.host_sockets[0].deliver(OTHER_ADDRESS, MODULE_ADDRESS, msg, len);
+        dest.loop();
+      }
+    }
+    run_modules(modules, 3, 2000);
+  }
+  host_clock_manual(false);
+
+  /* Every frame meant to be lost was */
+  boolean passed = (to_dest.drops == 0) && (from_dest.drops == 0);
+  for (int value = 1; value < RELIABLE_VALUES; value++) {
+    passed = passed && (values_handled[value] == 1);
+  }
+  printf("  lost forward: %u handled, lost ack: %u handled, "
+         "lost ack after overrun: %u handled\n",
+         values_handled[1], values_handled[2], values_handled[3]);
+  printf("  %u retransmitted, %u undelivered, %u pending\n",
+         source.handler.retransmitted, source.handler.undelivered,
+         source.handler.reliable_pending());
+  return passed && (source.handler.retransmitted >= RELIABLE_VALUES - 1) &&
+         (source.handler.undelivered == 0) &&
+         (source.handler.reliable_pending() == 0);
+}
+
+/*******************************************************************************
+ * Low priority queue
+ */
+
+#define LOW_QUEUE_MAX_HANDLED 8
+
+/* Types of the messages handled, in order, and the buffers they were in */
+static uint8_t low_handled[LOW_QUEUE_MAX_HANDLED];
+static msg_hdr_t *low_handled_msgs[LOW_QUEUE_MAX_HANDLED];
+static uint8_t num_low_handled;
+
+static boolean record_low(MessageHandler *handler, msg_hdr_t *msg_hdr,
+                          Socket *src, Socket *serial_socket,
+                          config_hdr_t *config) {
+  if (num_low_handled < LOW_QUEUE_MAX_HANDLED) {
+    low_handled_msgs[num_low_handled] = msg_hdr;
+    low_handled[num_low_handled++] = msg_hdr->type;
+  }
+  return false;
+}
+
+/*
+ * Send pixel frames over one socket and a priority RGB message over another,
+ * and check that the RGB is handled first and the frames within the same
+ * check, each from its socket's receive buffer rather than a copy.
+ */
+static boolean check_low_queue() {
+  static HostModule module;
+  module.addSocket();
+  module.addSocket();
+  module.setup(MODULE_ADDRESS, MODULE_DEVICE_ID, 0);
+  module.handler.register_handler(MSG_TYPE_PIXEL_FRAME, record_low);
+  module.handler.register_handler(MSG_TYPE_OUTPUT, record_low);
+  module.loop();
+  num_low_handled = 0;
+
+  byte msg[HMTL_MAX_MSG_LEN];
+  byte rgb[3] = { 1, 2, 3 };
+  for (uint16_t offset = 0; offset < 2; offset++) {
+    uint16_t len = hmtl_pixel_frame_fmt(msg, sizeof (msg), MODULE_ADDRESS,
+                                        (offset == 0 ? MSG_FLAG_MORE_DATA : 0),
+                                        HOST_OUTPUT_PIXELS, 1, offset, rgb, 1);
+    module.host_sockets[0].deliver(SENDER_ADDRESS, MODULE_ADDRESS, msg, len);
+  }
+  uint16_t len = hmtl_rgb_fmt(msg, sizeof (msg), MODULE_ADDRESS,
+                              HOST_OUTPUT_RGB, 4, 5, 6);
+  ((msg_hdr_t *)msg)->flags |= MSG_FLAG_PRIORITY;
+  hmtl_msg_set_crc((msg_hdr_t *)msg);
+  module.host_sockets[1].deliver(OTHER_ADDRESS, MODULE_ADDRESS, msg, len);
+  uint16_t low_queued = module.handler.low_queued;
+  module.loop();
+
+  boolean ordered = (num_low_handled == 3) &&
+                    (low_handled[0] == MSG_TYPE_OUTPUT) &&
+                    (low_handled[1] == MSG_TYPE_PIXEL_FRAME) &&
+                    (low_handled[2] == MSG_TYPE_PIXEL_FRAME);
+  printf("  %u handled in one check, priority %s, %u queued\n",
+         num_low_handled, ordered ? "first" : "not first",
+         module.handler.low_queued - low_queued);
+
+  /* Both frames came from the socket's single receive buffer */
+  boolean in_place = ordered &&
+                     (low_handled_msgs[1] == low_handled_msgs[2]) &&
+                     ((byte *)low_handled_msgs[1] <
+                      (byte *)&module.host_sockets[0] +
+                      sizeof (module.host_sockets[0])) &&
+                     ((byte *)low_handled_msgs[1] >
+                      (byte *)&module.host_sockets[0]);
+  printf("  frames handled %s\n",
+         in_place ? "in the receive buffer" : "from a copy");
+
+  return ordered && in_place &&
+         (module.handler.low_queued - low_queued == 2);
+}
+
+/*******************************************************************************
+ * Coalescing
+ */
+
+#define COALESCE_MAX_HANDLED 4
+
+/* Output messages handled, in order, as their output and first value */
+static uint8_t coalesce_outputs[COALESCE_MAX_HANDLED];
+static uint8_t coalesce_values[COALESCE_MAX_HANDLED];
+static uint8_t num_coalesce_handled;
+
+static boolean record_coalesced(MessageHandler *handler, msg_hdr_t *msg_hdr,
+                                Socket *src, Socket *serial_socket,
+                                config_hdr_t *config) {
+  output_hdr_t *out_hdr = (output_hdr_t *)(msg_hdr + 1);
+  if (num_coalesce_handled < COALESCE_MAX_HANDLED) {
+    coalesce_outputs[num_coalesce_handled] = out_hdr->output;
+    coalesce_values[num_coalesce_handled] =
+      (out_hdr->type == HMTL_OUTPUT_RGB ?
+       ((msg_rgb_t *)out_hdr)->values[0] : ((msg_value_t *)out_hdr)->value);
+  }
+  num_coalesce_handled++;
+  return false;
+}
+
+/* Deliver an output message to a module's socket without running it */
+static void coalesce_send(HostModule *module, byte *msg, uint16_t len,
+                          uint8_t flags) {
+  ((msg_hdr_t *)msg)->flags |= flags;
+  hmtl_msg_set_crc((msg_hdr_t *)msg);
+  module->host_sockets[0].deliver(SENDER_ADDRESS, MODULE_ADDRESS, msg, len);
+}
+
+/*
+ * Send an RGB, a value and a newer RGB message within one check, and check
+ * that the newer RGB replaces the older and, taking the place of the newest,
+ * is handled after the value.  An RGB sent reliably is never coalesced, so it
+ * is handled after the RGB it would otherwise replace.
+ */
+static boolean check_coalescing() {
+  static HostModule module;
+  module.addSocket();
+  module.setup(MODULE_ADDRESS, MODULE_DEVICE_ID, 0);
+  module.handler.register_handler(MSG_TYPE_OUTPUT, record_coalesced);
+  host_clock_manual(true);
+  module.loop();
+  num_coalesce_handled = 0;
+  uint16_t coalesced = module.handler.coalesced;
+
+  byte msg[HMTL_MSG_RGB_LEN];
+  uint16_t len = hmtl_rgb_fmt(msg, sizeof (msg), MODULE_ADDRESS,
+                              HOST_OUTPUT_RGB, 1, 0, 0);
+  coalesce_send(&module, msg, len, 0);
+  len = hmtl_value_fmt(msg, sizeof (msg), MODULE_ADDRESS,
+                       HOST_OUTPUT_VALUE, 10);
+  coalesce_send(&module, msg, len, 0);
+  len = hmtl_rgb_fmt(msg, sizeof (msg), MODULE_ADDRESS,
+                     HOST_OUTPUT_RGB, 2, 0, 0);
+  coalesce_send(&module, msg, len, 0);
+  len = hmtl_rgb_fmt(msg, sizeof (msg), MODULE_ADDRESS,
+                     HOST_OUTPUT_RGB, 3, 0, 0);
+  coalesce_send(&module, msg, len, MSG_FLAG_RELIABLE);
+  module.loop();
+  host_clock_manual(false);
+
+  printf("  %u handled in one check, %u coalesced:",
+         num_coalesce_handled, module.handler.coalesced - coalesced);
+  for (uint8_t i = 0; (i < num_coalesce_handled) &&
+         (i < COALESCE_MAX_HANDLED); i++) {
+    printf(" %s %u", (coalesce_outputs[i] == HOST_OUTPUT_RGB ?
+                      "rgb" : "value"), coalesce_values[i]);
+  }
+  printf("\n");
+
+  return (num_coalesce_handled == 3) &&
+         (module.handler.coalesced - coalesced == 1) &&
+         (coalesce_outputs[0] == HOST_OUTPUT_VALUE) &&
+         (coalesce_values[0] == 10) &&
+         (coalesce_outputs[1] == HOST_OUTPUT_RGB) &&
+         (coalesce_values[1] == 2) &&
+         (coalesce_outputs[2] == HOST_OUTPUT_RGB) &&
+         (coalesce_values[2] == 3);
+}
+
+/*******************************************************************************
+ * Builders and views
+ */
+
+/*
+ * Build an RGB message and check that it is finished with its fixed length
+ * and types and that its view returns the values it was built with, while
+ * views of another output type, another message type or a message too short
+ * for the payload return NULL.  Then check that building into a buffer too
+ * small for the message, fixed or variable length, returns NULL and that a
+ * fmt function building such a message returns 0.
+ */
+static boolean check_builders() {
+  boolean passed = true;
+
+  byte msg[HMTL_MSG_RGB_LEN + 1];
+  msg_rgb_t *built = hmtl_output_build<msg_rgb_t>(msg, HMTL_MSG_RGB_LEN,
+                                                  HOST_OUTPUT_RGB);
+  if (built != NULL) {
+    built->values[0] = 1;
+    built->values[1] = 2;
+    built->values[2] = 3;
+  }
+  uint16_t len = hmtl_msg_finish<msg_rgb_t>(msg, MODULE_ADDRESS);
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)msg;
+  msg_rgb_t *rgb = hmtl_msg_view<msg_rgb_t>(msg_hdr);
+  boolean built_ok = (built != NULL) && (len == HMTL_MSG_RGB_LEN) &&
+    (hmtl_msg_length(msg_hdr) == len) && (msg_hdr->type == MSG_TYPE_OUTPUT) &&
+    (msg_hdr->address == MODULE_ADDRESS) && (rgb == built) &&
+    (rgb->hdr.type == HMTL_OUTPUT_RGB) &&
+    (rgb->hdr.output == HOST_OUTPUT_RGB) &&
+    (rgb->values[0] == 1) && (rgb->values[1] == 2) && (rgb->values[2] == 3);
+  printf("  rgb: %u bytes of type %u, view %s\n", len, msg_hdr->type,
+         built_ok ? "matches" : "doesn't match");
+  passed = passed && built_ok;
+
+  boolean wrong_output = (hmtl_msg_view<msg_value_t>(msg_hdr) == NULL);
+  boolean wrong_type = (hmtl_msg_view<msg_groups_t>(msg_hdr) == NULL);
+  msg_hdr->length = HMTL_MSG_RGB_LEN - 1;
+  boolean short_msg = (hmtl_msg_view<msg_rgb_t>(msg_hdr) == NULL);
+  printf("  views: other output %s, other type %s, short message %s\n",
+         wrong_output ? "refused" : "accepted",
+         wrong_type ? "refused" : "accepted",
+         short_msg ? "refused" : "accepted");
+  passed = passed && wrong_output && wrong_type && short_msg;
+
+  boolean fixed_small = (hmtl_output_build<msg_rgb_t>(
+                           msg, HMTL_MSG_RGB_LEN - 1, HOST_OUTPUT_RGB) == NULL);
+  boolean variable_small = (hmtl_msg_build<msg_groups_t>(
+                              msg, sizeof (msg), sizeof (msg)) == NULL);
+  config_groups_t groups;
+  memset(&groups, 0, sizeof (groups));
+  groups.num_groups = HMTL_MAX_GROUPS;
+  boolean fmt_small = (hmtl_groups_fmt(msg, sizeof (msg), &groups) == 0);
+  printf("  small buffer: fixed %s, variable %s, fmt returned %s\n",
+         fixed_small ? "refused" : "built",
+         variable_small ? "refused" : "built",
+         fmt_small ? "0" : "a length");
+  passed = passed && fixed_small && variable_small && fmt_small;
+
+  return passed;
+}
+
+/*******************************************************************************
+ * Message trace
+ */
+
+#define TRACE_RECORD_LEN \
+  (uint16_t)(sizeof (msg_trace_record_t) + HMTL_MSG_RGB_LEN)
+#define TRACE_RECORDS    (MSG_TRACE_BYTES / TRACE_RECORD_LEN)
+#define TRACE_MSGS       (TRACE_RECORDS + TRACE_RECORDS / 4)
+
+/*
+ * Returns the red value of the message in the trace record at an offset, or
+ * -1 if the record isn't of a whole RGB message from the sender.
+ */
+static int trace_red(HostModule *module, uint16_t offset) {
+  byte data[TRACE_RECORD_LEN];
+  if (module->handler.read_trace(offset, data, sizeof (data)) !=
+      sizeof (data)) {
+    return -1;
+  }
+
+  msg_trace_record_t *record = (msg_trace_record_t *)data;
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)(record + 1);
+  msg_rgb_t *rgb = hmtl_msg_view<msg_rgb_t>(msg_hdr);
+  if ((record->length != HMTL_MSG_RGB_LEN) || (record->source != 0) ||
+      (record->sender != SENDER_ADDRESS) || (rgb == NULL)) {
+    return -1;
+  }
+  return rgb->values[0];
+}
+
+/*
+ * Send a module more messages than its trace holds and check that it keeps
+ * only the most recent that fit, wrapping around the end of its buffer, and
+ * that they are read back whole and in order from the oldest.
+ */
+static boolean check_trace_wrap() {
+  static HostModule module;
+  module.addSocket();
+  module.setup(MODULE_ADDRESS, MODULE_DEVICE_ID, 0);
+
+  for (uint16_t i = 0; i < TRACE_MSGS; i++) {
+    byte msg[HMTL_MSG_RGB_LEN];
+    format_forwarded(msg, MODULE_ADDRESS, i, HMTL_MSG_DEFAULT_TTL, i);
+    module.host_sockets[0].deliver(SENDER_ADDRESS, MODULE_ADDRESS,
+                                   msg, sizeof (msg));
+    module.loop();
+  }
+
+  uint16_t length = module.handler.trace_length();
+  uint16_t in_order = 0;
+  for (uint16_t offset = 0; offset < length; offset += TRACE_RECORD_LEN) {
+    int expected = (TRACE_MSGS - TRACE_RECORDS + in_order) & 0xFF;
+    if (trace_red(&module, offset) != expected) break;
+    in_order++;
+  }
+  byte past_end;
+  uint16_t read_past = module.handler.read_trace(length, &past_end, 1);
+  printf("  %u messages: %u bytes kept of %u, %u records in order from %u\n",
+         TRACE_MSGS, length, MSG_TRACE_BYTES, in_order,
+         TRACE_MSGS - TRACE_RECORDS);
+
+  return (length == TRACE_RECORDS * TRACE_RECORD_LEN) &&
+         (in_order == TRACE_RECORDS) && (read_past == 0);
+}
+
+/******************************************************************************/
+
+static const struct {
+  const char *name;
+  check_func func;
+} checks[] = {
+  { "serial_resync", check_serial_resync },
+  { "batch",         check_batch },
+  { "raw_frame",     check_raw_frame },
+  { "pixel_frame",   check_pixel_frame },
+  { "crc",           check_crc },
+  { "budget",        check_budget },
+  { "dedup_ttl",     check_dedup_ttl },
+  { "routing",       check_routing },
+  { "dispatch",      check_dispatch },
+  { "deferred_poll", check_deferred_poll },
+  { "discovery",     check_discovery },
+  { "dump_config",   check_dump_config },
+  { "poll_outputs",  check_poll_outputs },
+  { "zero_copy",     check_zero_copy },
+  { "groups",        check_groups },
+  { "v2_peers",      check_v2_peers },
+  { "reassembly",    check_reassembly },
+  { "reliable",      check_reliable },
+  { "low_queue",     check_low_queue },
+  { "coalescing",    check_coalescing },
+  { "builders",      check_builders },
+  { "trace_wrap",    check_trace_wrap },
+};
+#define NUM_CHECKS (sizeof (checks) / sizeof (checks[0]))
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-t check]\n", name);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *name = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:h")) != -1) {
+    switch (opt) {
+      case 't':
+        name = optarg;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+
+  int run = 0;
+  int failed = 0;
+  for (byte c = 0; c < NUM_CHECKS; c++) {
+    if (name && strcmp(name, checks[c].name)) continue;
+
+    printf("%s\n", checks[c].name);
+    boolean passed = checks[c].func();
+    printf("  %s\n", passed ? "ok" : "FAILED");
+    run++;
+    if (!passed) failed++;
+  }
+
+  if (run == 0) {
+    usage(argv[0]);
+  }
+
+  printf("%d of %d checks passed\n", run - failed, run);
+  return (failed > 0 ? 1 : 0);
+}
@@ -0,0 +1,154 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * A host-side equivalent of the HMTL_Module sketch
+ ******************************************************************************/
+
+#include "Arduino.h"
+#include "EEPromUtils.h"
+
+#include "HMTLTypes.h"
+#include "HMTLMessaging.h"
+#include "HMTLPrograms.h"
+#include "TimeSync.h"
+
+#include "HostModule.h"
+
+/*
+ * As in the sketches, the timesync object is defined by the application
+ */
+TimeSync timesync;
+
+hmtl_program_t host_program_functions[] = {
+  { HMTL_PROGRAM_NONE, NULL, NULL},
+  { HMTL_PROGRAM_BLINK, program_blink, program_blink_init },
+  { HMTL_PROGRAM_TIMED_CHANGE, program_timed_change, program_timed_change_init },
+  { HMTL_PROGRAM_FADE, program_fade, program_fade_init },
+  { HMTL_PROGRAM_SPARKLE, program_sparkle, program_sparkle_init },
+  { PROGRAM_BRIGHTNESS, NULL,  program_brightness },
+  { PROGRAM_COLOR, NULL, program_color},
+  { HMTL_PROGRAM_CIRCULAR, program_circular, program_circular_init}
+};
+const byte host_num_programs =
+  sizeof (host_program_functions) / sizeof (hmtl_program_t);
+
+HostModule::HostModule() {
+  num_sockets = 0;
+  first_run = true;
+  for (byte i = 0; i < MAX_SOCKETS; i++) {
+    sockets[i] = NULL;
+  }
+}
+
+HostSocket *HostModule::addSocket(uint16_t data_size) {
+  if (num_sockets >= MAX_SOCKETS) return NULL;
+
+  HostSocket *socket = &host_sockets[num_sockets];
+  socket->init(SOCKET_ADDR_INVALID);
+  socket->initBuffer(socket_buffers[num_sockets], data_size);
+  sockets[num_sockets++] = socket;
+  return socket;
+}
+
+void HostModule::setup(socket_addr_t address, uint16_t device_id,
+                       uint16_t num_pixels,
+                       const socket_addr_t *member_groups,
+                       uint8_t num_groups) {
+  /* Construct and store the configuration */
+  config_hdr_t hdr;
+  memset(&hdr, 0, sizeof (hdr));
+  hdr.hardware_version = 1;
+  hdr.baud = BAUD_TO_BYTE(115200);
+  hdr.num_outputs = HOST_NUM_OUTPUTS;
+  hdr.device_id = device_id;
+  hdr.address = address;
+
+  config_value_t value;
+  memset(&value, 0, sizeof (value));
+  value.hdr.type = HMTL_OUTPUT_VALUE;
+  value.hdr.output = HOST_OUTPUT_VALUE;
+  value.pin = 3;
+
+  config_rgb_t rgb;
+  memset(&rgb, 0, sizeof (rgb));
+  rgb.hdr.type = HMTL_OUTPUT_RGB;
+  rgb.hdr.output = HOST_OUTPUT_RGB;
+  rgb.pins[0] = 5;
+  rgb.pins[1] = 6;
+  rgb.pins[2] = 9;
+
+  config_pixels_t pixel_config;
+  memset(&pixel_config, 0, sizeof (pixel_config));
+  pixel_config.hdr.type = HMTL_OUTPUT_PIXELS;
+  pixel_config.hdr.output = HOST_OUTPUT_PIXELS;
+  pixel_config.clockPin = 12;
+  pixel_config.dataPin = 11;
+  pixel_config.numPixels = num_pixels;
+
+  output_hdr_t *write_outputs[HOST_NUM_OUTPUTS] = {
+    &value.hdr, &rgb.hdr, &pixel_config.hdr
+  };
+
+  config_groups_t write_groups;
+  memset(&write_groups, 0, sizeof (write_groups));
+  for (byte i = 0; (i < num_groups) && (i < HMTL_MAX_GROUPS); i++) {
+    write_groups.groups[write_groups.num_groups++] = member_groups[i];
+  }
+  hmtl_write_config(&hdr, write_outputs, &write_groups);
+
+  /* Read back the configuration and initialize the outputs */
+  for (byte i = 0; i < HMTL_MAX_OUTPUTS; i++) {
+    outputs[i] = NULL;
+    objects[i] = NULL;
+  }
+  hmtl_setup(&config, readoutputs, outputs, objects, HMTL_MAX_OUTPUTS,
+             NULL, NULL, &pixels, NULL, NULL, NULL, NULL, &groups);
+
+  for (byte i = 0; i < num_sockets; i++) {
+    sockets[i]->sourceAddress = config.address;
+  }
+
+  manager = ProgramManager(outputs, trackers, objects, config.num_outputs,
+                           host_program_functions, host_num_programs);
+  handler.init(config.address, &manager, sockets, num_sockets);
+  handler.set_loop_stats(&loop_stats);
+  handler.set_groups(&groups);
+  loop_stats.reset();
+  first_run = true;
+}
+
+boolean HostModule::loop() {
+  loop_stats.begin();
+
+  handler.serial_ready();
+
+  boolean update = handler.check(&config);
+  loop_stats.mark(LOOP_PHASE_CHECK);
+
+  /* There is no sketch specific work on a host module */
+  loop_stats.mark(LOOP_PHASE_ADDITIONAL);
+
+  if (manager.run()) {
+    update = true;
+  }
+  loop_stats.mark(LOOP_PHASE_PROGRAMS);
+
+  if (first_run) {
+    update = true;
+    first_run = false;
+  }
+
+  update = handler.check_update(update);
+  if (update) {
+    for (byte i = 0; i < config.num_outputs; i++) {
+      hmtl_update_output(outputs[i], objects[i]);
+    }
+    loop_stats.mark(LOOP_PHASE_OUTPUTS);
+  }
+
+  loop_stats.end();
+
+  return update;
+}
@@ -0,0 +1,78 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * A host-side equivalent of the HMTL_Module sketch.  Each instance owns the
+ * configuration, outputs, program manager, message handler and sockets of a
+ * single module, so that one or more modules can be run inside a host
+ * process.
+ ******************************************************************************/
+
+#ifndef HOST_MODULE_H
+#define HOST_MODULE_H
+
+#include "Arduino.h"
+#include "HMTLTypes.h"
+#include "HMTLMessaging.h"
+#include "ProgramManager.h"
+#include "MessageHandler.h"
+#include "LoopStats.h"
+#include "PixelUtil.h"
+#include "HostSocket.h"
+
+/* Output indexes of the default module configuration */
+#define HOST_OUTPUT_VALUE  0
+#define HOST_OUTPUT_RGB    1
+#define HOST_OUTPUT_PIXELS 2
+#define HOST_NUM_OUTPUTS   3
+
+class HostModule {
+ public:
+  static const byte MAX_SOCKETS = 3;
+  static const uint16_t SOCKET_DATA_SIZE = 64;
+
+  HostModule();
+
+  /*
+   * Write a configuration with a value, RGB and pixel output to the EEPROM
+   * image and initialize the module from it as HMTL_Module's setup() does.
+   * The module is made a member of the groups if any are provided.
+   */
+  void setup(socket_addr_t address, uint16_t device_id, uint16_t num_pixels,
+             const socket_addr_t *member_groups = NULL,
+             uint8_t num_groups = 0);
+
+  /* Add a socket, must be called before setup() */
+  HostSocket *addSocket(uint16_t data_size = SOCKET_DATA_SIZE);
+
+  /* A single iteration of HMTL_Module's loop() */
+  boolean loop();
+
+  config_hdr_t config;
+  config_groups_t groups;
+  config_max_t readoutputs[HMTL_MAX_OUTPUTS];
+  output_hdr_t *outputs[HMTL_MAX_OUTPUTS];
+  void *objects[HMTL_MAX_OUTPUTS];
+  program_tracker_t *trackers[HMTL_MAX_OUTPUTS];
+
+  PixelUtil pixels;
+
+  HostSocket host_sockets[MAX_SOCKETS];
+  Socket *sockets[MAX_SOCKETS];
+  byte num_sockets;
+
+  ProgramManager manager;
+  MessageHandler handler;
+  LoopStats loop_stats;
+
+ private:
+  byte socket_buffers[MAX_SOCKETS][HOST_BUFFER_TOTAL(255)];
+  boolean first_run;
+};
+
+/* The programs available on a host module */
+extern hmtl_program_t host_program_functions[];
+extern const byte host_num_programs;
+
+#endif
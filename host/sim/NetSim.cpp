@@ -0,0 +1,236 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Multi-module network simulator.
+ *
+ * Runs a topology of host modules joined by virtual buses and reports bus
+ * utilization, per-module traffic and the latency and duplication of the
+ * messages sent by the controller.
+ *
+ * Topologies are read from a file with one directive per line:
+ *   bus <name> <bits/sec> <latency us> <loss per 1000> [shared|switched|collide]
+ *   module <address> <bus> [<bus> ...]
+ *   controller <address> <bus>
+ *   traffic <msgs/sec> <broadcast percent>
+ *   duration <ms>
+ * Addresses may be given in hex (0x..), '#' starts a comment.  A collide bus
+ * is shared but without carrier sense, so overlapping frames are lost.
+ *
+ * Without a file the default topology is a show layout: a serial gateway to an
+ * RS485 run of 20 modules, with two modules bridging it to 10 RFM69 modules.
+ *
+ * With -p the controller polls every module before sending traffic, letting
+ * the modules learn routes from the responses.  With -D it instead runs
+ * discovery rounds starting with the given number of slots of -S ms each, and
+ * reports the time taken to find the modules.  With -A the first round
+ * assigns slots by address over the range of the modules' addresses, as a
+ * rescan does.  With -T the exit status is nonzero unless discovery found
+ * every module within the given number of ms.
+ *
+ * With -P the given percentage of the controller's messages are sent as
+ * priority traffic, and their delivery latency is reported separately from
+ * that of the bulk traffic.
+ *
+ * Usage: NetSim [-f topology] [-d ms] [-r msgs/sec] [-b percent] [-t tick us]
+ *               [-s seed] [-p] [-D slots] [-S slot ms] [-A] [-T ms]
+ *               [-P percent]
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "SimNetwork.h"
+
+#define MAX_LINE   256
+#define MAX_TOKENS 8
+
+typedef struct {
+  uint32_t duration_ms;
+  uint32_t msgs_per_sec;
+  uint8_t broadcast_percent;
+} sim_options_t;
+
+static void build_default(SimNetwork *network, sim_options_t *options) {
+  SimBus *serial = network->addBus("serial", 115200, 100, 0, false);
+  SimBus *rs485 = network->addBus("rs485", 115200, 50, 0, true);
+  SimBus *rfm69 = network->addBus("rfm69", 55555, 1000, 20, true);
+
+  network->addController(0x00, serial);
+
+  int gateway = network->addModule(0x01);
+  network->connect(gateway, serial);
+  network->connect(gateway, rs485);
+
+  for (int i = 0; i < 20; i++) {
+    network->connect(network->addModule(0x10 + i), rs485);
+  }
+
+  for (int i = 0; i < 2; i++) {
+    int bridge = network->addModule(0x30 + i);
+    network->connect(bridge, rs485);
+    network->connect(bridge, rfm69);
+  }
+
+  for (int i = 0; i < 10; i++) {
+    network->connect(network->addModule(0x40 + i), rfm69);
+  }
+
+  options->msgs_per_sec = 20;
+  options->broadcast_percent = 10;
+}
+
+static int tokenize(char *line, char **tokens) {
+  char *comment = strchr(line, '#');
+  if (comment) *comment = '\0';
+
+  int count = 0;
+  char *save;
+  for (char *tok = strtok_r(line, " \t\r\n", &save);
+       (tok != NULL) && (count < MAX_TOKENS);
+       tok = strtok_r(NULL, " \t\r\n", &save)) {
+    tokens[count++] = tok;
+  }
+  return count;
+}
+
+static boolean load_topology(const char *path, SimNetwork *network,
+                             sim_options_t *options) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    perror(path);
+    return false;
+  }
+
+  char line[MAX_LINE];
+  char *tokens[MAX_TOKENS];
+  int lineno = 0;
+  boolean ok = true;
+
+  while (ok && fgets(line, sizeof (line), file)) {
+    lineno++;
+    int count = tokenize(line, tokens);
+    if (count == 0) continue;
+
+    if (!strcmp(tokens[0], "bus") && (count >= 5)) {
+      boolean shared = (count < 6) || strcmp(tokens[5], "switched");
+      SimBus *bus = network->addBus(tokens[1], strtoul(tokens[2], NULL, 0),
+                                    strtoul(tokens[3], NULL, 0),
+                                    strtoul(tokens[4], NULL, 0), shared);
+      ok = (bus != NULL);
+      if (ok && (count >= 6)) bus->collisions = !strcmp(tokens[5], "collide");
+    } else if (!strcmp(tokens[0], "module") && (count >= 3)) {
+      int node = network->addModule(strtoul(tokens[1], NULL, 0));
+      for (int i = 2; ok && (i < count); i++) {
+        ok = network->connect(node, network->findBus(tokens[i]));
+      }
+    } else if (!strcmp(tokens[0], "controller") && (count == 3)) {
+      ok = network->addController(strtoul(tokens[1], NULL, 0),
+                                  network->findBus(tokens[2]));
+    } else if (!strcmp(tokens[0], "traffic") && (count == 3)) {
+      options->msgs_per_sec = strtoul(tokens[1], NULL, 0);
+      options->broadcast_percent = strtoul(tokens[2], NULL, 0);
+    } else if (!strcmp(tokens[0], "duration") && (count == 2)) {
+      options->duration_ms = strtoul(tokens[1], NULL, 0);
+    } else {
+      ok = false;
+    }
+
+    if (!ok) {
+      fprintf(stderr, "%s:%d: invalid directive '%s'\n", path, lineno,
+              tokens[0]);
+    }
+  }
+
+  fclose(file);
+  return ok;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-f topology] [-d ms] [-r msgs/sec] "
+          "[-b percent] [-t tick us] [-s seed] [-p] [-D slots] "
+          "[-S slot ms] [-A] [-T ms] [-P percent]\n", name);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *topology = NULL;
+  uint32_t seed = 1;
+  uint32_t tick_us = 100;
+
+  /* Command line values override the topology's */
+  long duration_ms = -1;
+  long msgs_per_sec = -1;
+  long broadcast_percent = -1;
+  boolean poll = false;
+  uint8_t discover_slots = 0;
+  uint8_t slot_ms = 5;
+  boolean by_address = false;
+  long limit_ms = -1;
+  uint8_t priority_percent = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "f:d:r:b:t:s:pD:S:AT:P:h")) != -1) {
+    switch (opt) {
+      case 'f': topology = optarg; break;
+      case 'd': duration_ms = strtol(optarg, NULL, 0); break;
+      case 'r': msgs_per_sec = strtol(optarg, NULL, 0); break;
+      case 'b': broadcast_percent = strtol(optarg, NULL, 0); break;
+      case 't': tick_us = strtoul(optarg, NULL, 0); break;
+      case 's': seed = strtoul(optarg, NULL, 0); break;
+      case 'p': poll = true; break;
+      case 'D': discover_slots = strtoul(optarg, NULL, 0); break;
+      case 'S': slot_ms = strtoul(optarg, NULL, 0); break;
+      case 'A': by_address = true; break;
+      case 'T': limit_ms = strtol(optarg, NULL, 0); break;
+      case 'P': priority_percent = strtoul(optarg, NULL, 0); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (tick_us == 0) usage(argv[0]);
+
+  sim_options_t options;
+  options.duration_ms = 5000;
+  options.msgs_per_sec = 10;
+  options.broadcast_percent = 0;
+
+  SimNetwork network(seed);
+  if (topology) {
+    if (!load_topology(topology, &network, &options)) return 1;
+  } else {
+    build_default(&network, &options);
+  }
+
+  if (duration_ms >= 0) options.duration_ms = duration_ms;
+  if (msgs_per_sec >= 0) options.msgs_per_sec = msgs_per_sec;
+  if (broadcast_percent >= 0) options.broadcast_percent = broadcast_percent;
+
+  network.start();
+  boolean passed = true;
+  if (discover_slots) {
+    uint64_t start_us = host_clock_us();
+    uint32_t found = network.discover(discover_slots, slot_ms, tick_us,
+                                      stdout, by_address);
+    uint32_t elapsed_ms = (host_clock_us() - start_us) / 1000;
+    printf("Discovered %u of %u modules in %u ms\n\n", found,
+           (unsigned)network.nodes.size(), elapsed_ms);
+    if ((limit_ms >= 0) &&
+        ((found < network.nodes.size()) || (elapsed_ms > limit_ms))) {
+      printf("FAILED: discovery must find every module within %ld ms\n\n",
+             limit_ms);
+      passed = false;
+    }
+  } else if (poll) {
+    network.poll();
+  }
+  network.run((uint64_t)options.duration_ms * 1000, tick_us,
+              options.msgs_per_sec, options.broadcast_percent,
+              priority_percent);
+  network.report(stdout);
+
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,604 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * In-process network simulation of HMTL modules
+ ******************************************************************************/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "Arduino.h"
+#include "HMTLTypes.h"
+#include "HMTLMessaging.h"
+
+#include "SimNetwork.h"
+
+/* Bits per byte on the wire, including start and stop bits */
+#define SIM_BITS_PER_BYTE 10
+
+#define SIM_DEVICE_ID_BASE 1000
+
+/* Discovery rounds wait this long beyond the last slot for responses */
+#define SIM_DISCOVER_MARGIN_MS 20
+#define SIM_DISCOVER_MIN_SLOTS 8
+
+/*
+ * A round can find nothing because the request itself was lost, so discovery
+ * only ends after this many rounds in a row find no new modules
+ */
+#define SIM_DISCOVER_EMPTY_ROUNDS 2
+
+const int SimNetwork::CONTROLLER_NODE;
+
+static void stat_add(sim_stat_t *stat, uint64_t value) {
+  if ((stat->count == 0) || (value < stat->min)) stat->min = value;
+  if ((stat->count == 0) || (value > stat->max)) stat->max = value;
+  stat->total += value;
+  stat->count++;
+}
+
+static void stat_print(FILE *out, const char *name, const sim_stat_t *stat) {
+  if (stat->count == 0) {
+    fprintf(out, "  %-18s -\n", name);
+    return;
+  }
+  fprintf(out, "  %-18s min %llu us  avg %llu us  max %llu us  (%u samples)\n",
+          name,
+          (unsigned long long)stat->min,
+          (unsigned long long)(stat->total / stat->count),
+          (unsigned long long)stat->max,
+          stat->count);
+}
+
+/*******************************************************************************
+ * Buses
+ */
+
+SimBus::SimBus(SimNetwork *_network, const char *_name, uint32_t _bandwidth,
+               uint32_t _latency_us, uint16_t _loss_permille,
+               boolean _shared) {
+  network = _network;
+  strncpy(name, _name, sizeof (name) - 1);
+  name[sizeof (name) - 1] = '\0';
+  bandwidth = _bandwidth;
+  latency_us = _latency_us;
+  loss_permille = _loss_permille;
+  shared = _shared;
+  collisions = false;
+
+  busy_until_us = 0;
+  busy_us = 0;
+  frames = 0;
+  bytes = 0;
+  lost = 0;
+  collided = 0;
+}
+
+/*
+ * Send a frame to every other endpoint on the bus.  A shared bus carries a
+ * single frame at a time so transmissions are serialized, or if collisions
+ * are modeled any that overlap are corrupted.
+ */
+uint64_t SimBus::transmit(sim_endpoint_t *from, const host_socket_hdr_t *hdr,
+                          const byte *data, uint64_t start_us) {
+  uint32_t frame_bytes = sizeof (host_socket_hdr_t) + hdr->length;
+  uint64_t duration_us = 0;
+  if (bandwidth) {
+    duration_us = ((uint64_t)frame_bytes * SIM_BITS_PER_BYTE * 1000000 +
+                   bandwidth - 1) / bandwidth;
+  }
+
+  boolean collision = false;
+  if (shared && (busy_until_us > start_us)) {
+    if (collisions) {
+      /* Frames that have ended may already have been delivered */
+      collision = true;
+      for (unsigned int i = 0; i < on_air.size(); i++) {
+        if (on_air[i].first > start_us) on_air[i].second->corrupt = true;
+      }
+    } else {
+      start_us = busy_until_us;
+    }
+  }
+  if (!collision) on_air.clear();
+
+  uint64_t end_us = start_us + duration_us;
+  frames++;
+  bytes += frame_bytes;
+
+  /* Overlapping transmissions only occupy the bus once */
+  uint64_t busy_from = (shared && (busy_until_us > start_us)) ?
+                       busy_until_us : start_us;
+  if (end_us > busy_from) busy_us += end_us - busy_from;
+  if (shared && (end_us > busy_until_us)) busy_until_us = end_us;
+
+  for (unsigned int i = 0; i < endpoints.size(); i++) {
+    sim_endpoint_t *to = endpoints[i];
+    if (to == from) continue;
+
+    if (loss_permille && (network->rand32() % 1000 < loss_permille)) {
+      lost++;
+      continue;
+    }
+
+    sim_frame_t *frame = new sim_frame_t;
+    frame->to = to;
+    frame->from = from->node;
+    frame->sent_us = host_clock_us();
+    frame->corrupt = collision;
+    frame->hdr = *hdr;
+    memcpy(frame->data, data, hdr->length);
+    network->schedule(frame, end_us + latency_us);
+    if (collisions) on_air.push_back(std::make_pair(end_us, frame));
+  }
+
+  return end_us;
+}
+
+/*******************************************************************************
+ * Network construction
+ */
+
+SimNetwork::SimNetwork(uint32_t seed) {
+  rand_state = seed ? seed : 1;
+  sequence = 0;
+  elapsed_us = 0;
+
+  memset(&controller, 0, sizeof (controller));
+  controller.index = CONTROLLER_NODE;
+  controller.address = SOCKET_ADDR_INVALID;
+  controller_endpoint = NULL;
+  discovering = false;
+
+  memset(&hop_latency, 0, sizeof (hop_latency));
+  memset(&delivery_latency, 0, sizeof (delivery_latency));
+  memset(&priority_latency, 0, sizeof (priority_latency));
+  injected = 0;
+  delivered = 0;
+  duplicates = 0;
+  untracked = 0;
+  max_hops = 0;
+}
+
+SimNetwork::~SimNetwork() {
+  for (std::multimap<uint64_t, sim_frame_t *>::iterator it = pending.begin();
+       it != pending.end(); it++) {
+    delete it->second;
+  }
+  for (unsigned int i = 0; i < endpoints.size(); i++) delete endpoints[i];
+  for (unsigned int i = 0; i < nodes.size(); i++) {
+    delete nodes[i]->module;
+    delete nodes[i];
+  }
+  for (unsigned int i = 0; i < buses.size(); i++) delete buses[i];
+}
+
+SimBus *SimNetwork::addBus(const char *name, uint32_t bandwidth,
+                           uint32_t latency_us, uint16_t loss_permille,
+                           boolean shared) {
+  if (findBus(name) != NULL) return NULL;
+
+  SimBus *bus = new SimBus(this, name, bandwidth, latency_us, loss_permille,
+                           shared);
+  buses.push_back(bus);
+  return bus;
+}
+
+SimBus *SimNetwork::findBus(const char *name) {
+  for (unsigned int i = 0; i < buses.size(); i++) {
+    if (!strcmp(buses[i]->name, name)) return buses[i];
+  }
+  return NULL;
+}
+
+int SimNetwork::addModule(socket_addr_t address, uint16_t num_pixels) {
+  sim_node_t *node = new sim_node_t;
+  memset(node, 0, sizeof (*node));
+  node->index = nodes.size();
+  node->address = address;
+  node->module = new HostModule();
+  node->num_pixels = num_pixels;
+  nodes.push_back(node);
+  return node->index;
+}
+
+sim_endpoint_t *SimNetwork::attach(sim_node_t *node, SimBus *bus,
+                                   HostSocket *socket) {
+  sim_endpoint_t *endpoint = new sim_endpoint_t;
+  endpoint->node = node;
+  endpoint->bus = bus;
+  endpoint->socket = socket;
+  socket->setTransmit(transmit, endpoint);
+
+  bus->endpoints.push_back(endpoint);
+  endpoints.push_back(endpoint);
+  return endpoint;
+}
+
+boolean SimNetwork::connect(int index, SimBus *bus) {
+  if ((index < 0) || (index >= (int)nodes.size()) || (bus == NULL)) {
+    return false;
+  }
+
+  sim_node_t *node = nodes[index];
+  HostSocket *socket = node->module->addSocket();
+  if (socket == NULL) return false;
+
+  attach(node, bus, socket);
+  return true;
+}
+
+boolean SimNetwork::addController(socket_addr_t address, SimBus *bus) {
+  if ((controller_endpoint != NULL) || (bus == NULL)) return false;
+
+  controller.address = address;
+  controller_socket.init(address);
+  controller_socket.initBuffer(controller_buffer, 64);
+  controller_endpoint = attach(&controller, bus, &controller_socket);
+  return true;
+}
+
+void SimNetwork::start() {
+  host_clock_manual(true);
+  host_clock_set_us(0);
+
+  for (unsigned int i = 0; i < nodes.size(); i++) {
+    sim_node_t *node = nodes[i];
+    node->module->setup(node->address, SIM_DEVICE_ID_BASE + i,
+                        node->num_pixels);
+  }
+}
+
+/*******************************************************************************
+ * Simulation
+ */
+
+uint32_t SimNetwork::rand32() {
+  /* xorshift32, independent of the avr-libc generator used by programs */
+  rand_state ^= rand_state << 13;
+  rand_state ^= rand_state >> 17;
+  rand_state ^= rand_state << 5;
+  return rand_state;
+}
+
+/*
+ * FNV-1a hash identifying a message as it is forwarded across the network.
+ * Forwarding modules assign the origin, decrement the ttl and update the CRC,
+ * so only the message's type, address and contents are included.
+ */
+uint32_t SimNetwork::frame_id(const byte *data, uint16_t length) {
+  uint32_t hash = 2166136261UL;
+  for (uint16_t i = 0; i < length; i++) {
+    if ((i < sizeof (msg_hdr_t)) &&
+        ((i < offsetof(msg_hdr_t, type)) || (i >= offsetof(msg_hdr_t, origin)))) {
+      continue;
+    }
+    hash ^= data[i];
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+void SimNetwork::schedule(sim_frame_t *frame, uint64_t arrival_us) {
+  pending.insert(std::make_pair(arrival_us, frame));
+}
+
+/*
+ * Sockets are called from within a module's loop(), as with the hardware
+ * sockets the sender is blocked until its frame has been transmitted.  The
+ * clock is advanced to then for the rest of the loop, so that the module sees
+ * the time taken, and is restored by run() once the loop returns.
+ */
+void SimNetwork::transmit(HostSocket *socket, const host_socket_hdr_t *hdr,
+                          const byte *data, void *arg) {
+  sim_endpoint_t *endpoint = (sim_endpoint_t *)arg;
+  sim_node_t *node = endpoint->node;
+
+  uint64_t now = host_clock_us();
+  uint64_t start_us = node->busy_until_us > now ? node->busy_until_us : now;
+  uint64_t end_us = endpoint->bus->transmit(endpoint, hdr, data, start_us);
+
+  if (end_us > now) {
+    node->busy_us += end_us - (node->busy_until_us > now ?
+                               node->busy_until_us : now);
+    node->busy_until_us = end_us;
+    host_clock_set_us(end_us);
+  }
+}
+
+void SimNetwork::poll() {
+  if (controller_endpoint == NULL) return;
+  hmtl_send_poll_request(&controller_socket, controller_socket.send_buffer,
+                         controller_socket.send_data_size, SOCKET_ADDR_ANY);
+}
+
+/* The controller only listens for poll responses while discovering */
+void SimNetwork::controller_arrive(sim_frame_t *frame) {
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)frame->data;
+  if (!discovering || (frame->hdr.length < HMTL_MSG_POLL_MIN_LEN) ||
+      (msg_hdr->type != MSG_TYPE_POLL) || !(msg_hdr->flags & MSG_FLAG_ACK)) {
+    return;
+  }
+
+  msg_poll_response_t *poll = (msg_poll_response_t *)(msg_hdr + 1);
+  discovered.insert(poll->config.address);
+}
+
+uint32_t SimNetwork::discover(uint8_t slots, uint8_t slot_ms,
+                              uint32_t tick_us, FILE *out,
+                              boolean by_address) {
+  if (controller_endpoint == NULL) return 0;
+
+  /* A rescan knows the range of addresses from the modules found before */
+  socket_addr_t base = 0;
+  uint8_t flags = 0;
+  if (by_address && !nodes.empty()) {
+    socket_addr_t low = nodes[0]->address;
+    socket_addr_t high = low;
+    for (unsigned int i = 1; i < nodes.size(); i++) {
+      if (nodes[i]->address < low) low = nodes[i]->address;
+      if (nodes[i]->address > high) high = nodes[i]->address;
+    }
+    if (high - low < 255) {
+      base = low;
+      slots = high - low + 1;
+      flags = HMTL_DISCOVER_BY_ADDRESS;
+    }
+  }
+
+  uint64_t start_us = host_clock_us();
+  byte known[HOST_SOCKET_MAX_FRAME];
+  memset(known, 0, sizeof (known));
+  uint8_t known_len = 0;
+  uint8_t max_known = controller_socket.send_data_size -
+                      HMTL_MSG_POLL_DISCOVER_MIN_LEN;
+
+  discovering = true;
+  discovered.clear();
+
+  fprintf(out, "%-8s %8s %8s %8s %10s\n",
+          "round", "slots", "found", "total", "time ms");
+  uint8_t empty = 0;
+  for (uint8_t round = 0; empty < SIM_DISCOVER_EMPTY_ROUNDS; round++) {
+    uint32_t before = discovered.size();
+
+    uint16_t len = hmtl_poll_discover_fmt(controller_socket.send_buffer,
+                                          controller_socket.send_data_size,
+                                          round, slots, slot_ms, base,
+                                          known, known_len,
+                                          HMTL_DISCOVER_BRIEF |
+                                          (round == 0 ? flags : 0));
+    controller_socket.sendMsgTo(SOCKET_ADDR_ANY,
+                                controller_socket.send_buffer, len);
+
+    /* Wait out the slots and the time for the last response to be relayed */
+    run(((uint64_t)slots * slot_ms + SIM_DISCOVER_MARGIN_MS) * 1000, tick_us,
+        0, 0);
+
+    uint32_t found = discovered.size() - before;
+    fprintf(out, "%-8u %8u %8u %8u %10.1f\n", round, slots, found,
+            (unsigned)discovered.size(),
+            (host_clock_us() - start_us) / 1000.0);
+    if (found == 0) {
+      empty++;
+      continue;
+    }
+    empty = 0;
+
+    for (std::set<socket_addr_t>::iterator it = discovered.begin();
+         it != discovered.end(); it++) {
+      if (*it < base) continue;
+      uint16_t bit = *it - base;
+      if (bit / 8 >= max_known) continue;
+      known[bit / 8] |= 1 << (bit % 8);
+      if (bit / 8 >= known_len) known_len = bit / 8 + 1;
+    }
+
+    /*
+     * Fewer modules remain each round, size the next from those just found.
+     * A round by address has no collisions, so only the few modules whose
+     * request or response was lost remain.
+     */
+    uint16_t next = (round == 0) && flags ? 0 : found * 2;
+    slots = next < SIM_DISCOVER_MIN_SLOTS ? SIM_DISCOVER_MIN_SLOTS :
+            (next > 255 ? 255 : next);
+  }
+
+  discovering = false;
+  return discovered.size();
+}
+
+/*
+ * Send a tracked message from the controller.  The RGB values carry a
+ * sequence number so that every injected message is unique, and its latency
+ * is measured from when it was queued.
+ */
+void SimNetwork::inject(socket_addr_t target, boolean priority,
+                        uint64_t queued_us) {
+  uint32_t seq = sequence++;
+  byte *buffer = controller_socket.send_buffer;
+  hmtl_rgb_fmt(buffer, controller_socket.send_data_size, target,
+               HOST_OUTPUT_RGB,
+               (seq >> 16) & 0xFF, (seq >> 8) & 0xFF, seq & 0xFF);
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)buffer;
+  if (priority) {
+    msg_hdr->flags |= MSG_FLAG_PRIORITY;
+    hmtl_msg_set_crc(msg_hdr);
+  }
+  uint16_t len = msg_hdr->length;
+
+  uint32_t id = frame_id(buffer, len);
+  sim_tracked_t *track = &tracked[id];
+  track->target = target;
+  track->priority = priority;
+  track->injected_us = queued_us;
+  track->hops[CONTROLLER_NODE] = 0;
+  injected++;
+
+  controller_socket.sendMsgTo(target, buffer, len);
+}
+
+void SimNetwork::arrive(sim_frame_t *frame, uint64_t now) {
+  sim_node_t *node = frame->to->node;
+
+  if (frame->corrupt) {
+    frame->to->bus->collided++;
+    return;
+  }
+
+  if (node->module == NULL) {
+    controller_arrive(frame);
+    return;
+  }
+
+  if (!frame->to->socket->deliver(frame->hdr.source, frame->hdr.dest,
+                                  frame->data, frame->hdr.length)) {
+    /* Receive queue overflow, counted by the socket */
+    return;
+  }
+  node->received++;
+
+  std::map<uint32_t, sim_tracked_t>::iterator it =
+    tracked.find(frame_id(frame->data, frame->hdr.length));
+  if (it == tracked.end()) {
+    untracked++;
+    return;
+  }
+  sim_tracked_t *track = &it->second;
+
+  stat_add(&hop_latency, now - frame->sent_us);
+
+  uint16_t receptions = ++track->receptions[node->index];
+  if (receptions > 1) {
+    duplicates++;
+    node->duplicates++;
+    return;
+  }
+
+  uint8_t hops = 1;
+  std::map<int, uint8_t>::iterator from = track->hops.find(frame->from->index);
+  if (from != track->hops.end()) hops = from->second + 1;
+  track->hops[node->index] = hops;
+  if (hops > max_hops) max_hops = hops;
+
+  if ((track->target == node->address) ||
+      (track->target == SOCKET_ADDR_ANY)) {
+    delivered++;
+    stat_add(track->priority ? &priority_latency : &delivery_latency,
+             now - track->injected_us);
+  }
+}
+
+void SimNetwork::run(uint64_t duration_us, uint32_t tick_us,
+                     uint32_t msgs_per_sec, uint8_t broadcast_percent,
+                     uint8_t priority_percent) {
+  uint64_t start_us = host_clock_us();
+  uint64_t end_us = start_us + duration_us;
+  uint64_t interval_us = msgs_per_sec ? 1000000 / msgs_per_sec : 0;
+  uint64_t next_inject_us = start_us;
+
+  while (host_clock_us() < end_us) {
+    uint64_t now = host_clock_us();
+
+    /* Controller traffic, queued by priority until its bus is free */
+    while (interval_us && controller_endpoint && (next_inject_us <= now) &&
+           !nodes.empty()) {
+      socket_addr_t target;
+      if (rand32() % 100 < broadcast_percent) {
+        target = SOCKET_ADDR_ANY;
+      } else {
+        target = nodes[rand32() % nodes.size()]->address;
+      }
+      sim_lane_t *lane = (rand32() % 100 < priority_percent) ?
+                         &send_high : &send_low;
+      lane->push_back(std::make_pair(target, next_inject_us));
+      next_inject_us += interval_us;
+    }
+
+    while ((controller.busy_until_us <= now) &&
+           (!send_high.empty() || !send_low.empty())) {
+      sim_lane_t *lane = send_high.empty() ? &send_low : &send_high;
+      inject(lane->front().first, lane == &send_high, lane->front().second);
+      lane->pop_front();
+      host_clock_set_us(now);
+    }
+
+    /* Frames that have arrived */
+    while (!pending.empty() && (pending.begin()->first <= now)) {
+      sim_frame_t *frame = pending.begin()->second;
+      pending.erase(pending.begin());
+      arrive(frame, now);
+      delete frame;
+    }
+
+    /* Modules which are not blocked transmitting run their loop */
+    for (unsigned int i = 0; i < nodes.size(); i++) {
+      if (nodes[i]->busy_until_us <= now) {
+        nodes[i]->module->loop();
+        host_clock_set_us(now);
+      }
+    }
+
+    host_clock_set_us(now + tick_us);
+  }
+
+  elapsed_us += host_clock_us() - start_us;
+}
+
+/*******************************************************************************
+ * Reporting
+ */
+
+void SimNetwork::report(FILE *out) {
+  double elapsed = elapsed_us ? (double)elapsed_us : 1.0;
+
+  fprintf(out, "Simulated %.3f s, %u modules, %u buses\n",
+          elapsed_us / 1000000.0, (unsigned)nodes.size(),
+          (unsigned)buses.size());
+
+  fprintf(out, "\n%-12s %10s %10s %8s %8s %8s %8s\n",
+          "bus", "frames", "bytes", "lost", "collided", "util%", "endpts");
+  for (unsigned int i = 0; i < buses.size(); i++) {
+    SimBus *bus = buses[i];
+    fprintf(out, "%-12s %10u %10u %8u %8u %8.1f %8u\n",
+            bus->name, bus->frames, bus->bytes, bus->lost, bus->collided,
+            100.0 * bus->busy_us / elapsed,
+            (unsigned)bus->endpoints.size());
+  }
+
+  fprintf(out, "\n%-8s %10s %10s %10s %10s %8s %8s\n",
+          "module", "received", "sent", "dups", "overflow", "backlog",
+          "busy%");
+  for (unsigned int i = 0; i < nodes.size(); i++) {
+    sim_node_t *node = nodes[i];
+    uint32_t sent = 0, overflows = 0;
+    for (byte s = 0; s < node->module->num_sockets; s++) {
+      sent += node->module->host_sockets[s].sent_msgs;
+      overflows += node->module->host_sockets[s].overflows;
+    }
+    char address[8];
+    snprintf(address, sizeof (address), "0x%02x", node->address);
+    fprintf(out, "%-8s %10u %10u %10u %10u %8u %8.1f\n",
+            address, node->received, sent, node->duplicates, overflows,
+            node->module->loop_stats.phases[LOOP_PHASE_BACKLOG].max_us,
+            100.0 * node->busy_us / elapsed);
+  }
+
+  fprintf(out, "\nTracked messages\n");
+  fprintf(out, "  %-18s %u\n", "injected", injected);
+  fprintf(out, "  %-18s %u\n", "delivered", delivered);
+  fprintf(out, "  %-18s %u\n", "duplicates", duplicates);
+  fprintf(out, "  %-18s %u\n", "max hops", max_hops);
+  fprintf(out, "  %-18s %u\n", "untracked frames", untracked);
+  fprintf(out, "  %-18s %u\n", "in flight", (unsigned)pending.size());
+  fprintf(out, "  %-18s %u\n", "unsent",
+          (unsigned)(send_high.size() + send_low.size()));
+  stat_print(out, "hop latency", &hop_latency);
+  stat_print(out, "delivery latency", &delivery_latency);
+  if (priority_latency.count) {
+    stat_print(out, "priority latency", &priority_latency);
+  }
+}
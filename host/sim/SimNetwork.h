@@ -0,0 +1,228 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * In-process network simulation of HMTL modules.
+ *
+ * Any number of HostModules are joined by virtual buses (RS485, RFM69, TCP,
+ * ...) which model bandwidth, latency and loss.  All modules share a manually
+ * advanced clock, and on every tick each module runs one iteration of its
+ * loop() as HMTL_Module does.
+ *
+ * As with the hardware sockets, sending a frame blocks the module until the
+ * frame has been transmitted, so forwarding cost shows up as time a module
+ * spends unable to run its loop.
+ *
+ * Traffic injected by the controller is tracked across every hop, so that the
+ * per-hop latency, duplicate deliveries and bus utilization of a topology can
+ * be measured before it is deployed.
+ ******************************************************************************/
+
+#ifndef SIM_NETWORK_H
+#define SIM_NETWORK_H
+
+#include <stdio.h>
+
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "Arduino.h"
+#include "HostSocket.h"
+#include "HostModule.h"
+
+class SimBus;
+class SimNetwork;
+
+/* A module or controller participating in the simulation */
+typedef struct {
+  int index;
+  HostModule *module;      // NULL for the controller
+  socket_addr_t address;
+  uint16_t num_pixels;
+
+  uint64_t busy_until_us;  // Blocked transmitting until this time
+  uint64_t busy_us;
+  uint32_t received;
+  uint32_t duplicates;
+} sim_node_t;
+
+/* A node's attachment to a bus */
+typedef struct {
+  sim_node_t *node;
+  SimBus *bus;
+  HostSocket *socket;
+} sim_endpoint_t;
+
+/* A scheduled frame arrival */
+typedef struct {
+  sim_endpoint_t *to;
+  sim_node_t *from;
+  uint64_t sent_us;
+  boolean corrupt;         // Overlapped another frame on the bus
+  host_socket_hdr_t hdr;
+  byte data[HOST_SOCKET_MAX_FRAME];
+} sim_frame_t;
+
+/*
+ * A virtual transport.  A shared bus (RS485, RFM69) carries a single frame
+ * at a time and every frame is heard by all other endpoints, while a switched
+ * bus (TCP) allows concurrent transmissions.
+ *
+ * Senders on a shared bus wait for the bus to be free unless collisions is
+ * set, as on RS485 which has no carrier sense, in which case frames that
+ * overlap are all corrupted.
+ */
+class SimBus {
+ public:
+  SimBus(SimNetwork *network, const char *name, uint32_t bandwidth,
+         uint32_t latency_us, uint16_t loss_permille, boolean shared);
+
+  /* Transmit a frame no earlier than start_us, returning its end time */
+  uint64_t transmit(sim_endpoint_t *from, const host_socket_hdr_t *hdr,
+                    const byte *data, uint64_t start_us);
+
+  char name[16];
+  uint32_t bandwidth;     // Bits per second
+  uint32_t latency_us;    // Propagation and receive delay per frame
+  uint16_t loss_permille; // Chance of each receiver losing a frame
+  boolean shared;
+  boolean collisions;
+
+  std::vector<sim_endpoint_t *> endpoints;
+
+  /* Statistics */
+  uint64_t busy_until_us;
+  uint64_t busy_us;
+  uint32_t frames;
+  uint32_t bytes;
+  uint32_t lost;
+  uint32_t collided;
+
+ private:
+  SimNetwork *network;
+
+  /* Frames of the transmissions currently on the bus, by their end time */
+  std::vector<std::pair<uint64_t, sim_frame_t *> > on_air;
+};
+
+/* State tracked for each controller-injected message */
+typedef struct {
+  socket_addr_t target;
+  boolean priority;                   // Sent with MSG_FLAG_PRIORITY
+  uint64_t injected_us;
+  std::map<int, uint8_t> hops;        // Hop count of first reception per node
+  std::map<int, uint16_t> receptions; // Number of receptions per node
+} sim_tracked_t;
+
+/* Running min/avg/max of a set of samples */
+typedef struct {
+  uint32_t count;
+  uint64_t total;
+  uint64_t min;
+  uint64_t max;
+} sim_stat_t;
+
+class SimNetwork {
+ public:
+  static const int CONTROLLER_NODE = -1;
+
+  SimNetwork(uint32_t seed = 1);
+  ~SimNetwork();
+
+  SimBus *addBus(const char *name, uint32_t bandwidth, uint32_t latency_us,
+                 uint16_t loss_permille, boolean shared);
+  SimBus *findBus(const char *name);
+
+  /* Add a module, returning its node index */
+  int addModule(socket_addr_t address, uint16_t num_pixels = 50);
+  boolean connect(int node, SimBus *bus);
+
+  /* Set the bus the controller injects traffic on */
+  boolean addController(socket_addr_t address, SimBus *bus);
+
+  /* Initialize all modules, must be called after the topology is complete */
+  void start();
+
+  /*
+   * Send a broadcast poll from the controller, as the server does to discover
+   * modules, so that the modules learn routes from the responses.
+   */
+  void poll();
+
+  /*
+   * Discover the modules with discovery polls from the controller, starting
+   * with the given number of response slots, or if by_address is set with a
+   * round of HMTL_DISCOVER_BY_ADDRESS slots over the range of the modules'
+   * addresses as a rescan would.  Each following round marks the modules
+   * found so far as known, and rounds continue until they stop finding new
+   * modules.  Requests ask for brief responses, as the server's do.
+   * Returns the number of modules found.
+   */
+  uint32_t discover(uint8_t slots, uint8_t slot_ms, uint32_t tick_us,
+                    FILE *out, boolean by_address = false);
+
+  /*
+   * Run the network for the given time, with the controller sending RGB
+   * messages at the indicated rate to random modules, or to the broadcast
+   * address for the indicated percentage of messages.  The indicated
+   * percentage of messages are sent as priority traffic, which the controller
+   * sends ahead of any bulk traffic waiting for its bus.
+   */
+  void run(uint64_t duration_us, uint32_t tick_us, uint32_t msgs_per_sec,
+           uint8_t broadcast_percent, uint8_t priority_percent = 0);
+
+  void report(FILE *out);
+
+  /* Called by buses */
+  void schedule(sim_frame_t *frame, uint64_t arrival_us);
+  uint32_t rand32();
+
+  std::vector<sim_node_t *> nodes;
+  std::vector<SimBus *> buses;
+
+ private:
+  static void transmit(HostSocket *socket, const host_socket_hdr_t *hdr,
+                       const byte *data, void *arg);
+  sim_endpoint_t *attach(sim_node_t *node, SimBus *bus, HostSocket *socket);
+  void inject(socket_addr_t target, boolean priority, uint64_t queued_us);
+  void arrive(sim_frame_t *frame, uint64_t now);
+  void controller_arrive(sim_frame_t *frame);
+  uint32_t frame_id(const byte *data, uint16_t length);
+
+  std::vector<sim_endpoint_t *> endpoints;
+  sim_node_t controller;
+  sim_endpoint_t *controller_endpoint;
+  HostSocket controller_socket;
+  byte controller_buffer[HOST_BUFFER_TOTAL(64)];
+
+  std::multimap<uint64_t, sim_frame_t *> pending;
+
+  /* Controller messages waiting for its bus, by target and time queued */
+  typedef std::deque<std::pair<socket_addr_t, uint64_t> > sim_lane_t;
+  sim_lane_t send_high;
+  sim_lane_t send_low;
+  std::map<uint32_t, sim_tracked_t> tracked;
+
+  /* Modules that have responded to the controller's discovery polls */
+  boolean discovering;
+  std::set<socket_addr_t> discovered;
+
+  uint32_t rand_state;
+  uint32_t sequence;
+  uint64_t elapsed_us;
+
+  /* Statistics */
+  sim_stat_t hop_latency;
+  sim_stat_t delivery_latency;
+  sim_stat_t priority_latency;
+  uint32_t injected;
+  uint32_t delivered;
+  uint32_t duplicates;
+  uint32_t untracked;
+  uint8_t max_hops;
+};
+
+#endif
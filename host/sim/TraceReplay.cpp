@@ -0,0 +1,419 @@
+/*******************************************************************************
+ * Author: Adam Phelps
+ * License: MIT
+ * Copyright: 2026
+ *
+ * Message trace replay.
+ *
+ * Replays a trace of the messages a module received, as dumped in response to
+ * MSG_TYPE_TRACE, into a host module at the times they were originally
+ * received, and reports the time the module spent in each loop and what it
+ * did with the messages, so that problems seen in the field can be reproduced
+ * and profiled offline.
+ *
+ * Trace files hold the records exactly as dumped, which is how HMTLClient
+ * --trace saves them and what HMTLReplay sends back to a real module.  Messages
+ * that arrived over a socket are delivered to the replay module's socket of
+ * the same index from their recorded sender, and those from the serial device
+ * are written to its Serial input.  The module's loop is run every -t us.
+ *
+ * Without a file a trace is first recorded: generated output traffic is sent
+ * to a host module for -d ms at -r msgs/sec, some of it over serial and some
+ * for another module, and the module's trace is then dumped by a trace
+ * request and written to the -o file if given.  Once replayed, the outputs of
+ * the replay module are checked against those of the recording module.
+ *
+ * Usage: TraceReplay [-f trace] [-o trace] [-a address] [-t tick us]
+ *                    [-d ms] [-r msgs/sec] [-s seed]
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Arduino.h"
+#include "HMTLMessaging.h"
+
+#include "HostModule.h"
+#include "BenchUtil.h"
+
+#define MODULE_ADDRESS     0x40
+#define MODULE_DEVICE_ID   100
+#define OTHER_ADDRESS      0x41
+#define CONTROLLER_ADDRESS 0x01
+#define NUM_PIXELS         150
+
+#define RECORD_SOCKETS     2
+#define DRAIN_MS           100   // Time run after the last message is replayed
+#define MAX_DUMP_LOOPS     10000
+
+typedef std::vector<byte> trace_t;
+
+typedef struct {
+  msg_trace_record_t record;
+  const byte *msg;
+} trace_entry_t;
+
+/* The module the trace is replayed into, and the one it may be recorded from */
+static HostModule recorder;
+static HostModule replayer;
+
+/*******************************************************************************
+ * Trace files
+ */
+
+static boolean load_trace(const char *path, trace_t *trace) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+
+  byte buffer[1024];
+  size_t count;
+  while ((count = fread(buffer, 1, sizeof (buffer), file)) > 0) {
+    trace->insert(trace->end(), buffer, buffer + count);
+  }
+  fclose(file);
+  return true;
+}
+
+static boolean save_trace(const char *path, const trace_t *trace) {
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+
+  size_t count = fwrite(trace->data(), 1, trace->size(), file);
+  fclose(file);
+  return (count == trace->size());
+}
+
+/* Split a trace into its records, returns false if it is truncated */
+static boolean parse_trace(const trace_t *trace,
+                           std::vector<trace_entry_t> *entries) {
+  size_t offset = 0;
+  while (offset + sizeof (msg_trace_record_t) <= trace->size()) {
+    trace_entry_t entry;
+    memcpy(&entry.record, &(*trace)[offset], sizeof (entry.record));
+    offset += sizeof (entry.record);
+
+    if ((entry.record.length < sizeof (msg_hdr_t)) ||
+        (offset + entry.record.length > trace->size())) {
+      break;
+    }
+    entry.msg = &(*trace)[offset];
+    offset += entry.record.length;
+
+    entries->push_back(entry);
+  }
+
+  return (offset == trace->size());
+}
+
+/*******************************************************************************
+ * Recording
+ */
+
+typedef struct {
+  trace_t trace;
+  boolean complete;
+} trace_dump_t;
+
+/* Reassemble the pages of a trace dump sent by the recording module */
+static void collect_page(HostSocket *socket, const host_socket_hdr_t *hdr,
+                         const byte *data, void *arg) {
+  trace_dump_t *dump = (trace_dump_t *)arg;
+  msg_hdr_t *msg_hdr = (msg_hdr_t *)data;
+
+  msg_trace_response_t *page = hmtl_msg_view<msg_trace_response_t>(msg_hdr);
+  if ((page == NULL) || !(msg_hdr->flags & MSG_FLAG_ACK)) {
+    return;
+  }
+
+  uint16_t datalen = hmtl_msg_length(msg_hdr) - HMTL_MSG_TRACE_MIN_LEN;
+  dump->trace.resize(page->length);
+  if (page->offset + datalen <= page->length) {
+    memcpy(&dump->trace[page->offset], page->data, datalen);
+  }
+
+  if (!(msg_hdr->flags & MSG_FLAG_MORE_DATA)) {
+    dump->complete = true;
+  }
+}
+
+/* Send one of the generated messages to the recording module */
+static void send_generated(socket_addr_t address) {
+  byte buffer[HMTL_MSG_RGB_LEN];
+  long choice = random(100);
+
+  socket_addr_t dest = address;
+  if (choice < 10) {
+    dest = OTHER_ADDRESS;
+  } else if (choice < 20) {
+    dest = SOCKET_ADDR_ANY;
+  }
+
+  uint16_t len;
+  if (random(2)) {
+    len = hmtl_value_fmt(buffer, sizeof (buffer), dest, HOST_OUTPUT_VALUE,
+                         random(256));
+  } else {
+    len = hmtl_rgb_fmt(buffer, sizeof (buffer), dest, HOST_OUTPUT_RGB,
+                       random(256), random(256), random(256));
+  }
+
+  if (choice >= 90) {
+    Serial.inject(buffer, len);
+  } else {
+    recorder.host_sockets[0].deliver(CONTROLLER_ADDRESS, dest, buffer, len);
+  }
+}
+
+/*
+ * Run generated traffic through the recording module and dump its trace,
+ * returns false if the dump didn't complete.
+ */
+static boolean record_trace(socket_addr_t address, uint32_t duration_ms,
+                            uint32_t msgs_per_sec, uint32_t tick_us,
+                            trace_t *trace) {
+  for (byte i = 0; i < RECORD_SOCKETS; i++) {
+    recorder.addSocket();
+  }
+  recorder.setup(address, MODULE_DEVICE_ID, NUM_PIXELS);
+
+  trace_dump_t dump;
+  dump.complete = false;
+  recorder.host_sockets[0].setTransmit(collect_page, &dump);
+
+  uint64_t start_us = host_clock_us();
+  uint64_t end_us = start_us + (uint64_t)duration_ms * 1000;
+  uint64_t next_us = start_us;
+  while (host_clock_us() < end_us) {
+    if (msgs_per_sec && (host_clock_us() >= next_us)) {
+      send_generated(address);
+      next_us += random(2 * 1000000 / msgs_per_sec) + 1;
+    }
+    recorder.loop();
+    host_clock_advance_us(tick_us);
+  }
+
+  byte request[HMTL_MSG_TRACE_REQUEST_LEN];
+  uint16_t len = hmtl_trace_request_fmt(request, sizeof (request), address,
+                                        0, 0, 0);
+  recorder.host_sockets[0].deliver(CONTROLLER_ADDRESS, address, request, len);
+  for (uint32_t i = 0; (i < MAX_DUMP_LOOPS) && !dump.complete; i++) {
+    recorder.loop();
+    host_clock_advance_us(tick_us);
+  }
+
+  *trace = dump.trace;
+  return dump.complete;
+}
+
+/*******************************************************************************
+ * Replay
+ */
+
+typedef struct {
+  uint32_t serial;
+  uint32_t socket[HostModule::MAX_SOCKETS];
+  uint32_t skipped;       // Messages from sockets the replay module lacks
+  uint32_t loops;
+  uint64_t loop_ns;
+  uint64_t max_loop_ns;
+  uint32_t max_loop_ms;   // Trace time of the slowest loop
+  uint32_t transmitted;
+} replay_stats_t;
+
+static void count_transmit(HostSocket *socket, const host_socket_hdr_t *hdr,
+                           const byte *data, void *arg) {
+  ((replay_stats_t *)arg)->transmitted++;
+}
+
+static void deliver_entry(const trace_entry_t *entry, replay_stats_t *stats) {
+  if (entry->record.source == HMTL_TRACE_SERIAL) {
+    Serial.inject(entry->msg, entry->record.length);
+    stats->serial++;
+  } else if (entry->record.source < replayer.num_sockets) {
+    replayer.host_sockets[entry->record.source].deliver(
+            entry->record.sender, ((msg_hdr_t *)entry->msg)->address,
+            entry->msg, entry->record.length);
+    stats->socket[entry->record.source]++;
+  } else {
+    stats->skipped++;
+  }
+}
+
+/*
+ * Deliver each message to the replay module once the time since the first
+ * has reached that between them when recorded, running the module's loop
+ * every tick until shortly after the last.
+ */
+static void replay_trace(socket_addr_t address,
+                         const std::vector<trace_entry_t> *entries,
+                         uint32_t tick_us, replay_stats_t *stats) {
+  memset(stats, 0, sizeof (*stats));
+
+  uint8_t num_sockets = 1;
+  for (size_t i = 0; i < entries->size(); i++) {
+    uint8_t source = (*entries)[i].record.source;
+    if ((source != HMTL_TRACE_SERIAL) && (source >= num_sockets)) {
+      num_sockets = source + 1;
+    }
+  }
+  if (num_sockets > HostModule::MAX_SOCKETS) {
+    num_sockets = HostModule::MAX_SOCKETS;
+  }
+
+  for (byte i = 0; i < num_sockets; i++) {
+    replayer.addSocket()->setTransmit(count_transmit, stats);
+  }
+  replayer.setup(address, MODULE_DEVICE_ID, NUM_PIXELS);
+  Serial.reset();
+
+  /* Start the clock at the recorded time, as the module's would have been */
+  uint32_t first_ms = entries->empty() ? 0 : (*entries)[0].record.ms;
+  uint32_t last_ms = entries->empty() ? 0 : entries->back().record.ms;
+  uint64_t start_us = (uint64_t)first_ms * 1000;
+  host_clock_set_us(start_us);
+
+  size_t next = 0;
+  uint64_t end_us = (uint64_t)(last_ms - first_ms + DRAIN_MS) * 1000;
+  for (uint64_t elapsed_us = 0; elapsed_us <= end_us; elapsed_us += tick_us) {
+    while ((next < entries->size()) &&
+           ((uint64_t)((*entries)[next].record.ms - first_ms) * 1000 <=
+            elapsed_us)) {
+      deliver_entry(&(*entries)[next], stats);
+      next++;
+    }
+
+    uint64_t loop_start = bench_now_ns();
+    replayer.loop();
+    uint64_t loop_ns = bench_now_ns() - loop_start;
+
+    stats->loops++;
+    stats->loop_ns += loop_ns;
+    if (loop_ns > stats->max_loop_ns) {
+      stats->max_loop_ns = loop_ns;
+      stats->max_loop_ms = first_ms + (uint32_t)(elapsed_us / 1000);
+    }
+
+    host_clock_set_us(start_us + elapsed_us + tick_us);
+  }
+}
+
+static void report(FILE *out, const std::vector<trace_entry_t> *entries,
+                   const replay_stats_t *stats) {
+  uint32_t span_ms = entries->empty() ? 0 :
+                     entries->back().record.ms - (*entries)[0].record.ms;
+  fprintf(out, "Replayed %u messages over %u ms\n",
+          (unsigned)entries->size(), span_ms);
+  fprintf(out, "  %-18s %u\n", "serial", stats->serial);
+  for (byte i = 0; i < replayer.num_sockets; i++) {
+    fprintf(out, "  socket %-11u %u\n", i, stats->socket[i]);
+  }
+  if (stats->skipped) {
+    fprintf(out, "  %-18s %u\n", "skipped", stats->skipped);
+  }
+  fprintf(out, "  %-18s %u\n", "transmitted", stats->transmitted);
+
+  MessageHandler *handler = &replayer.handler;
+  fprintf(out, "  %-18s %u\n", "low queued", handler->low_queued);
+  fprintf(out, "  %-18s %u\n", "coalesced", handler->coalesced);
+  fprintf(out, "  %-18s %u\n", "hop limited", handler->hop_limited);
+  fprintf(out, "  %-18s %u\n", "budget overruns", handler->budget_overruns);
+  fprintf(out, "  %-18s %u\n", "reassembled", handler->reassembled);
+  fprintf(out, "  %-18s %u\n", "retransmitted", handler->retransmitted);
+
+  fprintf(out, "\nLoops: %u\n", stats->loops);
+  fprintf(out, "  %-18s %.1f\n", "avg ns",
+          stats->loops ? (double)stats->loop_ns / stats->loops : 0.0);
+  fprintf(out, "  %-18s %llu at %u ms\n", "max ns",
+          (unsigned long long)stats->max_loop_ns, stats->max_loop_ms);
+}
+
+/* Returns true if the replay module's outputs are those of the recorder */
+static boolean check_outputs(FILE *out) {
+  config_value_t *value[2];
+  config_rgb_t *rgb[2];
+  HostModule *modules[2] = { &recorder, &replayer };
+  for (byte i = 0; i < 2; i++) {
+    value[i] = (config_value_t *)modules[i]->outputs[HOST_OUTPUT_VALUE];
+    rgb[i] = (config_rgb_t *)modules[i]->outputs[HOST_OUTPUT_RGB];
+  }
+
+  boolean match = (value[0]->value == value[1]->value) &&
+                  (memcmp(rgb[0]->values, rgb[1]->values, 3) == 0);
+  fprintf(out, "\nOutputs %s the recording module: value %u rgb %u,%u,%u\n",
+          match ? "match" : "differ from", value[1]->value,
+          rgb[1]->values[0], rgb[1]->values[1], rgb[1]->values[2]);
+  return match;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-f trace] [-o trace] [-a address] "
+          "[-t tick us] [-d ms] [-r msgs/sec] [-s seed]\n", name);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *trace_path = NULL;
+  const char *output_path = NULL;
+  socket_addr_t address = MODULE_ADDRESS;
+  uint32_t tick_us = 1000;
+  uint32_t duration_ms = 2000;
+  uint32_t msgs_per_sec = 200;
+  uint32_t seed = 1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "f:o:a:t:d:r:s:h")) != -1) {
+    switch (opt) {
+      case 'f': trace_path = optarg; break;
+      case 'o': output_path = optarg; break;
+      case 'a': address = strtoul(optarg, NULL, 0); break;
+      case 't': tick_us = strtoul(optarg, NULL, 0); break;
+      case 'd': duration_ms = strtoul(optarg, NULL, 0); break;
+      case 'r': msgs_per_sec = strtoul(optarg, NULL, 0); break;
+      case 's': seed = strtoul(optarg, NULL, 0); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (tick_us == 0) usage(argv[0]);
+
+  randomSeed(seed);
+  host_clock_manual(true);
+
+  trace_t trace;
+  if (trace_path) {
+    if (!load_trace(trace_path, &trace)) return 1;
+  } else {
+    if (!record_trace(address, duration_ms, msgs_per_sec, tick_us, &trace)) {
+      fprintf(stderr, "Trace dump did not complete\n");
+      return 1;
+    }
+    printf("Recorded %u bytes of trace, %u messages not recorded\n\n",
+           (unsigned)trace.size(), recorder.handler.untraced);
+  }
+
+  if (output_path && !save_trace(output_path, &trace)) return 1;
+
+  std::vector<trace_entry_t> entries;
+  if (!parse_trace(&trace, &entries)) {
+    fprintf(stderr, "Trace is truncated after %u messages\n",
+            (unsigned)entries.size());
+  }
+
+  replay_stats_t stats;
+  replay_trace(address, &entries, tick_us, &stats);
+  report(stdout, &entries, &stats);
+
+  if (!trace_path && !check_outputs(stdout)) {
+    return 1;
+  }
+
+  return 0;
+}
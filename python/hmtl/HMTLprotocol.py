@@ -25,20 +25,49 @@ HMTL_TERMINATOR    = b'\xfe\xfe\xfe\xfe' # Indicates end of command
 #
 # HMTL Message formats
 #
-MSG_HDR_FMT = "<BBBBBBH" # All HMTL messages start with this
+MSG_HDR_FMT = "<BBBBBBHHBB" # All HMTL messages start with this
+MSG_PROTOCOL_VERSION = 3
+
+# Header version of messages longer than 255 bytes, whose ttl holds the high
+# byte of the length.  These are only sent as fragments.
+MSG_PROTOCOL_VERSION_LONG = 4
+
+# Origin of messages that haven't yet entered the network, the first module to
+# receive them assigns it and a sequence number
+MSG_ORIGIN_NONE = 0xFFFE
+
+# Number of times a message may be forwarded between modules
+MSG_DEFAULT_TTL = 8
 
 # Msg type
 MSG_TYPE_OUTPUT   = 1
 MSG_TYPE_POLL     = 2
 MSG_TYPE_SET_ADDR = 3
+MSG_TYPE_STATS    = 6
+MSG_TYPE_BATCH    = 7
+MSG_TYPE_PIXEL_FRAME = 8
+MSG_TYPE_FRAGMENT = 9
+MSG_TYPE_GROUPS   = 0x0A
+MSG_TYPE_DELIVERED = 0x0B
 MSG_TYPE_DUMPCONFIG = 0xE0
+MSG_TYPE_TRACE    = 0xE1
+
+# Broadcasts of message types from this one on are not forwarded
+MSG_TYPE_DONT_FORWARD = 0xE0
 
 # Mapping of message types to strings
 MSG_TYPES = {
     MSG_TYPE_OUTPUT: "OUTPUT",
     MSG_TYPE_POLL: "POLL",
     MSG_TYPE_SET_ADDR: "SETADDR",
+    MSG_TYPE_STATS: "STATS",
+    MSG_TYPE_BATCH: "BATCH",
+    MSG_TYPE_PIXEL_FRAME: "PIXELFRAME",
+    MSG_TYPE_FRAGMENT: "FRAGMENT",
+    MSG_TYPE_GROUPS: "GROUPS",
+    MSG_TYPE_DELIVERED: "DELIVERED",
     MSG_TYPE_DUMPCONFIG: "DUMPCONFIG",
+    MSG_TYPE_TRACE: "TRACE",
 }
 
 # Msg flags
@@ -46,6 +75,9 @@ MSG_FLAG_ACK       = (1 << 0)
 MSG_FLAG_RESPONSE  = (1 << 1)
 MSG_FLAG_MORE_DATA = (1 << 2)
 MSG_FLAG_ERROR     = (1 << 3)
+MSG_FLAG_PRIORITY  = (1 << 4)
+MSG_FLAG_RELIABLE  = (1 << 5)
+MSG_FLAG_RETRY     = (3 << 6)  # Retransmission count of a reliable message
 
 # Mapping of message flags to strings
 MSG_FLAGS = {
@@ -53,13 +85,17 @@ MSG_FLAGS = {
     MSG_FLAG_RESPONSE: "RESPONSE",
     MSG_FLAG_MORE_DATA: "MORE_DATA",
     MSG_FLAG_ERROR: "ERROR",
+    MSG_FLAG_PRIORITY: "PRIORITY",
+    MSG_FLAG_RELIABLE: "RELIABLE",
+    (1 << 6): "RETRY1",
+    (1 << 7): "RETRY2",
 }
 
 MSG_VALUE_FMT = "H"
 MSG_RGB_FMT = "BBB"
 MSG_PROGRAM_FMT = "B"
 
-MSG_BASE_LEN = 8
+MSG_BASE_LEN = 12
 MSG_OUTPUT_LEN = MSG_BASE_LEN + 2
 MSG_VALUE_LEN = MSG_OUTPUT_LEN + 2
 MSG_RGB_LEN = MSG_OUTPUT_LEN + 3
@@ -68,7 +104,51 @@ MSG_PROGRAM_VALUE_LEN = 12
 MSG_PROGRAM_LEN = MSG_OUTPUT_LEN + 1 + MSG_PROGRAM_VALUE_LEN
 
 MSG_POLL_LEN = MSG_BASE_LEN
-MSG_DUMPCONFIG_LEN = MSG_BASE_LEN
+MSG_POLL_OUTPUTS_FMT = "<BB"
+MSG_POLL_OUTPUT_FMT = "<BBH"
+MSG_POLL_DISCOVER_FMT = "<BBBBH"
+MSG_POLL_DISCOVER_LEN = MSG_BASE_LEN + 6
+MSG_DUMPCONFIG_FMT = "<HBB"
+MSG_DUMPCONFIG_LEN = MSG_BASE_LEN + 4
+MSG_DUMPCONFIG_PAGE_FMT = "<HH"
+MSG_TRACE_FMT = "<HBB"
+MSG_TRACE_LEN = MSG_BASE_LEN + 4
+MSG_TRACE_PAGE_FMT = "<HH"
+MSG_STATS_LEN = MSG_BASE_LEN + 1
+MSG_BATCH_MAX_LEN = 64
+MSG_PIXEL_FRAME_FMT = "<BBHBB"
+MSG_PIXEL_FRAME_MIN_LEN = MSG_BASE_LEN + 6
+MSG_FRAGMENT_FMT = "<HBBHH"
+MSG_FRAGMENT_MIN_LEN = MSG_BASE_LEN + 8
+
+# Pixel frame encodings
+PIXEL_FRAME_RAW   = 0
+PIXEL_FRAME_RLE   = 1
+PIXEL_FRAME_DELTA = 2
+
+# Largest known bitmap in a discovery request that fits a 64 byte buffer
+DISCOVER_MAX_KNOWN = 64 - MSG_POLL_DISCOVER_LEN
+
+# Discovery request flags
+DISCOVER_BY_ADDRESS = (1 << 0) # Slot is the address's offset from known_base
+DISCOVER_BRIEF      = (1 << 1) # Respond without output descriptors
+
+# Stats request flags
+STATS_RESET = (1 << 0)
+
+# Trace request controls
+TRACE_HOLD  = (1 << 0)  # Leave recording stopped after the dump
+TRACE_CLEAR = (1 << 1)  # Empty the trace after the dump
+
+# Each trace record is its time, length, source socket and sender, followed by
+# the message.  Messages from the serial device have a source of TRACE_SERIAL.
+TRACE_RECORD_FMT = "<IHBH"
+TRACE_SERIAL = 0xFF
+
+# Phases of a module's loop reported by a stats message.  The backlog phase
+# counts messages handled by each check rather than microseconds.
+LOOP_PHASES = ["check", "additional", "programs", "outputs", "total",
+               "backlog"]
 
 # Broadcast address
 BROADCAST = 65535  # = (uint16_t)-1
@@ -106,17 +186,122 @@ MODULE_TYPES = {
 # HMTL Message types
 #
 
-def get_msg_hdr(msglen, address, mtype=MSG_TYPE_OUTPUT, flags=0):
+def get_msg_hdr(msglen, address, mtype=MSG_TYPE_OUTPUT, flags=0,
+                ttl=MSG_DEFAULT_TTL):
+    version = MSG_PROTOCOL_VERSION
+    if msglen > 0xFF:
+        # Must be sent with get_fragment_msgs()
+        version = MSG_PROTOCOL_VERSION_LONG
+        ttl = msglen >> 8
+        msglen &= 0xFF
     packed = struct.pack(MSG_HDR_FMT,
                          0xFC,   # Startcode
-                         0,      # CRC - XXX: TODO!
-                         2,      # Protocol version
+                         0,      # CRC, set by set_msg_crc()
+                         version, # Protocol version
                          msglen, # Message length
                          mtype,  # Type: 1 is OUTPUT, 2 POLL, 3 is SETADDR
                          flags,  # flags
-                         address)  # Destination address 65535 is "Any"
+                         address, # Destination address 65535 is "Any"
+                         MSG_ORIGIN_NONE, # Origin, assigned by the module
+                         0,      # Sequence, assigned by the module
+                         ttl)    # Remaining hops
     return packed
 
+# CRC-8 with reflected polynomial 0x8C, as computed by the modules
+CRC_TABLE = [
+    0x00, 0x5e, 0xbc, 0xe2, 0x61, 0x3f, 0xdd, 0x83, 0xc2, 0x9c, 0x7e, 0x20,
+    0xa3, 0xfd, 0x1f, 0x41, 0x9d, 0xc3, 0x21, 0x7f, 0xfc, 0xa2, 0x40, 0x1e,
+    0x5f, 0x01, 0xe3, 0xbd, 0x3e, 0x60, 0x82, 0xdc, 0x23, 0x7d, 0x9f, 0xc1,
+    0x42, 0x1c, 0xfe, 0xa0, 0xe1, 0xbf, 0x5d, 0x03, 0x80, 0xde, 0x3c, 0x62,
+    0xbe, 0xe0, 0x02, 0x5c, 0xdf, 0x81, 0x63, 0x3d, 0x7c, 0x22, 0xc0, 0x9e,
+    0x1d, 0x43, 0xa1, 0xff, 0x46, 0x18, 0xfa, 0xa4, 0x27, 0x79, 0x9b, 0xc5,
+    0x84, 0xda, 0x38, 0x66, 0xe5, 0xbb, 0x59, 0x07, 0xdb, 0x85, 0x67, 0x39,
+    0xba, 0xe4, 0x06, 0x58, 0x19, 0x47, 0xa5, 0xfb, 0x78, 0x26, 0xc4, 0x9a,
+    0x65, 0x3b, 0xd9, 0x87, 0x04, 0x5a, 0xb8, 0xe6, 0xa7, 0xf9, 0x1b, 0x45,
+    0xc6, 0x98, 0x7a, 0x24, 0xf8, 0xa6, 0x44, 0x1a, 0x99, 0xc7, 0x25, 0x7b,
+    0x3a, 0x64, 0x86, 0xd8, 0x5b, 0x05, 0xe7, 0xb9, 0x8c, 0xd2, 0x30, 0x6e,
+    0xed, 0xb3, 0x51, 0x0f, 0x4e, 0x10, 0xf2, 0xac, 0x2f, 0x71, 0x93, 0xcd,
+    0x11, 0x4f, 0xad, 0xf3, 0x70, 0x2e, 0xcc, 0x92, 0xd3, 0x8d, 0x6f, 0x31,
+    0xb2, 0xec, 0x0e, 0x50, 0xaf, 0xf1, 0x13, 0x4d, 0xce, 0x90, 0x72, 0x2c,
+    0x6d, 0x33, 0xd1, 0x8f, 0x0c, 0x52, 0xb0, 0xee, 0x32, 0x6c, 0x8e, 0xd0,
+    0x53, 0x0d, 0xef, 0xb1, 0xf0, 0xae, 0x4c, 0x12, 0x91, 0xcf, 0x2d, 0x73,
+    0xca, 0x94, 0x76, 0x28, 0xab, 0xf5, 0x17, 0x49, 0x08, 0x56, 0xb4, 0xea,
+    0x69, 0x37, 0xd5, 0x8b, 0x57, 0x09, 0xeb, 0xb5, 0x36, 0x68, 0x8a, 0xd4,
+    0x95, 0xcb, 0x29, 0x77, 0xf4, 0xaa, 0x48, 0x16, 0xe9, 0xb7, 0x55, 0x0b,
+    0x88, 0xd6, 0x34, 0x6a, 0x2b, 0x75, 0x97, 0xc9, 0x4a, 0x14, 0xf6, 0xa8,
+    0x74, 0x2a, 0xc8, 0x96, 0x15, 0x4b, 0xa9, 0xf7, 0xb6, 0xe8, 0x0a, 0x54,
+    0xd7, 0x89, 0x6b, 0x35
+]
+
+def get_msg_length(msg):
+    """Return a message's length from its header"""
+    data = bytearray(msg)
+    if data[2] == MSG_PROTOCOL_VERSION_LONG:
+        return data[3] | (data[11] << 8)
+    return data[3]
+
+def get_msg_crc(msg):
+    """Compute the CRC of a message, with its CRC field treated as zero"""
+    data = bytearray(msg)
+    crc = CRC_TABLE[data[0]]
+    crc = CRC_TABLE[crc]
+    for val in data[2:get_msg_length(data)]:
+        crc = CRC_TABLE[crc ^ val]
+    return crc
+
+def set_msg_crc(msg):
+    """
+    Return the message with its CRC set.  Modules drop messages with an
+    invalid CRC, so this must be applied to a message once it is complete.
+    Data that isn't a HMTL message is returned unchanged.
+    """
+    data = bytearray(msg)
+    if ((len(data) < MSG_BASE_LEN) or (data[0] != 0xFC) or
+            (get_msg_length(data) != len(data))):
+        return msg
+    data[1] = get_msg_crc(data)
+    return bytes(data)
+
+# Sequence numbers identifying the fragments of each message sent
+_fragment_sequence = [0]
+
+def get_fragment_msgs(msg, msg_version, max_len=MSG_BATCH_MAX_LEN):
+    """
+    Split a message into fragments no longer than max_len, which the module
+    it is addressed to puts back together.  Messages that already fit are
+    returned as is.  The message's CRC must already be set.  The msg_version
+    is that of the module's poll response, a module that doesn't advertise
+    MSG_PROTOCOL_VERSION_LONG won't reassemble fragments so a ValueError is
+    raised and the caller must send the message some other way.
+    """
+    if len(msg) <= max_len:
+        return [msg]
+    if msg_version < MSG_PROTOCOL_VERSION_LONG:
+        raise ValueError("Module doesn't reassemble %d byte messages" %
+                         len(msg))
+
+    (address, origin) = struct.unpack_from("<HH", msg, 6)
+    flags = bytearray(msg)[5] & MSG_FLAG_PRIORITY
+    sequence = _fragment_sequence[0]
+    _fragment_sequence[0] = (sequence + 1) & 0xFF
+
+    # Fragments of broadcasts that aren't forwarded mustn't be either
+    ttl = MSG_DEFAULT_TTL
+    if (address == BROADCAST) and (bytearray(msg)[4] >= MSG_TYPE_DONT_FORWARD):
+        ttl = 0
+
+    max_data = max_len - MSG_FRAGMENT_MIN_LEN
+    msgs = []
+    for offset in range(0, len(msg), max_data):
+        data = msg[offset:offset + max_data]
+        msgs.append(set_msg_crc(
+            get_msg_hdr(MSG_FRAGMENT_MIN_LEN + len(data), address,
+                        mtype=MSG_TYPE_FRAGMENT, flags=flags, ttl=ttl) +
+            struct.pack(MSG_FRAGMENT_FMT, origin, sequence, 0, len(msg),
+                        offset) +
+            data))
+    return msgs
+
 def get_output_hdr(otype, output):
     packed = struct.pack(OUTPUT_HDR_FMT,
                          CONFIG_TYPES[otype], # Message type 
@@ -139,6 +324,173 @@ def get_rgb_msg(address, output, r, g, b):
     return packed_hdr + packed_out + packed
 
 
+def get_batch_msg(address, msgs):
+    """
+    Combine output messages (as from get_rgb_msg(), get_value_msg(), etc) into
+    a single batch message, each message's header is replaced by a length byte.
+    """
+    records = b''
+    for msg in msgs:
+        output = msg[MSG_BASE_LEN:]
+        records += struct.pack("<B", len(output)) + output
+
+    msglen = MSG_BASE_LEN + len(records)
+    if (msglen > MSG_BATCH_MAX_LEN):
+        raise Exception("Batch of %d bytes exceeds max of %d" %
+                        (msglen, MSG_BATCH_MAX_LEN))
+
+    return get_msg_hdr(msglen, address, mtype=MSG_TYPE_BATCH) + records
+
+
+def _pixel_frame_raw(pixels, max_data):
+    """Split pixels into (offset, data) chunks of raw RGB values"""
+    per_msg = max_data // 3
+    chunks = []
+    for offset in range(0, max(len(pixels), 1), per_msg):
+        run = pixels[offset:offset + per_msg]
+        chunks.append((offset,
+                       b''.join(struct.pack("BBB", *rgb) for rgb in run)))
+    return chunks
+
+
+def _pixel_frame_rle(pixels, max_data):
+    """Split pixels into (offset, data) chunks of single color runs"""
+    chunks = []
+    offset = 0
+    data = b''
+    i = 0
+    while i < len(pixels):
+        j = i
+        while (j < len(pixels)) and (j - i < 255) and (pixels[j] == pixels[i]):
+            j += 1
+        if len(data) + 4 > max_data:
+            chunks.append((offset, data))
+            offset = i
+            data = b''
+        data += struct.pack("BBBB", j - i, *pixels[i])
+        i = j
+    chunks.append((offset, data))
+    return chunks
+
+
+def _pixel_frame_delta(pixels, previous, max_data):
+    """Split pixels into (offset, data) chunks of spans changed from previous"""
+    chunks = []
+    offset = 0
+    data = b''
+    i = 0 # Pixel following the end of the current chunk's data
+    n = len(pixels)
+    while True:
+        j = i
+        while (j < n) and (pixels[j] == previous[j]):
+            j += 1
+        if j >= n:
+            break
+        k = j
+        while (k < n) and (pixels[k] != previous[k]):
+            k += 1
+
+        while j < k:
+            if len(data) + 5 > max_data:
+                chunks.append((offset, data))
+                offset = i
+                data = b''
+            if j - i > 255:
+                # Skip as far as possible with an empty span
+                data += struct.pack("BB", 255, 0)
+                i += 255
+                continue
+            count = min(k - j, 255, (max_data - len(data) - 2) // 3)
+            data += struct.pack("BB", j - i, count)
+            data += b''.join(struct.pack("BBB", *rgb)
+                             for rgb in pixels[j:j + count])
+            i = j + count
+            j = i
+    chunks.append((offset, data))
+    return chunks
+
+
+def _pixel_frame_len(chunks):
+    return sum(MSG_PIXEL_FRAME_MIN_LEN + len(data) for (offset, data) in chunks)
+
+
+def get_pixel_frame_msgs(address, output, frame, pixels, max_len=64,
+                         encoding=PIXEL_FRAME_RAW, previous=None):
+    """
+    Split a frame of (r, g, b) pixel values into the messages needed to send
+    it, each no longer than max_len.  The frame id should differ from that of
+    the previous frame sent to the output.  A delta encoding is relative to
+    previous, which must be the last frame sent as frame - 1.
+    """
+    max_data = max_len - MSG_PIXEL_FRAME_MIN_LEN
+    if encoding == PIXEL_FRAME_RLE:
+        chunks = _pixel_frame_rle(pixels, max_data)
+    elif encoding == PIXEL_FRAME_DELTA:
+        chunks = _pixel_frame_delta(pixels, previous, max_data)
+    else:
+        chunks = _pixel_frame_raw(pixels, max_data)
+    return _pixel_frame_msgs(address, output, frame, encoding, chunks)
+
+
+def _pixel_frame_msgs(address, output, frame, encoding, chunks):
+    msgs = []
+    for (i, (offset, data)) in enumerate(chunks):
+        more = (i < len(chunks) - 1)
+        msgs.append(get_msg_hdr(MSG_PIXEL_FRAME_MIN_LEN + len(data), address,
+                                mtype=MSG_TYPE_PIXEL_FRAME,
+                                flags=MSG_FLAG_MORE_DATA if more else 0) +
+                    struct.pack(MSG_PIXEL_FRAME_FMT, output, frame & 0xFF,
+                                offset, encoding, (frame - 1) & 0xFF) +
+                    data)
+    return msgs
+
+
+class PixelFrameEncoder(object):
+    """
+    Encodes successive frames for a pixel output, choosing the encoding that
+    results in the fewest bytes for each.  As a module ignores delta frames
+    when it missed the frame they're relative to, a full frame is sent at
+    least every keyframe_interval frames.
+    """
+    def __init__(self, address, output, max_len=64, keyframe_interval=30):
+        self.address = address
+        self.output = output
+        self.max_data = max_len - MSG_PIXEL_FRAME_MIN_LEN
+        self.keyframe_interval = keyframe_interval
+
+        self.frame = 0
+        self.previous = None
+        self.since_keyframe = 0
+        self.last_encoding = None
+
+    def encode(self, pixels):
+        """Return the messages for the next frame"""
+        candidates = [
+            (PIXEL_FRAME_RAW, _pixel_frame_raw(pixels, self.max_data)),
+            (PIXEL_FRAME_RLE, _pixel_frame_rle(pixels, self.max_data)),
+        ]
+        if ((self.previous is not None) and
+                (len(self.previous) == len(pixels)) and
+                (self.since_keyframe < self.keyframe_interval)):
+            candidates.append(
+                (PIXEL_FRAME_DELTA,
+                 _pixel_frame_delta(pixels, self.previous, self.max_data)))
+
+        (encoding, chunks) = min(candidates,
+                                 key=lambda c: _pixel_frame_len(c[1]))
+
+        self.frame = (self.frame + 1) & 0xFF
+        if encoding == PIXEL_FRAME_DELTA:
+            self.since_keyframe += 1
+        else:
+            self.since_keyframe = 0
+        self.previous = list(pixels)
+        self.last_encoding = encoding
+
+        return _pixel_frame_msgs(self.address, self.output, self.frame,
+                                 encoding, chunks)
+
+
 def get_poll_msg(address):
     packed_hdr = get_msg_hdr(MSG_POLL_LEN, address,
                              mtype=MSG_TYPE_POLL,
@@ -147,12 +499,84 @@ def get_poll_msg(address):
     return packed_hdr
 
 
-def get_dumpconfig_msg(address):
+def get_discover_msg(nonce, slots, slot_ms, known=(), known_base=0, flags=0):
+    """
+    Broadcast poll in discovery mode, modules respond in one of slots slots
+    of slot_ms picked from their address and the nonce, or with
+    DISCOVER_BY_ADDRESS from their address's offset from known_base, and
+    modules whose address is in known don't respond.
+    """
+    bitmap = bytearray()
+    for address in known:
+        bit = address - known_base
+        if (bit < 0) or (bit // 8 >= DISCOVER_MAX_KNOWN):
+            continue
+        if bit // 8 >= len(bitmap):
+            bitmap.extend([0] * (bit // 8 + 1 - len(bitmap)))
+        bitmap[bit // 8] |= 1 << (bit % 8)
+
+    packed_hdr = get_msg_hdr(MSG_POLL_DISCOVER_LEN + len(bitmap), BROADCAST,
+                             mtype=MSG_TYPE_POLL,
+                             flags=MSG_FLAG_RESPONSE)
+    packed_req = struct.pack(MSG_POLL_DISCOVER_FMT, nonce & 0xFF, slots,
+                             slot_ms, flags, known_base)
+
+    return packed_hdr + packed_req + bytes(bitmap)
+
+
+def get_dumpconfig_msg(address, offset=0, pages=0):
+    """
+    Request the module's configuration, one EEPROM object per response.  An
+    offset of 0 starts from the beginning of the configuration and pages of 0
+    returns all remaining objects.
+    """
     packed_hdr = get_msg_hdr(MSG_DUMPCONFIG_LEN, address,
                              mtype=MSG_TYPE_DUMPCONFIG,
                              flags=MSG_FLAG_RESPONSE)
+    packed_req = struct.pack(MSG_DUMPCONFIG_FMT, offset, pages, 0)
+
+    return packed_hdr + packed_req
 
-    return packed_hdr
+
+def get_trace_msg(address, offset=0, pages=0, control=0):
+    """
+    Request the module's trace of received messages, starting from the given
+    offset in the stream of records.  A pages of 0 returns all that remain.
+    """
+    packed_hdr = get_msg_hdr(MSG_TRACE_LEN, address,
+                             mtype=MSG_TYPE_TRACE,
+                             flags=MSG_FLAG_RESPONSE)
+    packed_req = struct.pack(MSG_TRACE_FMT, offset, pages, control)
+
+    return packed_hdr + packed_req
+
+
+def trace_records(data):
+    """
+    Split a trace into a list of (ms, source, sender, msg) tuples, stopping at
+    any truncated record.
+    """
+    records = []
+    offset = 0
+    record_len = struct.calcsize(TRACE_RECORD_FMT)
+    while offset + record_len <= len(data):
+        (ms, length, source, sender) = struct.unpack_from(TRACE_RECORD_FMT,
+                                                          data, offset)
+        offset += record_len
+        if offset + length > len(data):
+            break
+        records.append((ms, source, sender, data[offset:offset + length]))
+        offset += length
+    return records
+
+
+def get_stats_msg(address, reset=False):
+    packed_hdr = get_msg_hdr(MSG_STATS_LEN, address,
+                             mtype=MSG_TYPE_STATS,
+                             flags=MSG_FLAG_RESPONSE)
+    packed_req = struct.pack("<B", STATS_RESET if reset else 0)
+
+    return packed_hdr + packed_req
 
 
 def get_set_addr_msg(address, device_id, new_address):
@@ -164,11 +588,11 @@ def get_set_addr_msg(address, device_id, new_address):
     return hdr.pack() + sethdr.pack()
 
 
-def get_program_msg(address, output, program_type, program_data):
+def get_program_msg(address, output, program_type, program_data, flags=0):
     if (len(program_data) != MSG_PROGRAM_VALUE_LEN):
         raise Exception("Program data must be %d bytes" % (MSG_PROGRAM_VALUE_LEN))
 
-    packed_hdr = get_msg_hdr(MSG_PROGRAM_LEN, address)
+    packed_hdr = get_msg_hdr(MSG_PROGRAM_LEN, address, flags=flags)
     packed_out = get_output_hdr("program", output)
     packed = struct.pack(MSG_PROGRAM_FMT, program_type)
 
@@ -194,7 +618,9 @@ def get_program_timed_change_msg(address, output,
                       start_values[0], start_values[1], start_values[2],
                       stop_values[0], stop_values[1],stop_values[2],
                       0, 0)
-    return get_program_msg(address, output, MSG_PROGRAM_TIMED_CHANGE_TYPE, msg)
+    # Timed changes drive poofers, so are handled ahead of bulk traffic
+    return get_program_msg(address, output, MSG_PROGRAM_TIMED_CHANGE_TYPE, msg,
+                           flags=MSG_FLAG_PRIORITY)
 
 
 # Decode raw data into an HMTL message
@@ -299,10 +725,11 @@ class MsgHdr(Msg):
     LENGTH =  MSG_BASE_LEN
     
     STARTCODE = 0xFC
-    PROTOCOL_VERSION = 2
+    PROTOCOL_VERSION = MSG_PROTOCOL_VERSION
 
     def __init__(self, startcode=STARTCODE, crc=0, version=PROTOCOL_VERSION, 
-                 length=0, mtype=0, flags=0, address=0):
+                 length=0, mtype=0, flags=0, address=0,
+                 origin=MSG_ORIGIN_NONE, sequence=0, ttl=MSG_DEFAULT_TTL):
         self.startcode = startcode
         self.crc = crc
         self.version = version
@@ -310,6 +737,9 @@ class MsgHdr(Msg):
         self.mtype = mtype
         self.flags = flags
         self.address = address
+        self.origin = origin
+        self.sequence = sequence
+        self.ttl = ttl
 
     def __str__(self):
         return """  msg_hdr_t:
@@ -320,6 +750,9 @@ class MsgHdr(Msg):
     type:%d (%s)
     flags:0x%x (%s)
     addr:%d
+    origin:%d
+    sequence:%d
+    ttl:%d
 """ % (
             self.startcode,
             self.crc,
@@ -327,12 +760,16 @@ class MsgHdr(Msg):
             self.length,
             self.mtype, MSG_TYPES[self.mtype],
             self.flags, '|'.join([MSG_FLAGS[1 << x] for x in range(0,8) if ((1 << x) & self.flags) ]),
-            self.address
+            self.address,
+            self.origin,
+            self.sequence,
+            self.ttl
         )
 
     def pack(self):
         return struct.pack(self.FORMAT, self.startcode, self.crc, self.version, 
-                           self.length, self.mtype, self.flags, self.address)
+                           self.length, self.mtype, self.flags, self.address,
+                           self.origin, self.sequence, self.ttl)
 
     def next_hdr(self, data):
         '''Return the header following the message header'''
@@ -340,8 +777,12 @@ class MsgHdr(Msg):
             raise Exception("MSG_TYPE_OUTPUT currently not handled in parsing")
         elif (self.mtype == MSG_TYPE_POLL):
             return PollHdr.from_data(data, self.LENGTH)
+        elif (self.mtype == MSG_TYPE_STATS):
+            return StatsHdr.from_data(data, self.LENGTH)
         elif (self.mtype == MSG_TYPE_DUMPCONFIG):
             return DumpConfigHdr.from_data(data[self.LENGTH:])
+        elif (self.mtype == MSG_TYPE_TRACE):
+            return TraceHdr.from_data(data[self.LENGTH:])
         else:
             raise Exception("Unknown message type %d" % (self.mtype))
 
@@ -379,6 +820,40 @@ class PollHdr(Msg):
         self.buffer_size = buffer_size
         self.msg_version = msg_version
 
+        # (type, output, pixels) for each output described by this response,
+        # which may be only some of them if the response was split, starting
+        # from output first
+        self.first = 0
+        self.outputs = []
+
+    @classmethod
+    def from_data(cls, data, offset=0):
+        hdr = super(PollHdr, cls).from_data(data, offset)
+
+        offset += struct.calcsize(cls.FORMAT)
+        if len(data) >= offset + struct.calcsize(MSG_POLL_OUTPUTS_FMT):
+            (first, count) = struct.unpack_from(MSG_POLL_OUTPUTS_FMT,
+                                                data, offset)
+            offset += struct.calcsize(MSG_POLL_OUTPUTS_FMT)
+            hdr.first = first
+            for i in range(count):
+                hdr.outputs.append(struct.unpack_from(MSG_POLL_OUTPUT_FMT,
+                                                      data, offset))
+                offset += struct.calcsize(MSG_POLL_OUTPUT_FMT)
+        return hdr
+
+    def merge(self, other):
+        """
+        Add the outputs of a continuation of this response split across
+        messages.  A continuation that isn't the next in order, such as a
+        duplicate or one following a lost message, is ignored.  Returns
+        whether the outputs were added.
+        """
+        if other.first != self.first + len(self.outputs):
+            return False
+        self.outputs.extend(other.outputs)
+        return True
+
     def __str__(self):
         return """  poll_hdr_t:
     config_hdr_t:
@@ -420,6 +895,66 @@ class PollHdr(Msg):
                 self.num_outputs, module_type)
 
 
+class StatsHdr(Msg):
+    """Loop timing statistics for a single phase of a module's loop"""
+    TYPE = "STATS"
+    NUM_BUCKETS = 8
+    FORMAT = "<BBBBIIHH" + "H" * NUM_BUCKETS
+    LENGTH = 32
+
+    def __init__(self, phase, num_phases, num_buckets, bucket_shift,
+                 count, total_us, min_us, max_us, *buckets):
+        self.phase = phase
+        self.num_phases = num_phases
+        self.num_buckets = num_buckets
+        self.bucket_shift = bucket_shift
+        self.count = count
+        self.total_us = total_us
+        self.min_us = min_us
+        self.max_us = max_us
+        self.buckets = list(buckets[:num_buckets])
+
+    def phase_name(self):
+        if self.phase < len(LOOP_PHASES):
+            return LOOP_PHASES[self.phase]
+        return "phase%d" % self.phase
+
+    def avg_us(self):
+        if self.count == 0:
+            return 0
+        return float(self.total_us) / self.count
+
+    def bucket_limits(self):
+        """Upper limit in microseconds of each histogram bucket, the last
+           bucket has no limit"""
+        return [(1 << (self.bucket_shift + i))
+                for i in range(self.num_buckets - 1)] + [None]
+
+    def __str__(self):
+        return """  stats_hdr_t:
+    phase:%d (%s)
+    num_phases:%d
+    count:%d
+    total_us:%d
+    min_us:%d
+    avg_us:%.1f
+    max_us:%d
+    buckets:%s
+""" % (self.phase, self.phase_name(), self.num_phases, self.count,
+       self.total_us, self.min_us, self.avg_us(), self.max_us,
+       self.buckets)
+
+    @classmethod
+    def headers(cls):
+        return "%-10s %-10s %-8s %-8s %-8s  %s" % \
+               ("phase", "count", "min", "avg", "max", "histogram")
+
+    def dump(self):
+        return "%-10s %-10d %-8d %-8.1f %-8d  %s" % \
+               (self.phase_name(), self.count, self.min_us, self.avg_us(),
+                self.max_us, ' '.join(["%d" % x for x in self.buckets]))
+
+
 class SetAddress(Msg):
     TYPE = "SETADDR"
     FORMAT = "<HH"
@@ -437,22 +972,58 @@ class SetAddress(Msg):
         return struct.pack(self.FORMAT, self.device_id, self.address)
 
 
+class TraceHdr(Msg):
+    """A page of a module's trace of received messages"""
+    TYPE = "TRACE"
+    LENGTH = -1
+
+    PAGE_LENGTH = 4
+
+    def __init__(self, data, offset=0, length=0):
+        self.data = data
+        self.offset = offset  # Offset of this page in the trace
+        self.length = length  # Length of the whole trace
+
+    @classmethod
+    def from_data(cls, data, offset=0):
+        (page_offset, length) = struct.unpack(MSG_TRACE_PAGE_FMT,
+                                              data[:cls.PAGE_LENGTH])
+        return cls(data[cls.PAGE_LENGTH:], page_offset, length)
+
+    def __str__(self):
+        return "trace page offset:%d len:%d of %d" % (self.offset,
+                                                      len(self.data),
+                                                      self.length)
+
+
 class DumpConfigHdr(Msg):
     """Message type for receiving configuration data from a module"""
     TYPE = "DUMPCONFIG"
     LENGTH = -1
 
-    def __init__(self, data, config):
+    PAGE_LENGTH = 4
+
+    def __init__(self, data, config, offset=0, next=0):
         self.data = data
         self.config = config
+        self.offset = offset  # EEPROM offset of this page's object
+        self.next = next      # Offset of the following object, 0 if none
 
     @classmethod
     def from_data(cls, data, offset=0):
-        if ord(data[0]) == HEADER_MAGIC:
+        (page_offset, page_next) = struct.unpack(MSG_DUMPCONFIG_PAGE_FMT,
+                                                 data[:cls.PAGE_LENGTH])
+        data = data[cls.PAGE_LENGTH:]
+        if len(data) == 0:
+            # Error responses carry no object
+            config = None
+        elif ord(data[0]) == HEADER_MAGIC:
             config = ConfigHeaderMain.from_data(data)
+        elif ord(data[0]) == CONFIG_TYPES["groups"]:
+            config = ConfigGroups.from_data(data)
         else:
             config = cls.full_config(data)
-        return cls(data, config)
+        return cls(data, config, page_offset, page_next)
 
     def __str__(self):
         return str(self.config)
@@ -131,6 +131,22 @@ def get_baud_struct(baud):
 
     return packed_start + packed_baud
 
+
+def get_groups_struct(groups):
+    print("get_groups_struct: groups %s" % (groups))
+
+    if len(groups) > MAX_GROUPS:
+        raise Exception("At most %d groups are allowed" % (MAX_GROUPS))
+    for group in groups:
+        if (group < GROUP_BASE) or (group >= 0xFFFE):
+            raise Exception("Invalid group address %d" % (group))
+
+    packed_start = get_config_start("groups")
+    packed_groups = struct.pack(UPDATE_GROUPS_FMT, len(groups)) + \
+                    struct.pack('<' + 'H' * len(groups), *groups)
+
+    return packed_start + packed_groups
+
 ################################################################################
 #
 # Configuration object classes
@@ -347,6 +363,24 @@ class ConfigHeaderMPR121(BaseConfig):
                            *self.thresholds)
 
 
+class ConfigGroups(BaseConfig):
+    """This class is for the config_groups_t structure"""
+    TYPE = "Groups"
+    FORMAT = CONFIG_GROUPS_FMT
+
+    def __init__(self, type, num_groups, *groups):
+        self.num_groups = num_groups
+        self.groups = list(groups[:num_groups])
+
+    def __str__(self):
+        return """  config_groups_t:
+    groups:%s
+""" % (self.groups)
+
+    def short(self):
+        return "groups %s" % (",".join("%04x" % g for g in self.groups))
+
+
 ################################################################################
 #
 # Helper functions
@@ -356,6 +390,6 @@ class ConfigHeaderMPR121(BaseConfig):
 def config_types(headers):
     types = []
     for hdr in headers:
-        if not isinstance(hdr, ConfigHeaderMain):
+        if not isinstance(hdr, (ConfigHeaderMain, ConfigGroups)):
             types.append(hdr.type())
     return types
\ No newline at end of file
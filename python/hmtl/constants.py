@@ -35,6 +35,7 @@ CONFIG_TYPES = {
     "address": 0xE0,
     "device_id": 0xE1,
     "baud": 0xE2,
+    "groups": 0xE3,
 }
 
 # Individial object formats
@@ -54,6 +55,12 @@ OUTPUT_ALL_OUTPUTS = 254
 UPDATE_ADDRESS_FMT = '<H'
 UPDATE_DEVICE_ID_FMT = '<H'
 UPDATE_BAUD_FMT = '<B'
+UPDATE_GROUPS_FMT = '<B'  # Followed by one '<H' per group
+
+# Group addresses, stored in the config as a fixed size object
+GROUP_BASE = 0xFF00
+MAX_GROUPS = 4
+CONFIG_GROUPS_FMT = '<BB' + 'H' * MAX_GROUPS
 
 #
 # Utility
@@ -8,7 +8,9 @@
 #
 ################################################################################
 
+from collections import deque
 from multiprocessing.connection import Listener
+import random
 import threading
 
 from HMTLSerial import *
@@ -84,7 +86,7 @@ class HMTLServer():
 
     def send_data(self, data):
             self.serial_cv.acquire()
-            self.ser.send_and_confirm(data, False)
+            self.ser.send_and_confirm(HMTLprotocol.set_msg_crc(data), False)
             self.serial_cv.release()
 
 
@@ -152,6 +154,22 @@ class DeviceScanner(threading.Thread):
     of discovered devices
     """
 
+    # Response slots in the first discovery round when no devices are known,
+    # later scans give each address in the range previously found a slot
+    DISCOVER_SLOTS = 128
+    DISCOVER_MIN_SLOTS = 8
+
+    # Discovery responses are brief, without output descriptors, which fit
+    # in 4ms at 115200 baud
+    DISCOVER_SLOT_MS = 4
+
+    # Time beyond the last slot to wait for responses to be relayed
+    DISCOVER_MARGIN = 0.05
+
+    # A round may find nothing because the request was lost, so a scan only
+    # ends after this many rounds in a row find no new devices
+    DISCOVER_EMPTY_ROUNDS = 2
+
     def __init__(self, server, verbose=True, period=60.0):
         threading.Thread.__init__(self)
 
@@ -165,12 +183,6 @@ class DeviceScanner(threading.Thread):
         # Period between scans
         self.scan_period = period
 
-        # Period between address
-        self.address_period = 0.25
-
-        # TODO: This range is arbitrary for scanning purposes
-        self.address_range = [x for x in range(120, 150)]
-
         # Set as a daemon so that this thread will exit correctly
         # when the parent receives a kill signal
         self.daemon = True
@@ -187,42 +199,164 @@ class DeviceScanner(threading.Thread):
     def stop(self):
         self._Thread__stop()
 
+    def get_stats(self, address):
+        """
+        Request the loop timing statistics of a module, returning a dictionary
+        of StatsHdr by phase name
+        """
+        self.server.send_data(HMTLprotocol.get_stats_msg(address))
+
+        stats = {}
+        while True:
+            item = self.server.get_data_msg()
+            if not item:
+                break
+
+            headers = HMTLprotocol.msg_to_headers(item.data)
+            hdr = headers[-1]
+            if (isinstance(hdr, HMTLprotocol.StatsHdr) and
+                    not (headers[0].flags & HMTLprotocol.MSG_FLAG_ERROR)):
+                stats[hdr.phase_name()] = hdr
+
+            if not headers[0].more_data():
+                break
+
+        return stats
+
+    def discover(self):
+        """
+        Find the devices with rounds of discovery polls, returning a
+        dictionary of PollHdr by address.  Each round after the first marks
+        the devices already found as known, so only those whose responses were
+        missed or collided respond again.
+
+        Random slots need several times as many slots as devices to avoid
+        most collisions, so a rescan starts with a round giving each address
+        in the range of the devices found before its own slot.  Responses are
+        brief, the output descriptors are polled from each device found.
+        """
+        found = {}
+        slots = self.DISCOVER_SLOTS
+        known_base = 0
+        flags = 0
+        if self.devices:
+            known_base = min(self.devices.keys())
+            span = max(self.devices.keys()) - known_base + 1
+            if span <= 255:
+                slots = span
+                flags = HMTLprotocol.DISCOVER_BY_ADDRESS
+            else:
+                slots = min(255, max(self.DISCOVER_MIN_SLOTS,
+                                     2 * len(self.devices)))
+        nonce = random.randint(0, 255)
+        empty = 0
+
+        while empty < self.DISCOVER_EMPTY_ROUNDS:
+            self.log("Discovery round with %d slots" % slots)
+            self.server.send_data(
+                HMTLprotocol.get_discover_msg(nonce, slots,
+                                              self.DISCOVER_SLOT_MS,
+                                              found.keys(), known_base,
+                                              flags |
+                                              HMTLprotocol.DISCOVER_BRIEF))
+            nonce += 1
+            flags = 0
+
+            new = 0
+            time_limit = (time.time() + self.DISCOVER_MARGIN +
+                          slots * self.DISCOVER_SLOT_MS / 1000.0)
+            while time.time() < time_limit:
+                item = self.server.get_data_msg(time_limit - time.time())
+                if not item:
+                    continue
+                (text, msg) = HMTLprotocol.decode_msg(item.data)
+                if not isinstance(msg, HMTLprotocol.PollHdr):
+                    continue
+                if msg.address not in found:
+                    self.log("Poll response: %s" % (msg.dump()))
+                    found[msg.address] = msg
+                    new += 1
+                else:
+                    # Continuation of a response split across messages
+                    found[msg.address].merge(msg)
+
+            if new == 0:
+                empty += 1
+                continue
+            empty = 0
+
+            # Fewer devices remain each round, size the next from those found
+            slots = min(255, max(self.DISCOVER_MIN_SLOTS, 2 * new))
+
+        # Poll for the outputs unless the device's firmware predates brief
+        # responses and described them already
+        for (address, msg) in found.items():
+            if len(msg.outputs) < msg.num_outputs:
+                polled = self.poll(address)
+                if polled:
+                    found[address] = polled
+
+        return found
+
+    def poll(self, address):
+        """
+        Poll a single module, returning its PollHdr with every output
+        described, or None if it didn't respond
+        """
+        self.server.send_data(HMTLprotocol.get_poll_msg(address))
+
+        poll = None
+        while True:
+            item = self.server.get_data_msg()
+            if not item:
+                break
+
+            headers = HMTLprotocol.msg_to_headers(item.data)
+            hdr = headers[-1]
+            if not isinstance(hdr, HMTLprotocol.PollHdr):
+                continue
+            if poll is None:
+                # Wait for the start if the first part was lost
+                if hdr.first == 0:
+                    poll = hdr
+            else:
+                # Continuation of a response split across messages
+                poll.merge(hdr)
+
+            if not headers[0].more_data():
+                break
+
+        return poll
+
     def run(self):
         self.log("Scanner started")
 
         while True:
             self.log("Starting scan")
 
-            for address in self.address_range:
-                self.log("Polling address %d" % address)
-
-                msg = HMTLprotocol.get_poll_msg(address)
-
-                try:
-                    self.server.send_data(msg)
-                    item = self.server.get_data_msg()
-                    if item:
-                        (text, msg) = HMTLprotocol.decode_msg(item.data)
-                        if (isinstance(msg, HMTLprotocol.PollHdr)):
-                            self.log("Poll response: %s" % (msg.dump()))
-
-                            if self.devices[address]:
-                                # A device previously responded to this address
-                                self.devices[address].update(msg)
-                            else:
-                                # Create a new device on this address
-                                self.devices[address] = HMTLModule(msg)
-                        else:
-                            self.log("XXX: Wrong message type? %s" % (msg.dump()))
-                    elif self.devices[address]:
+            try:
+                found = self.discover()
+
+                for (address, msg) in found.items():
+                    if self.devices.get(address):
+                        # A device previously responded to this address
+                        self.devices[address].update(msg)
+                    else:
+                        # Create a new device on this address
+                        self.devices[address] = HMTLModule(msg)
+
+                    stats = self.get_stats(address)
+                    if stats:
+                        self.devices[address].update_stats(stats)
+
+                for address in self.devices.keys():
+                    if address not in found:
                         # There was no response for a module we previously had configured
                         self.log("No response for known address %d" % address)
                         self.devices[address].set_active(False)
-                except Exception as e:
-                    print("Exception: %s" % e)
-                    pass
-
-                time.sleep(self.address_period)
+            except Exception as e:
+                print("Exception: %s" % e)
+                pass
 
             self.log("Current devices:")
             for deviceid in self.devices.keys():
@@ -233,6 +367,9 @@ class DeviceScanner(threading.Thread):
 
 class HMTLModule(object):
 
+    # Number of loop statistics samples retained for graphing
+    STATS_HISTORY = 100
+
     def __init__(self, pollhdr):
         self.protocol_version = pollhdr.protocol_version
         self.hardware_version = pollhdr.hardware_version
@@ -246,9 +383,16 @@ class HMTLModule(object):
         self.buffer_size = pollhdr.buffer_size
         self.msg_version = pollhdr.msg_version
 
+        # (type, output, pixels) for each of the module's outputs
+        self.outputs = list(pollhdr.outputs)
+
         self.active = True
         self.last_active = time.time()
 
+        # Most recent loop timing statistics and their history
+        self.loop_stats = {}
+        self.stats_history = deque(maxlen=self.STATS_HISTORY)
+
     def update(self, pollhdr):
         """
         Update an existing module based on a poll header
@@ -256,7 +400,36 @@ class HMTLModule(object):
         :return:
         """
         self.set_active(True)
-        pass
+        self.msg_version = pollhdr.msg_version
+        if pollhdr.outputs:
+            self.outputs = list(pollhdr.outputs)
+
+    def reassembles(self):
+        """
+        Return whether the module puts fragmented messages back together, so
+        that messages longer than its buffer can be sent with
+        get_fragment_msgs()
+        """
+        return self.msg_version >= HMTLprotocol.MSG_PROTOCOL_VERSION_LONG
+
+    def update_stats(self, stats):
+        """
+        Record the loop timing statistics from a module
+        :param stats: dictionary of StatsHdr by phase name
+        """
+        self.loop_stats = stats
+        self.stats_history.append((time.time(), stats))
+
+    def dump(self):
+        text = "device:%d address:%d type:%d active:%s" % \
+               (self.device_id, self.address, self.object_type, self.active)
+        if "total" in self.loop_stats:
+            total = self.loop_stats["total"]
+            text += " loop avg:%.1fus max:%dus" % (total.avg_us(), total.max_us)
+        if "backlog" in self.loop_stats:
+            backlog = self.loop_stats["backlog"]
+            text += " backlog max:%d" % backlog.max_us
+        return text
 
     def set_active(self, active):
         self.active = active
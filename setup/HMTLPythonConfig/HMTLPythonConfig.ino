@@ -53,6 +53,7 @@
 #endif
 
 config_hdr_t config_hdr;
+config_groups_t config_groups = { HMTL_CONFIG_GROUPS, 0 };
 output_hdr_t *outputs[HMTL_MAX_OUTPUTS];
 config_max_t rawoutputs[HMTL_MAX_OUTPUTS];
 int config_outputs = 0;
@@ -99,7 +100,8 @@ void loop()
 boolean read_configuration() {
   int configOffset = hmtl_read_config(&config_hdr,
 				      rawoutputs,
-				      HMTL_MAX_OUTPUTS);
+				      HMTL_MAX_OUTPUTS,
+				      &config_groups);
   if (configOffset < 0) {
     DEBUG_ERR("Failed to read configuration");
     return false;
@@ -400,6 +402,38 @@ void handle_command(byte *cmd, byte len) {
         break;
       }
 
+      case HMTL_COMMAND_GROUPS: {
+        if (config_length < (int)sizeof(uint8_t)) {
+          DEBUG_VALUE(DEBUG_ERROR,
+                      "Received config message with wrong len for groups:",
+                      config_length);
+          goto FAIL;
+        }
+        uint8_t count = *(uint8_t *)config_start;
+        if ((count > HMTL_MAX_GROUPS) ||
+            (config_length != (int)(sizeof(uint8_t) +
+                                    count * sizeof(uint16_t)))) {
+          DEBUG_VALUE(DEBUG_ERROR,
+                      "Received config message with wrong len for groups:",
+                      config_length);
+          goto FAIL;
+        }
+
+        config_groups.type = HMTL_CONFIG_GROUPS;
+        config_groups.num_groups = count;
+        memcpy(config_groups.groups, (uint8_t *)config_start + sizeof(uint8_t),
+               count * sizeof(uint16_t));
+        hmtl_print_groups(&config_groups);
+
+        if (!hmtl_validate_groups(&config_groups)) {
+          DEBUG_ERR("Received invalid groups");
+          config_groups.num_groups = 0;
+          goto FAIL;
+        }
+
+        break;
+      }
+
       default: {
         DEBUG1_VALUELN("Received unknown configuration type:",
                        type);
@@ -412,6 +446,7 @@ void handle_command(byte *cmd, byte len) {
 
     if (strcmp(str, HMTL_CONFIG_START) == 0) {
       DEBUG3_PRINTLN("Received command 'start'");
+      config_groups.num_groups = 0;
       state = STATE_READY;
     }
 
@@ -439,7 +474,8 @@ void handle_command(byte *cmd, byte len) {
         goto FAIL;
       }
 
-      int configOffset = hmtl_write_config(&config_hdr, outputs);
+      int configOffset = hmtl_write_config(&config_hdr, outputs,
+                                           &config_groups);
       if (configOffset < 0) {
         DEBUG_ERR("Failed to write configuration");
         goto FAIL;
@@ -449,6 +485,7 @@ void handle_command(byte *cmd, byte len) {
     else if (strcmp(str, HMTL_CONFIG_PRINT) == 0) {
       DEBUG3_PRINTLN("Received command 'print'");
       hmtl_print_config(&config_hdr, outputs);
+      hmtl_print_groups(&config_groups);
     }
 
     else if (strcmp(str, HMTL_CONFIG_READ) == 0) {